@@ -0,0 +1,276 @@
+/*
+ * aof.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "aof.h"
+#include "common.h"
+
+struct aof {
+	int fd;
+	int policy;
+	size_t replay_size;
+	pthread_mutex_t mu;
+	pthread_cond_t cond;
+	// filled by the loops under mu, taken by the thread
+	String *buf;
+	uint64_t appended;
+	bool kicked;
+	// appended bytes that are durable per the policy
+	atomic_uint_fast64_t synced;
+	void (*on_sync)(void*);
+	void *arg;
+	pthread_t thread;
+};
+
+bool aof_parse_record(const uint8_t *data, size_t len, StrView *args, size_t *nargs) {
+	uint32_t n = 0;
+	if (len < 4) {
+		return false;
+	}
+	memcpy(&n, data, 4);
+	if (n < 1 || n > K_MAX_ARGS) {
+		return false;
+	}
+	size_t pos = 4;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t sz = 0;
+		if (pos + 4 > len) {
+			return false;
+		}
+		memcpy(&sz, &data[pos], 4);
+		if (pos + 4 + sz > len) {
+			return false;
+		}
+		args[i].data = (const char*) &data[pos + 4];
+		args[i].len = sz;
+		pos += 4 + sz;
+	}
+	*nargs = n;
+	return pos == len;
+}
+
+// walks the records in data, calling apply on each if set. Returns how
+// many bytes of it are complete records, the rest is a torn write.
+static size_t walk_records(const uint8_t *data, size_t size, int64_t *count,
+		void (*apply)(void*, StrView*, size_t), void *arg) {
+	StrView args[K_MAX_ARGS];
+	size_t pos = 0;
+	*count = 0;
+	while (size - pos >= 4) {
+		uint32_t len = 0;
+		memcpy(&len, &data[pos], 4);
+		size_t nargs = 0;
+		if (len > size - pos - 4 || !aof_parse_record(&data[pos + 4], len, args, &nargs)) {
+			break;
+		}
+		if (apply) {
+			apply(arg, args, nargs);
+		}
+		(*count)++;
+		pos += 4 + (size_t) len;
+	}
+	return pos;
+}
+
+static int map_file(const char *path, size_t size, const uint8_t **data) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		return -errno;
+	}
+	madvise(ptr, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	*data = (const uint8_t*) ptr;
+	return 0;
+}
+
+int64_t aof_replay(const char *path, size_t size,
+		void (*apply)(void*, StrView*, size_t), void *arg) {
+	if (size == 0) {
+		return 0;
+	}
+	const uint8_t *data = NULL;
+	int rv = map_file(path, size, &data);
+	if (rv < 0) {
+		return rv;
+	}
+	int64_t count = 0;
+	walk_records(data, size, &count, apply, arg);
+	munmap((void*) data, size);
+	return count;
+}
+
+static uint64_t mono_ms(void) {
+	return get_monotonic_usec() / 1000;
+}
+
+// a record cut in half would end the replay there, so this doesn't give up
+static void write_all(int fd, const char *buf, size_t n) {
+	while (n > 0) {
+		ssize_t rv = write(fd, buf, n);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			// the disk is full or gone, try again in a bit
+			msg("writing the append only file failed");
+			sleep(1);
+			continue;
+		}
+		n -= (size_t) rv;
+		buf += rv;
+	}
+}
+
+static void* aof_run(void *arg) {
+	Aof *aof = (Aof*) arg;
+	String *batch = str_init(NULL);
+	uint64_t last_sync_ms = mono_ms();
+	// written but not synced yet, for AOF_EVERYSEC
+	bool dirty = false;
+	while (true) {
+		pthread_mutex_lock(&aof->mu);
+		while (!aof->kicked) {
+			if (aof->policy != AOF_EVERYSEC || !dirty) {
+				pthread_cond_wait(&aof->cond, &aof->mu);
+				continue;
+			}
+			// wake up for the sync that is due
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			if (pthread_cond_timedwait(&aof->cond, &aof->mu, &ts) == ETIMEDOUT) {
+				break;
+			}
+		}
+		aof->kicked = false;
+		// swap the buffers, the loops go on appending to the empty one
+		String *full = aof->buf;
+		aof->buf = batch;
+		batch = full;
+		uint64_t upto = aof->appended;
+		pthread_mutex_unlock(&aof->mu);
+
+		write_all(aof->fd, batch->data, (size_t) str_size(batch));
+		dirty = dirty || str_size(batch) > 0;
+		str_clear(batch);
+
+		uint64_t now = mono_ms();
+		if (aof->policy == AOF_ALWAYS || (aof->policy == AOF_EVERYSEC && dirty
+				&& now - last_sync_ms >= 1000)) {
+			if (fdatasync(aof->fd) != 0) {
+				msg("syncing the append only file failed");
+			}
+			last_sync_ms = now;
+			dirty = false;
+		}
+		atomic_store(&aof->synced, upto);
+		if (aof->policy == AOF_ALWAYS && aof->on_sync) {
+			aof->on_sync(aof->arg);
+		}
+	}
+	return NULL;
+}
+
+Aof* aof_open(const char *path, int policy, void (*on_sync)(void*), void *arg) {
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	// a crash can leave half a record behind, new ones must not go after it
+	size_t size = (size_t) st.st_size;
+	if (size > 0) {
+		const uint8_t *data = NULL;
+		if (map_file(path, size, &data) < 0) {
+			close(fd);
+			return NULL;
+		}
+		int64_t count = 0;
+		size_t valid = walk_records(data, size, &count, NULL, NULL);
+		munmap((void*) data, size);
+		if (valid < size) {
+			msg("the append only file ends in a torn record, cutting it off");
+			if (ftruncate(fd, (off_t) valid) < 0) {
+				close(fd);
+				return NULL;
+			}
+			size = valid;
+		}
+	}
+	if (lseek(fd, 0, SEEK_END) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	Aof *aof = calloc(1, sizeof(Aof));
+	if (!aof) {
+		die("Out of memory");
+	}
+	aof->fd = fd;
+	aof->policy = policy;
+	aof->replay_size = size;
+	aof->buf = str_init(NULL);
+	aof->on_sync = on_sync;
+	aof->arg = arg;
+	atomic_init(&aof->synced, 0);
+	pthread_mutex_init(&aof->mu, NULL);
+	pthread_cond_init(&aof->cond, NULL);
+	if (pthread_create(&aof->thread, NULL, &aof_run, aof)) {
+		die("pthread_create");
+	}
+	return aof;
+}
+
+size_t aof_replay_size(Aof *aof) {
+	return aof->replay_size;
+}
+
+uint64_t aof_append(Aof *aof, const StrView *args, size_t n) {
+	uint32_t len = 4;
+	for (size_t i = 0; i < n; i++) {
+		len += 4 + (uint32_t) args[i].len;
+	}
+	pthread_mutex_lock(&aof->mu);
+	String *buf = aof->buf;
+	str_append_uint32(buf, len);
+	str_append_uint32(buf, (uint32_t) n);
+	for (size_t i = 0; i < n; i++) {
+		str_append_uint32(buf, (uint32_t) args[i].len);
+		str_appendCs_size(buf, args[i].data, (uint32_t) args[i].len);
+	}
+	aof->appended += 4 + (uint64_t) len;
+	uint64_t offset = aof->appended;
+	pthread_mutex_unlock(&aof->mu);
+	return offset;
+}
+
+void aof_kick(Aof *aof) {
+	pthread_mutex_lock(&aof->mu);
+	aof->kicked = true;
+	pthread_cond_signal(&aof->cond);
+	pthread_mutex_unlock(&aof->mu);
+}
+
+bool aof_durable(Aof *aof, uint64_t offset) {
+	return aof->policy != AOF_ALWAYS || atomic_load(&aof->synced) >= offset;
+}
@@ -0,0 +1,53 @@
+/*
+ * aof.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef AOF_H_
+#define AOF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "strings.h"
+
+// The append only file: every write command, as a request in the wire
+// format (u32 len, u32 nargs, then u32 len and the bytes of every arg).
+// The loops append to one buffer, a thread of its own writes it out and
+// syncs it, so one fsync covers whatever all of the loops wrote meanwhile.
+enum {
+	// written when there is something, synced by the OS when it wants
+	AOF_NO = 0,
+	// synced once a second
+	AOF_EVERYSEC = 1,
+	// synced before the replies go out, see aof_durable
+	AOF_ALWAYS = 2,
+};
+
+typedef struct aof Aof;
+
+// a torn record at the end, from a crash, is cut off. on_sync is called
+// from the thread after every sync in AOF_ALWAYS mode. NULL on failure.
+extern Aof* aof_open(const char *path, int policy, void (*on_sync)(void*), void *arg);
+// the size of the file when it was opened, what is there to replay
+extern size_t aof_replay_size(Aof *aof);
+// returns the offset just past the record, for aof_durable
+extern uint64_t aof_append(Aof *aof, const StrView *args, size_t n);
+// lets the thread know there is something to write
+extern void aof_kick(Aof *aof);
+// whether everything up to offset is on disk as far as the policy cares
+extern bool aof_durable(Aof *aof, uint64_t offset);
+
+// the args of the record at data (past its length), which has len bytes.
+// false if they don't add up to exactly len.
+extern bool aof_parse_record(const uint8_t *data, size_t len, StrView *args, size_t *nargs);
+
+// calls apply with the args of every record in the first size bytes of
+// the file, the views point into a mapping of it. Returns the number of
+// records, or -errno.
+extern int64_t aof_replay(const char *path, size_t size,
+		void (*apply)(void*, StrView*, size_t), void *arg);
+
+#endif /* AOF_H_ */
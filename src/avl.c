@@ -173,3 +173,47 @@ extern void avl_init(AVLNode *node){
     node->cnt = 1;
     node->left = node->right = node->parent = NULL;
 }
+
+int64_t avl_rank(AVLNode *node) {
+    int64_t rank = avl_cnt(node->left);
+    while (node->parent) {
+        if (node->parent->right == node) {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+        node = node->parent;
+    }
+    return rank;
+}
+
+AVLNode *avl_at(AVLNode *root, int64_t rank) {
+    if (rank < 0 || rank >= avl_cnt(root)) {
+        return NULL;
+    }
+    AVLNode *node = root;
+    while (node) {
+        int64_t left = avl_cnt(node->left);
+        if (rank < left) {
+            node = node->left;
+        } else if (rank == left) {
+            return node;
+        } else {
+            rank -= left + 1;
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+AVLNode *avl_next(AVLNode *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
@@ -24,6 +24,13 @@ extern void avl_init(AVLNode *node);
 extern AVLNode *avl_fix(AVLNode *node);
 extern AVLNode *avl_del(AVLNode *node);
 extern AVLNode *avl_offset(AVLNode *node, int64_t offset);
+// the position of the node in its tree, from 0. O(log n), from cnt.
+extern int64_t avl_rank(AVLNode *node);
+// the node at that position of the tree, NULL if there is none
+extern AVLNode *avl_at(AVLNode *root, int64_t rank);
+// the next node in order. Walking a range with it visits every edge at most
+// twice, instead of climbing from the top every step.
+extern AVLNode *avl_next(AVLNode *node);
 
 
 #endif /* AVL_H_ */
@@ -0,0 +1,499 @@
+/*
+ * bench.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+// A load generator for the server. Every thread drives its share of the
+// connections, each keeping a pipeline of requests in flight, and records
+// the latency of every request in a log linear histogram.
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+// proj
+#include "common.h"
+#include "minis.h"
+
+enum {
+	CMD_GET = 0, CMD_SET, CMD_ZADD, CMD_ZQUERY, CMD_PEXPIRE, CMD_MGET, CMD_COUNT,
+};
+
+static const char *k_cmd_names[CMD_COUNT] = { "get", "set", "zadd", "zquery", "pexpire", "mget" };
+
+// the keys of one MGET
+#define K_MGET_KEYS 10
+
+// the sorted sets ZADD and ZQUERY go to
+#define K_ZSETS 16
+
+// Values below HIST_SUB are counted exactly, above that every power of two
+// gets HIST_SUB / 2 buckets, so a bucket is never off by more than 1/64
+// of the value. Same idea as HdrHistogram with 2 significant digits.
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * (HIST_SUB / 2) + HIST_SUB / 2)
+
+typedef struct {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+} Hist;
+
+static size_t hist_index(uint64_t v) {
+	if (v < HIST_SUB) {
+		return (size_t) v;
+	}
+	size_t shift = (size_t) (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+	return shift * (HIST_SUB / 2) + (size_t) (v >> shift);
+}
+
+// the largest value that lands in bucket idx
+static uint64_t hist_value(size_t idx) {
+	if (idx < HIST_SUB) {
+		return idx;
+	}
+	size_t shift = idx / (HIST_SUB / 2) - 1;
+	uint64_t m = idx - shift * (HIST_SUB / 2);
+	return ((m + 1) << shift) - 1;
+}
+
+static void hist_record(Hist *hist, uint64_t v) {
+	hist->counts[hist_index(v)]++;
+	hist->total++;
+	if (v > hist->max) {
+		hist->max = v;
+	}
+}
+
+static void hist_merge(Hist *into, const Hist *from) {
+	for (size_t i = 0; i < HIST_BUCKETS; i++) {
+		into->counts[i] += from->counts[i];
+	}
+	into->total += from->total;
+	if (from->max > into->max) {
+		into->max = from->max;
+	}
+}
+
+static uint64_t hist_percentile(const Hist *hist, double p) {
+	uint64_t rank = (uint64_t) (p * (double) hist->total + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			uint64_t v = hist_value(i);
+			return v < hist->max ? v : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+static struct {
+	struct sockaddr_in addr;
+	uint32_t threads;
+	uint32_t conns;
+	uint32_t pipeline;
+	uint64_t requests;
+	uint32_t seconds;
+	uint32_t keyspace;
+	uint32_t value_size;
+	// cumulative weights of the commands, out of mix[CMD_COUNT - 1]
+	uint32_t mix[CMD_COUNT];
+	// requests handed out so far, against requests
+	atomic_uint_fast64_t issued;
+	uint64_t deadline_ns;
+	char *value;
+} g_cfg;
+
+typedef struct {
+	MinisConn conn;
+	// the replies due, the oldest one went out at sent_ns[done]
+	uint32_t done;
+	uint64_t *sent_ns;
+} BenchConn;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t nconns;
+	BenchConn *conns;
+	uint64_t rng;
+	Hist hist;
+	uint64_t errors;
+	uint64_t cmds[CMD_COUNT];
+} Worker;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t rng_next(Worker *w) {
+	// xorshift64*
+	w->rng ^= w->rng >> 12;
+	w->rng ^= w->rng << 25;
+	w->rng ^= w->rng >> 27;
+	return w->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t pick_cmd(Worker *w) {
+	uint32_t r = (uint32_t) (rng_next(w) % g_cfg.mix[CMD_COUNT - 1]);
+	uint32_t cmd = 0;
+	while (r >= g_cfg.mix[cmd]) {
+		cmd++;
+	}
+	return cmd;
+}
+
+static void put_random_request(Worker *w, MinisConn *conn) {
+	char key[32];
+	char num[32];
+	char member[32];
+	char keys[K_MGET_KEYS - 1][32];
+	const char *args[1 + K_MGET_KEYS];
+	uint32_t lens[1 + K_MGET_KEYS];
+	uint32_t nargs = 0;
+	uint32_t cmd = pick_cmd(w);
+	w->cmds[cmd]++;
+
+	args[nargs] = k_cmd_names[cmd];
+	lens[nargs++] = (uint32_t) strlen(k_cmd_names[cmd]);
+	uint64_t k = rng_next(w) % g_cfg.keyspace;
+	if (cmd == CMD_ZADD || cmd == CMD_ZQUERY) {
+		lens[nargs] = (uint32_t) snprintf(key, sizeof(key), "zset:%u", (unsigned) (k % K_ZSETS));
+	} else {
+		lens[nargs] = (uint32_t) snprintf(key, sizeof(key), "key:%lu", (unsigned long) k);
+	}
+	args[nargs++] = key;
+
+	switch (cmd) {
+	case CMD_SET:
+		args[nargs] = g_cfg.value;
+		lens[nargs++] = g_cfg.value_size;
+		break;
+	case CMD_ZADD:
+		lens[nargs] = (uint32_t) snprintf(num, sizeof(num), "%lu", (unsigned long) (rng_next(w) % 1000000));
+		args[nargs++] = num;
+		lens[nargs] = (uint32_t) snprintf(member, sizeof(member), "m:%lu", (unsigned long) k);
+		args[nargs++] = member;
+		break;
+	case CMD_ZQUERY:
+		lens[nargs] = (uint32_t) snprintf(num, sizeof(num), "%lu", (unsigned long) (rng_next(w) % 1000000));
+		args[nargs++] = num;
+		args[nargs] = "";
+		lens[nargs++] = 0;
+		args[nargs] = "0";
+		lens[nargs++] = 1;
+		args[nargs] = "10";
+		lens[nargs++] = 2;
+		break;
+	case CMD_PEXPIRE:
+		// long enough that the keys mostly stay around
+		lens[nargs] = (uint32_t) snprintf(num, sizeof(num), "%lu", (unsigned long) (10000 + rng_next(w) % 50000));
+		args[nargs++] = num;
+		break;
+	case CMD_MGET:
+		for (size_t i = 0; i < K_MGET_KEYS - 1; i++) {
+			k = rng_next(w) % g_cfg.keyspace;
+			lens[nargs] = (uint32_t) snprintf(keys[i], sizeof(keys[i]), "key:%lu", (unsigned long) k);
+			args[nargs++] = keys[i];
+		}
+		break;
+	default:
+		break;
+	}
+	if (minis_append(conn, nargs, args, lens)) {
+		die("Request too long");
+	}
+}
+
+// how many requests the next batch may have, 0 when the run is over
+static uint32_t claim(void) {
+	if (g_cfg.seconds) {
+		return now_ns() < g_cfg.deadline_ns ? g_cfg.pipeline : 0;
+	}
+	uint64_t at = atomic_fetch_add(&g_cfg.issued, g_cfg.pipeline);
+	if (at >= g_cfg.requests) {
+		return 0;
+	}
+	uint64_t left = g_cfg.requests - at;
+	return left < g_cfg.pipeline ? (uint32_t) left : g_cfg.pipeline;
+}
+
+static bool conn_send_batch(Worker *w, BenchConn *bc) {
+	uint32_t n = claim();
+	if (n == 0) {
+		return false;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		put_random_request(w, &bc->conn);
+	}
+	uint64_t now = now_ns();
+	for (uint32_t i = 0; i < n; i++) {
+		bc->sent_ns[i] = now;
+	}
+	bc->done = 0;
+	// the whole batch in one write
+	if (minis_flush(&bc->conn)) {
+		die("write()");
+	}
+	return true;
+}
+
+static void conn_read(Worker *w, BenchConn *bc) {
+	int rv = minis_fill(&bc->conn);
+	if (rv < 0) {
+		die(errno == ECONNRESET ? "Server closed the connection" : "read()");
+	}
+	uint64_t now = now_ns();
+	MinisReply reply;
+	while (bc->conn.pending > 0 && (rv = minis_take(&bc->conn, &reply)) > 0) {
+		if (reply.type == SER_ERR) {
+			w->errors++;
+		}
+		hist_record(&w->hist, now - bc->sent_ns[bc->done++]);
+	}
+	if (rv < 0) {
+		die("Bad reply");
+	}
+}
+
+static void* worker_run(void *arg) {
+	Worker *w = (Worker*) arg;
+	struct pollfd *pfds = calloc(w->nconns, sizeof(struct pollfd));
+	BenchConn **polled = calloc(w->nconns, sizeof(BenchConn*));
+	if (!pfds || !polled) {
+		die("Out of memory");
+	}
+	bool running = true;
+	while (true) {
+		nfds_t npfds = 0;
+		for (uint32_t i = 0; i < w->nconns; i++) {
+			BenchConn *conn = &w->conns[i];
+			if (conn->conn.pending == 0 && running) {
+				running = conn_send_batch(w, conn);
+			}
+			if (conn->conn.pending > 0) {
+				pfds[npfds].fd = conn->conn.fd;
+				pfds[npfds].events = POLLIN;
+				pfds[npfds].revents = 0;
+				polled[npfds++] = conn;
+			}
+		}
+		if (npfds == 0) {
+			break;
+		}
+		int rv = poll(pfds, npfds, -1);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv < 0) {
+			die("poll");
+		}
+		for (nfds_t i = 0; i < npfds; i++) {
+			if (pfds[i].revents) {
+				conn_read(w, polled[i]);
+			}
+		}
+	}
+	free(polled);
+	free(pfds);
+	return NULL;
+}
+
+// -m get:50,set:40,zadd:5,zquery:3,pexpire:2
+static void parse_mix(const char *spec) {
+	uint32_t weights[CMD_COUNT] = { 0 };
+	char *copy = strdup(spec);
+	char *save = NULL;
+	for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *colon = strchr(tok, ':');
+		if (!colon) {
+			die("Bad -m, expected cmd:weight,...");
+		}
+		*colon = '\0';
+		size_t cmd = 0;
+		while (cmd < CMD_COUNT && strcasecmp(tok, k_cmd_names[cmd])) {
+			cmd++;
+		}
+		if (cmd == CMD_COUNT) {
+			die("Bad -m, unknown command");
+		}
+		weights[cmd] = (uint32_t) atoi(colon + 1);
+	}
+	free(copy);
+	uint32_t sum = 0;
+	for (size_t i = 0; i < CMD_COUNT; i++) {
+		sum += weights[i];
+		g_cfg.mix[i] = sum;
+	}
+	if (sum == 0) {
+		die("Bad -m, all weights are 0");
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr,
+			"usage: bench [-h host] [-p port] [-t threads] [-c connections] [-P pipeline]\n"
+			"             [-n requests | -d seconds] [-k keyspace] [-s value size]\n"
+			"             [-m get:50,set:40,zadd:5,zquery:3,pexpire:2]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *host = "127.0.0.1";
+	int port = PORT;
+	g_cfg.threads = 4;
+	g_cfg.conns = 50;
+	g_cfg.pipeline = 1;
+	g_cfg.requests = 1000000;
+	g_cfg.seconds = 0;
+	g_cfg.keyspace = 100000;
+	g_cfg.value_size = 32;
+	parse_mix("get:50,set:40,zadd:5,zquery:3,pexpire:2");
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "h:p:t:c:P:n:d:k:s:m:")) != -1) {
+		switch (opt) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			g_cfg.threads = (uint32_t) atoi(optarg);
+			break;
+		case 'c':
+			g_cfg.conns = (uint32_t) atoi(optarg);
+			break;
+		case 'P':
+			g_cfg.pipeline = (uint32_t) atoi(optarg);
+			break;
+		case 'n':
+			g_cfg.requests = (uint64_t) atoll(optarg);
+			break;
+		case 'd':
+			g_cfg.seconds = (uint32_t) atoi(optarg);
+			break;
+		case 'k':
+			g_cfg.keyspace = (uint32_t) atoi(optarg);
+			break;
+		case 's':
+			g_cfg.value_size = (uint32_t) atoi(optarg);
+			break;
+		case 'm':
+			parse_mix(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (g_cfg.threads == 0 || g_cfg.conns == 0 || g_cfg.pipeline == 0 || g_cfg.keyspace == 0) {
+		usage();
+	}
+	if (g_cfg.threads > g_cfg.conns) {
+		g_cfg.threads = g_cfg.conns;
+	}
+	g_cfg.addr.sin_family = AF_INET;
+	g_cfg.addr.sin_port = htons((uint16_t) port);
+	if (inet_pton(AF_INET, host, &g_cfg.addr.sin_addr) != 1) {
+		die("Bad -h, expected an IPv4 address");
+	}
+	g_cfg.value = malloc(g_cfg.value_size + 1);
+	if (!g_cfg.value) {
+		die("Out of memory");
+	}
+	memset(g_cfg.value, 'x', g_cfg.value_size);
+	g_cfg.value[g_cfg.value_size] = '\0';
+
+	Worker *workers = calloc(g_cfg.threads, sizeof(Worker));
+	if (!workers) {
+		die("Out of memory");
+	}
+	for (uint32_t t = 0; t < g_cfg.threads; t++) {
+		Worker *w = &workers[t];
+		w->nconns = g_cfg.conns / g_cfg.threads + (t < g_cfg.conns % g_cfg.threads);
+		w->conns = calloc(w->nconns, sizeof(BenchConn));
+		if (!w->conns) {
+			die("Out of memory");
+		}
+		w->rng = 0x9E3779B97F4A7C15ULL * (t + 1);
+		for (uint32_t i = 0; i < w->nconns; i++) {
+			BenchConn *conn = &w->conns[i];
+			if (minis_connect(&conn->conn, &g_cfg.addr)) {
+				die("connect");
+			}
+			conn->sent_ns = calloc(g_cfg.pipeline, sizeof(uint64_t));
+			if (!conn->sent_ns) {
+				die("Out of memory");
+			}
+		}
+	}
+
+	uint64_t start = now_ns();
+	g_cfg.deadline_ns = start + (uint64_t) g_cfg.seconds * 1000000000;
+	for (uint32_t t = 0; t < g_cfg.threads; t++) {
+		if (pthread_create(&workers[t].thread, NULL, worker_run, &workers[t])) {
+			die("pthread_create");
+		}
+	}
+	Hist *hist = calloc(1, sizeof(Hist));
+	if (!hist) {
+		die("Out of memory");
+	}
+	uint64_t errors = 0;
+	uint64_t cmds[CMD_COUNT] = { 0 };
+	for (uint32_t t = 0; t < g_cfg.threads; t++) {
+		Worker *w = &workers[t];
+		pthread_join(w->thread, NULL);
+		hist_merge(hist, &w->hist);
+		errors += w->errors;
+		for (size_t i = 0; i < CMD_COUNT; i++) {
+			cmds[i] += w->cmds[i];
+		}
+	}
+	double secs = (double) (now_ns() - start) / 1e9;
+
+	printf("%u threads, %u connections, pipeline %u, keyspace %u, values of %u bytes\n",
+			g_cfg.threads, g_cfg.conns, g_cfg.pipeline, g_cfg.keyspace, g_cfg.value_size);
+	for (size_t i = 0; i < CMD_COUNT; i++) {
+		if (cmds[i]) {
+			printf("  %-8s %lu\n", k_cmd_names[i], (unsigned long) cmds[i]);
+		}
+	}
+	printf("%lu requests in %.2fs, %.0f requests/s, %lu errors\n",
+			(unsigned long) hist->total, secs, (double) hist->total / secs, (unsigned long) errors);
+	printf("latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+			(double) hist_percentile(hist, 0.50) / 1e3,
+			(double) hist_percentile(hist, 0.99) / 1e3,
+			(double) hist_percentile(hist, 0.999) / 1e3,
+			(double) hist->max / 1e3);
+
+	for (uint32_t t = 0; t < g_cfg.threads; t++) {
+		for (uint32_t i = 0; i < workers[t].nconns; i++) {
+			minis_close(&workers[t].conns[i].conn);
+			free(workers[t].conns[i].sent_ns);
+		}
+		free(workers[t].conns);
+	}
+	free(workers);
+	free(hist);
+	free(g_cfg.value);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * buffer.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "common.h"
+
+// chunks of the standard size kept around per thread, so that connections
+// becoming busy and idle again don't go through malloc every time.
+#define POOL_MAX 256
+
+static __thread struct {
+	Chunk *free;
+	size_t size;
+} t_pool = { NULL, 0 };
+
+Chunk* chunk_new(size_t min_cap) {
+	Chunk *chunk = NULL;
+	if (min_cap <= CHUNK_SIZE && t_pool.free) {
+		chunk = t_pool.free;
+		t_pool.free = chunk->next;
+		t_pool.size--;
+	} else {
+		size_t cap = min_cap <= CHUNK_SIZE ? CHUNK_SIZE : min_cap;
+		chunk = malloc(sizeof(Chunk) + cap);
+		if (!chunk) {
+			die("Out of memory");
+		}
+		chunk->cap = (uint32_t) cap;
+	}
+	chunk->next = NULL;
+	atomic_store_explicit(&chunk->refs, 1, memory_order_relaxed);
+	chunk->start = 0;
+	chunk->end = 0;
+	return chunk;
+}
+
+void chunk_ref(Chunk *chunk) {
+	atomic_fetch_add_explicit(&chunk->refs, 1, memory_order_relaxed);
+}
+
+void chunk_unref(Chunk *chunk) {
+	if (atomic_fetch_sub_explicit(&chunk->refs, 1, memory_order_acq_rel) != 1) {
+		return;
+	}
+	if (chunk->cap == CHUNK_SIZE && t_pool.size < POOL_MAX) {
+		chunk->next = t_pool.free;
+		t_pool.free = chunk;
+		t_pool.size++;
+	} else {
+		free(chunk);
+	}
+}
+
+void chain_init(ChunkChain *chain) {
+	chain->head = chain->tail = NULL;
+	chain->size = 0;
+}
+
+void chain_append(ChunkChain *chain, const void *data, size_t len) {
+	const uint8_t *src = (const uint8_t*) data;
+	while (len > 0) {
+		Chunk *tail = chain->tail;
+		if (!tail || tail->end == tail->cap) {
+			tail = chunk_new(0);
+			if (chain->tail) {
+				chain->tail->next = tail;
+			} else {
+				chain->head = tail;
+			}
+			chain->tail = tail;
+		}
+		size_t n = tail->cap - tail->end;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(&tail->data[tail->end], src, n);
+		tail->end += (uint32_t) n;
+		chain->size += n;
+		src += n;
+		len -= n;
+	}
+}
+
+int chain_iov(ChunkChain *chain, struct iovec *iov, int max) {
+	int n = 0;
+	for (Chunk *chunk = chain->head; chunk && n < max; chunk = chunk->next) {
+		if (chunk->end == chunk->start) {
+			continue;
+		}
+		iov[n].iov_base = &chunk->data[chunk->start];
+		iov[n].iov_len = chunk->end - chunk->start;
+		n++;
+	}
+	return n;
+}
+
+void chain_consume(ChunkChain *chain, size_t n) {
+	assert(n <= chain->size);
+	chain->size -= n;
+	while (chain->head) {
+		Chunk *head = chain->head;
+		size_t avail = head->end - head->start;
+		if (n < avail) {
+			head->start += (uint32_t) n;
+			return;
+		}
+		n -= avail;
+		chain->head = head->next;
+		if (!chain->head) {
+			chain->tail = NULL;
+		}
+		chunk_unref(head);
+	}
+}
+
+void chain_clear(ChunkChain *chain) {
+	chain_consume(chain, chain->size);
+}
@@ -0,0 +1,51 @@
+/*
+ * buffer.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef BUFFER_H_
+#define BUFFER_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// the usual chunk size, these are pooled. Bigger ones are made to measure.
+#define CHUNK_SIZE (16 * 1024)
+
+// a reference counted piece of a connection buffer.
+// The bytes in [start, end) are the ones waiting to be consumed.
+typedef struct chunk {
+	struct chunk *next;
+	atomic_uint refs;
+	uint32_t cap;
+	uint32_t start;
+	uint32_t end;
+	uint8_t data[0];
+} Chunk;
+
+// a queue of bytes kept in a chain of chunks
+typedef struct {
+	Chunk *head;
+	Chunk *tail;
+	size_t size;
+} ChunkChain;
+
+// at least min_cap bytes of room, CHUNK_SIZE if smaller
+extern Chunk* chunk_new(size_t min_cap);
+extern void chunk_ref(Chunk *chunk);
+// back to the pool once the last reference is gone
+extern void chunk_unref(Chunk *chunk);
+
+extern void chain_init(ChunkChain *chain);
+extern void chain_append(ChunkChain *chain, const void *data, size_t len);
+// fills up to max iovecs with the queued bytes, returns how many were used
+extern int chain_iov(ChunkChain *chain, struct iovec *iov, int max);
+// drops n bytes from the front, releasing the chunks that are done with
+extern void chain_consume(ChunkChain *chain, size_t n);
+extern void chain_clear(ChunkChain *chain);
+
+#endif /* BUFFER_H_ */
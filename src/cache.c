@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,141 +7,403 @@
 #include <math.h>
 #include <time.h>
 #include "strings.h"
-#include "heap.h"
+#include "timer.h"
 #include "cache.h"
 #include "zset.h"
+#include "hash.h"
 #include "out.h"
 #include "common.h"
+#include "slab.h"
+#include "slowlog.h"
+#include "repl.h"
+#include "cluster.h"
+#include "minis.h"
+#include <arpa/inet.h>
 
-// the structure for the key
+// the structure for the key. The key, and a short value, live right
+// behind it in the same allocation, like the name of a ZNode.
 typedef struct entry {
 	HNode node;
-	char *key;
-	char *val;
-	uint32_t type;
-	ZSet *zset;
-	// for TTLs
-	size_t heap_idx;
+	uint8_t type;
+	// how a T_STR value is kept
+	uint8_t enc;
+	// room for the value behind the key
+	uint16_t val_cap;
+	uint32_t key_len;
+	uint32_t val_len;
+	// for eviction, see entry_touch
+	uint32_t access;
+	union {
+		// E_RAW: either points behind the key, or to an allocation of its own
+		char *val;
+		// E_INT
+		int64_t ival;
+	};
+	union {
+		ZSet *zset;
+		Hash *hash;
+	};
+	// only keys with a TTL have a timer
+	struct ttl_timer *ttl;
+	char key[0];
 } Entry;
 
+// the TTL of a key, on the loop's timer wheel
+typedef struct ttl_timer {
+	Timer timer;
+	Entry *ent;
+} TtlTimer;
+
+enum {
+	T_STR = 0, T_ZSET = 1, T_HASH = 2,
+};
+
+// a string that reads back the same as an int64 is kept as one, so that
+// counters take no room for the value and change without allocating
 enum {
-	T_STR = 0, T_ZSET = 1,
+	E_RAW = 0, E_INT = 1,
 };
 
+// the longest int64, with the sign
+#define K_INT_LEN 20
+
+// values up to this size are stored inline when the key is created
+const size_t k_max_inline_val = 64;
+
+static char* entry_inline_val(Entry *ent) {
+	return &ent->key[ent->key_len];
+}
+
 // deallocate the key immediately
 static void entry_destroy(Entry *ent) {
     switch (ent->type) {
     case T_ZSET:
         zset_dispose(ent->zset);
-        free(ent->zset);
+        slab_free(ent->zset, sizeof(ZSet));
         break;
+    case T_HASH:
+        hash_dispose(ent->hash);
+        slab_free(ent->hash, sizeof(Hash));
+        break;
+    }
+    if (ent->enc == E_RAW && ent->val != entry_inline_val(ent)) {
+        slab_free(ent->val, ent->val_len);
     }
-    if (ent->key)
-	free(ent->key);
-    if (ent->val)
-	free(ent->val);
-    free(ent);
+    slab_free(ent, sizeof(Entry) + ent->key_len + ent->val_cap);
 }
 
-static int cmd_is(const char *word, const char *cmd) {
-	return 0 == strcasecmp(word, cmd);
+// a helper structure for the hashtable lookup, points straight into the request
+typedef struct {
+	HNode node;
+	const char *key;
+	size_t len;
+} LookupKey;
+
+static void lookup_key_init(Cache *cache, LookupKey *key, const StrView *view) {
+	key->key = view->data;
+	key->len = view->len;
+	if (cache->hint.data && view->data == cache->hint.data && view->len == cache->hint.len) {
+		// the very same bytes, hashed for the prefetch
+		key->node.hcode = cache->hint_hcode;
+		return;
+	}
+	key->node.hcode = str_hash((uint8_t*) view->data, view->len);
 }
 
-static int entry_eq(HNode *lhs, HNode *rhs) {
-	Entry *le = container_of(lhs, Entry, node);
-	Entry *re = container_of(rhs, Entry, node);
-	return lhs->hcode == rhs->hcode
-			&& (le != NULL && re != NULL && le->key != NULL && re->key != NULL
-					&& strcmp(le->key, re->key) == 0);
+static int cmd_is(const StrView *word, const char *cmd) {
+	size_t len = strlen(cmd);
+	return word->len == len && 0 == strncasecmp(word->data, cmd, len);
 }
 
-static void h_scan(HTab *tab, void (*f)(HNode*, void*), void *arg) {
-	if (tab->size == 0) {
-		return;
+static int entry_eq(HNode *node, HNode *key) {
+	if (node->hcode != key->hcode) {
+		return false;
 	}
-	for (size_t i = 0; i < tab->mask + 1; ++i) {
-		HNode *node = tab->tab[i];
-		while (node) {
-			f(node, arg);
-			node = node->next;
+	Entry *ent = container_of(node, Entry, node);
+	LookupKey *lkey = container_of(key, LookupKey, node);
+	return ent->key_len == lkey->len
+			&& 0 == memcmp(ent->key, lkey->key, lkey->len);
+}
+
+// a new entry with a copy of the key, the request buffer is reused once the
+// command is done. Whatever the size class leaves over behind the key is
+// used for the value.
+static Entry* entry_new(const LookupKey *key, uint32_t type, size_t val_len) {
+	size_t size = sizeof(Entry) + key->len;
+	if (val_len <= k_max_inline_val) {
+		size = slab_size_class(size + val_len);
+	}
+	Entry *ent = slab_alloc(size);
+	ent->node.hcode = key->node.hcode;
+	ent->type = (uint8_t) type;
+	ent->enc = E_RAW;
+	ent->key_len = (uint32_t) key->len;
+	ent->val_cap = (uint16_t) (size - sizeof(Entry) - key->len);
+	ent->val_len = 0;
+	ent->val = entry_inline_val(ent);
+	ent->zset = NULL;
+	ent->ttl = NULL;
+	ent->access = 0;
+	memcpy(ent->key, key->key, key->len);
+	return ent;
+}
+
+// the int64 a string is the exact decimal form of: a minus sign at most,
+// no leading zeros, nothing else
+static bool str2canon_int(const StrView *val, int64_t *out) {
+	const char *s = val->data;
+	size_t n = val->len;
+	if (n == 0 || n > K_INT_LEN) {
+		return false;
+	}
+	bool neg = s[0] == '-';
+	size_t i = neg ? 1 : 0;
+	if (i == n || (s[i] == '0' && (neg || n > 1))) {
+		return false;
+	}
+	uint64_t num = 0;
+	for (; i < n; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return false;
 		}
+		uint64_t digit = (uint64_t) (s[i] - '0');
+		if (num > (UINT64_MAX - digit) / 10) {
+			return false;
+		}
+		num = num * 10 + digit;
+	}
+	if (num > (uint64_t) INT64_MAX + (neg ? 1 : 0)) {
+		return false;
+	}
+	*out = neg ? (int64_t) (0 - num) : (int64_t) num;
+	return true;
+}
+
+static void entry_drop_val(Entry *ent) {
+	if (ent->enc == E_RAW && ent->val != entry_inline_val(ent)) {
+		slab_free(ent->val, ent->val_len);
+	}
+	ent->val_len = 0;
+}
+
+static void entry_set_int(Entry *ent, int64_t num) {
+	if (ent->enc != E_INT) {
+		entry_drop_val(ent);
+		ent->enc = E_INT;
+	}
+	ent->ival = num;
+}
+
+static void entry_set_val(Entry *ent, const StrView *val) {
+	int64_t num = 0;
+	if (str2canon_int(val, &num)) {
+		entry_set_int(ent, num);
+		return;
 	}
+	char *inline_val = entry_inline_val(ent);
+	if (ent->enc == E_RAW && ent->val != inline_val && ent->val_len == val->len) {
+		// same size, reuse the allocation
+		memcpy(ent->val, val->data, val->len);
+		return;
+	}
+	entry_drop_val(ent);
+	ent->enc = E_RAW;
+	ent->val = val->len <= ent->val_cap ? inline_val : slab_alloc(val->len);
+	memcpy(ent->val, val->data, val->len);
+	ent->val_len = (uint32_t) val->len;
+}
+
+static Entry* entry_new_str(const LookupKey *key, const StrView *val) {
+	// an int needs no room behind the key
+	int64_t num = 0;
+	Entry *ent = entry_new(key, T_STR, str2canon_int(val, &num) ? 0 : val->len);
+	entry_set_val(ent, val);
+	return ent;
+}
+
+// the value of a T_STR entry, ints are written out to buf
+static StrView entry_str(Entry *ent, char buf[K_INT_LEN + 1]) {
+	StrView view = { ent->val, ent->val_len };
+	if (ent->enc == E_INT) {
+		view.data = buf;
+		view.len = (size_t) snprintf(buf, K_INT_LEN + 1, "%lld", (long long) ent->ival);
+	}
+	return view;
 }
 
 static void cb_scan(HNode *node, void *arg) {
 	String *out = (String*) arg;
-	out_str(out, container_of(node, Entry, node)->key);
+	Entry *ent = container_of(node, Entry, node);
+	out_str_size(out, ent->key, ent->key_len);
+}
+
+// the bytes an entry holds on to, as the slab hands them out
+static size_t entry_mem(Entry *ent) {
+	size_t mem = slab_size_class(sizeof(Entry) + ent->key_len + ent->val_cap);
+	if (ent->type == T_STR && ent->enc == E_RAW && ent->val != entry_inline_val(ent)) {
+		mem += slab_size_class(ent->val_len);
+	}
+	if (ent->type == T_ZSET) {
+		mem += slab_size_class(sizeof(ZSet)) + zset_mem(ent->zset);
+	}
+	if (ent->type == T_HASH) {
+		mem += slab_size_class(sizeof(Hash)) + hash_mem(ent->hash);
+	}
+	if (ent->ttl) {
+		mem += slab_size_class(sizeof(TtlTimer));
+	}
+	return mem;
+}
+
+// after a change to ent, which took before bytes then
+static void mem_changed(Cache *cache, Entry *ent, size_t before) {
+	cache->used_mem += entry_mem(ent) - before;
+}
+
+static uint64_t cache_rand(Cache *cache) {
+	// xorshift64*
+	uint64_t x = cache->rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	cache->rng = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+// LFU: the counter of a new key, so that it isn't the first to go, and how
+// slowly the counter climbs. It takes about a million hits to saturate.
+#define LFU_INIT 5
+#define LFU_LOG_FACTOR 10
+
+static uint32_t lfu_minutes(Cache *cache) {
+	return (uint32_t) (cache->clock_ms / 60000) & 0xFFFFFF;
+}
+
+// the counter less a point for every minute since it was last touched
+static uint32_t lfu_counter(Cache *cache, uint32_t access) {
+	uint32_t counter = access & 0xFF;
+	uint32_t idle = (lfu_minutes(cache) - (access >> 8)) & 0xFFFFFF;
+	return idle >= counter ? 0 : counter - idle;
+}
+
+// access is the ms clock of the last access for LRU, which wraps after 49
+// days. For LFU it is the minute clock of the last access in the top 24
+// bits and a logarithmic access counter in the low 8.
+static void entry_touch(Cache *cache, Entry *ent, bool created) {
+	if (cache->evict_policy == EVICT_LRU) {
+		ent->access = (uint32_t) cache->clock_ms;
+		return;
+	}
+	uint32_t counter = created ? LFU_INIT : lfu_counter(cache, ent->access);
+	if (!created && counter < 255) {
+		uint32_t base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+		double r = (double) (cache_rand(cache) >> 11) / (double) (1ull << 53);
+		if (r * (base * LFU_LOG_FACTOR + 1) < 1.0) {
+			counter++;
+		}
+	}
+	ent->access = lfu_minutes(cache) << 8 | counter;
+}
+
+static void entry_del(Cache *cache, Entry *ent);
+static void entry_release(Cache *cache, Entry *ent, size_t max_cost);
+
+// a key of the db, which counts as an access to it. One whose TTL ran out
+// is deleted right here, its timer may not have been handled yet.
+static Entry* db_lookup(Cache *cache, LookupKey *key) {
+	HNode *node = hm_lookup(&cache->db, &key->node, &entry_eq);
+	if (!node) {
+		counter_add(&cache->stats.misses, cache->reading);
+		return NULL;
+	}
+	Entry *ent = container_of(node, Entry, node);
+	if (ent->ttl && ent->ttl->timer.expire_ms <= cache->clock_ms) {
+		hm_pop(&cache->db, &key->node, &entry_eq);
+		entry_del(cache, ent);
+		cache->expired++;
+		counter_add(&cache->stats.misses, cache->reading);
+		return NULL;
+	}
+	counter_add(&cache->stats.hits, cache->reading);
+	entry_touch(cache, ent, false);
+	return ent;
+}
+
+static void db_insert(Cache *cache, Entry *ent) {
+	entry_touch(cache, ent, true);
+	hm_insert(&cache->db, &ent->node);
+	cache->used_mem += entry_mem(ent);
+}
+
+// numbers are short, so copy them out of the request buffer to get a terminator
+#define K_MAX_NUM_LEN 63
+
+static int view2cstr(const StrView *view, char *buf) {
+	if (view->len == 0 || view->len > K_MAX_NUM_LEN) {
+		return false;
+	}
+	memcpy(buf, view->data, view->len);
+	buf[view->len] = '\0';
+	return true;
 }
 
-static int str2dbl(const char *s, double *out) {
+static int str2dbl(const StrView *view, double *out) {
+	char buf[K_MAX_NUM_LEN + 1];
+	if (!view2cstr(view, buf)) {
+		return false;
+	}
 	char *endp = NULL;
-	*out = strtod(s, &endp);
-	return endp == s + strlen(s) && !isnan(*out);
+	*out = strtod(buf, &endp);
+	return endp == buf + view->len && !isnan(*out);
 }
 
-static int str2int(const char *s, int64_t *out) {
+static int str2int(const StrView *view, int64_t *out) {
+	char buf[K_MAX_NUM_LEN + 1];
+	if (!view2cstr(view, buf)) {
+		return false;
+	}
 	char *endp = NULL;
-	*out = strtoll(s, &endp, 10);
-	return endp == s + strlen(s);
+	*out = strtoll(buf, &endp, 10);
+	return endp == buf + view->len;
 }
 
 // zadd zset score name
-static void do_zadd(Cache *cache, char **cmd, String *out) {
+static void do_zadd(Cache *cache, StrView *cmd, size_t size, String *out) {
 	double score = 0;
-	if (!str2dbl(cmd[2], &score)) {
+	if (!str2dbl(&cmd[2], &score)) {
 		out_err(out, ERR_ARG, "expect fp number");
 		return;
 	}
 
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
-	HNode *hnode = hm_lookup(&cache->db, &key.node, &entry_eq);
-
-	Entry *ent = NULL;
-	if (!hnode) {
-		ent = malloc(sizeof(Entry));
-		memset(ent, 0, sizeof(Entry));
-		if (!ent) {
-			abort();
-		}
-		ent->key = calloc(strlen(key.key) + 1, sizeof(char));
-		if (!ent->key) {
-			abort();
-		}
-		strcpy(ent->key, key.key);
-		ent->node.hcode = key.node.hcode;
-		ent->type = T_ZSET;
-		ent->zset = malloc(sizeof(ZSet));
-		if (!ent->zset)
-			die("Couldnt allocate zset");
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		ent = entry_new(&key, T_ZSET, 0);
+		ent->zset = slab_alloc(sizeof(ZSet));
 		memset(ent->zset, 0, sizeof(ZSet));
-		ent->heap_idx = -1;
-		hm_insert(&cache->db, &ent->node);
-	} else {
-		ent = container_of(hnode, Entry, node);
-		if (ent->type != T_ZSET) {
-			out_err(out, ERR_TYPE, "expect zset");
-		}
+		db_insert(cache, ent);
+	} else if (ent->type != T_ZSET) {
+		out_err(out, ERR_TYPE, "expect zset");
+		return;
 	}
 
 // add or update the tuple
-	const char *name = cmd[3];
-	int added = zset_add(ent->zset, name, strlen(name), score);
+	size_t before = entry_mem(ent);
+	int added = zset_add(ent->zset, cmd[3].data, cmd[3].len, score);
+	mem_changed(cache, ent, before);
 	out_int(out, (int64_t) added);
 }
 
-static int expect_zset(Cache *cache, String *out, char *s, Entry **ent) {
-	Entry key;
-	key.key = s;
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
-	HNode *hnode = hm_lookup(&cache->db, &key.node, &entry_eq);
-	if (!hnode) {
+static int expect_zset(Cache *cache, String *out, StrView *s, Entry **ent) {
+	LookupKey key;
+	lookup_key_init(cache, &key, s);
+	*ent = db_lookup(cache, &key);
+	if (!*ent) {
 		out_nil(out);
 		return false;
 	}
 
-	*ent = container_of(hnode, Entry, node);
 	if ((*ent)->type != T_ZSET) {
 		out_err(out, ERR_TYPE, "expect zset");
 		return false;
@@ -149,58 +412,59 @@ static int expect_zset(Cache *cache, String *out, char *s, Entry **ent) {
 }
 
 // zrem zset name
-static void do_zrem(Cache *cache, char **cmd, String *out) {
+static void do_zrem(Cache *cache, StrView *cmd, size_t size, String *out) {
 	Entry *ent = NULL;
-	if (!expect_zset(cache, out, cmd[1], &ent)) {
+	if (!expect_zset(cache, out, &cmd[1], &ent)) {
 		return;
 	}
 
-	ZNode *znode = zset_pop(ent->zset, cmd[2], strlen(cmd[2]));
-	if (znode) {
-		znode_del(znode);
-	}
-	out_int(out, znode ? 1 : 0);
+	size_t before = entry_mem(ent);
+	bool removed = zset_rem(ent->zset, cmd[2].data, cmd[2].len);
+	mem_changed(cache, ent, before);
+	out_int(out, removed ? 1 : 0);
 }
 
 // zscore zset name
-static void do_zscore(Cache *cache, char **cmd, String *out) {
+static void do_zscore(Cache *cache, StrView *cmd, size_t size, String *out) {
 	Entry *ent = NULL;
-	if (!expect_zset(cache, out, cmd[1], &ent)) {
+	if (!expect_zset(cache, out, &cmd[1], &ent)) {
 		return;
 	}
 
-	ZNode *znode = zset_lookup(ent->zset, cmd[2], strlen(cmd[2]));
-	if (znode) {
-		out_dbl(out, znode->score);
+	double score = 0;
+	if (zset_score(ent->zset, cmd[2].data, cmd[2].len, &score)) {
+		out_dbl(out, score);
 	} else {
 		out_nil(out);
 	}
 }
 
 // zquery zset score name offset limit
-static void do_zquery(Cache *cache, char **cmd, String *out) {
+static void do_zquery(Cache *cache, StrView *cmd, size_t size, String *out) {
 // parse args
 	double score = 0;
-	if (!str2dbl(cmd[2], &score)) {
+	if (!str2dbl(&cmd[2], &score)) {
 		out_err(out, ERR_ARG, "expect fp number");
 		return;
 	}
 	int64_t offset = 0;
 	int64_t limit = 0;
-	if (!str2int(cmd[4], &offset)) {
+	if (!str2int(&cmd[4], &offset)) {
 		out_err(out, ERR_ARG, "expect int");
 		return;
 	}
-	if (!str2int(cmd[5], &limit)) {
+	if (!str2int(&cmd[5], &limit)) {
 		out_err(out, ERR_ARG, "expect int");
 		return;
 	}
 
 // get the zset
 	Entry *ent = NULL;
-	if (!expect_zset(cache, out, cmd[1], &ent)) {
-		if (str_char_at(out, 0) == SER_NIL) {
-			str_clear(out);
+	// out may already hold other replies
+	size_t start = str_size(out);
+	if (!expect_zset(cache, out, &cmd[1], &ent)) {
+		if (out->data[start] == SER_NIL) {
+			str_truncate(out, start);
 			out_arr(out, (uint32_t) 0);
 		}
 		return;
@@ -211,227 +475,1803 @@ static void do_zquery(Cache *cache, char **cmd, String *out) {
 		out_arr(out, (uint32_t) 0);
 		return;
 	}
-	ZNode *znode = zset_query(ent->zset, score, cmd[3], strlen(cmd[3]));
-	znode = znode_offset(znode, offset);
+	ZIter it;
+	zset_seek(ent->zset, score, cmd[3].data, cmd[3].len, &it);
+	zset_offset(&it, offset);
 
 	// output
 	size_t idx = out_bgn_arr(out);
 	uint32_t n = 0;
-	while (znode && (int64_t) n < limit) {
-		out_str_size(out, znode->name, znode->len);
-		out_dbl(out, znode->score);
-		znode = znode_offset(znode, +1);
+	for (; it.valid && (int64_t) n < limit; zset_next(&it)) {
+		out_str_size(out, it.name, it.len);
+		out_dbl(out, it.score);
 		n += 2;
 	}
 	out_end_arr(out,idx, n);
 }
 
-// set or remove the TTL
-static void entry_set_ttl(Cache *cache, Entry *ent, int64_t ttl_ms) {
-	if (ttl_ms < 0 && ent->heap_idx != (size_t) -1) {
-		(void) heap_remove_idx(&cache->heap, ent->heap_idx);
-		ent->heap_idx = -1;
-	} else if (ttl_ms >= 0) {
-		size_t pos = ent->heap_idx;
-		if (pos == (size_t) -1) {
-			// add an new item to the heap
-			HeapItem item;
-			item.ref = &ent->heap_idx;
-			item.val = get_monotonic_usec() + (uint64_t) ttl_ms * 1000;
-			heap_add(&cache->heap, &item);
-		} else {
-			heap_get(&cache->heap, pos)->val = get_monotonic_usec() + (uint64_t) ttl_ms * 1000; 
-			heap_update(&cache->heap, pos);
-		}
+// the zset at key for a command that replies with an array. A missing key
+// is an empty one, which is already in out when this returns false.
+static bool expect_zset_arr(Cache *cache, String *out, StrView *key, Entry **ent) {
+	size_t start = str_size(out);
+	if (expect_zset(cache, out, key, ent)) {
+		return true;
+	}
+	if (out->data[start] == SER_NIL) {
+		str_truncate(out, start);
+		out_arr(out, (uint32_t) 0);
 	}
+	return false;
 }
 
-static void do_keys(Cache *cache, char **cmd, String *out) {
-	(void) cmd;
-	out_arr(out, (uint32_t) hm_size(&cache->db));
-	h_scan(&cache->db.ht1, &cb_scan, out);
-	h_scan(&cache->db.ht2, &cb_scan, out);
+// zrank zset name, zrevrank zset name
+static void zrank(Cache *cache, StrView *cmd, String *out, bool rev) {
+	Entry *ent = NULL;
+	if (!expect_zset(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	int64_t rank = zset_rank(ent->zset, cmd[2].data, cmd[2].len);
+	if (rank < 0) {
+		out_nil(out);
+		return;
+	}
+	out_int(out, rev ? zset_size(ent->zset) - 1 - rank : rank);
+}
+
+static void do_zrank(Cache *cache, StrView *cmd, size_t size, String *out) {
+	zrank(cache, cmd, out, false);
 }
 
-static void do_del(Cache *cache, char **cmd, String *out) {
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
+static void do_zrevrank(Cache *cache, StrView *cmd, size_t size, String *out) {
+	zrank(cache, cmd, out, true);
+}
 
-	HNode *node = hm_pop(&cache->db, &key.node, &entry_eq);
-	if (node) {
-		Entry *entry = container_of(node, Entry, node);
-		if (entry->heap_idx != (size_t) -1) {
-			heap_remove_idx(&cache->heap, entry->heap_idx);
-		}
-		entry_destroy(entry);
+// a score range bound: a number, -inf or +inf, with a ( in front for an
+// exclusive one
+static int str2bound(const StrView *view, double *score, bool *exclusive) {
+	StrView num = *view;
+	*exclusive = num.len > 0 && num.data[0] == '(';
+	if (*exclusive) {
+		num.data++;
+		num.len--;
 	}
-	out_int(out, node ? 1 : 0);
+	return str2dbl(&num, score);
 }
 
-static void do_set(Cache *cache, char **cmd, String *out) {
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
+// the rank of the first node with a score past the bound, the size if there
+// is none
+static int64_t bound_rank(ZSet *zset, double score, bool exclusive) {
+	ZIter it;
+	zset_seek_score(zset, score, exclusive, &it);
+	return zset_iter_rank(&it);
+}
 
-	HNode *node = hm_lookup(&cache->db, &key.node, &entry_eq);
-	if (node) {
-		Entry *ent = container_of(node, Entry, node);
-		ent->val = calloc(strlen(cmd[2]) + 1, sizeof(char));
-		strcpy(ent->val, cmd[2]);
-	} else {
-		Entry *ent = malloc(sizeof(Entry));
-		ent->key = calloc(strlen(cmd[1]) + 1, sizeof(char));
-		strcpy(ent->key, cmd[1]);
-		ent->node.hcode = key.node.hcode;
-		ent->val = calloc(strlen(cmd[2]) + 1, sizeof(char));
-		strcpy(ent->val, cmd[2]);
-		ent->heap_idx = -1;
-		ent->type = T_STR;
-		hm_insert(&cache->db, &ent->node);
-	}
-	out_nil(out);
+static bool score_in(double score, double max, bool max_excl) {
+	return max_excl ? score < max : score <= max;
 }
 
-static void entry_del_async(void *arg) {
-    entry_destroy((Entry *)arg);
+// zcount zset min max: the number of members with a score in the range,
+// from two rank lookups
+static void do_zcount(Cache *cache, StrView *cmd, size_t size, String *out) {
+	double min = 0;
+	double max = 0;
+	bool min_excl = false;
+	bool max_excl = false;
+	if (!str2bound(&cmd[2], &min, &min_excl) || !str2bound(&cmd[3], &max, &max_excl)) {
+		out_err(out, ERR_ARG, "expect fp number");
+		return;
+	}
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		out_int(out, 0);
+		return;
+	}
+	if (ent->type != T_ZSET) {
+		out_err(out, ERR_TYPE, "expect zset");
+		return;
+	}
+	int64_t lo = bound_rank(ent->zset, min, min_excl);
+	// the first one past max
+	int64_t hi = bound_rank(ent->zset, max, !max_excl);
+	out_int(out, hi > lo ? hi - lo : 0);
 }
 
-static void entry_del(Cache *cache, Entry *ent) {
-	entry_set_ttl(cache, ent, -1);
+// the members from it on, n of them at most, and only up to max if bounded
+static void out_znodes(String *out, ZIter *it, int64_t n, bool scores,
+		bool bounded, double max, bool max_excl) {
+	size_t idx = out_bgn_arr(out);
+	uint32_t len = 0;
+	for (; it->valid && n > 0; zset_next(it), n--) {
+		if (bounded && !score_in(it->score, max, max_excl)) {
+			break;
+		}
+		out_str_size(out, it->name, it->len);
+		len++;
+		if (scores) {
+			out_dbl(out, it->score);
+			len++;
+		}
+	}
+	out_end_arr(out, idx, len);
+}
 
-	const size_t k_large_container_size = 10000;
-	bool too_big = false;
-	switch (ent->type) {
-	case T_ZSET:
-		too_big = hm_size(&ent->zset->hmap) > k_large_container_size;
-		break;
+// zrange zset start stop [withscores]: by rank, inclusive, negative ones
+// count from the end
+static void do_zrange(Cache *cache, StrView *cmd, size_t size, String *out) {
+	bool scores = size == 5 && cmd_is(&cmd[4], "withscores");
+	if (size > 5 || (size == 5 && !scores)) {
+		out_err(out, ERR_ARG, "syntax error");
+		return;
+	}
+	int64_t start = 0;
+	int64_t stop = 0;
+	if (!str2int(&cmd[2], &start) || !str2int(&cmd[3], &stop)) {
+		out_err(out, ERR_ARG, "expect int");
+		return;
+	}
+	Entry *ent = NULL;
+	if (!expect_zset_arr(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	int64_t n = zset_size(ent->zset);
+	if (start < 0) {
+		start = start + n < 0 ? 0 : start + n;
+	}
+	if (stop < 0) {
+		stop += n;
+	}
+	if (stop >= n) {
+		stop = n - 1;
 	}
+	if (start > stop) {
+		out_arr(out, (uint32_t) 0);
+		return;
+	}
+	ZIter it;
+	zset_seek_rank(ent->zset, start, &it);
+	out_znodes(out, &it, stop - start + 1, scores, false, 0, false);
+}
 
-	if (too_big) {
-		thread_pool_queue(&cache->tp, &entry_del_async, ent);
-	} else {
-		entry_destroy(ent);
+// zrangebyscore zset min max [withscores] [limit offset count]
+static void do_zrangebyscore(Cache *cache, StrView *cmd, size_t size, String *out) {
+	double min = 0;
+	double max = 0;
+	bool min_excl = false;
+	bool max_excl = false;
+	if (!str2bound(&cmd[2], &min, &min_excl) || !str2bound(&cmd[3], &max, &max_excl)) {
+		out_err(out, ERR_ARG, "expect fp number");
+		return;
 	}
+	bool scores = false;
+	int64_t offset = 0;
+	int64_t count = -1;
+	for (size_t i = 4; i < size; i++) {
+		if (cmd_is(&cmd[i], "withscores")) {
+			scores = true;
+		} else if (cmd_is(&cmd[i], "limit") && i + 2 < size && str2int(&cmd[i + 1], &offset)
+				&& str2int(&cmd[i + 2], &count)) {
+			i += 2;
+		} else {
+			out_err(out, ERR_ARG, "syntax error");
+			return;
+		}
+	}
+	Entry *ent = NULL;
+	if (!expect_zset_arr(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	if (offset < 0 || count == 0) {
+		out_arr(out, (uint32_t) 0);
+		return;
+	}
+	// skip to the offset by rank rather than one by one
+	ZIter it;
+	zset_seek_score(ent->zset, min, min_excl, &it);
+	if (offset > 0) {
+		zset_offset(&it, offset);
+	}
+	out_znodes(out, &it, count < 0 ? INT64_MAX : count, scores, true, max, max_excl);
+}
+
+static uint64_t now_ms(void) {
+	return get_monotonic_usec() / 1000;
 }
 
-static void do_get(Cache *cache, char **cmd, String *out) {
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
+// TTLs are saved as unix time, the wheel's clock doesn't survive a restart
+static int64_t wall_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	HNode *node = hm_lookup(&cache->db, &key.node, &entry_eq);
-	if (!node) {
-		out_nil(out);
+// set or remove the TTL
+static void entry_set_ttl(Cache *cache, Entry *ent, int64_t ttl_ms) {
+	if (ttl_ms < 0) {
+		if (ent->ttl) {
+			wheel_cancel(cache->timers, &ent->ttl->timer);
+			slab_free(ent->ttl, sizeof(TtlTimer));
+			ent->ttl = NULL;
+			cache->used_mem -= slab_size_class(sizeof(TtlTimer));
+		}
 		return;
 	}
+	if (!ent->ttl) {
+		ent->ttl = slab_alloc(sizeof(TtlTimer));
+		timer_init(&ent->ttl->timer, TIMER_TTL);
+		ent->ttl->ent = ent;
+		cache->used_mem += slab_size_class(sizeof(TtlTimer));
+	}
+	wheel_add(cache->timers, &ent->ttl->timer, now_ms() + (uint64_t) ttl_ms);
+}
 
-	char *val = container_of(node, Entry, node)->val;
-	int val_size = sizeof val - 1;
-	assert(val_size <= K_MAX_MSG);
-	out_str(out, val);
+static void do_keys(Cache *cache, StrView *cmd, size_t size, String *out) {
+	(void) cmd;
+	out_arr(out, (uint32_t) hm_size(&cache->db));
+	hm_scan(&cache->db, &cb_scan, out);
 }
 
-static void do_expire(Cache *cache, char **cmd, String *out) {
-	int64_t ttl_ms = 0;
-	if (!str2int(cmd[2], &ttl_ms)) {
-		out_err(out, ERR_ARG, "expect int64");
+typedef struct {
+	String *out;
+	const StrView *pattern;
+	// keys visited and keys put into the reply
+	size_t visited;
+	uint32_t n;
+} ScanCtx;
+
+static void cb_scan_match(HNode *node, void *arg) {
+	ScanCtx *ctx = (ScanCtx*) arg;
+	Entry *ent = container_of(node, Entry, node);
+	ctx->visited++;
+	if (ctx->pattern && !glob_match(ctx->pattern->data, ctx->pattern->len, ent->key, ent->key_len)) {
+		return;
+	}
+	out_str_size(ctx->out, ent->key, ent->key_len);
+	ctx->n++;
+}
+
+// scan cursor [match pattern] [count n]
+// The low bits of the cursor are the shard, the rest the HMap cursor in it.
+// A shard that is done hands over to the next one.
+static void do_scan(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t cursor = 0;
+	if (!str2int(&cmd[1], &cursor) || cursor < 0
+			|| (cursor & SCAN_SHARD_MASK) != cache->shard) {
+		out_err(out, ERR_ARG, "invalid cursor");
 		return;
 	}
+	int64_t count = 10;
+	ScanCtx ctx = { out, NULL, 0, 0 };
+	// the options come in pairs, checked by the caller
+	for (size_t i = 2; i + 1 < size; i += 2) {
+		if (cmd_is(&cmd[i], "match")) {
+			ctx.pattern = &cmd[i + 1];
+		} else if (cmd_is(&cmd[i], "count")) {
+			if (!str2int(&cmd[i + 1], &count) || count <= 0) {
+				out_err(out, ERR_ARG, "expect positive int");
+				return;
+			}
+		} else {
+			out_err(out, ERR_ARG, "syntax error");
+			return;
+		}
+	}
+
+	out_arr(out, 2);
+	// the next cursor goes first, it is filled in once known
+	size_t cursor_pos = str_size(out);
+	out_int(out, 0);
+	size_t arr = out_bgn_arr(out);
+	size_t pos = (size_t) cursor >> SCAN_SHARD_BITS;
+	// a bound on the buckets looked at, they can be mostly empty
+	size_t steps = (size_t) count * 10;
+	do {
+		pos = hm_scan_cursor(&cache->db, pos, &cb_scan_match, &ctx);
+	} while (pos != 0 && ctx.visited < (size_t) count && --steps > 0);
+	out_end_arr(out, arr, ctx.n);
+
+	uint64_t next = 0;
+	if (pos != 0) {
+		next = ((uint64_t) pos << SCAN_SHARD_BITS) | cache->shard;
+	} else if (cache->shard + 1 < cache->nshards) {
+		next = cache->shard + 1;
+	}
+	memcpy(&out->data[cursor_pos + 1], &next, 8);
+}
 
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
+// Freeing a value takes about one free per allocation in it, and a big
+// allocation a little more per page. DEL leaves the ones that cost more
+// than k_large_container_size to the thread pool, UNLINK and FLUSHALL
+// ASYNC the ones past k_lazyfree_cost.
+const size_t k_large_container_size = 10000;
+const size_t k_lazyfree_cost = 64;
 
-	HNode *node = hm_lookup(&cache->db, &key.node, &entry_eq);
+// see entry_release for max_cost
+static bool del_key(Cache *cache, LookupKey *key, size_t max_cost) {
+	HNode *node = hm_pop(&cache->db, &key->node, &entry_eq);
 	if (node) {
-		Entry *ent = container_of(node, Entry, node);
-		entry_set_ttl(cache, ent, ttl_ms);
+		entry_release(cache, container_of(node, Entry, node), max_cost);
+	}
+	return node != NULL;
+}
+
+static void set_key(Cache *cache, LookupKey *key, const StrView *val) {
+	Entry *ent = db_lookup(cache, key);
+	if (ent && ent->type != T_STR) {
+		// a value of another type is replaced as a whole
+		del_key(cache, key, k_large_container_size);
+		ent = NULL;
+	}
+	if (ent) {
+		size_t before = entry_mem(ent);
+		entry_set_val(ent, val);
+		mem_changed(cache, ent, before);
+	} else {
+		db_insert(cache, entry_new_str(key, val));
 	}
-	out_int(out, node ? 1 : 0);
 }
 
-static void do_ttl(Cache *cache, char **cmd, String *out) {
-	Entry key;
-	key.key = cmd[1];
-	key.node.hcode = str_hash((uint8_t*) key.key, strlen(key.key));
+static void do_set(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	set_key(cache, &key, &cmd[2]);
+	out_nil(out);
+}
 
-	HNode *node = hm_lookup(&cache->db, &key.node, &entry_eq);
-	if (!node) {
-		out_int(out, -2);
+// incr key, incrby key n, decr key, decrby key n: the value after. A missing
+// key counts from 0, the TTL stays as it was.
+static void incr(Cache *cache, StrView *cmd, int64_t by, String *out) {
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	Entry *ent = db_lookup(cache, &key);
+	int64_t num = 0;
+	if (ent && ent->type != T_STR) {
+		out_err(out, ERR_TYPE, "expect string");
 		return;
 	}
-
-	Entry *ent = container_of(node, Entry, node);
-	if (ent->heap_idx == (size_t) -1) {
-		out_int(out, -1);
+	if (ent && ent->enc == E_INT) {
+		num = ent->ival;
+	} else if (ent) {
+		StrView val = { ent->val, ent->val_len };
+		if (!str2canon_int(&val, &num)) {
+			out_err(out, ERR_ARG, "value is not an integer");
+			return;
+		}
+	}
+	if (__builtin_add_overflow(num, by, &num)) {
+		out_err(out, ERR_ARG, "increment or decrement would overflow");
 		return;
 	}
+	if (!ent) {
+		ent = entry_new(&key, T_STR, 0);
+		db_insert(cache, ent);
+	}
+	size_t before = entry_mem(ent);
+	entry_set_int(ent, num);
+	mem_changed(cache, ent, before);
+	out_int(out, num);
+}
 
-	uint64_t expire_at = heap_get(&cache->heap, ent->heap_idx)->val;
-	uint64_t now_us = get_monotonic_usec();
-	out_int(out, expire_at > now_us ? (expire_at - now_us) / 1000 : 0);
-}
-
-void cache_execute(Cache *cache, char **cmd, size_t size, String *out) {
-	if (size == 1 && cmd_is(cmd[0], "keys")) {
-		do_keys(cache, cmd, out);
-	} else if (size == 2 && cmd_is(cmd[0], "get")) {
-		do_get(cache, cmd, out);
-	} else if (size == 3 && cmd_is(cmd[0], "set")) {
-		do_set(cache, cmd, out);
-	} else if (size == 2 && cmd_is(cmd[0], "del")) {
-		do_del(cache, cmd, out);
-	} else if (size == 3 && cmd_is(cmd[0], "pexpire")) {
-		do_expire(cache, cmd, out);
-	} else if (size == 2 && cmd_is(cmd[0], "pttl")) {
-		do_ttl(cache, cmd, out);
-	} else if (size == 4 && cmd_is(cmd[0], "zadd")) {
-		do_zadd(cache, cmd, out);
-	} else if (size == 3 && cmd_is(cmd[0], "zrem")) {
-		do_zrem(cache, cmd, out);
-	} else if (size == 3 && cmd_is(cmd[0], "zscore")) {
-		do_zscore(cache, cmd, out);
-	} else if (size == 6 && cmd_is(cmd[0], "zquery")) {
-		do_zquery(cache, cmd, out);
-	} else {
-		out_err(out, ERR_UNKNOWN, "Unknown cmd");
+static bool incr_arg(StrView *arg, bool negate, int64_t *by, String *out) {
+	if (!str2int(arg, by) || (negate && *by == INT64_MIN)) {
+		out_err(out, ERR_ARG, "expect int64");
+		return false;
+	}
+	if (negate) {
+		*by = -*by;
 	}
+	return true;
 }
 
-int hnode_same(HNode *lhs, HNode *rhs) {
-	return lhs == rhs;
+static void do_incr(Cache *cache, StrView *cmd, size_t size, String *out) {
+	incr(cache, cmd, 1, out);
 }
 
-Cache* cache_init(void) {
-	Cache* cache = (Cache*) malloc(sizeof(Cache));
-	memset(cache, 0, sizeof(Cache));
-	hm_init(&cache->db);
-	thread_pool_init(&cache->tp, 4);
-	heap_init(&cache->heap);
-	return cache;
+static void do_decr(Cache *cache, StrView *cmd, size_t size, String *out) {
+	incr(cache, cmd, -1, out);
 }
 
-void cache_evict(Cache *cache, uint64_t now_us) {
-	// TTL timers
-	const size_t k_max_works = 2000;
-	size_t nworks = 0;
-	while (!heap_empty(&cache->heap) && heap_top(&cache->heap)->val < now_us) {
-		Entry *ent = container_of(heap_top(&cache->heap)->ref, Entry, heap_idx);
-		HNode *node = hm_pop(&cache->db, &ent->node, &hnode_same);
-		assert(node == &ent->node);
-		entry_del(cache, ent);
-		if (nworks++ >= k_max_works) {
-			// don't stall the server if too many keys are expiring at once
-			break;
+static void do_incrby(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t by = 0;
+	if (incr_arg(&cmd[2], false, &by, out)) {
+		incr(cache, cmd, by, out);
+	}
+}
+
+static void do_decrby(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t by = 0;
+	if (incr_arg(&cmd[2], true, &by, out)) {
+		incr(cache, cmd, by, out);
+	}
+}
+
+// whether the key is in this shard. Requests with keys of several shards
+// visit all of them, and each one does its own keys.
+static bool cache_owns(Cache *cache, const LookupKey *key) {
+	return cache->nshards == 1
+			|| cache_shard_of(key->node.hcode, cache->nshards) == cache->shard;
+}
+
+// the multi key commands hash all of their keys and prefetch the buckets
+// first, so that the lookups after wait on memory together rather than one
+// after the other. Every step-th of the n args is a key.
+static void batch_keys(Cache *cache, const StrView *args, size_t n, size_t step,
+		LookupKey *keys) {
+	for (size_t i = 0; i < n; i += step) {
+		LookupKey *key = &keys[i / step];
+		lookup_key_init(cache, key, &args[i]);
+		if (cache_owns(cache, key)) {
+			hm_prefetch(&cache->db, key->node.hcode);
+		}
+	}
+}
+
+void cache_prefetch(Cache *cache, const StrView *keys, uint64_t *hcodes, size_t n) {
+	uint64_t owned[CACHE_PREFETCH_MAX];
+	size_t m = 0;
+	for (size_t i = 0; i < n; i++) {
+		hcodes[i] = str_hash((const uint8_t*) keys[i].data, keys[i].len);
+		if (m < CACHE_PREFETCH_MAX && (cache->nshards == 1
+				|| cache_shard_of(hcodes[i], cache->nshards) == cache->shard)) {
+			hm_prefetch(&cache->db, hcodes[i]);
+			owned[m++] = hcodes[i];
+		}
+	}
+	// a lone key has nothing to overlap with
+	if (m < 2) {
+		return;
+	}
+	// the buckets are on their way, by the time they are all asked for the
+	// first ones are in, and so on
+	for (size_t i = 0; i < m; i++) {
+		HNode *node = hm_peek(&cache->db, owned[i]);
+		if (node) {
+			Entry *ent = container_of(node, Entry, node);
+			__builtin_prefetch(ent);
+			__builtin_prefetch(ent->key);
 		}
 	}
 }
 
-uint64_t cache_next_expiry(Cache* cache) {
-	// ttl timers
-	if (heap_empty(&cache->heap)) {
-		return -1;
+void cache_hint(Cache *cache, const StrView *key, uint64_t hcode) {
+	cache->hint.data = key ? key->data : NULL;
+	cache->hint.len = key ? key->len : 0;
+	cache->hint_hcode = hcode;
+}
+
+// the hash at key, or NULL when there is none. False, with the error in
+// out, when it's another type.
+static bool expect_hash(Cache *cache, String *out, StrView *s, Entry **ent) {
+	LookupKey key;
+	lookup_key_init(cache, &key, s);
+	*ent = db_lookup(cache, &key);
+	if (*ent && (*ent)->type != T_HASH) {
+		out_err(out, ERR_TYPE, "expect hash");
+		return false;
+	}
+	return true;
+}
+
+// hset key field value...: the number of fields that are new
+static void do_hset(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		ent = entry_new(&key, T_HASH, 0);
+		ent->hash = slab_alloc(sizeof(Hash));
+		memset(ent->hash, 0, sizeof(Hash));
+		hash_reserve(ent->hash, (size - 2) / 2);
+		db_insert(cache, ent);
+	} else if (ent->type != T_HASH) {
+		out_err(out, ERR_TYPE, "expect hash");
+		return;
+	}
+	size_t before = entry_mem(ent);
+	int64_t added = 0;
+	for (size_t i = 2; i + 1 < size; i += 2) {
+		added += hash_set(ent->hash, cmd[i].data, cmd[i].len, cmd[i + 1].data, cmd[i + 1].len);
 	}
-	return heap_top(&cache->heap)->val; 
+	mem_changed(cache, ent, before);
+	out_int(out, added);
+}
+
+// hget key field
+static void do_hget(Cache *cache, StrView *cmd, size_t size, String *out) {
+	Entry *ent = NULL;
+	if (!expect_hash(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	const char *val = NULL;
+	size_t len = 0;
+	if (ent && hash_get(ent->hash, cmd[2].data, cmd[2].len, &val, &len)) {
+		out_str_size(out, val, len);
+	} else {
+		out_nil(out);
+	}
+}
+
+// hdel key field...: the number of fields removed. The key goes with the
+// last one.
+static void do_hdel(Cache *cache, StrView *cmd, size_t size, String *out) {
+	Entry *ent = NULL;
+	if (!expect_hash(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	if (!ent) {
+		out_int(out, 0);
+		return;
+	}
+	size_t before = entry_mem(ent);
+	int64_t removed = 0;
+	for (size_t i = 2; i < size; i++) {
+		removed += hash_del(ent->hash, cmd[i].data, cmd[i].len);
+	}
+	if (hash_size(ent->hash) == 0) {
+		LookupKey key;
+		lookup_key_init(cache, &key, &cmd[1]);
+		del_key(cache, &key, k_large_container_size);
+	} else {
+		mem_changed(cache, ent, before);
+	}
+	out_int(out, removed);
+}
+
+static void cb_hgetall(const char *field, size_t flen, const char *val, size_t vlen, void *arg) {
+	out_str_size((String*) arg, field, flen);
+	out_str_size((String*) arg, val, vlen);
+}
+
+// hgetall key: every field followed by its value, in no particular order
+static void do_hgetall(Cache *cache, StrView *cmd, size_t size, String *out) {
+	Entry *ent = NULL;
+	if (!expect_hash(cache, out, &cmd[1], &ent)) {
+		return;
+	}
+	out_arr(out, ent ? (uint32_t) (2 * hash_size(ent->hash)) : 0);
+	if (ent) {
+		hash_scan(ent->hash, &cb_hgetall, out);
+	}
+}
+
+// mget key...: an array with the value of every key, nil for the missing
+// ones and the ones that aren't strings
+static void do_mget(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey keys[K_MAX_ARGS];
+	size_t n = size - 1;
+	batch_keys(cache, &cmd[1], n, 1, keys);
+	out_arr(out, (uint32_t) n);
+	for (size_t i = 0; i < n; i++) {
+		Entry *ent = cache_owns(cache, &keys[i]) ? db_lookup(cache, &keys[i]) : NULL;
+		if (ent && ent->type == T_STR) {
+			char buf[K_INT_LEN + 1];
+			StrView val = entry_str(ent, buf);
+			out_str_size(out, val.data, val.len);
+		} else {
+			out_nil(out);
+		}
+	}
+}
+
+// mset key value...
+static void do_mset(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey keys[K_MAX_ARGS];
+	size_t n = (size - 1) / 2;
+	batch_keys(cache, &cmd[1], size - 1, 2, keys);
+	for (size_t i = 0; i < n; i++) {
+		if (cache_owns(cache, &keys[i])) {
+			set_key(cache, &keys[i], &cmd[2 + 2 * i]);
+		}
+	}
+	out_nil(out);
+}
+
+static size_t entry_free_cost(Entry *ent) {
+	switch (ent->type) {
+	case T_ZSET:
+		return ent->zset->encoding == ZSET_PACKED ? 2 : 1 + (size_t) zset_size(ent->zset);
+	case T_HASH:
+		return ent->hash->encoding == HASH_PACKED ? 2 : 1 + hash_size(ent->hash);
+	}
+	return ent->enc == E_RAW && ent->val != entry_inline_val(ent) ? 1 + ent->val_len / 4096 : 1;
+}
+
+static void del_keys(Cache *cache, StrView *cmd, size_t size, String *out, size_t max_cost) {
+	LookupKey keys[K_MAX_ARGS];
+	size_t n = size - 1;
+	batch_keys(cache, &cmd[1], n, 1, keys);
+	int64_t deleted = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (cache_owns(cache, &keys[i]) && del_key(cache, &keys[i], max_cost)) {
+			deleted++;
+		}
+	}
+	out_int(out, deleted);
+}
+
+// del key...: the number of keys deleted
+static void do_del(Cache *cache, StrView *cmd, size_t size, String *out) {
+	del_keys(cache, cmd, size, out, k_large_container_size);
+}
+
+// unlink key...: del, but the values that take a while to free go to the
+// thread pool
+static void do_unlink(Cache *cache, StrView *cmd, size_t size, String *out) {
+	del_keys(cache, cmd, size, out, k_lazyfree_cost);
+}
+
+static void db_free_node(HNode *node, void *arg) {
+	Entry *ent = container_of(node, Entry, node);
+	if (ent->ttl) {
+		slab_free(ent->ttl, sizeof(TtlTimer));
+	}
+	entry_destroy(ent);
+}
+
+static void db_free(void *arg) {
+	HMap *db = (HMap*) arg;
+	hm_scan(db, &db_free_node, NULL);
+	hm_destroy(db);
+	free(db);
+}
+
+// The db is swapped for an empty one right away, with async the old one is
+// freed by the thread pool.
+static void db_clear(Cache *cache, bool async) {
+	// the TTL timers are in the loop's wheel, they can only go here
+	wheel_cancel_kind(cache->timers, TIMER_TTL);
+	HMap *old = malloc(sizeof(HMap));
+	if (!old) {
+		die("Out of memory");
+	}
+	*old = cache->db;
+	memset(&cache->db, 0, sizeof(HMap));
+	hm_init(&cache->db);
+	cache->used_mem = 0;
+	if (async) {
+		thread_pool_queue(cache->tp, &db_free, old);
+	} else {
+		db_free(old);
+	}
+}
+
+// flushall [async|sync]: deletes every key
+static void do_flushall(Cache *cache, StrView *cmd, size_t size, String *out) {
+	bool async = size == 2 && cmd_is(&cmd[1], "async");
+	if (size > 2 || (size == 2 && !async && !cmd_is(&cmd[1], "sync"))) {
+		out_err(out, ERR_ARG, "expect async or sync");
+		return;
+	}
+	db_clear(cache, async);
+	out_nil(out);
+}
+
+static void entry_del_async(void *arg) {
+    entry_destroy((Entry *)arg);
+}
+
+// for an entry already taken out of the db. One that costs more than
+// max_cost to free (see entry_free_cost) is freed by the thread pool.
+static void entry_release(Cache *cache, Entry *ent, size_t max_cost) {
+	entry_set_ttl(cache, ent, -1);
+	cache->used_mem -= entry_mem(ent);
+	if (entry_free_cost(ent) > max_cost) {
+		thread_pool_queue(cache->tp, &entry_del_async, ent);
+	} else {
+		entry_destroy(ent);
+	}
+}
+
+static void entry_del(Cache *cache, Entry *ent) {
+	entry_release(cache, ent, k_large_container_size);
+}
+
+static void do_get(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		out_nil(out);
+		return;
+	}
+	if (ent->type != T_STR) {
+		out_err(out, ERR_TYPE, "expect string");
+		return;
+	}
+	assert(ent->val_len <= K_MAX_MSG);
+	char buf[K_INT_LEN + 1];
+	StrView val = entry_str(ent, buf);
+	out_str_size(out, val.data, val.len);
+}
+
+static void do_expire(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t ttl_ms = 0;
+	if (!str2int(&cmd[2], &ttl_ms)) {
+		out_err(out, ERR_ARG, "expect int64");
+		return;
+	}
+
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+
+	Entry *ent = db_lookup(cache, &key);
+	if (ent) {
+		entry_set_ttl(cache, ent, ttl_ms);
+	}
+	out_int(out, ent ? 1 : 0);
+}
+
+// pexpireat key unix_ms: what the append only file has for pexpire, so
+// that a replay doesn't restart the TTL. A time in the past deletes the key.
+static void do_expireat(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t at_ms = 0;
+	if (!str2int(&cmd[2], &at_ms)) {
+		out_err(out, ERR_ARG, "expect int64");
+		return;
+	}
+
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+
+	Entry *ent = db_lookup(cache, &key);
+	if (ent) {
+		int64_t ttl_ms = at_ms - wall_ms();
+		if (ttl_ms > 0) {
+			entry_set_ttl(cache, ent, ttl_ms);
+		} else {
+			hm_pop(&cache->db, &key.node, &entry_eq);
+			entry_del(cache, ent);
+		}
+	}
+	out_int(out, ent ? 1 : 0);
+}
+
+static void do_ttl(Cache *cache, StrView *cmd, size_t size, String *out) {
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		out_int(out, -2);
+		return;
+	}
+
+	if (!ent->ttl) {
+		out_int(out, -1);
+		return;
+	}
+
+	uint64_t expire_at = ent->ttl->timer.expire_ms;
+	uint64_t now = now_ms();
+	out_int(out, expire_at > now ? (int64_t) (expire_at - now) : 0);
+}
+
+static void out_stat(String *out, const char *name, size_t val) {
+	out_str(out, name);
+	out_int(out, (int64_t) val);
+}
+
+// memory stats: what the cache asked for vs. what the slabs handed out and
+// what they took from the system
+static void do_memory(Cache *cache, StrView *cmd, size_t size, String *out) {
+	if (!cmd_is(&cmd[1], "stats")) {
+		out_err(out, ERR_UNKNOWN, "Unknown cmd");
+		return;
+	}
+	// every shard answers, the numbers are added up. The slab ones are for
+	// the whole process already.
+	SlabStats stats;
+	memset(&stats, 0, sizeof(stats));
+	if (cache->shard == 0) {
+		slab_stats(&stats);
+	}
+	out_arr(out, 22);
+	out_stat(out, "used_memory", cache_used_mem(cache));
+	out_stat(out, "maxmemory", cache->max_mem);
+	out_stat(out, "evicted_keys", cache->evicted);
+	out_stat(out, "expired_keys", cache->expired);
+	out_stat(out, "requested_bytes", stats.requested_bytes);
+	out_stat(out, "used_bytes", stats.used_bytes);
+	out_stat(out, "reserved_bytes", stats.reserved_bytes);
+	out_stat(out, "objects", stats.objects);
+	out_stat(out, "pages", stats.pages);
+	out_stat(out, "large_objects", stats.large_objects);
+	out_stat(out, "large_bytes", stats.large_bytes);
+}
+
+// bgsave: a snapshot of every shard, written in the background
+static void do_bgsave(Cache *cache, StrView *cmd, size_t size, String *out) {
+	if (cache->snap) {
+		out_err(out, ERR_UNKNOWN, "a snapshot is already being written");
+	} else if (!cache_bgsave(cache)) {
+		out_err(out, ERR_UNKNOWN, "can't create the snapshot file");
+	} else {
+		out_nil(out);
+	}
+}
+
+// replicaof host port: follows the primary whose replication port that is, and
+// turns away writes from clients. replicaof no one: stops following.
+static void do_replicaof(Cache *cache, StrView *cmd, size_t size, String *out) {
+	if (cmd_is(&cmd[1], "no") && cmd_is(&cmd[2], "one")) {
+		repl_unfollow();
+		out_nil(out);
+		return;
+	}
+	char host[K_MAX_NUM_LEN + 1];
+	int64_t port = 0;
+	if (!view2cstr(&cmd[1], host) || !str2int(&cmd[2], &port) || port < 1 || port > 65535
+			|| !repl_follow(host, (int) port)) {
+		out_err(out, ERR_ARG, "expect an IPv4 address and a port");
+		return;
+	}
+	out_nil(out);
+}
+
+// ip port: the address of a node
+static bool node_arg(const StrView *ip, const StrView *port, struct sockaddr_in *addr) {
+	char buf[K_MAX_NUM_LEN + 1];
+	int64_t n = 0;
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	if (!view2cstr(ip, buf) || inet_pton(AF_INET, buf, &addr->sin_addr) != 1
+			|| !str2int(port, &n) || n < 1 || n > 65535) {
+		return false;
+	}
+	addr->sin_port = htons((uint16_t) n);
+	return true;
+}
+
+static bool slot_arg(const StrView *view, uint32_t *slot) {
+	int64_t n = 0;
+	if (!str2int(view, &n) || n < 0 || n >= K_SLOTS) {
+		return false;
+	}
+	*slot = (uint32_t) n;
+	return true;
+}
+
+// [first, last, ip, port] for every run of slots a node serves
+static void out_cluster_slots(String *out) {
+	size_t pos = out_bgn_arr(out);
+	uint32_t n = 0;
+	for (uint32_t first = 0; first < K_SLOTS;) {
+		uint32_t last = 0;
+		uint32_t node = cluster_slot_run(first, &last);
+		if (node != CLUSTER_NO_NODE) {
+			struct sockaddr_in addr = cluster_node_addr(node);
+			char ip[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+			out_arr(out, 4);
+			out_int(out, first);
+			out_int(out, last);
+			out_str(out, ip);
+			out_int(out, ntohs(addr.sin_port));
+			n++;
+		}
+		first = last + 1;
+	}
+	out_end_arr(out, pos, n);
+}
+
+// cluster keyslot key | slots | setslots first last ip port
+//     | migrating slot ip port | importing slot
+// See cluster.h for how a slot moves.
+static void do_cluster(Cache *cache, StrView *cmd, size_t size, String *out) {
+	if (size == 3 && cmd_is(&cmd[1], "keyslot")) {
+		out_int(out, key_slot((const uint8_t*) cmd[2].data, cmd[2].len));
+		return;
+	}
+	if (!cluster_enabled()) {
+		out_err(out, ERR_ARG, "cluster mode is off");
+		return;
+	}
+	struct sockaddr_in addr;
+	uint32_t first = 0;
+	uint32_t last = 0;
+	if (size == 2 && cmd_is(&cmd[1], "slots")) {
+		out_cluster_slots(out);
+	} else if (size == 6 && cmd_is(&cmd[1], "setslots") && slot_arg(&cmd[2], &first)
+			&& slot_arg(&cmd[3], &last) && first <= last && node_arg(&cmd[4], &cmd[5], &addr)) {
+		uint32_t node = cluster_node(&addr);
+		if (node == CLUSTER_NO_NODE) {
+			out_err(out, ERR_ARG, "too many nodes");
+			return;
+		}
+		cluster_set_slots(first, last, node);
+		out_nil(out);
+	} else if (size == 5 && cmd_is(&cmd[1], "migrating") && slot_arg(&cmd[2], &first)
+			&& node_arg(&cmd[3], &cmd[4], &addr)) {
+		uint32_t node = cluster_node(&addr);
+		if (node == CLUSTER_NO_NODE || !cluster_set_migrating(first, node)) {
+			out_err(out, ERR_ARG, "the slot isn't served here");
+			return;
+		}
+		out_nil(out);
+	} else if (size == 3 && cmd_is(&cmd[1], "importing") && slot_arg(&cmd[2], &first)) {
+		if (!cluster_set_importing(first)) {
+			out_err(out, ERR_ARG, "the slot is served here already");
+			return;
+		}
+		out_nil(out);
+	} else {
+		out_err(out, ERR_ARG, "expect keyslot key, slots, setslots first last ip port,"
+				" migrating slot ip port or importing slot");
+	}
+}
+
+typedef struct {
+	String *out;
+	uint32_t slot;
+	uint32_t n;
+	uint32_t max;
+} SlotKeysCtx;
+
+static void cb_slot_keys(HNode *node, void *arg) {
+	SlotKeysCtx *ctx = (SlotKeysCtx*) arg;
+	Entry *ent = container_of(node, Entry, node);
+	if (ctx->n < ctx->max && key_slot((const uint8_t*) ent->key, ent->key_len) == ctx->slot) {
+		out_str_size(ctx->out, ent->key, ent->key_len);
+		ctx->n++;
+	}
+}
+
+// getkeysinslot slot count: up to count keys of the slot from every shard,
+// for MIGRATE. There is no index by slot, every key is looked at.
+static void do_getkeysinslot(Cache *cache, StrView *cmd, size_t size, String *out) {
+	uint32_t slot = 0;
+	int64_t count = 0;
+	if (!slot_arg(&cmd[1], &slot) || !str2int(&cmd[2], &count) || count < 0) {
+		out_err(out, ERR_ARG, "expect a slot and a count");
+		return;
+	}
+	SlotKeysCtx ctx = { out, slot, 0, count > UINT32_MAX ? UINT32_MAX : (uint32_t) count };
+	size_t pos = out_bgn_arr(out);
+	hm_scan(&cache->db, &cb_slot_keys, &ctx);
+	out_end_arr(out, pos, ctx.n);
+}
+
+// the requests that rebuild a key on the other node go out in batches of
+// this many, neither side has to hold more than that of the other's
+const uint32_t k_migrate_batch = 1024;
+// the loop waits for the other node, but not for long
+const uint32_t k_migrate_timeout_ms = 1000;
+
+typedef struct {
+	MinisConn *conn;
+	const char *key;
+	uint32_t key_len;
+	// -1 when the connection failed, 1 when the node answered with an error
+	int failed;
+	char why[64];
+} MigrateCtx;
+
+// waits for the replies of everything sent so far
+static void migrate_sync(MigrateCtx *ctx) {
+	MinisReply reply;
+	while (!ctx->failed && ctx->conn->pending > 0) {
+		if (minis_read(ctx->conn, &reply)) {
+			ctx->failed = -1;
+		} else if (reply.type == SER_ERR) {
+			ctx->failed = 1;
+			snprintf(ctx->why, sizeof(ctx->why), "%.*s", (int) reply.len,
+					(const char*) reply.data);
+		}
+	}
+}
+
+static void migrate_send(MigrateCtx *ctx, uint32_t nargs, const char *const *args,
+		const uint32_t *lens) {
+	if (ctx->failed) {
+		return;
+	}
+	if (minis_append(ctx->conn, nargs, args, lens)) {
+		ctx->failed = -1;
+	} else if (ctx->conn->pending >= k_migrate_batch) {
+		migrate_sync(ctx);
+	}
+}
+
+static void cb_migrate_znode(double score, const char *name, size_t len, void *arg) {
+	MigrateCtx *ctx = (MigrateCtx*) arg;
+	char buf[32];
+	int n = snprintf(buf, sizeof(buf), "%.17g", score);
+	const char *args[] = { "zadd", ctx->key, buf, name };
+	uint32_t lens[] = { 4, ctx->key_len, (uint32_t) n, (uint32_t) len };
+	migrate_send(ctx, 4, args, lens);
+}
+
+static void cb_migrate_hfield(const char *field, size_t flen, const char *val, size_t vlen,
+		void *arg) {
+	MigrateCtx *ctx = (MigrateCtx*) arg;
+	const char *args[] = { "hset", ctx->key, field, val };
+	uint32_t lens[] = { 4, ctx->key_len, (uint32_t) flen, (uint32_t) vlen };
+	migrate_send(ctx, 4, args, lens);
+}
+
+// the connection MIGRATE keeps to the node it moved keys to last
+static MinisConn* migrate_conn(Cache *cache, const struct sockaddr_in *addr) {
+	if (cache->migrate_conn && cache->migrate_addr.sin_addr.s_addr == addr->sin_addr.s_addr
+			&& cache->migrate_addr.sin_port == addr->sin_port) {
+		return cache->migrate_conn;
+	}
+	if (cache->migrate_conn) {
+		minis_close(cache->migrate_conn);
+		free(cache->migrate_conn);
+		cache->migrate_conn = NULL;
+	}
+	MinisConn *conn = malloc(sizeof(MinisConn));
+	if (!conn) {
+		die("Out of memory");
+	}
+	if (minis_connect_timeout(conn, addr, k_migrate_timeout_ms)) {
+		free(conn);
+		return NULL;
+	}
+	cache->migrate_conn = conn;
+	cache->migrate_addr = *addr;
+	return conn;
+}
+
+static bool cache_logging(Cache *cache);
+static void cache_append(Cache *cache, const StrView *args, size_t n);
+
+// migrate key ip port: moves the key to the node at ip:port, the one its
+// slot is being migrated to, as the writes that make it there. 1 once it's
+// there and gone from here, 0 when there was no such key. The loop waits
+// for the other node in the meantime.
+static void do_migrate(Cache *cache, StrView *cmd, size_t size, String *out) {
+	struct sockaddr_in addr;
+	if (!node_arg(&cmd[2], &cmd[3], &addr)) {
+		out_err(out, ERR_ARG, "expect an IPv4 address and a port");
+		return;
+	}
+	LookupKey key;
+	lookup_key_init(cache, &key, &cmd[1]);
+	Entry *ent = db_lookup(cache, &key);
+	if (!ent) {
+		out_int(out, 0);
+		return;
+	}
+	MinisConn *conn = migrate_conn(cache, &addr);
+	if (!conn) {
+		out_err(out, ERR_TRYAGAIN, "can't connect to the node");
+		return;
+	}
+	MigrateCtx ctx = { conn, ent->key, ent->key_len, 0, "" };
+	// whatever the node had under the key goes first
+	const char *del[] = { "del", ent->key };
+	uint32_t del_lens[] = { 3, ent->key_len };
+	migrate_send(&ctx, 2, del, del_lens);
+	switch (ent->type) {
+	case T_STR: {
+		char buf[K_INT_LEN + 1];
+		StrView val = entry_str(ent, buf);
+		const char *set[] = { "set", ent->key, val.data };
+		uint32_t set_lens[] = { 3, ent->key_len, (uint32_t) val.len };
+		migrate_send(&ctx, 3, set, set_lens);
+		break;
+	}
+	case T_ZSET:
+		zset_scan(ent->zset, &cb_migrate_znode, &ctx);
+		break;
+	case T_HASH:
+		hash_scan(ent->hash, &cb_migrate_hfield, &ctx);
+		break;
+	}
+	if (ent->ttl) {
+		char at[32];
+		int n = snprintf(at, sizeof(at), "%lld",
+				(long long) ((int64_t) ent->ttl->timer.expire_ms + wall_ms() - (int64_t) now_ms()));
+		const char *expire[] = { "pexpireat", ent->key, at };
+		uint32_t expire_lens[] = { 9, ent->key_len, (uint32_t) n };
+		migrate_send(&ctx, 3, expire, expire_lens);
+	}
+	migrate_sync(&ctx);
+	if (ctx.failed) {
+		// the replies still due would be read as the next key's
+		minis_close(conn);
+		free(conn);
+		cache->migrate_conn = NULL;
+		char why[128];
+		snprintf(why, sizeof(why), ctx.failed < 0 ? "lost the connection to the node"
+				: "the node turned it down: %s", ctx.why);
+		out_err(out, ERR_TRYAGAIN, why);
+		return;
+	}
+	del_key(cache, &key, k_large_container_size);
+	if (cache_logging(cache)) {
+		StrView args[2] = { { "del", 3 }, cmd[1] };
+		cache_append(cache, args, 2);
+	}
+	out_int(out, 1);
+}
+
+static void do_cmdstats(Cache *cache, StrView *cmd, size_t size, String *out);
+static void do_info(Cache *cache, StrView *cmd, size_t size, String *out);
+static void do_slowlog(Cache *cache, StrView *cmd, size_t size, String *out);
+
+// The commands, at the perfect hash of their name: its length and the
+// first, second and last letter, lowercased. The positions are worked out
+// by the compiler, two names on the same one are an error (override-init,
+// in -Wextra), so a new name that collides needs the constants adjusted.
+#define CMD_HASH(len, a, b, z) ((((uint32_t) (len)) * 4 + (((uint32_t) (a)) | 0x20) * 15 \
+		+ (((uint32_t) (b)) | 0x20) * 19 + (((uint32_t) (z)) | 0x20) * 14) & (CMD_TABLE_SIZE - 1))
+
+static const Command k_commands[CMD_TABLE_SIZE] = {
+	[CMD_HASH(4, 'k', 'e', 's')] = { "keys", 1, 0, CMD_ALL, 0, &do_keys },
+	[CMD_HASH(4, 's', 'c', 'n')] = { "scan", 2, 2, CMD_CURSOR, 0, &do_scan },
+	[CMD_HASH(3, 'g', 'e', 't')] = { "get", 2, 0, 0, 0, &do_get },
+	[CMD_HASH(3, 's', 'e', 't')] = { "set", 3, 0, CMD_WRITE, 0, &do_set },
+	[CMD_HASH(4, 'i', 'n', 'r')] = { "incr", 2, 0, CMD_WRITE | CMD_LOG_SET, 0, &do_incr },
+	[CMD_HASH(6, 'i', 'n', 'y')] = { "incrby", 3, 0, CMD_WRITE | CMD_LOG_SET, 0, &do_incrby },
+	[CMD_HASH(4, 'd', 'e', 'r')] = { "decr", 2, 0, CMD_WRITE | CMD_LOG_SET, 0, &do_decr },
+	[CMD_HASH(6, 'd', 'e', 'y')] = { "decrby", 3, 0, CMD_WRITE | CMD_LOG_SET, 0, &do_decrby },
+	[CMD_HASH(3, 'd', 'e', 'l')] = { "del", 2, 1, CMD_WRITE | CMD_MULTI_KEY, 1, &do_del },
+	[CMD_HASH(6, 'u', 'n', 'k')] = { "unlink", 2, 1, CMD_WRITE | CMD_MULTI_KEY, 1, &do_unlink },
+	[CMD_HASH(8, 'f', 'l', 'l')] = { "flushall", 1, 1, CMD_WRITE | CMD_ALL, 0, &do_flushall },
+	[CMD_HASH(4, 'm', 'g', 't')] = { "mget", 2, 1, CMD_MULTI_KEY, 1, &do_mget },
+	[CMD_HASH(4, 'm', 's', 't')] = { "mset", 3, 2, CMD_WRITE | CMD_MULTI_KEY, 2, &do_mset },
+	[CMD_HASH(7, 'p', 'e', 'e')] = { "pexpire", 3, 0, CMD_WRITE, 0, &do_expire },
+	[CMD_HASH(9, 'p', 'e', 't')] = { "pexpireat", 3, 0, CMD_WRITE, 0, &do_expireat },
+	[CMD_HASH(4, 'p', 't', 'l')] = { "pttl", 2, 0, 0, 0, &do_ttl },
+	[CMD_HASH(4, 'z', 'a', 'd')] = { "zadd", 4, 0, CMD_WRITE, 0, &do_zadd },
+	[CMD_HASH(4, 'z', 'r', 'm')] = { "zrem", 3, 0, CMD_WRITE, 0, &do_zrem },
+	[CMD_HASH(6, 'z', 's', 'e')] = { "zscore", 3, 0, 0, 0, &do_zscore },
+	[CMD_HASH(6, 'z', 'q', 'y')] = { "zquery", 6, 0, 0, 0, &do_zquery },
+	[CMD_HASH(5, 'z', 'r', 'k')] = { "zrank", 3, 0, 0, 0, &do_zrank },
+	[CMD_HASH(8, 'z', 'r', 'k')] = { "zrevrank", 3, 0, 0, 0, &do_zrevrank },
+	[CMD_HASH(6, 'z', 'c', 't')] = { "zcount", 4, 0, 0, 0, &do_zcount },
+	[CMD_HASH(6, 'z', 'r', 'e')] = { "zrange", 4, 1, 0, 0, &do_zrange },
+	[CMD_HASH(13, 'z', 'r', 'e')] = { "zrangebyscore", 4, 1, 0, 0, &do_zrangebyscore },
+	[CMD_HASH(4, 'h', 's', 't')] = { "hset", 4, 2, CMD_WRITE, 0, &do_hset },
+	[CMD_HASH(4, 'h', 'g', 't')] = { "hget", 3, 0, 0, 0, &do_hget },
+	[CMD_HASH(4, 'h', 'd', 'l')] = { "hdel", 3, 1, CMD_WRITE, 0, &do_hdel },
+	[CMD_HASH(7, 'h', 'g', 'l')] = { "hgetall", 2, 0, 0, 0, &do_hgetall },
+	[CMD_HASH(6, 'm', 'e', 'y')] = { "memory", 2, 0, CMD_SPLIT, 0, &do_memory },
+	[CMD_HASH(6, 'b', 'g', 'e')] = { "bgsave", 1, 0, CMD_ALL, 0, &do_bgsave },
+	[CMD_HASH(8, 'c', 'm', 's')] = { "cmdstats", 1, 0, CMD_ADMIN, 0, &do_cmdstats },
+	[CMD_HASH(4, 'i', 'n', 'o')] = { "info", 1, 0, CMD_ADMIN, 0, &do_info },
+	[CMD_HASH(7, 's', 'l', 'g')] = { "slowlog", 2, 1, CMD_ADMIN, 0, &do_slowlog },
+	[CMD_HASH(9, 'r', 'e', 'f')] = { "replicaof", 3, 0, CMD_ADMIN, 0, &do_replicaof },
+	[CMD_HASH(7, 'c', 'l', 'r')] = { "cluster", 2, 1, CMD_ADMIN, 0, &do_cluster },
+	[CMD_HASH(13, 'g', 'e', 't')] = { "getkeysinslot", 3, 0, CMD_ALL, 0, &do_getkeysinslot },
+	[CMD_HASH(7, 'm', 'i', 'e')] = { "migrate", 4, 0, CMD_ADMIN, 0, &do_migrate },
+};
+
+const Command* cache_command(const char *name, size_t len) {
+	if (len < 2) {
+		return NULL;
+	}
+	const Command *c = &k_commands[CMD_HASH(len, name[0], name[1], name[len - 1])];
+	if (!c->name || strlen(c->name) != len || 0 != strncasecmp(c->name, name, len)) {
+		return NULL;
+	}
+	return c;
+}
+
+static bool cmd_arity_ok(const Command *c, size_t size) {
+	if (c->arg_step == 0) {
+		return size == c->min_args;
+	}
+	return size >= c->min_args && (size - c->min_args) % c->arg_step == 0;
+}
+
+// The shards by number, for INFO and CMDSTATS to add them all up on
+// whichever one they run. Filled in before any loop starts.
+static Cache **g_shards;
+static uint64_t g_start_ms;
+
+// the numbers only the shard's thread may look at, copied over for the
+// others to read
+static void stats_publish(Cache *cache) {
+	ShardStats *st = &cache->stats;
+	counter_set(&st->keys, hm_size(&cache->db));
+	// the nodes still in the old table of a resize
+	counter_set(&st->rehashing, cache->db.ht2.size);
+	counter_set(&st->used_mem, cache_used_mem(cache));
+	counter_set(&st->expired, cache->expired);
+	counter_set(&st->evicted, cache->evicted);
+}
+
+void cache_loop_done(Cache *cache, uint64_t busy_usec, size_t conns, bool stalled) {
+	stats_publish(cache);
+	counter_set(&cache->stats.conns, conns);
+	counter_add(&cache->stats.loops, 1);
+	counter_add(&cache->stats.stalls, stalled);
+	hist_record(&cache->stats.loop_lat, busy_usec);
+}
+
+// cmdstats: name, calls, microseconds spent and the p50, p99 and p99.9
+// latencies in ns for every command, over all shards. A command that runs
+// on all of them counts once per shard.
+static void do_cmdstats(Cache *cache, StrView *cmd, size_t size, String *out) {
+	Histogram *hists[SCAN_SHARD_MASK + 1];
+	size_t pos = out_bgn_arr(out);
+	uint32_t n = 0;
+	for (size_t i = 0; i < CMD_TABLE_SIZE; i++) {
+		if (!k_commands[i].name) {
+			continue;
+		}
+		uint64_t calls = 0;
+		uint64_t nsec = 0;
+		for (uint32_t s = 0; s < cache->nshards; s++) {
+			CmdStat *stat = &g_shards[s]->cmd_stats[i];
+			calls += counter_get(&stat->calls);
+			nsec += counter_get(&stat->nsec);
+			hists[s] = &stat->lat;
+		}
+		out_str(out, k_commands[i].name);
+		out_int(out, (int64_t) calls);
+		out_int(out, (int64_t) (nsec / 1000));
+		out_int(out, (int64_t) hist_quantile(hists, cache->nshards, 0.5));
+		out_int(out, (int64_t) hist_quantile(hists, cache->nshards, 0.99));
+		out_int(out, (int64_t) hist_quantile(hists, cache->nshards, 0.999));
+		n += 6;
+	}
+	out_end_arr(out, pos, n);
+}
+
+// info: name and value pairs about the whole server
+static void do_info(Cache *cache, StrView *cmd, size_t size, String *out) {
+	stats_publish(cache);
+	// the counters that are added up as they are, in the order they go out
+	static const char *const k_names[] = { "connections", "keyspace_hits", "keyspace_misses",
+			"keys", "rehashing_keys", "used_memory", "expired_keys", "evicted_keys",
+			"loop_iterations", "loop_stalls" };
+	const size_t k_sums = sizeof(k_names) / sizeof(k_names[0]);
+	uint64_t sums[sizeof(k_names) / sizeof(k_names[0])] = { 0 };
+	uint64_t calls = 0;
+	uint64_t ops = 0;
+	Histogram *hists[SCAN_SHARD_MASK + 1];
+	for (uint32_t s = 0; s < cache->nshards; s++) {
+		ShardStats *st = &g_shards[s]->stats;
+		const Counter *counters[] = { &st->conns, &st->hits, &st->misses, &st->keys,
+				&st->rehashing, &st->used_mem, &st->expired, &st->evicted, &st->loops,
+				&st->stalls };
+		for (size_t i = 0; i < k_sums; i++) {
+			sums[i] += counter_get(counters[i]);
+		}
+		for (size_t i = 0; i < CMD_TABLE_SIZE; i++) {
+			calls += counter_get(&g_shards[s]->cmd_stats[i].calls);
+		}
+		ops += rate_get(&st->ops, cache->clock_ms);
+		hists[s] = &st->loop_lat;
+	}
+	ReplInfo repl;
+	repl_info(&repl);
+	out_arr(out, (uint32_t) (2 * (k_sums + 13)));
+	out_stat(out, "uptime_sec", (cache->clock_ms - g_start_ms) / 1000);
+	out_stat(out, "shards", cache->nshards);
+	out_stat(out, "commands", calls);
+	out_stat(out, "ops_per_sec", ops);
+	for (size_t i = 0; i < k_sums; i++) {
+		out_stat(out, k_names[i], sums[i]);
+	}
+	out_stat(out, "pool_pending", thread_pool_pending(cache->tp));
+	out_stat(out, "loop_p50_usec", hist_quantile(hists, cache->nshards, 0.5));
+	out_stat(out, "loop_p99_usec", hist_quantile(hists, cache->nshards, 0.99));
+	out_stat(out, "loop_p999_usec", hist_quantile(hists, cache->nshards, 0.999));
+	out_stat(out, "loop_max_usec", hist_max(hists, cache->nshards));
+	out_stat(out, "replica", repl.replica);
+	out_stat(out, "primary_link_up", repl.link_up);
+	out_stat(out, "repl_offset", repl.offset);
+	out_stat(out, "connected_replicas", repl.replicas);
+}
+
+// slowlog get [n]: the newest n (10 by default) of the slow commands of all
+// shards, slowlog len: how many there are, slowlog reset: forget them
+static void do_slowlog(Cache *cache, StrView *cmd, size_t size, String *out) {
+	int64_t n = 10;
+	if (size <= 3 && cmd_is(&cmd[1], "get")) {
+		if (size == 3 && (!str2int(&cmd[2], &n) || n < 0)) {
+			out_err(out, ERR_ARG, "expect int");
+			return;
+		}
+		slowlog_out(out, (size_t) n);
+	} else if (size == 2 && cmd_is(&cmd[1], "len")) {
+		out_int(out, (int64_t) slowlog_len());
+	} else if (size == 2 && cmd_is(&cmd[1], "reset")) {
+		slowlog_reset();
+		out_nil(out);
+	} else {
+		out_err(out, ERR_UNKNOWN, "Unknown cmd");
+	}
+}
+
+// whether the writes have to be logged at all
+static bool cache_logging(Cache *cache) {
+	return cache->aof || repl_feeding();
+}
+
+// a write goes to the append only file and to the replicas as the same record
+static void cache_append(Cache *cache, const StrView *args, size_t n) {
+	if (cache->aof) {
+		cache->aof_last = aof_append(cache->aof, args, n);
+	}
+	repl_feed(args, n);
+}
+
+// the write commands go to the append only file once they succeeded. A
+// relative TTL is logged as the time it runs out.
+static void cache_log(Cache *cache, const Command *c, StrView *cmd, size_t size) {
+	if ((c->flags & CMD_MULTI_KEY) && cache->nshards > 1) {
+		// only the keys of this shard, the other shards log their own
+		StrView args[K_MAX_ARGS];
+		size_t n = 1;
+		args[0] = cmd[0];
+		for (size_t i = 1; i + c->key_step <= size; i += c->key_step) {
+			LookupKey key;
+			lookup_key_init(cache, &key, &cmd[i]);
+			if (cache_owns(cache, &key)) {
+				memcpy(&args[n], &cmd[i], c->key_step * sizeof(StrView));
+				n += c->key_step;
+			}
+		}
+		if (n > 1) {
+			cache_append(cache, args, n);
+		}
+		return;
+	}
+	if (c->flags & CMD_LOG_SET) {
+		LookupKey key;
+		lookup_key_init(cache, &key, &cmd[1]);
+		HNode *node = hm_lookup(&cache->db, &key.node, &entry_eq);
+		assert(node);
+		char buf[K_INT_LEN + 1];
+		StrView args[3] = { { "set", 3 }, cmd[1], entry_str(container_of(node, Entry, node), buf) };
+		cache_append(cache, args, 3);
+		return;
+	}
+	int64_t ttl_ms = 0;
+	if (c->fn == &do_expire && str2int(&cmd[2], &ttl_ms) && ttl_ms >= 0) {
+		char buf[32];
+		int len = snprintf(buf, sizeof(buf), "%lld", (long long) (wall_ms() + ttl_ms));
+		StrView args[3] = { { "pexpireat", 9 }, cmd[1], { buf, (size_t) len } };
+		cache_append(cache, args, 3);
+		return;
+	}
+	cache_append(cache, cmd, size);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void cache_execute(Cache *cache, StrView *cmd, size_t size, String *out) {
+	const Command *c = cache_command(cmd[0].data, cmd[0].len);
+	if (!c || !cmd_arity_ok(c, size)) {
+		out_err(out, ERR_UNKNOWN, "Unknown cmd");
+		return;
+	}
+	size_t start = str_size(out);
+	uint64_t begin = now_ns();
+	cache->clock_ms = begin / 1000000;
+	cache->reading = !(c->flags & CMD_WRITE);
+	c->fn(cache, cmd, size, out);
+	CmdStat *stat = &cache->cmd_stats[c - k_commands];
+	uint64_t took = now_ns() - begin;
+	counter_add(&stat->calls, 1);
+	counter_add(&stat->nsec, took);
+	hist_record(&stat->lat, took);
+	if (g_slowlog_usec >= 0 && took >= (uint64_t) g_slowlog_usec * 1000) {
+		slowlog_push(cmd, size, took / 1000, cache->shard);
+	}
+	rate_add(&cache->stats.ops, cache->clock_ms, 1);
+	if ((c->flags & CMD_WRITE) && cache_logging(cache) && str_char_at(out, (int) start) != SER_ERR) {
+		cache_log(cache, c, cmd, size);
+	}
+}
+
+int hnode_same(HNode *lhs, HNode *rhs) {
+	return lhs == rhs;
+}
+
+Cache* cache_init(uint32_t shard, uint32_t nshards, TimerWheel *timers, TheadPool *tp) {
+	Cache* cache = (Cache*) malloc(sizeof(Cache));
+	memset(cache, 0, sizeof(Cache));
+	cache->shard = shard;
+	cache->nshards = nshards;
+	cache->rng = 0x9E3779B97F4A7C15ull * (shard + 1);
+	hm_init(&cache->db);
+	for (size_t i = 0; i < CMD_TABLE_SIZE; i++) {
+		// a name put at the wrong position would never be found
+		assert(!k_commands[i].name
+				|| cache_command(k_commands[i].name, strlen(k_commands[i].name)) == &k_commands[i]);
+	}
+	cache->tp = tp;
+	cache->timers = timers;
+	if (!g_shards) {
+		g_shards = calloc(nshards, sizeof(Cache*));
+		if (!g_shards) {
+			die("Out of memory");
+		}
+		g_start_ms = now_ms();
+	}
+	g_shards[shard] = cache;
+	return cache;
+}
+
+void cache_expire(Cache *cache, Timer *timer) {
+	Entry *ent = container_of(timer, TtlTimer, timer)->ent;
+	HNode *node = hm_pop(&cache->db, &ent->node, &hnode_same);
+	assert(node == &ent->node);
+	entry_del(cache, ent);
+	cache->expired++;
+}
+
+void cache_set_maxmemory(Cache *cache, size_t max_mem, int policy) {
+	cache->max_mem = max_mem;
+	cache->evict_policy = policy;
+}
+
+size_t cache_used_mem(Cache *cache) {
+	return cache->used_mem + hm_mem(&cache->db);
+}
+
+// the bigger, the sooner the key should go
+static uint32_t evict_score(Cache *cache, Entry *ent) {
+	if (cache->evict_policy == EVICT_LRU) {
+		return (uint32_t) cache->clock_ms - ent->access;
+	}
+	return 255 - lfu_counter(cache, ent->access);
+}
+
+// approximates the policy: it is the worst of a few random keys that goes,
+// not the worst one of all
+#define K_EVICT_SAMPLES 5
+
+bool cache_evict(Cache *cache, size_t max) {
+	if (!cache->max_mem) {
+		return false;
+	}
+	cache->clock_ms = now_ms();
+	for (size_t n = 0; n < max; n++) {
+		if (cache_used_mem(cache) <= cache->max_mem || hm_size(&cache->db) == 0) {
+			return false;
+		}
+		Entry *victim = NULL;
+		uint32_t worst = 0;
+		for (int i = 0; i < K_EVICT_SAMPLES; i++) {
+			Entry *ent = container_of(hm_sample(&cache->db, cache_rand(cache)), Entry, node);
+			uint32_t score = evict_score(cache, ent);
+			if (!victim || score > worst) {
+				victim = ent;
+				worst = score;
+			}
+		}
+		if (cache_logging(cache)) {
+			// or a replay would bring it back, and the replicas would keep it
+			StrView args[2] = { { "del", 3 }, { victim->key, victim->key_len } };
+			cache_append(cache, args, 2);
+		}
+		HNode *node = hm_pop(&cache->db, &victim->node, &hnode_same);
+		assert(node == &victim->node);
+		entry_del(cache, victim);
+		cache->evicted++;
+	}
+	return cache_used_mem(cache) > cache->max_mem;
+}
+
+// spread the hash over the shards with bits the HMap does not use for
+// picking buckets, otherwise each shard would only ever fill 1/n of them.
+uint32_t cache_shard_of(uint64_t hcode, uint32_t nshards) {
+	return (uint32_t) (((hcode * 0x9E3779B97F4A7C15ull) >> 32) % nshards);
+}
+
+// where the snapshot of a shard goes, to be freed by the caller
+static char* snap_shard_path(const char *path, uint32_t shard) {
+	char *out = malloc(strlen(path) + 16);
+	if (!out) {
+		die("Out of memory");
+	}
+	sprintf(out, "%s.%u", path, shard);
+	return out;
+}
+
+// A snapshot is put together by the loop a few buckets at a time, in between
+// requests, and written out by the thread pool. It is not a point in time
+// copy: keys changed while it is being written may be in it either way.
+const size_t k_save_steps = 64;
+// what is buffered before it goes to the pool
+const size_t k_save_buf_size = 1 << 20;
+
+typedef struct {
+	SnapWriter *w;
+	// turns the wheel's expiry times into unix time
+	int64_t wall_offset;
+} SaveCtx;
+
+static void cb_save_znode(double score, const char *name, size_t len, void *arg) {
+	snap_put_znode((SnapWriter*) arg, score, name, len);
+}
+
+static void cb_save_hfield(const char *field, size_t flen, const char *val, size_t vlen,
+		void *arg) {
+	snap_put_hfield((SnapWriter*) arg, field, flen, val, vlen);
+}
+
+static void cb_save(HNode *node, void *arg) {
+	SaveCtx *ctx = (SaveCtx*) arg;
+	Entry *ent = container_of(node, Entry, node);
+	int64_t expire_at = ent->ttl ? (int64_t) ent->ttl->timer.expire_ms + ctx->wall_offset : 0;
+	switch (ent->type) {
+	case T_STR: {
+		char buf[K_INT_LEN + 1];
+		StrView val = entry_str(ent, buf);
+		snap_put_str(ctx->w, ent->key, ent->key_len, val.data, val.len, expire_at);
+		break;
+	}
+	case T_ZSET:
+		snap_put_zset(ctx->w, ent->key, ent->key_len, (uint32_t) zset_size(ent->zset),
+				expire_at);
+		zset_scan(ent->zset, &cb_save_znode, ctx->w);
+		break;
+	case T_HASH:
+		snap_put_hash(ctx->w, ent->key, ent->key_len, (uint32_t) hash_size(ent->hash),
+				expire_at);
+		hash_scan(ent->hash, &cb_save_hfield, ctx->w);
+		break;
+	}
+}
+
+bool cache_bgsave(Cache *cache) {
+	if (cache->snap || !cache->snap_path) {
+		return false;
+	}
+	char *path = snap_shard_path(cache->snap_path, cache->shard);
+	cache->snap = snap_writer_new(path, cache->shard, cache->nshards, cache->tp);
+	free(path);
+	if (!cache->snap) {
+		msg("can't create the snapshot file");
+		return false;
+	}
+	cache->snap_cursor = 0;
+	cache->snap_scanned = false;
+	cache->snap_from = repl_offset();
+	return true;
+}
+
+uint32_t cache_save_step(Cache *cache) {
+	SnapWriter *w = cache->snap;
+	if (!w) {
+		return (uint32_t) -1;
+	}
+	if (!cache->snap_scanned) {
+		SaveCtx ctx = { w, wall_ms() - (int64_t) now_ms() };
+		for (size_t i = 0; i < k_save_steps && snap_buffered(w) < k_save_buf_size; i++) {
+			cache->snap_cursor = hm_scan_cursor(&cache->db, cache->snap_cursor, &cb_save, &ctx);
+			if (cache->snap_cursor == 0) {
+				cache->snap_scanned = true;
+				break;
+			}
+		}
+	}
+	if (cache->snap_scanned) {
+		// does nothing once the trailer is out
+		snap_flush(w, true);
+	} else if (snap_buffered(w) >= k_save_buf_size && !snap_flush(w, false)) {
+		// the disk is behind, wait for it
+		return 1;
+	}
+
+	int state = snap_state(w);
+	if (state == SNAP_RUNNING) {
+		return cache->snap_scanned ? 1 : 0;
+	}
+	if (state == SNAP_DONE) {
+		counter_set(&cache->saved_from, cache->snap_from);
+		printf("shard %u: snapshot saved\n", cache->shard);
+	} else {
+		msg("writing the snapshot failed");
+	}
+	snap_writer_free(w);
+	cache->snap = NULL;
+	if (cache->save_ms) {
+		wheel_add(cache->timers, &cache->save_timer, now_ms() + cache->save_ms);
+	}
+	return (uint32_t) -1;
+}
+
+// fills the db from one snapshot file, returns the number of keys added
+static size_t cache_load_file(Cache *cache, SnapReader *r, bool filter) {
+	int64_t now = wall_ms();
+	size_t n = 0;
+	SnapRecord rec;
+	while (snap_next(r, &rec)) {
+		if (rec.expire_at && rec.expire_at <= now) {
+			continue;
+		}
+		LookupKey key;
+		lookup_key_init(cache, &key, &rec.key);
+		if (filter && cache_shard_of(key.node.hcode, cache->nshards) != cache->shard) {
+			continue;
+		}
+		// a key the table moved around while it was being saved is in there
+		// twice, the later copy is the newer one
+		HNode *old = hm_pop(&cache->db, &key.node, &entry_eq);
+		if (old) {
+			entry_del(cache, container_of(old, Entry, node));
+		} else {
+			n++;
+		}
+
+		Entry *ent = NULL;
+		if (rec.type == SNAP_STR) {
+			ent = entry_new_str(&key, &rec.val);
+		} else if (rec.type == SNAP_HASH) {
+			ent = entry_new(&key, T_HASH, 0);
+			ent->hash = slab_alloc(sizeof(Hash));
+			memset(ent->hash, 0, sizeof(Hash));
+			hash_reserve(ent->hash, rec.nmembers);
+			StrView field;
+			StrView val;
+			while (snap_next_hfield(r, &field, &val)) {
+				hash_set(ent->hash, field.data, field.len, val.data, val.len);
+			}
+		} else {
+			ent = entry_new(&key, T_ZSET, 0);
+			ent->zset = slab_alloc(sizeof(ZSet));
+			memset(ent->zset, 0, sizeof(ZSet));
+			zset_reserve(ent->zset, rec.nmembers);
+			double score = 0;
+			StrView name;
+			while (snap_next_znode(r, &score, &name)) {
+				zset_add(ent->zset, name.data, name.len, score);
+			}
+		}
+		db_insert(cache, ent);
+		if (rec.expire_at) {
+			entry_set_ttl(cache, ent, rec.expire_at - now);
+		}
+	}
+	if (r->bad) {
+		msg("the snapshot is damaged, loaded what could be read");
+	}
+	return n;
+}
+
+// the files saved under base, by any number of shards
+static void cache_load(Cache *cache, const char *base) {
+	uint64_t start = get_monotonic_usec();
+	// the first file says how many shards the last run had
+	SnapReader first;
+	char *path = snap_shard_path(base, 0);
+	int rv = snap_open(&first, path);
+	free(path);
+	if (rv < 0) {
+		if (rv != -ENOENT) {
+			msg("can't read the snapshot");
+		}
+		return;
+	}
+	uint32_t nfiles = first.nshards;
+	snap_close(&first);
+	if (nfiles == 0 || nfiles > SCAN_SHARD_MASK + 1) {
+		msg("can't read the snapshot");
+		return;
+	}
+
+	// with the same number of shards as before every key is in the file of
+	// its shard, otherwise every file has some
+	bool same = nfiles == cache->nshards;
+	SnapReader *readers = calloc(nfiles, sizeof(SnapReader));
+	if (!readers) {
+		die("Out of memory");
+	}
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < nfiles; i++) {
+		if (same && i != cache->shard) {
+			continue;
+		}
+		path = snap_shard_path(base, i);
+		rv = snap_open(&readers[i], path);
+		free(path);
+		if (rv < 0) {
+			msg("a snapshot file is missing or incomplete");
+		} else if (readers[i].nshards != nfiles || readers[i].shard != i) {
+			msg("a snapshot file is from another run");
+			snap_close(&readers[i]);
+		} else {
+			total += readers[i].nrecords;
+		}
+	}
+
+	// size the table for all of it up front, rather than growing it through
+	// every power of 2 on the way
+	hm_reserve(&cache->db, same ? total : total / cache->nshards + total / 16);
+	size_t n = 0;
+	for (uint32_t i = 0; i < nfiles; i++) {
+		if (readers[i].data) {
+			n += cache_load_file(cache, &readers[i], !same);
+			snap_close(&readers[i]);
+		}
+	}
+	free(readers);
+	printf("shard %u: loaded %zu keys in %lu ms\n", cache->shard, n,
+			(unsigned long) ((get_monotonic_usec() - start) / 1000));
+}
+
+typedef struct {
+	Cache *cache;
+	String *out;
+	size_t n;
+} ReplayCtx;
+
+static void cb_replay(void *arg, StrView *cmd, size_t size) {
+	ReplayCtx *ctx = (ReplayCtx*) arg;
+	Cache *cache = ctx->cache;
+	// every shard reads the whole file, and keeps its own keys. The multi
+	// key commands sort that out themselves.
+	const Command *c = cache_command(cmd[0].data, cmd[0].len);
+	if (size > 1 && cache->nshards > 1 && !(c && (c->flags & (CMD_MULTI_KEY | CMD_ALL)))
+			&& cache_shard_of(str_hash((const uint8_t*) cmd[1].data, cmd[1].len),
+					cache->nshards) != cache->shard) {
+		return;
+	}
+	str_clear(ctx->out);
+	cache_execute(cache, cmd, size, ctx->out);
+	ctx->n++;
+}
+
+// the writes since the file was started go over whatever the snapshot had.
+// They only ever set a key or a member to a value, so replaying ones the
+// snapshot already has ends up in the same place.
+static void cache_replay(Cache *cache, Aof *aof, const char *path) {
+	uint64_t start = get_monotonic_usec();
+	ReplayCtx ctx = { cache, str_init(NULL), 0 };
+	int64_t rv = aof_replay(path, aof_replay_size(aof), &cb_replay, &ctx);
+	str_free(ctx.out);
+	if (rv < 0) {
+		msg("can't read the append only file");
+		return;
+	}
+	if (rv > 0) {
+		printf("shard %u: replayed %zu of %lld writes in %lu ms\n", cache->shard, ctx.n,
+				(long long) rv, (unsigned long) ((get_monotonic_usec() - start) / 1000));
+	}
+}
+
+void cache_open(Cache *cache, const char *path, uint64_t save_ms, Aof *aof,
+		const char *aof_path) {
+	cache->snap_path = strdup(path);
+	if (!cache->snap_path) {
+		die("Out of memory");
+	}
+	cache->save_ms = save_ms;
+	timer_init(&cache->save_timer, TIMER_SAVE);
+	cache_load(cache, path);
+	if (aof) {
+		cache_replay(cache, aof, aof_path);
+		// only now, the replay must not log itself again
+		cache->aof = aof;
+	}
+	if (save_ms) {
+		wheel_add(cache->timers, &cache->save_timer, now_ms() + save_ms);
+	}
+}
+
+void cache_reload(Cache *cache, const char *path) {
+	db_clear(cache, true);
+	cache_load(cache, path);
+}
+
+uint64_t cache_saved_from(Cache *cache) {
+	return counter_get(&cache->saved_from);
+}
+
+bool cache_has(Cache *cache, const char *key, size_t len) {
+	StrView view = { key, len };
+	LookupKey lkey;
+	lookup_key_init(cache, &lkey, &view);
+	HNode *node = hm_lookup(&cache->db, &lkey.node, &entry_eq);
+	if (!node) {
+		return false;
+	}
+	Entry *ent = container_of(node, Entry, node);
+	return !ent->ttl || ent->ttl->timer.expire_ms > now_ms();
 }
@@ -8,25 +8,192 @@
 #ifndef CACHE_H
 #define  CACHE_H
 
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "aof.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "strings.h"
-#include "heap.h"
+#include "timer.h"
 #include "thread_pool.h"
 #include "zset.h"
 
+// the command table, indexed by a perfect hash of the names (see cache.c)
+#define CMD_TABLE_SIZE 128
+
+typedef struct {
+	Counter calls;
+	Counter nsec;
+	// how long the calls took, in ns
+	Histogram lat;
+} CmdStat;
+
+// what INFO reports. Every shard keeps its own, the one asked adds them up.
+typedef struct {
+	// lookups of the read commands that found the key, and that didn't
+	Counter hits;
+	Counter misses;
+	Rate ops;
+	// copies of the shard's numbers, see cache_loop_done
+	Counter keys;
+	Counter rehashing;
+	Counter used_mem;
+	Counter expired;
+	Counter evicted;
+	Counter conns;
+	// iterations of the event loop, and how long they took, in usec
+	Counter loops;
+	Counter stalls;
+	Histogram loop_lat;
+} ShardStats;
+
+// which keys go first past maxmemory, out of a few picked at random: the
+// one used the longest ago, or the one used the least often lately
+enum {
+	EVICT_LRU = 0, EVICT_LFU = 1,
+};
+
 typedef struct {
 	// The hashmap for the key -> value thing
 	HMap db;
 
-	// timers for TTLs
-	Heap heap;
+	// timers for TTLs, the wheel belongs to the event loop
+	TimerWheel *timers;
+
+	// the thread pool, shared with the other shards
+	TheadPool *tp;
+
+	// which part of the keyspace this is, for the SCAN cursors
+	uint32_t shard;
+	uint32_t nshards;
 
-	// the thread pool
-	TheadPool tp;
+	// snapshots go to snap_path.<shard>, every save_ms unless that is 0
+	char *snap_path;
+	uint64_t save_ms;
+	Timer save_timer;
+	// the snapshot being written, with the scan position in db
+	SnapWriter *snap;
+	size_t snap_cursor;
+	bool snap_scanned;
+	// where the replication stream was when the snapshot being written
+	// started, and when the last one that went through did, see repl.h
+	uint64_t snap_from;
+	Counter saved_from;
+
+	// the connection MIGRATE keeps to the node at migrate_addr, NULL until
+	// it's first used
+	struct minis_conn *migrate_conn;
+	struct sockaddr_in migrate_addr;
+
+	// the append only file shared by all shards, NULL when it is off, and
+	// the offset just past the last write of this shard in it
+	Aof *aof;
+	uint64_t aof_last;
+
+	// the bytes the entries of this shard hold on to. Past max_mem, unless
+	// that is 0, keys are evicted as evict_policy says.
+	size_t used_mem;
+	size_t max_mem;
+	int evict_policy;
+	uint64_t evicted;
+	// keys whose TTL ran out, deleted by their timer or on a lookup
+	uint64_t expired;
+	// when the command being run started, for the access clocks
+	uint64_t clock_ms;
+	uint64_t rng;
+	// the command being run doesn't write, its lookups count as hits or misses
+	bool reading;
+	// the key the next commands look up first, already hashed, see cache_hint
+	StrView hint;
+	uint64_t hint_hcode;
+
+	ShardStats stats;
+	// per command, at the same index as in the command table
+	CmdStat cmd_stats[CMD_TABLE_SIZE];
 } Cache;
 
-extern Cache* cache_init(void);
-extern void cache_evict(Cache *cache, uint64_t now_us);
-extern uint64_t cache_next_expiry(Cache* cache);
-extern void cache_execute(Cache* cache, char **cmd, size_t size, String *out);
+enum {
+	// changes the db, and goes to the append only file
+	CMD_WRITE = 1 << 0,
+	// runs on every shard, the arrays they reply with are joined (KEYS)
+	CMD_ALL = 1 << 1,
+	// runs on every shard, the replies are laid over each other
+	CMD_SPLIT = 1 << 2,
+	// has keys at every key_step-th arg from the first on, which may be in
+	// different shards. Every shard runs it and does its own keys.
+	CMD_MULTI_KEY = 1 << 3,
+	// the first arg is a SCAN cursor, which says the shard
+	CMD_CURSOR = 1 << 4,
+	// logged as a SET of the value it left behind rather than as itself, so
+	// that replaying it over a snapshot that already has it changes nothing
+	CMD_LOG_SET = 1 << 5,
+	// not about the data, in cluster mode it runs whatever slot its args are in
+	CMD_ADMIN = 1 << 6,
+};
+
+typedef struct {
+	const char *name;
+	// the number of args, the name included: min_args, and if arg_step
+	// isn't 0 any more than that in multiples of it
+	uint32_t min_args;
+	uint32_t arg_step;
+	uint32_t flags;
+	uint32_t key_step;
+	void (*fn)(Cache *cache, StrView *cmd, size_t size, String *out);
+} Command;
+
+// SCAN cursors keep the shard in their low bits
+#define SCAN_SHARD_BITS 8
+#define SCAN_SHARD_MASK ((1 << SCAN_SHARD_BITS) - 1)
+
+extern Cache* cache_init(uint32_t shard, uint32_t nshards, TimerWheel *timers, TheadPool *tp);
+// the shard a key belongs to
+extern uint32_t cache_shard_of(uint64_t hcode, uint32_t nshards);
+// loads what the last run saved under path, and saves there every save_ms
+// (never if 0). With an aof, the writes in aof_path are replayed on top and
+// every write from then on goes there. Has to run on the loop's thread, it
+// arms timers.
+extern void cache_open(Cache *cache, const char *path, uint64_t save_ms, Aof *aof,
+		const char *aof_path);
+// drops every key and loads the snapshot files under path instead, for a
+// replica that resyncs. On the loop's thread.
+extern void cache_reload(Cache *cache, const char *path);
+// the replication offset the last complete snapshot was started at, 0 if
+// there is none. Any thread may ask.
+extern uint64_t cache_saved_from(Cache *cache);
+// starts a background snapshot, false if one is already running
+extern bool cache_bgsave(Cache *cache);
+// does a slice of the snapshot in progress, if any. Returns how long the
+// loop may wait for events as far as the snapshot is concerned,
+// (uint32_t) -1 when there is none.
+extern uint32_t cache_save_step(Cache *cache);
+// the command named name, NULL if there is none
+extern const Command* cache_command(const char *name, size_t len);
+// a TIMER_TTL timer of this cache went off, the key is deleted
+extern void cache_expire(Cache *cache, Timer *timer);
+// a memory limit for this shard, 0 for none
+extern void cache_set_maxmemory(Cache *cache, size_t max_mem, int policy);
+// the entries plus the table of the db
+extern size_t cache_used_mem(Cache *cache);
+// evicts up to max keys while over the limit, true if it still is after
+extern bool cache_evict(Cache *cache, size_t max);
+// lets INFO know what the end of a loop iteration looks like: it took
+// busy_usec, not counting the wait, and there are conns connections. A
+// stalled one took too long.
+extern void cache_loop_done(Cache *cache, uint64_t busy_usec, size_t conns, bool stalled);
+// The lookups of a pipeline of requests, before it runs: the buckets of
+// the keys of this shard are pulled in, and then the entries they start
+// with, so that up to CACHE_PREFETCH_MAX of them wait on memory together.
+// Changes nothing. hcodes gets the hashes of the n keys, for cache_hint.
+#define CACHE_PREFETCH_MAX 16
+extern void cache_prefetch(Cache *cache, const StrView *keys, uint64_t *hcodes, size_t n);
+// the lookups of key, a view into the commands about to run, take hcode
+// for its hash instead of hashing it again. A NULL key ends it.
+extern void cache_hint(Cache *cache, const StrView *key, uint64_t hcode);
+// whether the shard has the key, without it counting as an access
+extern bool cache_has(Cache *cache, const char *key, size_t len);
+// the command arguments are views into the request, nothing is copied
+// unless it has to outlive the call (keys and values stored in the db)
+extern void cache_execute(Cache* cache, StrView *cmd, size_t size, String *out);
 
 #endif /* CACHE_H */
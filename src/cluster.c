@@ -0,0 +1,136 @@
+/*
+ * cluster.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "cluster.h"
+#include "common.h"
+
+// A slot is the node serving it in the low 16 bits and the one it's moving
+// to or from in the high ones: the node it's migrating to when it's served
+// here, CLUSTER_MYSELF when it's being imported, CLUSTER_NO_NODE otherwise.
+#define SLOT_WORD(owner, peer) ((uint32_t) (owner) | ((uint32_t) (peer) << 16))
+#define SLOT_OWNER(word) ((word) & 0xffff)
+#define SLOT_PEER(word) ((word) >> 16)
+
+static struct {
+	bool enabled;
+	_Atomic uint32_t slots[K_SLOTS];
+	// only ever added to, under mu. A node is written before nnodes says
+	// it's there.
+	pthread_mutex_t mu;
+	struct sockaddr_in nodes[K_MAX_NODES];
+	atomic_uint nnodes;
+} g_cluster = { .mu = PTHREAD_MUTEX_INITIALIZER };
+
+void cluster_init(const struct sockaddr_in *addr) {
+	g_cluster.nodes[CLUSTER_MYSELF] = *addr;
+	atomic_store(&g_cluster.nnodes, 1);
+	for (uint32_t i = 0; i < K_SLOTS; i++) {
+		atomic_init(&g_cluster.slots[i], SLOT_WORD(CLUSTER_NO_NODE, CLUSTER_NO_NODE));
+	}
+	g_cluster.enabled = true;
+}
+
+bool cluster_enabled(void) {
+	return g_cluster.enabled;
+}
+
+int cluster_slot_state(uint32_t slot, uint32_t *node) {
+	// acquire, the node it names is there
+	uint32_t word = atomic_load_explicit(&g_cluster.slots[slot], memory_order_acquire);
+	uint32_t owner = SLOT_OWNER(word);
+	uint32_t peer = SLOT_PEER(word);
+	if (owner == CLUSTER_MYSELF) {
+		if (peer == CLUSTER_NO_NODE) {
+			return SLOT_HERE;
+		}
+		*node = peer;
+		return SLOT_MIGRATING;
+	}
+	if (peer == CLUSTER_MYSELF) {
+		return SLOT_HERE;
+	}
+	if (owner == CLUSTER_NO_NODE) {
+		return SLOT_DOWN;
+	}
+	*node = owner;
+	return SLOT_MOVED;
+}
+
+static bool same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+	return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+uint32_t cluster_node(const struct sockaddr_in *addr) {
+	pthread_mutex_lock(&g_cluster.mu);
+	uint32_t n = atomic_load(&g_cluster.nnodes);
+	uint32_t node = 0;
+	while (node < n && !same_addr(&g_cluster.nodes[node], addr)) {
+		node++;
+	}
+	if (node == n) {
+		if (n < K_MAX_NODES) {
+			g_cluster.nodes[n] = *addr;
+			atomic_store_explicit(&g_cluster.nnodes, n + 1, memory_order_release);
+		} else {
+			node = CLUSTER_NO_NODE;
+		}
+	}
+	pthread_mutex_unlock(&g_cluster.mu);
+	return node;
+}
+
+struct sockaddr_in cluster_node_addr(uint32_t node) {
+	return g_cluster.nodes[node];
+}
+
+int cluster_node_name(uint32_t node, char *buf, size_t size) {
+	const struct sockaddr_in *addr = &g_cluster.nodes[node];
+	char ip[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+	return snprintf(buf, size, "%s:%u", ip, (unsigned) ntohs(addr->sin_port));
+}
+
+void cluster_set_slots(uint32_t first, uint32_t last, uint32_t node) {
+	for (uint32_t i = first; i <= last; i++) {
+		atomic_store_explicit(&g_cluster.slots[i], SLOT_WORD(node, CLUSTER_NO_NODE),
+				memory_order_release);
+	}
+}
+
+bool cluster_set_migrating(uint32_t slot, uint32_t node) {
+	uint32_t word = atomic_load(&g_cluster.slots[slot]);
+	if (SLOT_OWNER(word) != CLUSTER_MYSELF || node == CLUSTER_MYSELF) {
+		return false;
+	}
+	atomic_store(&g_cluster.slots[slot], SLOT_WORD(CLUSTER_MYSELF, node));
+	return true;
+}
+
+bool cluster_set_importing(uint32_t slot) {
+	uint32_t word = atomic_load(&g_cluster.slots[slot]);
+	if (SLOT_OWNER(word) == CLUSTER_MYSELF) {
+		return false;
+	}
+	atomic_store(&g_cluster.slots[slot], SLOT_WORD(SLOT_OWNER(word), CLUSTER_MYSELF));
+	return true;
+}
+
+uint32_t cluster_slot_run(uint32_t first, uint32_t *last) {
+	uint32_t owner = SLOT_OWNER(atomic_load_explicit(&g_cluster.slots[first], memory_order_relaxed));
+	uint32_t i = first + 1;
+	while (i < K_SLOTS
+			&& SLOT_OWNER(atomic_load_explicit(&g_cluster.slots[i], memory_order_relaxed)) == owner) {
+		i++;
+	}
+	*last = i - 1;
+	return owner;
+}
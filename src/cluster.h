@@ -0,0 +1,67 @@
+/*
+ * cluster.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Cluster mode. The keyspace is split into K_SLOTS slots by key_slot, and
+// every node serves some of them. Requests for a slot served elsewhere get
+// ERR_MOVED with the node to go to. The slot map is set by hand on every
+// node, CLUSTER SETSLOTS, and lives in memory only.
+//
+// A slot moves like this: the node it goes to is told it's IMPORTING it,
+// and serves its requests from then on. The one it comes from is told
+// it's MIGRATING it there, and keeps serving the keys it still has, while
+// requests for the ones it doesn't get ERR_ASK. MIGRATE moves the keys
+// over one at a time, and once they are all gone SETSLOTS hands the slot
+// over on every node.
+//
+// The map is read by all loops on every request and changed by whichever
+// gets a CLUSTER command, every slot is one atomic word.
+
+#define K_MAX_NODES 1024
+#define CLUSTER_NO_NODE 0xffff
+// the node this one is, always there
+#define CLUSTER_MYSELF 0
+
+enum {
+	SLOT_HERE = 0,
+	// served here, keys that are gone are at the node it's migrating to
+	SLOT_MIGRATING = 1,
+	SLOT_MOVED = 2,
+	SLOT_DOWN = 3,
+};
+
+// cluster mode on, this node being at addr. No slot is served until
+// SETSLOTS says so.
+extern void cluster_init(const struct sockaddr_in *addr);
+extern bool cluster_enabled(void);
+// SLOT_*, *node is the node of SLOT_MIGRATING or SLOT_MOVED
+extern int cluster_slot_state(uint32_t slot, uint32_t *node);
+// the node at addr, added if it's new. CLUSTER_NO_NODE when there are
+// K_MAX_NODES already.
+extern uint32_t cluster_node(const struct sockaddr_in *addr);
+extern struct sockaddr_in cluster_node_addr(uint32_t node);
+// "<ip>:<port>", buf has room for at least 22 bytes
+extern int cluster_node_name(uint32_t node, char *buf, size_t size);
+
+// slots first to last are served by node from now on, whatever they were
+// migrating or importing is done
+extern void cluster_set_slots(uint32_t first, uint32_t last, uint32_t node);
+// false when the slot isn't served here
+extern bool cluster_set_migrating(uint32_t slot, uint32_t node);
+// false when the slot is served here already
+extern bool cluster_set_importing(uint32_t slot);
+// the node of the run of slots from first on, *last set to where it ends.
+// CLUSTER_NO_NODE for a run nobody serves.
+extern uint32_t cluster_slot_run(uint32_t first, uint32_t *last);
+
+#endif /* CLUSTER_H_ */
@@ -10,15 +10,102 @@
 #include "common.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <time.h>
 
-inline uint64_t str_hash(const uint8_t *data, size_t len) {
-    uint32_t h = 0x811C9DC5;
-    for (size_t i = 0; i < len; i++) {
-        h = (h + (data[i] ? data[i] : 0)) * 0x01000193;
+// wyhash (final version 4.2): 8 or 16 bytes at a time, each pair folded
+// in with a 64x64->128 multiply. Three lanes run side by side over long
+// keys. A seed nobody outside knows makes it hard to pick keys that all
+// land in one bucket.
+static const uint64_t k_wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+static uint64_t g_hash_seed;
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t wyr8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+void str_hash_seed(uint64_t seed) {
+    g_hash_seed = seed ^ wymix(seed ^ k_wyp[0], k_wyp[1]);
+}
+
+static uint64_t wyhash(const uint8_t *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            // the first and last 4 bytes, and the ones in the middle if any
+            size_t mid = (len >> 3) << 2;
+            a = (wyr4(p) << 32) | wyr4(p + mid);
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ k_wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ k_wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ k_wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ k_wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        // the last 16 bytes, overlapping what was done already if need be
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
     }
-    return h;
+    a ^= k_wyp[1];
+    b ^= seed;
+    __uint128_t r = (__uint128_t) a * b;
+    return wymix((uint64_t) r ^ k_wyp[0] ^ len, (uint64_t) (r >> 64) ^ k_wyp[1]);
+}
+
+uint64_t str_hash(const uint8_t *data, size_t len) {
+    return wyhash(data, len, g_hash_seed);
+}
+
+// every node and client has to agree on the slots, so their seed is no
+// secret. Keys that all land in one slot can't do more than fill a node.
+static const uint64_t k_slot_seed = 0x6d696e69732d736cull;
+
+uint32_t key_slot(const uint8_t *data, size_t len) {
+    const uint8_t *open = memchr(data, '{', len);
+    if (open) {
+        size_t from = (size_t) (open - data) + 1;
+        const uint8_t *close = memchr(open + 1, '}', len - from);
+        if (close && close > open + 1) {
+            data = open + 1;
+            len = (size_t) (close - data);
+        }
+    }
+    return (uint32_t) (wyhash(data, len, k_slot_seed) & (K_SLOTS - 1));
 }
 
 uint64_t get_monotonic_usec(void) {
@@ -36,3 +123,84 @@ inline void die(const char *msg) {
     fprintf(stderr, "[%d] %s\n", err, msg);
     abort();
 }
+
+// glob style matching for SCAN MATCH: * ? [abc] [^a-z] and \ to escape
+int glob_match(const char *pat, size_t plen, const char *str, size_t slen) {
+	while (plen > 0) {
+		switch (*pat) {
+		case '*':
+			while (plen > 1 && pat[1] == '*') {
+				pat++;
+				plen--;
+			}
+			if (plen == 1) {
+				return 1;
+			}
+			for (size_t i = 0; i <= slen; i++) {
+				if (glob_match(pat + 1, plen - 1, str + i, slen - i)) {
+					return 1;
+				}
+			}
+			return 0;
+		case '?':
+			if (slen == 0) {
+				return 0;
+			}
+			break;
+		case '[': {
+			if (slen == 0) {
+				return 0;
+			}
+			pat++;
+			plen--;
+			int negate = plen > 0 && *pat == '^';
+			if (negate) {
+				pat++;
+				plen--;
+			}
+			int found = 0;
+			while (plen > 0 && *pat != ']') {
+				if (*pat == '\\' && plen >= 2) {
+					pat++;
+					plen--;
+					found |= *pat == *str;
+				} else if (plen >= 3 && pat[1] == '-' && pat[2] != ']') {
+					char lo = pat[0] < pat[2] ? pat[0] : pat[2];
+					char hi = pat[0] < pat[2] ? pat[2] : pat[0];
+					found |= *str >= lo && *str <= hi;
+					pat += 2;
+					plen -= 2;
+				} else {
+					found |= *pat == *str;
+				}
+				pat++;
+				plen--;
+			}
+			if (plen == 0) {
+				// no closing ], a broken pattern matches nothing
+				return 0;
+			}
+			if (found == negate) {
+				return 0;
+			}
+			break;
+		}
+		case '\\':
+			if (plen >= 2) {
+				pat++;
+				plen--;
+			}
+			/* fall through */
+		default:
+			if (slen == 0 || *pat != *str) {
+				return 0;
+			}
+			break;
+		}
+		pat++;
+		plen--;
+		str++;
+		slen--;
+	}
+	return slen == 0;
+}
@@ -15,6 +15,15 @@
 #define ERR_2BIG 2
 #define ERR_TYPE 3
 #define ERR_ARG 4
+#define ERR_READONLY 5
+// cluster mode: the key's slot is at another node, the message is
+// "<slot> <ip>:<port>". MOVED for good, ASK for this one request while the
+// slot is being migrated there.
+#define ERR_MOVED 6
+#define ERR_ASK 7
+// the slot isn't served by any node, or is being migrated under a request
+// with several keys
+#define ERR_TRYAGAIN 8
 
 #define SER_NIL 0
 #define SER_ERR 1    // An error code and message
@@ -25,7 +34,9 @@
 
 #define PORT 1234
 
-#define K_MAX_MSG 4096
+// the largest request or response. The buffers grow as needed, this is only
+// here to turn away garbage lengths before allocating for them.
+#define K_MAX_MSG (32 << 20)
 #define K_MAX_ARGS 100
 
 #define container_of(ptr, type, member) ({\
@@ -34,7 +45,19 @@
 
 extern uint64_t get_monotonic_usec(void); 
 
+// 64 bits, all of them usable. Keys hash the same for as long as the seed
+// stays, so nothing that outlives the process may depend on it.
 extern uint64_t str_hash(const uint8_t *data, size_t len);
+// before anything is hashed
+extern void str_hash_seed(uint64_t seed);
+
+// the cluster slot of a key, the same everywhere. Only the part between the
+// first { and the } after it counts, if it isn't empty, so that keys can be
+// made to share a slot.
+#define K_SLOTS 16384
+extern uint32_t key_slot(const uint8_t *data, size_t len);
+
+extern int glob_match(const char *pat, size_t plen, const char *str, size_t slen);
 
 extern void msg(const char *msg); 
 
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "connections.h"
 
 
@@ -16,11 +17,17 @@ static void grow(Conns *this, size_t new_capacity) {
     if (new_capacity <= (2 * (this->capacity))) {
         new_capacity = 2 * this->capacity;
     }
-    this->conns_all = realloc(this->conns_all,
-            sizeof(Conn) * (new_capacity / 32) + 1);
+    size_t old_words = (this->capacity / 32) + 1;
+    size_t new_words = (new_capacity / 32) + 1;
+    this->presence = realloc(this->presence, sizeof(uint32_t) * new_words);
     this->conns_all = realloc(this->conns_all, sizeof(Conn) * new_capacity);
     this->conns_by_fd = realloc(this->conns_by_fd,
             sizeof(Value*) * new_capacity);
+    if (!this->presence || !this->conns_all || !this->conns_by_fd) {
+        abort();
+    }
+    memset(&this->presence[old_words], 0,
+            sizeof(uint32_t) * (new_words - old_words));
     this->capacity = new_capacity;
 }
 
@@ -58,9 +65,9 @@ void conns_set(Conns *this, Conn *connection) {
     }
     assert(connection->fd >= 0);
     if ((size_t) connection->fd >= this->capacity) {
-        grow(this, connection->fd);
+        grow(this, connection->fd + 1);
     }
-    if (this->presence[connection->fd / 32] & 1 << connection->fd) {
+    if (this->presence[connection->fd / 32] & 1u << (connection->fd % 32)) {
         Value *old_value = this->conns_by_fd[connection->fd];
         old_value->value = connection;
         this->conns_all[old_value->ind_in_all] = *connection;
@@ -72,34 +79,35 @@ void conns_set(Conns *this, Conn *connection) {
         this->conns_by_fd[connection->fd] = value;
         this->conns_all[this->size] = *connection;
         (this->size)++;
-        this->presence[connection->fd / 32] |= 1 << connection->fd;
+        this->presence[connection->fd / 32] |= 1u << (connection->fd % 32);
     }
 }
 
 void conns_del(Conns *this, int key) {
     assert(key >= 0);
     if (!this
-            || !((size_t) key <= ((this->capacity / 32 + 1) * 32)
-                    && (this->presence[key / 32] & 1 << key))) {
+            || !((size_t) key < this->capacity
+                    && (this->presence[key / 32] & 1u << (key % 32)))) {
         return;
     }
 
     Value *old_value = this->conns_by_fd[key];
-    if ((size_t) key != this->size - 1) {
+    if (old_value->ind_in_all != this->size - 1) {
         this->conns_all[old_value->ind_in_all] =
                 this->conns_all[this->size - 1];
         this->conns_by_fd[this->conns_all[this->size - 1].fd]->ind_in_all =
                 old_value->ind_in_all;
     }
     (this->size)--;
-    this->presence[key / 32] &= ~(1 << key);
+    this->presence[key / 32] &= ~(1u << (key % 32));
 
     free(old_value);
     this->conns_by_fd[key] = NULL;
 }
 
 Conn* conns_get(Conns *this, int key) {
-    if (!this || !(this->presence[key / 32] & 1 << key)) {
+    if (!this || key < 0 || (size_t) key >= this->capacity
+            || !(this->presence[key / 32] & 1u << (key % 32))) {
         return NULL;
     }
     return this->conns_by_fd[key]->value;
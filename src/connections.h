@@ -10,23 +10,49 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "list.h"
-
-#define K_MAX_MSG 4096
+#include "buffer.h"
+#include "strings.h"
+#include "timer.h"
 
 typedef struct {
 	int fd;
 	uint32_t state;     // either STATE_REQ or STATE_RES
-	// buffer for reading
-	size_t rbuf_size;
-	uint8_t rbuf[4 + K_MAX_MSG];
-	// buffer for writing
-	size_t wbuf_size;
-	size_t wbuf_sent;
-	uint8_t wbuf[4 + K_MAX_MSG];
-	uint64_t idle_start;
-	// timer
-	DList idle_list;
+	// buffer for reading, only held while there are unprocessed bytes.
+	// It is contiguous, and grows to fit a request that is bigger.
+	Chunk *rbuf;
+	// buffer for writing, the replies that could not be sent right away.
+	// Empty chains hold no chunks, so an idle connection holds no buffers.
+	ChunkChain wbuf;
+	// the replies of this loop iteration, serialized in place and sent out
+	// behind wbuf at the end of it
+	String *out;
+	// on the loop's list of connections to flush
+	DList flush_list;
+	// on the loop's list of connections that ran out of their turn with
+	// requests left, see process_requests. budget is what's left of the
+	// turn of loop iteration `turn`.
+	DList ready_list;
+	uint32_t budget;
+	uint64_t turn;
+	// the last write hit EAGAIN, no more tries until EPOLLOUT
+	bool write_blocked;
+	// goes off when the connection was idle for too long
+	Timer idle;
+	// a request handed off to the event loop owning its key, while set
+	// nothing else is read from this connection, to keep the replies in order
+	void *pending;
+	// io_uring engine only: a send is in flight, and which connection this
+	// is, as completions for a closed one can show up after its fd is reused
+	bool sending;
+	uint32_t gen;
+	// io_uring engine only: receiving is paused until the requests already
+	// in rbuf are down again, and the receive is kept here once it ended
+	bool recv_paused;
+	void *recv_op;
+	// the append only file offset the queued replies wait for, see conn_durable
+	uint64_t aof_need;
 } Conn;
 
 typedef struct {
@@ -0,0 +1,255 @@
+/*
+ * hash.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include "hash.h"
+#include "common.h"
+#include "slab.h"
+
+uint32_t g_hash_max_packed = 128;
+
+static size_t hfield_size(size_t flen, size_t vlen) {
+	return sizeof(HField) + flen + vlen;
+}
+
+static HField* hfield_new(const char *field, size_t flen, const char *val, size_t vlen,
+		uint64_t hcode) {
+	HField *node = (HField*) slab_alloc(hfield_size(flen, vlen));
+	node->hmap.hcode = hcode;
+	node->flen = (uint32_t) flen;
+	node->vlen = (uint32_t) vlen;
+	memcpy(&node->data[0], field, flen);
+	memcpy(&node->data[flen], val, vlen);
+	return node;
+}
+
+static void hfield_del(HField *node) {
+	slab_free(node, hfield_size(node->flen, node->vlen));
+}
+
+// a packed entry: u8 len, the field, u8 len, the value
+static uint32_t pk_size(const uint8_t *p) {
+	return 2 + p[0] + p[1 + p[0]];
+}
+
+static const uint8_t* pk_val(const uint8_t *p) {
+	return &p[1 + p[0]];
+}
+
+// the offset of the field, false if it isn't there
+static bool pk_find(Hash *hash, const char *field, size_t flen, uint32_t *off) {
+	for (uint32_t pos = 0; pos < hash->pack.used; pos += pk_size(&hash->pack.data[pos])) {
+		const uint8_t *p = &hash->pack.data[pos];
+		if (p[0] == flen && 0 == memcmp(&p[1], field, flen)) {
+			*off = pos;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void pk_delete(Hash *hash, uint32_t off) {
+	pack_delete(&hash->pack, off, pk_size(&hash->pack.data[off]));
+}
+
+// a new field goes to the end, the order doesn't matter
+static void pk_append(Hash *hash, const char *field, size_t flen, const char *val, size_t vlen) {
+	uint8_t *p = pack_insert(&hash->pack, hash->pack.used, 2 + (uint32_t) (flen + vlen));
+	p[0] = (uint8_t) flen;
+	memcpy(&p[1], field, flen);
+	p[1 + flen] = (uint8_t) vlen;
+	memcpy(&p[2 + flen], val, vlen);
+}
+
+static void table_insert(Hash *hash, HField *node) {
+	hm_insert(&hash->hmap, &node->hmap);
+	hash->table_mem += slab_size_class(hfield_size(node->flen, node->vlen));
+}
+
+// moves the fields of a packed hash into the table, for good
+static void hash_convert(Hash *hash, size_t reserve) {
+	Pack pack = hash->pack;
+	hash->encoding = HASH_TABLE;
+	// the table lands on the pack, start it from zero
+	memset(&hash->hmap, 0, sizeof(HMap));
+	hash->table_mem = 0;
+	hm_reserve(&hash->hmap, reserve);
+	for (uint32_t pos = 0; pos < pack.used; pos += pk_size(&pack.data[pos])) {
+		const uint8_t *p = &pack.data[pos];
+		const uint8_t *v = pk_val(p);
+		table_insert(hash, hfield_new((const char*) &p[1], p[0], (const char*) &v[1], v[0],
+				str_hash(&p[1], p[0])));
+	}
+	pack_dispose(&pack);
+}
+
+// a helper structure for the hashtable lookup
+typedef struct {
+	HNode node;
+	const char *field;
+	size_t flen;
+} HKey;
+
+static int hcmp(HNode *node, HNode *key) {
+	if (node->hcode != key->hcode) {
+		return false;
+	}
+	HField *hfield = container_of(node, HField, hmap);
+	HKey *hkey = container_of(key, HKey, node);
+	return hfield->flen == hkey->flen && 0 == memcmp(hfield->data, hkey->field, hkey->flen);
+}
+
+static void hkey_init(HKey *key, const char *field, size_t flen) {
+	key->node.hcode = str_hash((uint8_t*) field, flen);
+	key->field = field;
+	key->flen = flen;
+}
+
+bool hash_set(Hash *hash, const char *field, size_t flen, const char *val, size_t vlen) {
+	if (hash->encoding == HASH_PACKED) {
+		uint32_t off = 0;
+		bool found = pk_find(hash, field, flen, &off);
+		if (found) {
+			uint8_t *v = (uint8_t*) pk_val(&hash->pack.data[off]);
+			if (v[0] == vlen) {
+				// the same length, overwritten where it is
+				memcpy(&v[1], val, vlen);
+				return false;
+			}
+		}
+		if (vlen <= HASH_MAX_PACKED_LEN && flen <= HASH_MAX_PACKED_LEN
+				&& (found || hash->pack.n < g_hash_max_packed)) {
+			if (found) {
+				pk_delete(hash, off);
+			}
+			pk_append(hash, field, flen, val, vlen);
+			return !found;
+		}
+		hash_convert(hash, (size_t) hash->pack.n + 1);
+	}
+	HKey key;
+	hkey_init(&key, field, flen);
+	HNode *found = hm_lookup(&hash->hmap, &key.node, &hcmp);
+	if (found) {
+		HField *node = container_of(found, HField, hmap);
+		size_t size = hfield_size(flen, node->vlen);
+		if (slab_size_class(size) == slab_size_class(hfield_size(flen, vlen))) {
+			// the allocation fits the new value too
+			memcpy(&node->data[flen], val, vlen);
+			node->vlen = (uint32_t) vlen;
+			return false;
+		}
+		hm_pop(&hash->hmap, &key.node, &hcmp);
+		hash->table_mem -= slab_size_class(size);
+		hfield_del(node);
+	}
+	table_insert(hash, hfield_new(field, flen, val, vlen, key.node.hcode));
+	return found == NULL;
+}
+
+bool hash_get(Hash *hash, const char *field, size_t flen, const char **val, size_t *vlen) {
+	if (hash->encoding == HASH_PACKED) {
+		uint32_t off = 0;
+		if (!pk_find(hash, field, flen, &off)) {
+			return false;
+		}
+		const uint8_t *v = pk_val(&hash->pack.data[off]);
+		*val = (const char*) &v[1];
+		*vlen = v[0];
+		return true;
+	}
+	HKey key;
+	hkey_init(&key, field, flen);
+	HNode *found = hm_lookup(&hash->hmap, &key.node, &hcmp);
+	if (!found) {
+		return false;
+	}
+	HField *node = container_of(found, HField, hmap);
+	*val = &node->data[node->flen];
+	*vlen = node->vlen;
+	return true;
+}
+
+bool hash_del(Hash *hash, const char *field, size_t flen) {
+	if (hash->encoding == HASH_PACKED) {
+		uint32_t off = 0;
+		if (!pk_find(hash, field, flen, &off)) {
+			return false;
+		}
+		pk_delete(hash, off);
+		return true;
+	}
+	HKey key;
+	hkey_init(&key, field, flen);
+	HNode *found = hm_pop(&hash->hmap, &key.node, &hcmp);
+	if (!found) {
+		return false;
+	}
+	HField *node = container_of(found, HField, hmap);
+	hash->table_mem -= slab_size_class(hfield_size(node->flen, node->vlen));
+	hfield_del(node);
+	return true;
+}
+
+size_t hash_size(Hash *hash) {
+	if (hash->encoding == HASH_PACKED) {
+		return hash->pack.n;
+	}
+	return hm_size(&hash->hmap);
+}
+
+typedef struct {
+	void (*f)(const char*, size_t, const char*, size_t, void*);
+	void *arg;
+} ScanCtx;
+
+static void cb_scan(HNode *node, void *arg) {
+	ScanCtx *ctx = (ScanCtx*) arg;
+	HField *hfield = container_of(node, HField, hmap);
+	ctx->f(hfield->data, hfield->flen, &hfield->data[hfield->flen], hfield->vlen, ctx->arg);
+}
+
+void hash_scan(Hash *hash, void (*f)(const char*, size_t, const char*, size_t, void*),
+		void *arg) {
+	if (hash->encoding == HASH_PACKED) {
+		for (uint32_t pos = 0; pos < hash->pack.used; pos += pk_size(&hash->pack.data[pos])) {
+			const uint8_t *p = &hash->pack.data[pos];
+			const uint8_t *v = pk_val(p);
+			f((const char*) &p[1], p[0], (const char*) &v[1], v[0], arg);
+		}
+		return;
+	}
+	ScanCtx ctx = { f, arg };
+	hm_scan(&hash->hmap, &cb_scan, &ctx);
+}
+
+void hash_reserve(Hash *hash, size_t n) {
+	if (hash->encoding == HASH_PACKED && n > g_hash_max_packed) {
+		hash_convert(hash, n);
+	}
+}
+
+size_t hash_mem(Hash *hash) {
+	if (hash->encoding == HASH_PACKED) {
+		return hash->pack.cap;
+	}
+	return hash->table_mem + hm_mem(&hash->hmap);
+}
+
+static void cb_dispose(HNode *node, void *arg) {
+	hfield_del(container_of(node, HField, hmap));
+}
+
+void hash_dispose(Hash *hash) {
+	if (hash->encoding == HASH_PACKED) {
+		pack_dispose(&hash->pack);
+		return;
+	}
+	hm_scan(&hash->hmap, &cb_dispose, NULL);
+	hm_destroy(&hash->hmap);
+}
@@ -0,0 +1,68 @@
+/*
+ * hash.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.h"
+#include "pack.h"
+
+// Small hashes are packed: one buffer of (u8 len, field, u8 len, value)
+// entries in no particular order, searched front to back. A hash that grows
+// past g_hash_max_packed fields, or gets a field or value longer than
+// HASH_MAX_PACKED_LEN, moves to a hashtable of fields, and stays there. A
+// zeroed Hash is an empty packed one.
+enum {
+	HASH_PACKED = 0, HASH_TABLE = 1,
+};
+
+#define HASH_MAX_PACKED_LEN 64
+
+// 0 packs nothing. Set at startup, before there are any hashes.
+extern uint32_t g_hash_max_packed;
+
+typedef struct {
+	uint32_t encoding;
+	union {
+		Pack pack;
+		struct {
+			HMap hmap;
+			// bytes of the fields
+			size_t table_mem;
+		};
+	};
+} Hash;
+
+// a field of a HASH_TABLE hash, the value right behind the name
+typedef struct {
+	HNode hmap;
+	uint32_t flen;
+	uint32_t vlen;
+	char data[0];
+} HField;
+
+// set field to val, true if the field is new
+extern bool hash_set(Hash *hash, const char *field, size_t flen, const char *val, size_t vlen);
+// the value of field, false if it isn't there. It stays valid until the
+// hash changes.
+extern bool hash_get(Hash *hash, const char *field, size_t flen, const char **val, size_t *vlen);
+extern bool hash_del(Hash *hash, const char *field, size_t flen);
+// the number of fields
+extern size_t hash_size(Hash *hash);
+// every field and its value, in no particular order
+extern void hash_scan(Hash *hash,
+		void (*f)(const char*, size_t, const char*, size_t, void*), void *arg);
+// for an empty hash that will get n fields
+extern void hash_reserve(Hash *hash, size_t n);
+// the bytes the hash holds on to besides the Hash itself
+extern size_t hash_mem(Hash *hash);
+extern void hash_dispose(Hash *hash);
+
+#endif /* HASH_H_ */
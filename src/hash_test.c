@@ -0,0 +1,198 @@
+/*
+ * hash_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "hash.h"
+#include "slab.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool set(Hash *hash, const char *field, const char *val, size_t vlen) {
+	return hash_set(hash, field, strlen(field), val, vlen);
+}
+
+// the value of field, which must be there
+static const char* get(Hash *hash, const char *field, size_t *vlen) {
+	const char *val = NULL;
+	bool found = hash_get(hash, field, strlen(field), &val, vlen);
+	assert(found);
+	return val;
+}
+
+static void expect(Hash *hash, const char *field, const char *val) {
+	size_t vlen = 0;
+	const char *got = get(hash, field, &vlen);
+	assert(vlen == strlen(val) && 0 == memcmp(got, val, vlen));
+}
+
+typedef struct {
+	char fields[8];
+	size_t n;
+} Order;
+
+static void cb_order(const char *field, size_t flen, const char *val, size_t vlen, void *arg) {
+	Order *order = (Order*) arg;
+	assert(flen == 1);
+	order->fields[order->n++] = field[0];
+}
+
+static void test_packed_update(void) {
+	g_hash_max_packed = 128;
+	Hash hash;
+	memset(&hash, 0, sizeof(hash));
+	assert(set(&hash, "a", "1", 1));
+	assert(set(&hash, "b", "22", 2));
+	assert(set(&hash, "c", "333", 3));
+
+	// the same length is written over where it is
+	size_t vlen = 0;
+	const char *before = get(&hash, "b", &vlen);
+	size_t mem = hash_mem(&hash);
+	assert(!set(&hash, "b", "xy", 2));
+	assert(get(&hash, "b", &vlen) == before);
+	expect(&hash, "b", "xy");
+	assert(hash_mem(&hash) == mem);
+
+	// another length takes the field out and puts it at the end
+	assert(!set(&hash, "b", "a longer one", 12));
+	expect(&hash, "a", "1");
+	expect(&hash, "b", "a longer one");
+	expect(&hash, "c", "333");
+	Order order = { { 0 }, 0 };
+	hash_scan(&hash, &cb_order, &order);
+	assert(order.n == 3 && 0 == memcmp(order.fields, "acb", 3));
+
+	// and it shrinks back without leaving a gap
+	assert(!set(&hash, "b", "s", 1));
+	expect(&hash, "b", "s");
+	assert(hash.pack.used == (2 + 1 + 1) + (2 + 1 + 3) + (2 + 1 + 1));
+	assert(hash_size(&hash) == 3);
+	assert(hash.encoding == HASH_PACKED);
+	hash_dispose(&hash);
+}
+
+static void test_packed_limits(void) {
+	g_hash_max_packed = 4;
+	Hash hash;
+	memset(&hash, 0, sizeof(hash));
+	char big[HASH_MAX_PACKED_LEN + 1];
+	memset(big, 'x', sizeof(big));
+	assert(set(&hash, "a", big, HASH_MAX_PACKED_LEN));
+	assert(set(&hash, "b", "2", 1));
+	assert(set(&hash, "c", "3", 1));
+	assert(set(&hash, "d", "4", 1));
+	// a full hash updates in place, only a new field is one too many
+	assert(!set(&hash, "d", "four", 4));
+	assert(hash.encoding == HASH_PACKED);
+	assert(set(&hash, "e", "5", 1));
+	assert(hash.encoding == HASH_TABLE);
+	expect(&hash, "d", "four");
+	expect(&hash, "e", "5");
+	assert(hash_size(&hash) == 5);
+	hash_dispose(&hash);
+
+	// so is a value that outgrows the packed entries
+	g_hash_max_packed = 128;
+	memset(&hash, 0, sizeof(hash));
+	assert(set(&hash, "a", "1", 1));
+	assert(set(&hash, "b", "2", 1));
+	assert(!set(&hash, "b", big, sizeof(big)));
+	assert(hash.encoding == HASH_TABLE);
+	expect(&hash, "a", "1");
+	size_t vlen = 0;
+	const char *val = get(&hash, "b", &vlen);
+	assert(vlen == sizeof(big) && 0 == memcmp(val, big, vlen));
+	assert(hash_size(&hash) == 2);
+	hash_dispose(&hash);
+}
+
+static void test_table_update(void) {
+	g_hash_max_packed = 0;
+	Hash hash;
+	memset(&hash, 0, sizeof(hash));
+	char vals[SLAB_MAX_SIZE];
+	memset(vals, 'v', sizeof(vals));
+	// the largest value that still fits the first field's size class, and one
+	// byte more
+	size_t cls = slab_size_class(sizeof(HField) + 1 + 1);
+	size_t fits = cls - sizeof(HField) - 1;
+	size_t next = slab_size_class(cls + 1);
+
+	assert(set(&hash, "f", vals, 1));
+	size_t vlen = 0;
+	const char *before = get(&hash, "f", &vlen);
+	size_t mem = hash_mem(&hash);
+	assert(!set(&hash, "f", vals, fits));
+	assert(get(&hash, "f", &vlen) == before && vlen == fits);
+	assert(hash_mem(&hash) == mem);
+
+	assert(!set(&hash, "f", vals, fits + 1));
+	get(&hash, "f", &vlen);
+	assert(vlen == fits + 1);
+	assert(hash_mem(&hash) == mem - cls + next);
+
+	assert(!set(&hash, "f", vals, 1));
+	get(&hash, "f", &vlen);
+	assert(vlen == 1);
+	assert(hash_mem(&hash) == mem);
+	assert(hash_size(&hash) == 1);
+	hash_dispose(&hash);
+}
+
+#define K_FIELDS 32
+
+// values with lengths all over, against a plain array of them
+static void test_random(uint32_t max_packed) {
+	g_hash_max_packed = max_packed;
+	Hash hash;
+	memset(&hash, 0, sizeof(hash));
+	int lens[K_FIELDS];
+	char vals[K_FIELDS][HASH_MAX_PACKED_LEN + 8];
+	for (int i = 0; i < K_FIELDS; i++) {
+		lens[i] = -1;
+	}
+	size_t n = 0;
+	for (int step = 0; step < 20000; step++) {
+		int i = rand() % K_FIELDS;
+		char field[8];
+		size_t flen = (size_t) sprintf(field, "f%d", i);
+		if (rand() % 4) {
+			int len = rand() % (int) sizeof(vals[i]);
+			memset(vals[i], 'a' + step % 26, (size_t) len);
+			assert(hash_set(&hash, field, flen, vals[i], (size_t) len) == (lens[i] < 0));
+			n += lens[i] < 0;
+			lens[i] = len;
+		} else {
+			assert(hash_del(&hash, field, flen) == (lens[i] >= 0));
+			n -= lens[i] >= 0;
+			lens[i] = -1;
+		}
+		assert(hash_size(&hash) == n);
+		if (step % 64 == 0) {
+			for (int j = 0; j < K_FIELDS; j++) {
+				flen = (size_t) sprintf(field, "f%d", j);
+				const char *val = NULL;
+				size_t vlen = 0;
+				assert(hash_get(&hash, field, flen, &val, &vlen) == (lens[j] >= 0));
+				assert(lens[j] < 0
+						|| (vlen == (size_t) lens[j] && 0 == memcmp(val, vals[j], vlen)));
+			}
+		}
+	}
+	hash_dispose(&hash);
+}
+
+int main(void) {
+	test_packed_update();
+	test_packed_limits();
+	test_table_update();
+	test_random(0);
+	test_random(K_FIELDS);
+	printf("Success!\n");
+	return 0;
+}
@@ -97,6 +97,23 @@ HNode *hm_lookup(
     return from ? *from : NULL;
 }
 
+void hm_prefetch(HMap *hmap, uint64_t hcode) {
+    if (hmap->ht1.tab) {
+        __builtin_prefetch(&hmap->ht1.tab[hcode & hmap->ht1.mask]);
+    }
+    if (hmap->ht2.tab) {
+        __builtin_prefetch(&hmap->ht2.tab[hcode & hmap->ht2.mask]);
+    }
+}
+
+HNode *hm_peek(HMap *hmap, uint64_t hcode) {
+    HNode *node = hmap->ht1.tab ? hmap->ht1.tab[hcode & hmap->ht1.mask] : NULL;
+    if (!node && hmap->ht2.tab) {
+        node = hmap->ht2.tab[hcode & hmap->ht2.mask];
+    }
+    return node;
+}
+
 const size_t k_max_load_factor = 8;
 
 void hm_insert(HMap *hmap, HNode *node) {
@@ -134,9 +151,138 @@ size_t hm_size(HMap *hmap) {
     return hmap->ht1.size + hmap->ht2.size;
 }
 
+void hm_reserve(HMap *hmap, size_t n) {
+    if (hm_size(hmap) > 0 || hmap->ht2.tab) {
+        return;
+    }
+    // stay under the load factor that starts a resize
+    size_t cap = 4;
+    while (cap * k_max_load_factor <= n) {
+        cap *= 2;
+    }
+    if (hmap->ht1.tab && hmap->ht1.mask + 1 >= cap) {
+        return;
+    }
+    free(hmap->ht1.tab);
+    h_init(&hmap->ht1, cap);
+}
+
+static void h_scan(HTab *tab, void (*f)(HNode *, void *), void *arg) {
+    if (tab->size == 0) {
+        return;
+    }
+    for (size_t i = 0; i < tab->mask + 1; ++i) {
+        HNode *node = tab->tab[i];
+        while (node) {
+            // f may free it
+            HNode *next = node->next;
+            f(node, arg);
+            node = next;
+        }
+    }
+}
+
+void hm_scan(HMap *hmap, void (*f)(HNode *, void *), void *arg) {
+    h_scan(&hmap->ht1, f, arg);
+    h_scan(&hmap->ht2, f, arg);
+}
+
+// the nodes that hash to bucket b
+static void h_scan_bucket(HTab *tab, size_t b, void (*f)(HNode *, void *), void *arg) {
+    for (HNode *node = tab->tab[b]; node; node = node->next) {
+        f(node, arg);
+    }
+}
+
+#define HTAB_LIVE(t) ((t)->tab != NULL)
+
+// The cursor counts with its bits reversed, so that the buckets already
+// visited in a table stay visited in a table twice (or half) the size:
+// bucket b of the small one becomes buckets b and b + size of the big one,
+// which are next to each other in this order. While resizing, a bucket of
+// the small table is visited together with all of its buckets in the big
+// one.
+static size_t rev_bits(size_t v) {
+    size_t r = 0;
+    for (size_t i = 0; i < sizeof(size_t) * 8; i++) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static size_t next_cursor(size_t v, size_t mask) {
+    v |= ~mask;
+    v = rev_bits(v);
+    v++;
+    return rev_bits(v);
+}
+
+size_t hm_scan_cursor(HMap *hmap, size_t cursor, void (*f)(HNode *, void *), void *arg) {
+    HTab *t0 = &hmap->ht1;
+    HTab *t1 = &hmap->ht2;
+    if (!HTAB_LIVE(t1)) {
+        if (!HTAB_LIVE(t0)) {
+            return 0;
+        }
+        h_scan_bucket(t0, cursor & t0->mask, f, arg);
+        return next_cursor(cursor, t0->mask);
+    }
+    if (!HTAB_LIVE(t0) || t0->mask > t1->mask) {
+        t0 = &hmap->ht2;
+        t1 = &hmap->ht1;
+    }
+    // t0 is the smaller one
+    h_scan_bucket(t0, cursor & t0->mask, f, arg);
+    do {
+        h_scan_bucket(t1, cursor & t1->mask, f, arg);
+        cursor = next_cursor(cursor, t1->mask);
+    } while (cursor & (t0->mask ^ t1->mask));
+    return cursor;
+}
+
+static size_t h_mem(HTab *tab) {
+    return tab->tab ? (tab->mask + 1) * sizeof(HNode *) : 0;
+}
+
+size_t hm_mem(HMap *hmap) {
+    return h_mem(&hmap->ht1) + h_mem(&hmap->ht2);
+}
+
+// the first bucket with nodes from a random one, and a random node of it
+static HNode *h_sample(HTab *tab, uint64_t rnd) {
+    for (size_t i = 0; i <= tab->mask; i++) {
+        HNode *node = tab->tab[(rnd + i) & tab->mask];
+        if (!node) {
+            continue;
+        }
+        size_t len = 0;
+        for (HNode *cur = node; cur; cur = cur->next) {
+            len++;
+        }
+        for (size_t k = (size_t) (rnd >> 40) % len; k > 0; k--) {
+            node = node->next;
+        }
+        return node;
+    }
+    return NULL;
+}
+
+HNode *hm_sample(HMap *hmap, uint64_t rnd) {
+    size_t total = hm_size(hmap);
+    if (total == 0) {
+        return NULL;
+    }
+    // by the sizes, the one being moved out of may still hold most of it
+    HTab *tab = (size_t) (rnd >> 20) % total < hmap->ht2.size ? &hmap->ht2 : &hmap->ht1;
+    return h_sample(tab, rnd);
+}
+
 void hm_destroy(HMap *hmap) {
     free(hmap->ht1.tab);
     free(hmap->ht2.tab);
+    HTab empty = {};
+    hmap->ht1 = hmap->ht2 = empty;
     hm_init(hmap);
 }
 
@@ -8,15 +8,31 @@
 // hashtable node, should be embedded into the payload
 typedef struct hnode {
     uint64_t hcode;
+#ifndef HMAP_SWISS
     struct hnode *next;
+#endif
 } HNode;
 
+#ifdef HMAP_SWISS
+// an open addressing table (hashtable_swiss.c). Every slot has a control byte
+// that is either empty, deleted, or the low 7 bits of the hash of the node in it,
+// and probing looks at a whole group of them at once.
+typedef struct {
+    uint8_t *ctrl;
+    HNode **slots;
+    size_t mask;
+    size_t size;
+    // size + deleted slots, the load factor is about these
+    size_t used;
+} HTab;
+#else
 // a simple fixed-sized hashtable
 typedef struct {
     HNode **tab;
     size_t mask;
     size_t size;
 } HTab;
+#endif
 
 // the real hashtable interface.
 // it uses 2 hashtables for progressive resizing.
@@ -28,9 +44,31 @@ typedef struct {
 
 extern void hm_init(HMap *hmap);
 extern HNode *hm_lookup(HMap *hmap, HNode *key, int (*cmp)(HNode *, HNode *));
+// starts pulling in the bucket a lookup of hcode would go to first, so that
+// a batch of lookups waits on memory once rather than once per key
+extern void hm_prefetch(HMap *hmap, uint64_t hcode);
+// the node a lookup of hcode would look at first, without comparing it to
+// anything, NULL if there is none. For prefetching once the bucket is in.
+extern HNode *hm_peek(HMap *hmap, uint64_t hcode);
 extern void hm_insert(HMap *hmap, HNode *node);
 extern HNode *hm_pop(HMap *hmap, HNode *key, int (*cmp)(HNode *, HNode *));
 extern size_t hm_size(HMap *hmap);
+// sizes an empty map for n nodes up front, so filling it doesn't go
+// through any resizing. Does nothing if the map isn't empty.
+extern void hm_reserve(HMap *hmap, size_t n);
+// calls f on every node of both tables. f may free the node, if the map
+// goes right to hm_destroy after.
+extern void hm_scan(HMap *hmap, void (*f)(HNode *, void *), void *arg);
+// one step of an incremental scan: calls f on the nodes of the bucket(s)
+// at cursor and returns the next cursor, 0 once everything was visited.
+// Start at 0. Nodes present for the whole scan are seen at least once
+// however the table resizes in between, some may be seen more than once.
+extern size_t hm_scan_cursor(HMap *hmap, size_t cursor, void (*f)(HNode *, void *), void *arg);
+// the bytes of the tables themselves, the nodes are the caller's
+extern size_t hm_mem(HMap *hmap);
+// some node picked by rnd, NULL if the map is empty. About uniform for
+// random rnds, for sampling (e.g. eviction candidates).
+extern HNode *hm_sample(HMap *hmap, uint64_t rnd);
 extern void hm_destroy(HMap *hmap);
 
 #endif /* HASHTABLE_H_ */
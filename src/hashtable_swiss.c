@@ -0,0 +1,427 @@
+/*
+ * hashtable_swiss.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ *
+ * An open addressing HMap backend, built instead of hashtable.c with
+ * `make HMAP=swiss`. The layout follows the Swiss table: one control byte
+ * per slot, probed a group of 16 at a time, so a lookup touches one or two
+ * cache lines of control bytes and only dereferences nodes whose 7 bit
+ * fingerprint matched. Resizing is progressive, same as the chained table.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP_WIDTH 16
+
+#define CTRL_EMPTY   ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xFE)
+
+// the low 7 bits are the fingerprint kept in the control byte,
+// the rest pick the starting group
+static inline uint8_t h2(uint64_t hcode) {
+    return (uint8_t) (hcode & 0x7F);
+}
+
+static inline size_t h1(uint64_t hcode) {
+    return (size_t) (hcode >> 7);
+}
+
+// bit i is set if byte i of the group equals b
+static inline uint32_t group_match(const uint8_t *group, uint8_t b) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) b)));
+#else
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++) {
+        bits |= (uint32_t) (group[i] == b) << i;
+    }
+    return bits;
+#endif
+}
+
+// bit i is set if slot i of the group is empty or deleted (the high bit is set)
+static inline uint32_t group_match_free(const uint8_t *group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(ctrl);
+#else
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++) {
+        bits |= (uint32_t) (group[i] >> 7) << i;
+    }
+    return bits;
+#endif
+}
+
+// n must be a power of 2, and at least one group.
+// The first group of control bytes is mirrored past the end,
+// so a group can be loaded from any position without wrapping.
+static void h_init(HTab *htab, size_t n) {
+    assert(n >= GROUP_WIDTH && ((n - 1) & n) == 0);
+    htab->ctrl = (uint8_t *) malloc(n + GROUP_WIDTH);
+    htab->slots = (HNode **) calloc(n, sizeof(HNode *));
+    if (!htab->ctrl || !htab->slots) {
+        abort();
+    }
+    memset(htab->ctrl, CTRL_EMPTY, n + GROUP_WIDTH);
+    htab->mask = n - 1;
+    htab->size = 0;
+    htab->used = 0;
+}
+
+static void set_ctrl(HTab *htab, size_t pos, uint8_t c) {
+    htab->ctrl[pos] = c;
+    if (pos < GROUP_WIDTH) {
+        htab->ctrl[htab->mask + 1 + pos] = c;
+    }
+}
+
+// hashtable insertion, the caller makes sure there is room
+static void h_insert(HTab *htab, HNode *node) {
+    size_t pos = h1(node->hcode) & htab->mask;
+    size_t stride = 0;
+    while (true) {
+        uint32_t free_bits = group_match_free(&htab->ctrl[pos]);
+        if (free_bits) {
+            size_t slot = (pos + (size_t) __builtin_ctz(free_bits)) & htab->mask;
+            if (htab->ctrl[slot] == CTRL_EMPTY) {
+                htab->used++;
+            }
+            set_ctrl(htab, slot, h2(node->hcode));
+            htab->slots[slot] = node;
+            htab->size++;
+            return;
+        }
+        // triangular probing visits every group of a power of 2 sized table
+        stride += GROUP_WIDTH;
+        pos = (pos + stride) & htab->mask;
+    }
+}
+
+// hashtable look up subroutine, returns the slot index or -1.
+static size_t h_lookup(HTab *htab, HNode *key, int (*cmp)(HNode *, HNode *)) {
+    if (!htab->ctrl) {
+        return (size_t) -1;
+    }
+
+    uint8_t fp = h2(key->hcode);
+    size_t pos = h1(key->hcode) & htab->mask;
+    size_t stride = 0;
+    while (true) {
+        const uint8_t *group = &htab->ctrl[pos];
+        uint32_t bits = group_match(group, fp);
+        while (bits) {
+            size_t slot = (pos + (size_t) __builtin_ctz(bits)) & htab->mask;
+            if (cmp(htab->slots[slot], key)) {
+                return slot;
+            }
+            bits &= bits - 1;
+        }
+        if (group_match(group, CTRL_EMPTY)) {
+            // an empty slot ends the probe sequence
+            return (size_t) -1;
+        }
+        stride += GROUP_WIDTH;
+        if (stride > htab->mask) {
+            // visited every group
+            return (size_t) -1;
+        }
+        pos = (pos + stride) & htab->mask;
+    }
+}
+
+// remove a node, leaving a tombstone so that probe sequences stay intact
+static HNode *h_detach(HTab *htab, size_t slot) {
+    HNode *node = htab->slots[slot];
+    htab->slots[slot] = NULL;
+    set_ctrl(htab, slot, CTRL_DELETED);
+    htab->size--;
+    return node;
+}
+
+static void h_free(HTab *htab) {
+    free(htab->ctrl);
+    free(htab->slots);
+    HTab empty = {};
+    *htab = empty;
+}
+
+const size_t k_resizing_work = 128;
+
+static void hm_help_resizing(HMap *hmap) {
+    if (hmap->ht2.ctrl == NULL) {
+        return;
+    }
+
+    size_t nwork = 0;
+    while (nwork < k_resizing_work && hmap->ht2.size > 0) {
+        // scan for nodes from ht2 and move them to ht1
+        size_t pos = hmap->resizing_pos;
+        assert(pos <= hmap->ht2.mask);
+        if (hmap->ht2.ctrl[pos] & 0x80) {
+            hmap->resizing_pos++;
+            continue;
+        }
+
+        h_insert(&hmap->ht1, h_detach(&hmap->ht2, pos));
+        nwork++;
+    }
+
+    if (hmap->ht2.size == 0) {
+        // done
+        h_free(&hmap->ht2);
+    }
+}
+
+// the table is full at 7/8, counting tombstones
+static bool h_needs_resizing(HTab *htab) {
+    size_t cap = htab->mask + 1;
+    return htab->used >= cap - cap / 8;
+}
+
+static void hm_start_resizing(HMap *hmap) {
+    if (hmap->ht2.ctrl != NULL) {
+        // still moving from the last resize, this can only happen with lots
+        // of tombstones. Finish that first.
+        while (hmap->ht2.ctrl != NULL) {
+            hm_help_resizing(hmap);
+        }
+    }
+    // size the new table from the live nodes only, dropping the tombstones,
+    // so that it is at most half full once everything has moved over.
+    size_t n = GROUP_WIDTH;
+    while (n / 2 < hmap->ht1.size + 1) {
+        n *= 2;
+    }
+    hmap->ht2 = hmap->ht1;
+    h_init(&hmap->ht1, n);
+    hmap->resizing_pos = 0;
+}
+
+HNode *hm_lookup(HMap *hmap, HNode *key, int (*cmp)(HNode *, HNode *)) {
+    hm_help_resizing(hmap);
+    size_t slot = h_lookup(&hmap->ht1, key, cmp);
+    if (slot != (size_t) -1) {
+        return hmap->ht1.slots[slot];
+    }
+    slot = h_lookup(&hmap->ht2, key, cmp);
+    return slot != (size_t) -1 ? hmap->ht2.slots[slot] : NULL;
+}
+
+static void h_prefetch(HTab *htab, uint64_t hcode) {
+    if (htab->ctrl) {
+        size_t pos = h1(hcode) & htab->mask;
+        __builtin_prefetch(&htab->ctrl[pos]);
+        __builtin_prefetch(&htab->slots[pos]);
+    }
+}
+
+void hm_prefetch(HMap *hmap, uint64_t hcode) {
+    h_prefetch(&hmap->ht1, hcode);
+    h_prefetch(&hmap->ht2, hcode);
+}
+
+// the first slot of the starting group whose fingerprint matches
+static HNode *h_peek(HTab *htab, uint64_t hcode) {
+    if (!htab->ctrl) {
+        return NULL;
+    }
+    size_t pos = h1(hcode) & htab->mask;
+    uint32_t bits = group_match(&htab->ctrl[pos], h2(hcode));
+    return bits ? htab->slots[(pos + (size_t) __builtin_ctz(bits)) & htab->mask] : NULL;
+}
+
+HNode *hm_peek(HMap *hmap, uint64_t hcode) {
+    HNode *node = h_peek(&hmap->ht1, hcode);
+    return node ? node : h_peek(&hmap->ht2, hcode);
+}
+
+void hm_insert(HMap *hmap, HNode *node) {
+    if (!hmap->ht1.ctrl) {
+        h_init(&hmap->ht1, GROUP_WIDTH);
+    }
+    h_insert(&hmap->ht1, node);
+
+    if (h_needs_resizing(&hmap->ht1)) {
+        hm_start_resizing(hmap);
+    }
+    hm_help_resizing(hmap);
+}
+
+HNode *hm_pop(HMap *hmap, HNode *key, int (*cmp)(HNode *, HNode *)) {
+    hm_help_resizing(hmap);
+    size_t slot = h_lookup(&hmap->ht1, key, cmp);
+    if (slot != (size_t) -1) {
+        return h_detach(&hmap->ht1, slot);
+    }
+    slot = h_lookup(&hmap->ht2, key, cmp);
+    if (slot != (size_t) -1) {
+        return h_detach(&hmap->ht2, slot);
+    }
+    return NULL;
+}
+
+size_t hm_size(HMap *hmap) {
+    return hmap->ht1.size + hmap->ht2.size;
+}
+
+void hm_reserve(HMap *hmap, size_t n) {
+    if (hm_size(hmap) > 0 || hmap->ht2.ctrl) {
+        return;
+    }
+    // stay under the 7/8 that starts a resize
+    size_t cap = GROUP_WIDTH;
+    while (cap - cap / 8 <= n) {
+        cap *= 2;
+    }
+    if (hmap->ht1.ctrl && hmap->ht1.mask + 1 >= cap) {
+        return;
+    }
+    h_free(&hmap->ht1);
+    h_init(&hmap->ht1, cap);
+}
+
+static void h_scan(HTab *tab, void (*f)(HNode *, void *), void *arg) {
+    if (tab->size == 0) {
+        return;
+    }
+    for (size_t i = 0; i < tab->mask + 1; ++i) {
+        if (!(tab->ctrl[i] & 0x80)) {
+            f(tab->slots[i], arg);
+        }
+    }
+}
+
+void hm_scan(HMap *hmap, void (*f)(HNode *, void *), void *arg) {
+    h_scan(&hmap->ht1, f, arg);
+    h_scan(&hmap->ht2, f, arg);
+}
+
+// the nodes whose probe sequence starts at slot b. They are all found
+// before the first group with an empty slot, same as for a lookup, but
+// that group may be shared with nodes starting elsewhere.
+static void h_scan_bucket(HTab *tab, size_t b, void (*f)(HNode *, void *), void *arg) {
+    size_t pos = b;
+    size_t stride = 0;
+    while (true) {
+        const uint8_t *group = &tab->ctrl[pos];
+        uint32_t full = ~group_match_free(group) & 0xFFFF;
+        while (full) {
+            size_t slot = (pos + (size_t) __builtin_ctz(full)) & tab->mask;
+            HNode *node = tab->slots[slot];
+            if ((h1(node->hcode) & tab->mask) == b) {
+                f(node, arg);
+            }
+            full &= full - 1;
+        }
+        if (group_match(group, CTRL_EMPTY)) {
+            return;
+        }
+        stride += GROUP_WIDTH;
+        if (stride > tab->mask) {
+            return;
+        }
+        pos = (pos + stride) & tab->mask;
+    }
+}
+
+#define HTAB_LIVE(t) ((t)->ctrl != NULL)
+
+// The bucket of a node is where its probe sequence starts, h1 & mask.
+
+// The cursor counts with its bits reversed, so that the buckets already
+// visited in a table stay visited in a table twice (or half) the size:
+// bucket b of the small one becomes buckets b and b + size of the big one,
+// which are next to each other in this order. While resizing, a bucket of
+// the small table is visited together with all of its buckets in the big
+// one.
+static size_t rev_bits(size_t v) {
+    size_t r = 0;
+    for (size_t i = 0; i < sizeof(size_t) * 8; i++) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static size_t next_cursor(size_t v, size_t mask) {
+    v |= ~mask;
+    v = rev_bits(v);
+    v++;
+    return rev_bits(v);
+}
+
+size_t hm_scan_cursor(HMap *hmap, size_t cursor, void (*f)(HNode *, void *), void *arg) {
+    HTab *t0 = &hmap->ht1;
+    HTab *t1 = &hmap->ht2;
+    if (!HTAB_LIVE(t1)) {
+        if (!HTAB_LIVE(t0)) {
+            return 0;
+        }
+        h_scan_bucket(t0, cursor & t0->mask, f, arg);
+        return next_cursor(cursor, t0->mask);
+    }
+    if (!HTAB_LIVE(t0) || t0->mask > t1->mask) {
+        t0 = &hmap->ht2;
+        t1 = &hmap->ht1;
+    }
+    // t0 is the smaller one
+    h_scan_bucket(t0, cursor & t0->mask, f, arg);
+    do {
+        h_scan_bucket(t1, cursor & t1->mask, f, arg);
+        cursor = next_cursor(cursor, t1->mask);
+    } while (cursor & (t0->mask ^ t1->mask));
+    return cursor;
+}
+
+static size_t h_mem(HTab *tab) {
+    return tab->ctrl ? (tab->mask + 1) * (1 + sizeof(HNode *)) + GROUP_WIDTH : 0;
+}
+
+size_t hm_mem(HMap *hmap) {
+    return h_mem(&hmap->ht1) + h_mem(&hmap->ht2);
+}
+
+// the first full slot from a random one, a group of control bytes at a time
+static HNode *h_sample(HTab *tab, uint64_t rnd) {
+    size_t n = tab->mask + 1;
+    size_t pos = (size_t) rnd & tab->mask;
+    for (size_t i = 0; i < n; i += GROUP_WIDTH) {
+        uint32_t full = ~group_match_free(&tab->ctrl[pos]) & 0xFFFF;
+        if (full) {
+            return tab->slots[(pos + (size_t) __builtin_ctz(full)) & tab->mask];
+        }
+        pos = (pos + GROUP_WIDTH) & tab->mask;
+    }
+    return NULL;
+}
+
+HNode *hm_sample(HMap *hmap, uint64_t rnd) {
+    size_t total = hm_size(hmap);
+    if (total == 0) {
+        return NULL;
+    }
+    // by the sizes, the one being moved out of may still hold most of it
+    HTab *tab = (size_t) (rnd >> 20) % total < hmap->ht2.size ? &hmap->ht2 : &hmap->ht1;
+    return h_sample(tab, rnd);
+}
+
+void hm_destroy(HMap *hmap) {
+    h_free(&hmap->ht1);
+    h_free(&hmap->ht2);
+    hm_init(hmap);
+}
+
+void hm_init(HMap *hmap) {
+    hmap->resizing_pos = 0;
+}
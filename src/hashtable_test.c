@@ -0,0 +1,165 @@
+/*
+ * hashtable_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ *
+ * Runs against whichever backend was built: `make hashtable_test` or
+ * `make HMAP=swiss hashtable_test`.
+ */
+
+#include "hashtable.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+typedef struct {
+	HNode node;
+	uint64_t val;
+} Item;
+
+static int item_eq(HNode *lhs, HNode *rhs) {
+	Item *l = (Item*) ((char*) lhs - offsetof(Item, node));
+	Item *r = (Item*) ((char*) rhs - offsetof(Item, node));
+	return l->val == r->val;
+}
+
+// a poor hash on purpose, lots of collisions in the low bits
+static uint64_t hash(uint64_t val) {
+	return (val * 0x9E3779B1u) & 0xFFFFFF00u;
+}
+
+static Item *lookup(HMap *hmap, uint64_t val) {
+	Item key;
+	key.val = val;
+	key.node.hcode = hash(val);
+	HNode *node = hm_lookup(hmap, &key.node, &item_eq);
+	return node ? (Item*) ((char*) node - offsetof(Item, node)) : NULL;
+}
+
+static void count(HNode *node, void *arg) {
+	(void) node;
+	(*(size_t*) arg)++;
+}
+
+static void mark(HNode *node, void *arg) {
+	Item *item = (Item*) ((char*) node - offsetof(Item, node));
+	((unsigned char*) arg)[item->val] = 1;
+}
+
+int main(void) {
+	const size_t n = 100000;
+	HMap hmap = {};
+	hm_init(&hmap);
+	Item *items = calloc(n, sizeof(Item));
+	for (size_t i = 0; i < n; i++) {
+		items[i].val = i;
+		items[i].node.hcode = hash(i);
+		hm_insert(&hmap, &items[i].node);
+		// the one just inserted, and an old one possibly still in ht2
+		assert(lookup(&hmap, i) == &items[i]);
+		assert(lookup(&hmap, i / 2) == &items[i / 2]);
+	}
+	assert(hm_size(&hmap) == n);
+	assert(lookup(&hmap, n) == NULL);
+
+	// remove every other one, interleaved with inserts to keep resizing going
+	for (size_t i = 0; i < n; i += 2) {
+		Item key;
+		key.val = i;
+		key.node.hcode = hash(i);
+		HNode *node = hm_pop(&hmap, &key.node, &item_eq);
+		assert(node == &items[i].node);
+		assert(hm_pop(&hmap, &key.node, &item_eq) == NULL);
+	}
+	assert(hm_size(&hmap) == n / 2);
+	for (size_t i = 0; i < n; i++) {
+		assert(lookup(&hmap, i) == (i % 2 ? &items[i] : NULL));
+	}
+
+	// reinsert, reusing the deleted slots
+	for (size_t i = 0; i < n; i += 2) {
+		hm_insert(&hmap, &items[i].node);
+	}
+	size_t seen = 0;
+	hm_scan(&hmap, &count, &seen);
+	assert(seen == n);
+	assert(hm_size(&hmap) == n);
+	for (size_t i = 0; i < n; i++) {
+		assert(lookup(&hmap, i) == &items[i]);
+	}
+
+	hm_destroy(&hmap);
+
+	// an incremental scan over a table that keeps growing underneath it still
+	// sees every node that was there from the start
+	hm_init(&hmap);
+	const size_t half = n / 2;
+	for (size_t i = 0; i < half; i++) {
+		hm_insert(&hmap, &items[i].node);
+	}
+	unsigned char *marks = calloc(n, 1);
+	size_t cursor = 0;
+	size_t next = half;
+	do {
+		cursor = hm_scan_cursor(&hmap, cursor, &mark, marks);
+		if (next < n) {
+			hm_insert(&hmap, &items[next++].node);
+		}
+	} while (cursor != 0);
+	for (size_t i = 0; i < half; i++) {
+		assert(marks[i]);
+	}
+	free(marks);
+	hm_destroy(&hmap);
+
+	// a reserved map takes everything without starting a resize, which
+	// would leave the old nodes in ht2 for a while
+	hm_init(&hmap);
+	hm_reserve(&hmap, n);
+	for (size_t i = 0; i < n; i++) {
+		hm_insert(&hmap, &items[i].node);
+		assert(hmap.ht2.size == 0);
+	}
+	assert(hm_size(&hmap) == n);
+	assert(lookup(&hmap, n - 1) == &items[n - 1]);
+	// a peek only ever finds nodes of the map, and in a map of one node
+	// it's the node
+	for (size_t i = 0; i < n; i += 97) {
+		HNode *node = hm_peek(&hmap, hash(i));
+		assert(node && lookup(&hmap, ((Item*) ((char*) node - offsetof(Item, node)))->val));
+	}
+	hm_destroy(&hmap);
+	hm_init(&hmap);
+	assert(hm_peek(&hmap, hash(1)) == NULL);
+	hm_insert(&hmap, &items[1].node);
+	assert(hm_peek(&hmap, hash(1)) == &items[1].node);
+	hm_destroy(&hmap);
+
+	// samples come from the map, and are spread over all of it
+	hm_init(&hmap);
+	assert(hm_sample(&hmap, 1) == NULL);
+	for (size_t i = 0; i < n; i++) {
+		hm_insert(&hmap, &items[i].node);
+	}
+	marks = calloc(n, 1);
+	size_t distinct = 0;
+	uint64_t rnd = 1;
+	for (size_t i = 0; i < n; i++) {
+		rnd = rnd * 6364136223846793005ull + 1442695040888963407ull;
+		HNode *node = hm_sample(&hmap, rnd);
+		assert(node);
+		Item *item = (Item*) ((char*) node - offsetof(Item, node));
+		assert(item == &items[item->val]);
+		distinct += !marks[item->val];
+		marks[item->val] = 1;
+	}
+	// n uniform draws out of n hit about 63% of them
+	assert(distinct > n / 2);
+	free(marks);
+	hm_destroy(&hmap);
+
+	free(items);
+	printf("Success!\n");
+}
@@ -0,0 +1,62 @@
+/*
+ * mailbox.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <stddef.h>
+#include "mailbox.h"
+
+void mailbox_init(Mailbox *mb) {
+	atomic_store(&mb->stub.next, NULL);
+	atomic_store(&mb->head, &mb->stub);
+	mb->tail = &mb->stub;
+	atomic_store(&mb->notified, false);
+}
+
+static void push(Mailbox *mb, Mail *mail) {
+	atomic_store(&mail->next, NULL);
+	Mail *prev = atomic_exchange(&mb->head, mail);
+	// between the exchange and this store the queue is briefly "cut",
+	// mailbox_take() copes with that by reporting empty.
+	atomic_store(&prev->next, mail);
+}
+
+bool mailbox_post(Mailbox *mb, Mail *mail) {
+	push(mb, mail);
+	return !atomic_exchange(&mb->notified, true);
+}
+
+void mailbox_rearm(Mailbox *mb) {
+	atomic_store(&mb->notified, false);
+}
+
+Mail* mailbox_take(Mailbox *mb) {
+	Mail *tail = mb->tail;
+	Mail *next = atomic_load(&tail->next);
+	if (tail == &mb->stub) {
+		if (!next) {
+			return NULL;
+		}
+		// skip over the stub
+		mb->tail = next;
+		tail = next;
+		next = atomic_load(&tail->next);
+	}
+	if (next) {
+		mb->tail = next;
+		return tail;
+	}
+	if (tail != atomic_load(&mb->head)) {
+		// a producer is in the middle of a post
+		return NULL;
+	}
+	// tail is the last one, put the stub behind it so it can be handed out
+	push(mb, &mb->stub);
+	next = atomic_load(&tail->next);
+	if (next) {
+		mb->tail = next;
+		return tail;
+	}
+	return NULL;
+}
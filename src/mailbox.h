@@ -0,0 +1,39 @@
+/*
+ * mailbox.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// mailbox node, should be embedded into the payload
+typedef struct mail {
+	struct mail *_Atomic next;
+} Mail;
+
+// a lock-free, intrusive, multi-producer single-consumer queue.
+// any thread may post, only the owning thread may take.
+typedef struct {
+	Mail *_Atomic head;     // producers push here
+	Mail *tail;             // the consumer pops from here
+	Mail stub;
+	// set by the first producer after the consumer went to sleep,
+	// so that only one of them has to wake it up.
+	atomic_bool notified;
+} Mailbox;
+
+extern void mailbox_init(Mailbox *mb);
+// returns true if the caller is responsible for waking up the consumer
+extern bool mailbox_post(Mailbox *mb, Mail *mail);
+// call before draining the box, after having been woken up
+extern void mailbox_rearm(Mailbox *mb);
+// returns NULL when empty (or when a producer is half way through a post,
+// in which case that producer's wake up is still to come)
+extern Mail* mailbox_take(Mailbox *mb);
+
+#endif /* MAILBOX_H_ */
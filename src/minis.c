@@ -0,0 +1,540 @@
+/*
+ * minis.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "minis.h"
+#include "common.h"
+
+// the least room a read gets
+#define K_READ_CHUNK (16 * 1024)
+// replies don't nest much, this only has to stop garbage from blowing the stack
+#define K_MAX_DEPTH 64
+
+static int reserve(uint8_t **buf, size_t *cap, size_t need) {
+	if (need <= *cap) {
+		return 0;
+	}
+	size_t new_cap = *cap ? *cap : 4096;
+	while (new_cap < need) {
+		new_cap *= 2;
+	}
+	uint8_t *grown = realloc(*buf, new_cap);
+	if (!grown) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*buf = grown;
+	*cap = new_cap;
+	return 0;
+}
+
+void minis_init(MinisConn *conn, int fd) {
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = fd;
+}
+
+int minis_connect(MinisConn *conn, const struct sockaddr_in *addr) {
+	return minis_connect_timeout(conn, addr, 0);
+}
+
+int minis_connect_timeout(MinisConn *conn, const struct sockaddr_in *addr,
+		uint32_t timeout_ms) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	int val = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+	if (timeout_ms) {
+		// connect goes by the send timeout
+		struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	}
+	if (connect(fd, (const struct sockaddr*) addr, sizeof(*addr))) {
+		int err = errno == EINPROGRESS ? ETIMEDOUT : errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	minis_init(conn, fd);
+	conn->timeout_ms = timeout_ms;
+	return 0;
+}
+
+void minis_close(MinisConn *conn) {
+	if (conn->fd >= 0) {
+		close(conn->fd);
+	}
+	free(conn->wbuf);
+	free(conn->rbuf);
+	minis_init(conn, -1);
+}
+
+int minis_append(MinisConn *conn, uint32_t nargs, const char *const *args, const uint32_t *lens) {
+	size_t len = 4;
+	for (uint32_t i = 0; i < nargs; i++) {
+		len += 4 + (size_t) lens[i];
+	}
+	if (len > K_MAX_MSG) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (reserve(&conn->wbuf, &conn->wbuf_cap, conn->wbuf_size + 4 + len)) {
+		return -1;
+	}
+	// assume little endian, like the server
+	uint8_t *pos = &conn->wbuf[conn->wbuf_size];
+	uint32_t len32 = (uint32_t) len;
+	memcpy(pos, &len32, 4);
+	memcpy(pos + 4, &nargs, 4);
+	pos += 8;
+	for (uint32_t i = 0; i < nargs; i++) {
+		memcpy(pos, &lens[i], 4);
+		memcpy(pos + 4, args[i], lens[i]);
+		pos += 4 + lens[i];
+	}
+	conn->wbuf_size += 4 + len;
+	conn->pending++;
+	return 0;
+}
+
+int minis_append_strs(MinisConn *conn, uint32_t nargs, const char *const *args) {
+	uint32_t lens[K_MAX_ARGS];
+	if (nargs > K_MAX_ARGS) {
+		errno = E2BIG;
+		return -1;
+	}
+	for (uint32_t i = 0; i < nargs; i++) {
+		lens[i] = (uint32_t) strlen(args[i]);
+	}
+	return minis_append(conn, nargs, args, lens);
+}
+
+int minis_flush(MinisConn *conn) {
+	size_t done = 0;
+	while (done < conn->wbuf_size) {
+		ssize_t rv = write(conn->fd, &conn->wbuf[done], conn->wbuf_size - done);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv < 0 && errno == EAGAIN && conn->timeout_ms) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (rv < 0 && errno == EAGAIN) {
+			// a non blocking fd, wait for the server to catch up
+			struct pollfd pfd = { .fd = conn->fd, .events = POLLOUT };
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		if (rv <= 0) {
+			return -1;
+		}
+		done += (size_t) rv;
+	}
+	conn->wbuf_size = 0;
+	return 0;
+}
+
+int minis_fill(MinisConn *conn) {
+	if (conn->rbuf_pos > 0) {
+		memmove(conn->rbuf, &conn->rbuf[conn->rbuf_pos], conn->rbuf_size - conn->rbuf_pos);
+		conn->rbuf_size -= conn->rbuf_pos;
+		conn->rbuf_pos = 0;
+	}
+	// room for the whole reply that has started, so a big one is read in as
+	// few calls as it takes
+	size_t need = conn->rbuf_size + K_READ_CHUNK;
+	if (conn->rbuf_size >= 4) {
+		uint32_t len = 0;
+		memcpy(&len, conn->rbuf, 4);
+		if (len <= K_MAX_MSG && 4 + (size_t) len > need) {
+			need = 4 + (size_t) len;
+		}
+	}
+	if (reserve(&conn->rbuf, &conn->rbuf_cap, need)) {
+		return -1;
+	}
+	ssize_t rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], conn->rbuf_cap - conn->rbuf_size);
+	if (rv < 0 && errno == EAGAIN && conn->timeout_ms) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	if (rv < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return 0;
+	}
+	if (rv == 0) {
+		errno = ECONNRESET;
+		return -1;
+	}
+	if (rv < 0) {
+		return -1;
+	}
+	conn->rbuf_size += (size_t) rv;
+	return 1;
+}
+
+static int64_t parse(const uint8_t *data, size_t size, MinisReply *reply, int depth) {
+	if (size < 1 || depth > K_MAX_DEPTH) {
+		return -1;
+	}
+	memset(reply, 0, sizeof(*reply));
+	reply->type = data[0];
+	switch (data[0]) {
+	case SER_NIL:
+		return 1;
+	case SER_ERR: {
+		if (size < 1 + 8) {
+			return -1;
+		}
+		int32_t code = 0;
+		memcpy(&code, &data[1], 4);
+		memcpy(&reply->len, &data[1 + 4], 4);
+		if (size - (1 + 8) < reply->len) {
+			return -1;
+		}
+		reply->num = code;
+		reply->data = &data[1 + 8];
+		return 1 + 8 + (int64_t) reply->len;
+	}
+	case SER_STR:
+		if (size < 1 + 4) {
+			return -1;
+		}
+		memcpy(&reply->len, &data[1], 4);
+		if (size - (1 + 4) < reply->len) {
+			return -1;
+		}
+		reply->data = &data[1 + 4];
+		return 1 + 4 + (int64_t) reply->len;
+	case SER_INT:
+		if (size < 1 + 8) {
+			return -1;
+		}
+		memcpy(&reply->num, &data[1], 8);
+		return 1 + 8;
+	case SER_DBL:
+		if (size < 1 + 8) {
+			return -1;
+		}
+		memcpy(&reply->dbl, &data[1], 8);
+		return 1 + 8;
+	case SER_ARR: {
+		if (size < 1 + 4) {
+			return -1;
+		}
+		memcpy(&reply->len, &data[1], 4);
+		// walk the elements once to know where the array ends, minis_next
+		// then doesn't have to check anything twice
+		size_t pos = 1 + 4;
+		for (uint32_t i = 0; i < reply->len; i++) {
+			MinisReply elem;
+			int64_t rv = parse(&data[pos], size - pos, &elem, depth + 1);
+			if (rv < 0) {
+				return -1;
+			}
+			pos += (size_t) rv;
+		}
+		reply->data = &data[1 + 4];
+		reply->end = &data[pos];
+		return (int64_t) pos;
+	}
+	default:
+		return -1;
+	}
+}
+
+int64_t minis_parse(const uint8_t *data, size_t size, MinisReply *reply) {
+	return parse(data, size, reply, 0);
+}
+
+int minis_next(const MinisReply *arr, const uint8_t **pos, MinisReply *elem) {
+	if (*pos >= arr->end) {
+		return 0;
+	}
+	int64_t rv = minis_parse(*pos, (size_t) (arr->end - *pos), elem);
+	if (rv < 0) {
+		return -1;
+	}
+	*pos += rv;
+	return 1;
+}
+
+int minis_take(MinisConn *conn, MinisReply *reply) {
+	size_t avail = conn->rbuf_size - conn->rbuf_pos;
+	if (avail < 4) {
+		return 0;
+	}
+	uint32_t len = 0;
+	memcpy(&len, &conn->rbuf[conn->rbuf_pos], 4);
+	if (len > K_MAX_MSG) {
+		return -1;
+	}
+	if (avail < 4 + (size_t) len) {
+		return 0;
+	}
+	int64_t rv = minis_parse(&conn->rbuf[conn->rbuf_pos + 4], len, reply);
+	if (rv != (int64_t) len) {
+		return -1;
+	}
+	conn->rbuf_pos += 4 + (size_t) len;
+	if (conn->pending > 0) {
+		conn->pending--;
+	}
+	return 1;
+}
+
+int minis_read(MinisConn *conn, MinisReply *reply) {
+	if (conn->wbuf_size > 0 && minis_flush(conn)) {
+		return -1;
+	}
+	while (true) {
+		int rv = minis_take(conn, reply);
+		if (rv != 0) {
+			return rv > 0 ? 0 : -1;
+		}
+		if (minis_fill(conn) < 0) {
+			return -1;
+		}
+	}
+}
+
+void minis_pool_init(MinisPool *pool, const struct sockaddr_in *addr, size_t max_idle) {
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->mu, NULL);
+	pool->addr = *addr;
+	pool->max_idle = max_idle;
+}
+
+void minis_pool_destroy(MinisPool *pool) {
+	while (pool->idle) {
+		MinisConn *conn = pool->idle;
+		pool->idle = conn->next;
+		minis_close(conn);
+		free(conn);
+	}
+	pool->nidle = 0;
+	pthread_mutex_destroy(&pool->mu);
+}
+
+MinisConn* minis_pool_get(MinisPool *pool) {
+	pthread_mutex_lock(&pool->mu);
+	MinisConn *conn = pool->idle;
+	if (conn) {
+		pool->idle = conn->next;
+		pool->nidle--;
+	}
+	pthread_mutex_unlock(&pool->mu);
+	if (conn) {
+		conn->next = NULL;
+		return conn;
+	}
+	// connecting is slow, outside of the lock
+	conn = malloc(sizeof(MinisConn));
+	if (!conn) {
+		return NULL;
+	}
+	if (minis_connect(conn, &pool->addr)) {
+		free(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+void minis_pool_put(MinisPool *pool, MinisConn *conn, bool broken) {
+	// anything left over would be taken for the next user's replies
+	bool reusable = !broken && conn->pending == 0 && conn->wbuf_size == 0
+			&& conn->rbuf_pos == conn->rbuf_size;
+	if (reusable) {
+		conn->rbuf_pos = conn->rbuf_size = 0;
+		pthread_mutex_lock(&pool->mu);
+		if (pool->nidle < pool->max_idle) {
+			conn->next = pool->idle;
+			pool->idle = conn;
+			pool->nidle++;
+			conn = NULL;
+		}
+		pthread_mutex_unlock(&pool->mu);
+	}
+	if (conn) {
+		minis_close(conn);
+		free(conn);
+	}
+}
+
+static bool same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+	return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// the index of the pool for addr, a new one if there is none yet.
+// MINIS_NO_NODE when there are too many.
+static uint32_t cluster_pool_of(MinisCluster *cl, const struct sockaddr_in *addr) {
+	pthread_mutex_lock(&cl->mu);
+	uint32_t n = atomic_load(&cl->npools);
+	uint32_t i = 0;
+	while (i < n && !same_addr(&cl->pools[i]->addr, addr)) {
+		i++;
+	}
+	if (i == n) {
+		MinisPool *pool = n < MINIS_MAX_NODES ? malloc(sizeof(MinisPool)) : NULL;
+		if (pool) {
+			minis_pool_init(pool, addr, cl->max_idle);
+			cl->pools[n] = pool;
+			atomic_store_explicit(&cl->npools, n + 1, memory_order_release);
+		} else {
+			i = MINIS_NO_NODE;
+		}
+	}
+	pthread_mutex_unlock(&cl->mu);
+	return i;
+}
+
+// "<ip>:<port>" or "<slot> <ip>:<port>", the message of a redirect
+static bool parse_node(const uint8_t *data, size_t len, struct sockaddr_in *addr) {
+	char buf[64];
+	if (len >= sizeof(buf)) {
+		return false;
+	}
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+	char *colon = strrchr(buf, ':');
+	if (!colon) {
+		return false;
+	}
+	*colon = '\0';
+	long port = strtol(colon + 1, NULL, 10);
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons((uint16_t) port);
+	return port > 0 && port < 65536 && inet_pton(AF_INET, buf, &addr->sin_addr) == 1;
+}
+
+// one [first, last, ip, port] of CLUSTER SLOTS
+static int cluster_apply_run(MinisCluster *cl, const MinisReply *run, uint16_t *slots) {
+	MinisReply first, last, ip, port;
+	const uint8_t *pos = run->data;
+	if (run->type != SER_ARR || run->len != 4 || minis_next(run, &pos, &first) != 1
+			|| minis_next(run, &pos, &last) != 1 || minis_next(run, &pos, &ip) != 1
+			|| minis_next(run, &pos, &port) != 1 || first.type != SER_INT
+			|| last.type != SER_INT || ip.type != SER_STR || port.type != SER_INT
+			|| first.num < 0 || last.num < first.num || last.num >= K_SLOTS) {
+		return -1;
+	}
+	char name[64];
+	int len = snprintf(name, sizeof(name), "%.*s:%lld", (int) (ip.len < 40 ? ip.len : 40),
+			(const char*) ip.data, (long long) port.num);
+	struct sockaddr_in addr;
+	if (!parse_node((const uint8_t*) name, (size_t) len, &addr)) {
+		return -1;
+	}
+	uint32_t pool = cluster_pool_of(cl, &addr);
+	for (int64_t i = first.num; i <= last.num; i++) {
+		slots[i] = (uint16_t) pool;
+	}
+	return 0;
+}
+
+int minis_cluster_refresh(MinisCluster *cl, const struct sockaddr_in *addr) {
+	MinisConn conn;
+	if (minis_connect(&conn, addr)) {
+		return -1;
+	}
+	const char *args[] = { "cluster", "slots" };
+	MinisReply reply;
+	uint16_t *slots = malloc(K_SLOTS * sizeof(uint16_t));
+	int rv = slots && minis_append_strs(&conn, 2, args) == 0 && minis_read(&conn, &reply) == 0
+			&& reply.type == SER_ARR ? 0 : -1;
+	if (rv == 0) {
+		for (uint32_t i = 0; i < K_SLOTS; i++) {
+			slots[i] = MINIS_NO_NODE;
+		}
+		const uint8_t *pos = reply.data;
+		MinisReply run;
+		int more = 0;
+		while (rv == 0 && (more = minis_next(&reply, &pos, &run)) == 1) {
+			rv = cluster_apply_run(cl, &run, slots);
+		}
+		if (more < 0) {
+			rv = -1;
+		}
+	}
+	if (rv == 0) {
+		for (uint32_t i = 0; i < K_SLOTS; i++) {
+			atomic_store_explicit(&cl->slots[i], slots[i], memory_order_release);
+		}
+	} else {
+		errno = EPROTO;
+	}
+	free(slots);
+	minis_close(&conn);
+	return rv;
+}
+
+int minis_cluster_init(MinisCluster *cl, const struct sockaddr_in *addr, size_t max_idle) {
+	memset(cl, 0, sizeof(*cl));
+	pthread_mutex_init(&cl->mu, NULL);
+	cl->max_idle = max_idle;
+	cl->slots = malloc(K_SLOTS * sizeof(cl->slots[0]));
+	if (!cl->slots) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (uint32_t i = 0; i < K_SLOTS; i++) {
+		atomic_init(&cl->slots[i], MINIS_NO_NODE);
+	}
+	return minis_cluster_refresh(cl, addr);
+}
+
+void minis_cluster_destroy(MinisCluster *cl) {
+	uint32_t n = atomic_load(&cl->npools);
+	for (uint32_t i = 0; i < n; i++) {
+		minis_pool_destroy(cl->pools[i]);
+		free(cl->pools[i]);
+	}
+	free(cl->slots);
+	pthread_mutex_destroy(&cl->mu);
+}
+
+MinisPool* minis_cluster_pool(MinisCluster *cl, const char *key, size_t len) {
+	uint16_t node = atomic_load_explicit(&cl->slots[key_slot((const uint8_t*) key, len)],
+			memory_order_acquire);
+	return node == MINIS_NO_NODE ? NULL : cl->pools[node];
+}
+
+MinisPool* minis_cluster_redirect(MinisCluster *cl, const MinisReply *reply) {
+	if (reply->type != SER_ERR || (reply->num != ERR_MOVED && reply->num != ERR_ASK)) {
+		return NULL;
+	}
+	const uint8_t *space = memchr(reply->data, ' ', reply->len);
+	struct sockaddr_in addr;
+	if (!space) {
+		return NULL;
+	}
+	size_t skip = (size_t) (space - reply->data) + 1;
+	long slot = strtol((const char*) reply->data, NULL, 10);
+	if (slot < 0 || slot >= K_SLOTS || !parse_node(space + 1, reply->len - skip, &addr)) {
+		return NULL;
+	}
+	uint32_t node = cluster_pool_of(cl, &addr);
+	if (node == MINIS_NO_NODE) {
+		return NULL;
+	}
+	if (reply->num == ERR_MOVED) {
+		atomic_store_explicit(&cl->slots[slot], (uint16_t) node, memory_order_release);
+	}
+	return cl->pools[node];
+}
@@ -0,0 +1,141 @@
+/*
+ * minis.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef MINIS_H_
+#define MINIS_H_
+
+// libminis, the client side of the protocol. Requests are appended to the
+// connection's write buffer and go out together on the next flush, so a
+// pipeline of them costs one write. Replies are parsed where they landed in
+// the read buffer, a MinisReply only points into it.
+//
+// A connection is used by one thread at a time, a MinisPool hands them out
+// to many.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+typedef struct {
+	// SER_*
+	uint8_t type;
+	// the bytes of a string or an error message, the count of an array
+	uint32_t len;
+	// an int, or the code of an error
+	int64_t num;
+	double dbl;
+	// the bytes of a string or an error message, the first element of an
+	// array. Inside the read buffer, see minis_fill.
+	const uint8_t *data;
+	// how far the elements of an array go
+	const uint8_t *end;
+} MinisReply;
+
+typedef struct minis_conn {
+	int fd;
+	uint8_t *wbuf;
+	size_t wbuf_size;
+	size_t wbuf_cap;
+	// the replies not taken yet are rbuf[rbuf_pos, rbuf_size)
+	uint8_t *rbuf;
+	size_t rbuf_pos;
+	size_t rbuf_size;
+	size_t rbuf_cap;
+	// requests appended whose replies haven't been taken
+	uint32_t pending;
+	// how long a read or a write may block, 0 for as long as it takes
+	uint32_t timeout_ms;
+	// the next one in the pool's idle list
+	struct minis_conn *next;
+} MinisConn;
+
+typedef struct minis_pool {
+	pthread_mutex_t mu;
+	struct sockaddr_in addr;
+	MinisConn *idle;
+	size_t nidle;
+	// the most idle connections kept, the ones put back past that are closed
+	size_t max_idle;
+} MinisPool;
+
+#define MINIS_MAX_NODES 256
+#define MINIS_NO_NODE 0xffff
+
+// A server in cluster mode: which node serves each slot, as CLUSTER SLOTS
+// says, and a pool of connections to every node. Requests go straight to
+// the node of their key, a MOVED reply puts the map right as it comes.
+// Any number of threads may share one.
+typedef struct {
+	pthread_mutex_t mu;
+	// the index of the pool of every slot's node, MINIS_NO_NODE for none
+	_Atomic uint16_t *slots;
+	// only ever added to, under mu
+	struct minis_pool *pools[MINIS_MAX_NODES];
+	_Atomic uint32_t npools;
+	size_t max_idle;
+} MinisCluster;
+
+// 0, or -1 with errno set
+extern int minis_connect(MinisConn *conn, const struct sockaddr_in *addr);
+// same, but connecting and every read and write after give up with
+// ETIMEDOUT past timeout_ms
+extern int minis_connect_timeout(MinisConn *conn, const struct sockaddr_in *addr,
+		uint32_t timeout_ms);
+// takes over a connected fd
+extern void minis_init(MinisConn *conn, int fd);
+extern void minis_close(MinisConn *conn);
+
+// queues a request, nothing is sent until minis_flush. -1 when it is
+// larger than K_MAX_MSG.
+extern int minis_append(MinisConn *conn, uint32_t nargs, const char *const *args, const uint32_t *lens);
+// same, with the lengths from strlen
+extern int minis_append_strs(MinisConn *conn, uint32_t nargs, const char *const *args);
+// writes out every request queued. 0, or -1 on a write error.
+extern int minis_flush(MinisConn *conn);
+
+// One read from the socket, for the callers that poll the fd themselves.
+// The replies taken before are moved out from under their MinisReply here.
+// 1 when something came, 0 on EAGAIN or EINTR, -1 on an error or EOF, and
+// on a timeout of minis_connect_timeout.
+extern int minis_fill(MinisConn *conn);
+// the next reply if it's all in the buffer: 1 when there was one, 0 when
+// more has to be read first, -1 when it is garbage
+extern int minis_take(MinisConn *conn, MinisReply *reply);
+// flushes and blocks until the next reply is in. 0, or -1.
+extern int minis_read(MinisConn *conn, MinisReply *reply);
+
+// reads one value out of data, the bytes it took or -1
+extern int64_t minis_parse(const uint8_t *data, size_t size, MinisReply *reply);
+// the elements of an array one by one: *pos starts at arr->data.
+// 1 while there are more, 0 at the end, -1 on garbage.
+extern int minis_next(const MinisReply *arr, const uint8_t **pos, MinisReply *elem);
+
+// every connection connects to addr, none is opened up front
+extern void minis_pool_init(MinisPool *pool, const struct sockaddr_in *addr, size_t max_idle);
+extern void minis_pool_destroy(MinisPool *pool);
+// an idle connection, or a new one. NULL when it can't connect.
+extern MinisConn *minis_pool_get(MinisPool *pool);
+// back for the next minis_pool_get. Broken ones, and the ones with
+// replies still due, are closed instead.
+extern void minis_pool_put(MinisPool *pool, MinisConn *conn, bool broken);
+
+// asks the node at addr for the slot map, the pools keep up to max_idle
+// connections each. 0, or -1 with errno set.
+extern int minis_cluster_init(MinisCluster *cl, const struct sockaddr_in *addr, size_t max_idle);
+extern void minis_cluster_destroy(MinisCluster *cl);
+// the whole map again, from the node at addr
+extern int minis_cluster_refresh(MinisCluster *cl, const struct sockaddr_in *addr);
+// the pool of the node that serves the key, NULL when none does
+extern MinisPool* minis_cluster_pool(MinisCluster *cl, const char *key, size_t len);
+// the pool of the node a MOVED or ASK error points to, for the request to
+// be sent again there. A MOVED changes the map as well, an ASK is only for
+// this one request. NULL for any other reply.
+extern MinisPool* minis_cluster_redirect(MinisCluster *cl, const MinisReply *reply);
+
+#endif /* MINIS_H_ */
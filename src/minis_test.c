@@ -0,0 +1,276 @@
+/*
+ * minis_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "minis.h"
+#include "common.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+static size_t put(uint8_t *buf, size_t pos, const void *data, size_t len) {
+	memcpy(&buf[pos], data, len);
+	return pos + len;
+}
+
+static size_t put_str(uint8_t *buf, size_t pos, const char *s) {
+	uint8_t type = SER_STR;
+	uint32_t len = (uint32_t) strlen(s);
+	pos = put(buf, pos, &type, 1);
+	pos = put(buf, pos, &len, 4);
+	return put(buf, pos, s, len);
+}
+
+static size_t put_int(uint8_t *buf, size_t pos, int64_t v) {
+	uint8_t type = SER_INT;
+	pos = put(buf, pos, &type, 1);
+	return put(buf, pos, &v, 8);
+}
+
+static size_t put_arr(uint8_t *buf, size_t pos, uint32_t n) {
+	uint8_t type = SER_ARR;
+	pos = put(buf, pos, &type, 1);
+	return put(buf, pos, &n, 4);
+}
+
+// a reply frame around body[0, len)
+static size_t put_frame(uint8_t *buf, size_t pos, const uint8_t *body, uint32_t len) {
+	pos = put(buf, pos, &len, 4);
+	return put(buf, pos, body, len);
+}
+
+static void test_parse(void) {
+	// ["a", [7, "bc"], nil]
+	uint8_t buf[64];
+	size_t n = put_arr(buf, 0, 3);
+	n = put_str(buf, n, "a");
+	n = put_arr(buf, n, 2);
+	n = put_int(buf, n, 7);
+	n = put_str(buf, n, "bc");
+	buf[n++] = SER_NIL;
+
+	MinisReply arr;
+	assert(minis_parse(buf, n, &arr) == (int64_t) n);
+	assert(arr.type == SER_ARR && arr.len == 3);
+	const uint8_t *pos = arr.data;
+	MinisReply elem;
+	assert(minis_next(&arr, &pos, &elem) == 1);
+	assert(elem.type == SER_STR && elem.len == 1 && elem.data[0] == 'a');
+	assert(minis_next(&arr, &pos, &elem) == 1);
+	assert(elem.type == SER_ARR && elem.len == 2);
+	const uint8_t *inner_pos = elem.data;
+	MinisReply inner;
+	assert(minis_next(&elem, &inner_pos, &inner) == 1 && inner.num == 7);
+	assert(minis_next(&elem, &inner_pos, &inner) == 1);
+	assert(inner.len == 2 && memcmp(inner.data, "bc", 2) == 0);
+	assert(minis_next(&elem, &inner_pos, &inner) == 0);
+	assert(minis_next(&arr, &pos, &elem) == 1 && elem.type == SER_NIL);
+	assert(minis_next(&arr, &pos, &elem) == 0);
+
+	// cut short anywhere, it's not a value yet
+	for (size_t i = 0; i < n; i++) {
+		assert(minis_parse(buf, i, &arr) == -1);
+	}
+	buf[0] = 42;
+	assert(minis_parse(buf, n, &arr) == -1);
+}
+
+static void test_pipeline(void) {
+	int fds[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	MinisConn conn;
+	minis_init(&conn, fds[0]);
+
+	// three requests, one write
+	const char *set[] = { "set", "k", "v" };
+	const char *get[] = { "get", "k" };
+	assert(minis_append_strs(&conn, 3, set) == 0);
+	assert(minis_append_strs(&conn, 2, get) == 0);
+	assert(minis_append_strs(&conn, 2, get) == 0);
+	assert(conn.pending == 3);
+	size_t sent = conn.wbuf_size;
+	assert(minis_flush(&conn) == 0 && conn.wbuf_size == 0);
+
+	uint8_t req[256];
+	assert(read(fds[1], req, sizeof(req)) == (ssize_t) sent);
+	uint32_t len = 0;
+	uint32_t nargs = 0;
+	memcpy(&len, req, 4);
+	memcpy(&nargs, &req[4], 4);
+	assert(len == 4 + 3 * 4 + 5 && nargs == 3);
+	assert(memcmp(&req[8 + 4], "set", 3) == 0);
+
+	// the replies come back split in the middle of the second one
+	uint8_t body[32];
+	uint8_t replies[128];
+	size_t n = put_frame(replies, 0, body, (uint32_t) put_str(body, 0, "OK"));
+	n = put_frame(replies, n, body, (uint32_t) put_str(body, 0, "v"));
+	n = put_frame(replies, n, body, (uint32_t) put_str(body, 0, "v"));
+	size_t cut = n - 12;
+	assert(write(fds[1], replies, cut) == (ssize_t) cut);
+
+	MinisReply reply;
+	assert(minis_take(&conn, &reply) == 0);
+	assert(minis_fill(&conn) == 1);
+	assert(minis_take(&conn, &reply) == 1);
+	assert(reply.type == SER_STR && reply.len == 2 && memcmp(reply.data, "OK", 2) == 0);
+	// not copied out of the read buffer
+	assert(reply.data > conn.rbuf && reply.data < conn.rbuf + conn.rbuf_size);
+	assert(minis_take(&conn, &reply) == 0);
+	assert(conn.pending == 2);
+
+	assert(write(fds[1], &replies[cut], n - cut) == (ssize_t) (n - cut));
+	assert(minis_read(&conn, &reply) == 0 && reply.len == 1 && reply.data[0] == 'v');
+	assert(minis_read(&conn, &reply) == 0 && reply.len == 1 && reply.data[0] == 'v');
+	assert(conn.pending == 0);
+
+	close(fds[1]);
+	assert(minis_read(&conn, &reply) == -1);
+	minis_close(&conn);
+}
+
+static void test_pool(void) {
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(lfd, (const struct sockaddr*) &addr, sizeof(addr)) == 0);
+	assert(listen(lfd, 16) == 0);
+	socklen_t addr_len = sizeof(addr);
+	assert(getsockname(lfd, (struct sockaddr*) &addr, &addr_len) == 0);
+
+	MinisPool pool;
+	minis_pool_init(&pool, &addr, 1);
+	MinisConn *a = minis_pool_get(&pool);
+	MinisConn *b = minis_pool_get(&pool);
+	assert(a && b && a != b);
+	minis_pool_put(&pool, a, false);
+	// past max_idle
+	minis_pool_put(&pool, b, false);
+	assert(pool.nidle == 1);
+	assert(minis_pool_get(&pool) == a);
+	assert(pool.nidle == 0);
+
+	// a reply still due, the next user would get it
+	const char *get[] = { "get", "k" };
+	assert(minis_append_strs(a, 2, get) == 0);
+	minis_pool_put(&pool, a, false);
+	assert(pool.nidle == 0);
+
+	b = minis_pool_get(&pool);
+	minis_pool_put(&pool, b, true);
+	assert(pool.nidle == 0);
+	minis_pool_destroy(&pool);
+	close(lfd);
+}
+
+typedef struct {
+	int lfd;
+	const uint8_t *reply;
+	size_t len;
+} FakeNode;
+
+// answers the one request of the one connection it takes with reply
+static void* fake_node_run(void *arg) {
+	FakeNode *node = (FakeNode*) arg;
+	int fd = accept(node->lfd, NULL, NULL);
+	assert(fd >= 0);
+	uint8_t req[256];
+	assert(read(fd, req, sizeof(req)) > 0);
+	assert(write(fd, node->reply, node->len) == (ssize_t) node->len);
+	close(fd);
+	return NULL;
+}
+
+static size_t put_run(uint8_t *buf, size_t pos, int64_t first, int64_t last, const char *ip,
+		int64_t port) {
+	pos = put_arr(buf, pos, 4);
+	pos = put_int(buf, pos, first);
+	pos = put_int(buf, pos, last);
+	pos = put_str(buf, pos, ip);
+	return put_int(buf, pos, port);
+}
+
+static uint16_t pool_port(MinisPool *pool) {
+	return ntohs(pool->addr.sin_port);
+}
+
+static MinisReply err_reply(int32_t code, const char *msg) {
+	MinisReply reply = { 0 };
+	reply.type = SER_ERR;
+	reply.num = code;
+	reply.data = (const uint8_t*) msg;
+	reply.len = (uint32_t) strlen(msg);
+	return reply;
+}
+
+static void test_cluster(void) {
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(lfd, (const struct sockaddr*) &addr, sizeof(addr)) == 0);
+	assert(listen(lfd, 16) == 0);
+	socklen_t addr_len = sizeof(addr);
+	assert(getsockname(lfd, (struct sockaddr*) &addr, &addr_len) == 0);
+
+	// the lower half of the slots at 127.0.0.2:7000, nobody has the rest
+	uint8_t body[128];
+	size_t n = put_arr(body, 0, 1);
+	n = put_run(body, n, 0, K_SLOTS / 2 - 1, "127.0.0.2", 7000);
+	uint8_t reply[160];
+	FakeNode node = { lfd, reply, put_frame(reply, 0, body, (uint32_t) n) };
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, &fake_node_run, &node) == 0);
+	MinisCluster cl;
+	assert(minis_cluster_init(&cl, &addr, 1) == 0);
+	pthread_join(thread, NULL);
+
+	// a key of each half
+	char low[16];
+	char high[16];
+	low[0] = high[0] = '\0';
+	for (int i = 0; !low[0] || !high[0]; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "k%d", i);
+		strcpy(key_slot((const uint8_t*) key, strlen(key)) < K_SLOTS / 2 ? low : high, key);
+	}
+	MinisPool *pool = minis_cluster_pool(&cl, low, strlen(low));
+	assert(pool && pool_port(pool) == 7000);
+	assert(minis_cluster_pool(&cl, high, strlen(high)) == NULL);
+
+	// MOVED changes the map, ASK doesn't
+	char msg[64];
+	snprintf(msg, sizeof(msg), "%u 127.0.0.3:7001", key_slot((const uint8_t*) high, strlen(high)));
+	MinisReply moved = err_reply(ERR_MOVED, msg);
+	pool = minis_cluster_redirect(&cl, &moved);
+	assert(pool && pool_port(pool) == 7001);
+	assert(minis_cluster_pool(&cl, high, strlen(high)) == pool);
+	snprintf(msg, sizeof(msg), "%u 127.0.0.2:7000", key_slot((const uint8_t*) high, strlen(high)));
+	MinisReply ask = err_reply(ERR_ASK, msg);
+	pool = minis_cluster_redirect(&cl, &ask);
+	assert(pool && pool_port(pool) == 7000);
+	assert(pool_port(minis_cluster_pool(&cl, high, strlen(high))) == 7001);
+	// the same node, the same pool
+	assert(pool == minis_cluster_pool(&cl, low, strlen(low)));
+	MinisReply other = err_reply(ERR_ARG, "7 127.0.0.1:1");
+	assert(minis_cluster_redirect(&cl, &other) == NULL);
+	minis_cluster_destroy(&cl);
+	close(lfd);
+}
+
+int main(void) {
+	test_parse();
+	test_pipeline();
+	test_pool();
+	test_cluster();
+	printf("Success!\n");
+	return 0;
+}
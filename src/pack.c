@@ -0,0 +1,41 @@
+/*
+ * pack.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <string.h>
+#include "pack.h"
+#include "slab.h"
+
+uint8_t* pack_insert(Pack *pack, uint32_t off, uint32_t size) {
+	uint32_t need = pack->used + size;
+	if (need > pack->cap) {
+		// the size classes already leave some room, past them grow by half
+		uint32_t cap = need <= SLAB_MAX_SIZE ? (uint32_t) slab_size_class(need) : need + need / 2;
+		uint8_t *data = (uint8_t*) slab_alloc(cap);
+		if (pack->data) {
+			memcpy(data, pack->data, pack->used);
+			slab_free(pack->data, pack->cap);
+		}
+		pack->data = data;
+		pack->cap = cap;
+	}
+	uint8_t *p = &pack->data[off];
+	memmove(p + size, p, pack->used - off);
+	pack->used += size;
+	pack->n++;
+	return p;
+}
+
+void pack_delete(Pack *pack, uint32_t off, uint32_t size) {
+	memmove(&pack->data[off], &pack->data[off + size], pack->used - off - size);
+	pack->used -= size;
+	pack->n--;
+}
+
+void pack_dispose(Pack *pack) {
+	slab_free(pack->data, pack->cap);
+	pack->data = NULL;
+}
@@ -0,0 +1,31 @@
+/*
+ * pack.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef PACK_H_
+#define PACK_H_
+
+#include <stdint.h>
+
+// The buffer behind the packed encodings (zset.h, hash.h): entries one after
+// the other in a slab allocation, laid out by the owner, which also knows
+// their sizes. A zeroed Pack is an empty one.
+typedef struct {
+	uint8_t *data;
+	uint32_t n;
+	// bytes in use, and allocated
+	uint32_t used;
+	uint32_t cap;
+} Pack;
+
+// room for one more entry of size bytes at off, moving the ones behind it.
+// Returns where to write it.
+extern uint8_t* pack_insert(Pack *pack, uint32_t off, uint32_t size);
+// removes the entry of size bytes at off
+extern void pack_delete(Pack *pack, uint32_t off, uint32_t size);
+extern void pack_dispose(Pack *pack);
+
+#endif /* PACK_H_ */
@@ -0,0 +1,730 @@
+/*
+ * repl.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "repl.h"
+#include "aof.h"
+#include "common.h"
+
+#define REPL_ID_LEN 40
+// what a feeder copies out of the backlog per write, and a replica reads per read
+#define K_STREAM_CHUNK (64 * 1024)
+// the handshake records are short, anything longer is garbage
+#define K_MAX_HANDSHAKE 4096
+
+static struct {
+	ReplHooks hooks;
+	int port;
+	const char *snap_path;
+	uint32_t nshards;
+	size_t backlog_size;
+
+	pthread_mutex_t mu;
+	// the feeders wait on it for more of the stream
+	pthread_cond_t more;
+	uint32_t waiting;
+	// the backlog, allocated with the first replica. The stream bytes
+	// [start, off) are in it, byte x at x % backlog_size.
+	uint8_t *ring;
+	uint64_t start;
+	uint64_t off;
+	atomic_bool feeding;
+	// changes whenever the stream starts over, so that a replica can't
+	// resume one it never had
+	char id[REPL_ID_LEN + 1];
+	uint32_t nreplicas;
+
+	// the primary followed, if any. A follower thread whose gen isn't the
+	// current one anymore quits.
+	atomic_bool replica;
+	uint32_t gen;
+	struct sockaddr_in primary;
+	int link_fd;
+	bool link_up;
+	char primary_id[REPL_ID_LEN + 1];
+	uint64_t primary_off;
+} g_repl;
+
+static void new_id(char *id) {
+	uint8_t raw[REPL_ID_LEN / 2];
+	if (getrandom(raw, sizeof(raw), 0) != sizeof(raw)) {
+		uint64_t seed = get_monotonic_usec() ^ ((uint64_t) getpid() << 32);
+		for (size_t i = 0; i < sizeof(raw); i++) {
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			raw[i] = (uint8_t) (seed >> 56);
+		}
+	}
+	for (size_t i = 0; i < sizeof(raw); i++) {
+		sprintf(&id[2 * i], "%02x", raw[i]);
+	}
+}
+
+static int read_full(int fd, void *buf, size_t n) {
+	uint8_t *pos = buf;
+	while (n > 0) {
+		ssize_t rv = read(fd, pos, n);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			return -1;
+		}
+		n -= (size_t) rv;
+		pos += rv;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+	const uint8_t *pos = buf;
+	while (n > 0) {
+		ssize_t rv = write(fd, pos, n);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			return -1;
+		}
+		n -= (size_t) rv;
+		pos += rv;
+	}
+	return 0;
+}
+
+// one handshake record, the args point into buf
+static int read_record(int fd, uint8_t *buf, StrView *args, size_t *nargs) {
+	uint32_t len = 0;
+	if (read_full(fd, &len, 4) || len > K_MAX_HANDSHAKE || read_full(fd, buf, len)) {
+		return -1;
+	}
+	return aof_parse_record(buf, len, args, nargs) ? 0 : -1;
+}
+
+// the args are C strings
+static int write_record(int fd, const char *const *args, size_t n) {
+	uint8_t buf[K_MAX_HANDSHAKE];
+	uint32_t len = 4;
+	for (size_t i = 0; i < n; i++) {
+		len += 4 + (uint32_t) strlen(args[i]);
+	}
+	if (4 + (size_t) len > sizeof(buf)) {
+		return -1;
+	}
+	uint32_t n32 = (uint32_t) n;
+	memcpy(buf, &len, 4);
+	memcpy(&buf[4], &n32, 4);
+	size_t pos = 8;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t sz = (uint32_t) strlen(args[i]);
+		memcpy(&buf[pos], &sz, 4);
+		memcpy(&buf[pos + 4], args[i], sz);
+		pos += 4 + sz;
+	}
+	return write_all(fd, buf, pos);
+}
+
+static bool arg_is(const StrView *arg, const char *s) {
+	return arg->len == strlen(s) && memcmp(arg->data, s, arg->len) == 0;
+}
+
+static uint64_t arg_u64(const StrView *arg) {
+	char buf[32];
+	size_t len = arg->len < sizeof(buf) - 1 ? arg->len : sizeof(buf) - 1;
+	memcpy(buf, arg->data, len);
+	buf[len] = '\0';
+	return strtoull(buf, NULL, 10);
+}
+
+// the backlog
+
+static void ring_put(const void *data, size_t len) {
+	const uint8_t *pos = data;
+	while (len > 0) {
+		size_t at = (size_t) (g_repl.off % g_repl.backlog_size);
+		size_t n = g_repl.backlog_size - at < len ? g_repl.backlog_size - at : len;
+		memcpy(&g_repl.ring[at], pos, n);
+		g_repl.off += n;
+		pos += n;
+		len -= n;
+	}
+	if (g_repl.off - g_repl.start > g_repl.backlog_size) {
+		g_repl.start = g_repl.off - g_repl.backlog_size;
+	}
+}
+
+// up to max bytes of the stream from off on, under mu
+static size_t ring_get(uint64_t off, uint8_t *buf, size_t max) {
+	size_t len = g_repl.off - off < max ? (size_t) (g_repl.off - off) : max;
+	size_t done = 0;
+	while (done < len) {
+		size_t at = (size_t) ((off + done) % g_repl.backlog_size);
+		size_t n = g_repl.backlog_size - at < len - done ? g_repl.backlog_size - at : len - done;
+		memcpy(&buf[done], &g_repl.ring[at], n);
+		done += n;
+	}
+	return len;
+}
+
+bool repl_feeding(void) {
+	return atomic_load_explicit(&g_repl.feeding, memory_order_relaxed);
+}
+
+void repl_feed(const StrView *args, size_t n) {
+	if (!repl_feeding()) {
+		return;
+	}
+	uint32_t len = 4;
+	for (size_t i = 0; i < n; i++) {
+		len += 4 + (uint32_t) args[i].len;
+	}
+	uint32_t n32 = (uint32_t) n;
+	pthread_mutex_lock(&g_repl.mu);
+	ring_put(&len, 4);
+	ring_put(&n32, 4);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t sz = (uint32_t) args[i].len;
+		ring_put(&sz, 4);
+		ring_put(args[i].data, sz);
+	}
+	if (g_repl.waiting) {
+		pthread_cond_broadcast(&g_repl.more);
+	}
+	pthread_mutex_unlock(&g_repl.mu);
+}
+
+uint64_t repl_offset(void) {
+	pthread_mutex_lock(&g_repl.mu);
+	uint64_t off = g_repl.off;
+	pthread_mutex_unlock(&g_repl.mu);
+	return off;
+}
+
+// the primary side, a thread per replica
+
+static void ask_for_snapshots(void) {
+	static const char k_bgsave[] = { 1, 0, 0, 0, 6, 0, 0, 0, 'b', 'g', 's', 'a', 'v', 'e' };
+	g_repl.hooks.apply(g_repl.hooks.arg, (const uint8_t*) k_bgsave, sizeof(k_bgsave));
+}
+
+// a snapshot of every shard started at off or later, so that the stream
+// from off on brings the replica up to date. A shard that is already
+// saving turns the request down, it is asked again until it takes it.
+static void wait_for_snapshots(uint64_t off) {
+	uint64_t asked = 0;
+	while (g_repl.hooks.saved_from(g_repl.hooks.arg) < off) {
+		uint64_t now = get_monotonic_usec();
+		if (now - asked >= 1000000) {
+			ask_for_snapshots();
+			asked = now;
+		}
+		usleep(10000);
+	}
+}
+
+static int send_file(int fd, uint32_t shard) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.%u", g_repl.snap_path, shard);
+	int file = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (file < 0 || fstat(file, &st) < 0) {
+		msg("can't open a snapshot file for a replica");
+		if (file >= 0) {
+			close(file);
+		}
+		return -1;
+	}
+	char shard_buf[16];
+	char size_buf[32];
+	snprintf(shard_buf, sizeof(shard_buf), "%u", shard);
+	snprintf(size_buf, sizeof(size_buf), "%lld", (long long) st.st_size);
+	const char *head[] = { "file", shard_buf, size_buf };
+	int rv = write_record(fd, head, 3);
+	off_t pos = 0;
+	while (rv == 0 && pos < st.st_size) {
+		ssize_t n = sendfile(fd, file, &pos, (size_t) (st.st_size - pos));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			rv = -1;
+		}
+	}
+	close(file);
+	return rv;
+}
+
+// the snapshot files, for the stream to go on from *off
+static int full_resync(int fd, uint64_t *off) {
+	while (true) {
+		pthread_mutex_lock(&g_repl.mu);
+		*off = g_repl.off;
+		pthread_mutex_unlock(&g_repl.mu);
+		wait_for_snapshots(*off);
+		// the files may be replaced by newer ones any time, those are just
+		// as good. Only the stream from off on must still be there.
+		pthread_mutex_lock(&g_repl.mu);
+		bool kept = *off >= g_repl.start;
+		pthread_mutex_unlock(&g_repl.mu);
+		if (kept) {
+			break;
+		}
+	}
+	char off_buf[32];
+	char n_buf[16];
+	snprintf(off_buf, sizeof(off_buf), "%llu", (unsigned long long) *off);
+	snprintf(n_buf, sizeof(n_buf), "%u", g_repl.nshards);
+	pthread_mutex_lock(&g_repl.mu);
+	char id[REPL_ID_LEN + 1];
+	memcpy(id, g_repl.id, sizeof(id));
+	pthread_mutex_unlock(&g_repl.mu);
+	const char *head[] = { "fullresync", id, off_buf, n_buf };
+	if (write_record(fd, head, 4)) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < g_repl.nshards; i++) {
+		if (send_file(fd, i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// nothing ever comes from a replica past the handshake, so readable means
+// it went away
+static bool replica_gone(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static void stream_to(int fd, uint64_t off) {
+	uint8_t *buf = malloc(K_STREAM_CHUNK);
+	if (!buf) {
+		die("Out of memory");
+	}
+	while (true) {
+		pthread_mutex_lock(&g_repl.mu);
+		while (off == g_repl.off) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			g_repl.waiting++;
+			int rv = pthread_cond_timedwait(&g_repl.more, &g_repl.mu, &ts);
+			g_repl.waiting--;
+			if (rv == ETIMEDOUT && replica_gone(fd)) {
+				break;
+			}
+		}
+		if (off < g_repl.start) {
+			pthread_mutex_unlock(&g_repl.mu);
+			msg("a replica fell behind the backlog, it will have to resync");
+			break;
+		}
+		size_t n = ring_get(off, buf, K_STREAM_CHUNK);
+		pthread_mutex_unlock(&g_repl.mu);
+		if (n == 0 || write_all(fd, buf, n)) {
+			break;
+		}
+		off += n;
+	}
+	free(buf);
+}
+
+static void* feed_run(void *arg) {
+	int fd = (int) (intptr_t) arg;
+	uint8_t buf[K_MAX_HANDSHAKE];
+	StrView args[K_MAX_ARGS];
+	size_t nargs = 0;
+	if (read_record(fd, buf, args, &nargs) || nargs != 3 || !arg_is(&args[0], "psync")) {
+		msg("bad replication handshake");
+		close(fd);
+		return NULL;
+	}
+	uint64_t off = arg_u64(&args[2]);
+
+	pthread_mutex_lock(&g_repl.mu);
+	if (!g_repl.ring) {
+		// the stream starts here, with nothing to resume
+		g_repl.ring = malloc(g_repl.backlog_size);
+		if (!g_repl.ring) {
+			die("Out of memory");
+		}
+		g_repl.start = g_repl.off;
+		atomic_store(&g_repl.feeding, true);
+	}
+	g_repl.nreplicas++;
+	bool resume = arg_is(&args[1], g_repl.id) && off >= g_repl.start && off <= g_repl.off;
+	char id[REPL_ID_LEN + 1];
+	memcpy(id, g_repl.id, sizeof(id));
+	pthread_mutex_unlock(&g_repl.mu);
+
+	int rv = 0;
+	if (resume) {
+		char off_buf[32];
+		snprintf(off_buf, sizeof(off_buf), "%llu", (unsigned long long) off);
+		const char *head[] = { "continue", id, off_buf };
+		rv = write_record(fd, head, 3);
+		printf("a replica resumed at offset %llu\n", (unsigned long long) off);
+	} else {
+		rv = full_resync(fd, &off);
+		printf("a replica got a full resync, the stream goes on from offset %llu\n",
+				(unsigned long long) off);
+	}
+	if (rv == 0) {
+		stream_to(fd, off);
+	}
+	pthread_mutex_lock(&g_repl.mu);
+	g_repl.nreplicas--;
+	pthread_mutex_unlock(&g_repl.mu);
+	close(fd);
+	return NULL;
+}
+
+static void* listen_run(void *arg) {
+	int lfd = (int) (intptr_t) arg;
+	while (true) {
+		int fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR) {
+				msg("accept() error");
+			}
+			continue;
+		}
+		int val = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, &feed_run, (void*) (intptr_t) fd)) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+// the replica side, a thread following the primary
+
+static bool still_following(uint32_t gen) {
+	pthread_mutex_lock(&g_repl.mu);
+	bool same = g_repl.gen == gen;
+	pthread_mutex_unlock(&g_repl.mu);
+	return same;
+}
+
+static int recv_file(int fd, const char *path, uint64_t size) {
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	int file = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (file < 0) {
+		msg("can't create the snapshot file from the primary");
+		return -1;
+	}
+	uint8_t *buf = malloc(K_STREAM_CHUNK);
+	if (!buf) {
+		die("Out of memory");
+	}
+	int rv = 0;
+	while (rv == 0 && size > 0) {
+		size_t n = size < K_STREAM_CHUNK ? (size_t) size : K_STREAM_CHUNK;
+		rv = read_full(fd, buf, n) || write_all(file, buf, n) ? -1 : 0;
+		size -= n;
+	}
+	free(buf);
+	close(file);
+	if (rv == 0 && rename(tmp, path) != 0) {
+		rv = -1;
+	}
+	if (rv) {
+		unlink(tmp);
+	}
+	return rv;
+}
+
+// the snapshot files go next to the replica's own, under .repl
+static int load_files(int fd, uint32_t n) {
+	uint8_t buf[K_MAX_HANDSHAKE];
+	StrView args[K_MAX_ARGS];
+	size_t nargs = 0;
+	char base[4096];
+	snprintf(base, sizeof(base), "%s.repl", g_repl.snap_path);
+	for (uint32_t i = 0; i < n; i++) {
+		if (read_record(fd, buf, args, &nargs) || nargs != 3 || !arg_is(&args[0], "file")) {
+			return -1;
+		}
+		char path[4096 + 16];
+		snprintf(path, sizeof(path), "%s.%llu", base, (unsigned long long) arg_u64(&args[1]));
+		if (recv_file(fd, path, arg_u64(&args[2]))) {
+			return -1;
+		}
+	}
+	g_repl.hooks.load(g_repl.hooks.arg, base);
+	return 0;
+}
+
+static int handshake(int fd) {
+	pthread_mutex_lock(&g_repl.mu);
+	char id[REPL_ID_LEN + 1];
+	memcpy(id, g_repl.primary_id, sizeof(id));
+	char off_buf[32];
+	snprintf(off_buf, sizeof(off_buf), "%llu", (unsigned long long) g_repl.primary_off);
+	pthread_mutex_unlock(&g_repl.mu);
+	const char *req[] = { "psync", id, off_buf };
+	if (write_record(fd, req, 3)) {
+		return -1;
+	}
+
+	uint8_t buf[K_MAX_HANDSHAKE];
+	StrView args[K_MAX_ARGS];
+	size_t nargs = 0;
+	if (read_record(fd, buf, args, &nargs) || nargs < 3 || args[1].len != REPL_ID_LEN) {
+		return -1;
+	}
+	if (arg_is(&args[0], "continue") && nargs == 3) {
+		printf("resumed replicating at offset %s\n", off_buf);
+		return 0;
+	}
+	if (!arg_is(&args[0], "fullresync") || nargs != 4) {
+		return -1;
+	}
+	uint64_t off = arg_u64(&args[2]);
+	memcpy(id, args[1].data, REPL_ID_LEN);
+	id[REPL_ID_LEN] = '\0';
+	if (load_files(fd, (uint32_t) arg_u64(&args[3]))) {
+		return -1;
+	}
+	pthread_mutex_lock(&g_repl.mu);
+	memcpy(g_repl.primary_id, id, sizeof(id));
+	g_repl.primary_off = off;
+	// what this server streams to its own replicas just had a gap
+	new_id(g_repl.id);
+	pthread_mutex_unlock(&g_repl.mu);
+	printf("loaded the data of the primary, replicating from offset %llu\n",
+			(unsigned long long) off);
+	return 0;
+}
+
+// the records that are in, complete ones only. Returns how many bytes of
+// buf they took.
+static size_t apply_stream(const uint8_t *buf, size_t size) {
+	size_t pos = 0;
+	while (size - pos >= 4) {
+		uint32_t len = 0;
+		memcpy(&len, &buf[pos], 4);
+		if (size - pos - 4 < len) {
+			break;
+		}
+		g_repl.hooks.apply(g_repl.hooks.arg, &buf[pos + 4], len);
+		pos += 4 + (size_t) len;
+	}
+	if (pos > 0) {
+		pthread_mutex_lock(&g_repl.mu);
+		g_repl.primary_off += pos;
+		pthread_mutex_unlock(&g_repl.mu);
+	}
+	return pos;
+}
+
+static void stream_from(int fd) {
+	size_t cap = K_STREAM_CHUNK;
+	size_t size = 0;
+	uint8_t *buf = malloc(cap);
+	if (!buf) {
+		die("Out of memory");
+	}
+	while (true) {
+		if (cap - size < K_STREAM_CHUNK / 2) {
+			// a record bigger than what is left
+			cap *= 2;
+			buf = realloc(buf, cap);
+			if (!buf) {
+				die("Out of memory");
+			}
+		}
+		ssize_t rv = read(fd, &buf[size], cap - size);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			break;
+		}
+		size += (size_t) rv;
+		size_t used = apply_stream(buf, size);
+		memmove(buf, &buf[used], size - used);
+		size -= used;
+	}
+	free(buf);
+}
+
+static int connect_primary(uint32_t gen) {
+	pthread_mutex_lock(&g_repl.mu);
+	struct sockaddr_in addr = g_repl.primary;
+	pthread_mutex_unlock(&g_repl.mu);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	// notices a primary that went away without a word, in about a minute
+	int val = 1;
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+	val = 15;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
+	val = 3;
+	setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+	if (connect(fd, (const struct sockaddr*) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	pthread_mutex_lock(&g_repl.mu);
+	if (g_repl.gen != gen) {
+		pthread_mutex_unlock(&g_repl.mu);
+		close(fd);
+		return -1;
+	}
+	g_repl.link_fd = fd;
+	pthread_mutex_unlock(&g_repl.mu);
+	return fd;
+}
+
+static void* follow_run(void *arg) {
+	uint32_t gen = (uint32_t) (uintptr_t) arg;
+	while (still_following(gen)) {
+		int fd = connect_primary(gen);
+		if (fd >= 0) {
+			if (handshake(fd) == 0) {
+				pthread_mutex_lock(&g_repl.mu);
+				g_repl.link_up = g_repl.gen == gen;
+				pthread_mutex_unlock(&g_repl.mu);
+				stream_from(fd);
+			}
+			msg("lost the link to the primary");
+			pthread_mutex_lock(&g_repl.mu);
+			if (g_repl.gen == gen) {
+				g_repl.link_fd = -1;
+				g_repl.link_up = false;
+			}
+			pthread_mutex_unlock(&g_repl.mu);
+			close(fd);
+		}
+		// quick enough for a restart of the primary, slow enough not to spin
+		usleep(500000);
+	}
+	return NULL;
+}
+
+bool repl_follow(const char *host, int port) {
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t) port);
+	if (port < 1 || port > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+		return false;
+	}
+	pthread_mutex_lock(&g_repl.mu);
+	uint32_t gen = ++g_repl.gen;
+	g_repl.primary = addr;
+	if (g_repl.link_fd >= 0) {
+		// the old follower is woken up, and quits
+		shutdown(g_repl.link_fd, SHUT_RDWR);
+		g_repl.link_fd = -1;
+	}
+	g_repl.link_up = false;
+	atomic_store(&g_repl.replica, true);
+	pthread_mutex_unlock(&g_repl.mu);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, &follow_run, (void*) (uintptr_t) gen)) {
+		die("pthread_create");
+	}
+	pthread_detach(thread);
+	return true;
+}
+
+void repl_unfollow(void) {
+	pthread_mutex_lock(&g_repl.mu);
+	g_repl.gen++;
+	if (g_repl.link_fd >= 0) {
+		shutdown(g_repl.link_fd, SHUT_RDWR);
+		g_repl.link_fd = -1;
+	}
+	g_repl.link_up = false;
+	atomic_store(&g_repl.replica, false);
+	// the writes from now on are this server's own
+	new_id(g_repl.id);
+	pthread_mutex_unlock(&g_repl.mu);
+}
+
+bool repl_is_replica(void) {
+	return atomic_load_explicit(&g_repl.replica, memory_order_relaxed);
+}
+
+void repl_info(ReplInfo *info) {
+	pthread_mutex_lock(&g_repl.mu);
+	info->replica = atomic_load(&g_repl.replica);
+	info->link_up = g_repl.link_up;
+	info->offset = info->replica ? g_repl.primary_off : g_repl.off;
+	info->replicas = g_repl.nreplicas;
+	pthread_mutex_unlock(&g_repl.mu);
+}
+
+void repl_init(const ReplHooks *hooks, int port, const char *snap_path,
+		uint32_t nshards, size_t backlog_size) {
+	g_repl.hooks = *hooks;
+	g_repl.port = port;
+	g_repl.snap_path = snap_path;
+	g_repl.nshards = nshards;
+	g_repl.backlog_size = backlog_size;
+	pthread_mutex_init(&g_repl.mu, NULL);
+	pthread_cond_init(&g_repl.more, NULL);
+	g_repl.start = g_repl.off = 1;
+	atomic_init(&g_repl.feeding, false);
+	atomic_init(&g_repl.replica, false);
+	g_repl.link_fd = -1;
+	new_id(g_repl.id);
+	// nothing to resume yet, the first sync is a full one
+	strcpy(g_repl.primary_id, "?");
+	g_repl.primary_off = 0;
+
+	if (port == 0) {
+		return;
+	}
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		die("socket()");
+	}
+	int val = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t) port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (const struct sockaddr*) &addr, sizeof(addr)) || listen(fd, 16)) {
+		// the server runs on, it just can't have replicas
+		msg("can't listen on the replication port, replicas can't connect");
+		close(fd);
+		g_repl.port = 0;
+		return;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, &listen_run, (void*) (intptr_t) fd)) {
+		die("pthread_create");
+	}
+	pthread_detach(thread);
+}
@@ -0,0 +1,77 @@
+/*
+ * repl.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef REPL_H_
+#define REPL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "strings.h"
+
+// Replication. Replicas connect to the replication port of the primary,
+// if it has one (-R), and send
+//   psync <replication id> <offset>
+// as a request in the wire format. The primary answers with a record in
+// that format too:
+//   continue <replication id> <offset>
+// when it still has everything from offset on in its backlog, or else
+//   fullresync <replication id> <offset> <n>
+// followed by the snapshot files of its n shards, each one a record
+//   file <shard> <size>
+// and the size bytes of the file. After that comes the stream: every write
+// the shards log, the same records the append only file gets, from offset
+// on. Offsets count the bytes of the stream, from 1.
+//
+// The backlog is a ring shared by all shards, filled under a lock like the
+// append only file. It only exists once a replica has connected, until
+// then the writes don't pay for it.
+
+// what the module needs from the server, called from its threads
+typedef struct {
+	// runs a write that came from the primary on the shards it belongs to,
+	// in the order they come in
+	void (*apply)(void *arg, const uint8_t *req, uint32_t len);
+	// empties every shard and loads the snapshot files under path, ahead
+	// of anything applied after it
+	void (*load)(void *arg, const char *path);
+	// the lowest offset the last complete snapshot of a shard was started
+	// at, over all of them. 0 when one has none.
+	uint64_t (*saved_from)(void *arg);
+	void *arg;
+} ReplHooks;
+
+typedef struct {
+	bool replica;
+	// connected to the primary and streaming
+	bool link_up;
+	uint64_t offset;
+	uint32_t replicas;
+} ReplInfo;
+
+// listens on port for replicas, not at all when it's 0 or can't be had.
+// snap_path is where the shards save their snapshots, backlog_size how many
+// bytes of the stream are kept for the replicas that fall behind or reconnect.
+extern void repl_init(const ReplHooks *hooks, int port, const char *snap_path,
+		uint32_t nshards, size_t backlog_size);
+// whether the writes have to be fed to the backlog, cheap enough to ask
+// before every one
+extern bool repl_feeding(void);
+extern void repl_feed(const StrView *args, size_t n);
+// where the next write goes in the stream
+extern uint64_t repl_offset(void);
+
+// follows the primary at host, whose replication port is port. Replaces the
+// one followed before, if any. false when host isn't an IPv4 address.
+extern bool repl_follow(const char *host, int port);
+// stops following, the data stays and can be written again
+extern void repl_unfollow(void);
+// writes from clients are turned away
+extern bool repl_is_replica(void);
+extern void repl_info(ReplInfo *info);
+
+#endif /* REPL_H_ */
@@ -13,19 +13,36 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <stdbool.h>
 #include <time.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include "aof.h"
 #include "cache.h"
+#include "cluster.h"
 #include "connections.h"
+#include "hash.h"
+#include "mailbox.h"
 #include "strings.h"
 #include "common.h"
 #include "out.h"
+#include "repl.h"
+#include "slowlog.h"
+#include "uring.h"
+#include "timer.h"
 
 #define MAX_EVENTS 10000
+#define MAX_LOOPS 256
 
 enum {
 	RES_OK = 0, RES_ERR = 1, RES_NX = 2,
@@ -35,13 +52,111 @@ enum {
 	STATE_REQ = 0, STATE_RES = 1, STATE_END = 2, // mark the connection for deletion
 };
 
-static struct {
+// one event loop per thread. A loop owns its connections and its shard of
+// the keyspace, nothing in here is ever touched by another thread except the
+// mailbox (and the wake_fd that goes with it).
+typedef struct {
+	uint32_t id;
+	int epfd;
+	int listen_fd;
+	// eventfd, kicked by other loops when they post to our mailbox
+	int wake_fd;
 	// a map of all client connections, keyed by fd
 	Conns *fd2conn;
-	// timers for idle connections
-	DList idle_list;
+	// idle connections and TTLs
+	TimerWheel timers;
+	// the shard of the keyspace owned by this loop
+	Cache *cache;
+	// requests for keys we own, and replies to requests we handed off
+	Mailbox mailbox;
+	// the io_uring engine, NULL when running on epoll
+	Uring *ring;
+	// the buffers the kernel receives into, handed out per completion
+	UringBufRing bufs;
+	// connections with replies to send at the end of the iteration
+	DList flush_list;
+	// connections that carry on in the next iteration, in turn
+	DList ready_list;
+	// counts the iterations, for the turns of the connections
+	uint64_t iteration;
+	// a reply buffer to hand to the next connection that needs one
+	String *spare_out;
+	// tells connections that reused an fd apart, see UringOp
+	uint32_t next_gen;
+	// how far into the append only file the loop told its thread to write
+	uint64_t aof_kicked;
+	// over maxmemory still, and the time budget of the timers, see
+	// process_timers
+	bool evicting;
+	uint64_t timer_usec;
+	// what the eviction in the iteration took, and the second of the stalls
+	// reported last and the longest of them, see loop_watch
+	uint64_t evict_usec;
+	uint64_t stall_sec;
+	uint64_t stall_worst_usec;
+	pthread_t thread;
+} Loop;
+
+static struct {
+	Loop *loops;
+	uint32_t nloops;
+	bool uring;
+	// snapshots, loaded at startup and saved every save_ms if set
+	const char *snap_path;
+	uint64_t save_ms;
+	// every write also goes to the append only file, unless aof is NULL
+	Aof *aof;
+	const char *aof_path;
+	int aof_policy;
+	// split evenly over the shards, 0 for no limit
+	size_t max_mem;
+	int evict_policy;
+	// for the work that is taken off the loops, shared by all of them
+	TheadPool pool;
+	// an iteration of a loop that takes longer is reported, 0 for never
+	uint64_t stall_usec;
+	// where clients connect
+	int port;
+	size_t backlog_size;
+	// where replicas connect, 0 for none
+	int repl_port;
+	// writes from the primary posted to the loops and not done yet
+	atomic_size_t repl_inflight;
 } g_data;
 
+enum {
+	// FWD_LOAD is for a replica that resyncs, req is the path of the files
+	FWD_REQ = 0, FWD_RES = 1, FWD_LOAD = 2,
+};
+
+// a request handed off to the loop that owns its key, and on the way
+// back the reply to it
+typedef struct {
+	Mail mail;
+	uint32_t kind;
+	// ROUTE_ALL and ROUTE_SPLIT requests visit every shard in turn, this
+	// is the next one
+	uint32_t hop;
+	bool all;
+	bool split;
+	int32_t err;
+	// NULL for the writes that came from the primary, nobody waits for those
+	Loop *origin;
+	// the connection waiting for this, also checked against conn->pending
+	// in case the connection went away in the meantime
+	int fd;
+	String *out;
+	// the append only file offset of the write, 0 for none
+	uint64_t aof_off;
+	uint32_t len;
+	uint8_t req[0];
+} Forward;
+
+#define ROUTE_ALL ((uint32_t) -1)
+// a multi key request with keys in several shards: every shard does its
+// own keys, the replies are laid over each other (see forward_merge)
+#define ROUTE_SPLIT ((uint32_t) -2)
+
 static void fd_set_nb(int fd) {
 	errno = 0;
 	int flags = fcntl(fd, F_GETFL, 0);
@@ -59,48 +174,91 @@ static void fd_set_nb(int fd) {
 	}
 }
 
-static int32_t accept_new_conn(int fd) {
-	// accept
-	struct sockaddr_in client_addr = { };
-	socklen_t socklen = sizeof(client_addr);
-	int connfd = accept(fd, (struct sockaddr*) &client_addr, &socklen);
-	if (connfd < 0) {
-		msg("accept() error");
-		return -1;  // error
-	}
+const uint64_t k_idle_timeout_ms = 5 * 1000;
+
+// push the idle timer back, O(1) on the wheel
+static void conn_touch(Loop *loop, Conn *conn) {
+	wheel_add(&loop->timers, &conn->idle, get_monotonic_usec() / 1000 + k_idle_timeout_ms);
+}
 
+static Conn* conn_new(Loop *loop, int connfd) {
 	// set the new connection fd to nonblocking mode
 	fd_set_nb(connfd);
+	// replies are already gathered into one write per loop iteration, Nagle
+	// would only hold back the ones coming in from other loops
+	int val = 1;
+	setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 	// creating the struct Conn
 	Conn *conn = (Conn*) malloc(sizeof(Conn));
 	if (!conn) {
 		close(connfd);
-		return -1;
+		return NULL;
 	}
 	conn->fd = connfd;
 	conn->state = STATE_REQ;
-	conn->rbuf_size = 0;
-	conn->wbuf_size = 0;
-	conn->wbuf_sent = 0;
-	conn->idle_start = get_monotonic_usec();
-	dlist_insert_before(&g_data.idle_list, &conn->idle_list);
-	conns_set(g_data.fd2conn, conn);
-	return connfd;
+	conn->rbuf = NULL;
+	chain_init(&conn->wbuf);
+	conn->pending = NULL;
+	conn->out = NULL;
+	dlist_init(&conn->flush_list);
+	dlist_init(&conn->ready_list);
+	conn->budget = 0;
+	conn->turn = 0;
+	conn->write_blocked = false;
+	conn->gen = loop->next_gen++;
+	conn->sending = false;
+	conn->recv_paused = false;
+	conn->recv_op = NULL;
+	conn->aof_need = 0;
+	timer_init(&conn->idle, TIMER_IDLE);
+	conn_touch(loop, conn);
+	conns_set(loop->fd2conn, conn);
+	return conn;
+}
+
+static int32_t accept_new_conn(Loop *loop) {
+	// accept
+	struct sockaddr_in client_addr = { };
+	socklen_t socklen = sizeof(client_addr);
+	int connfd = accept(loop->listen_fd, (struct sockaddr*) &client_addr, &socklen);
+	if (connfd < 0) {
+		if (errno != EAGAIN) {
+			msg("accept() error");
+		}
+		return -1;  // error
+	}
+	return conn_new(loop, connfd) ? connfd : -1;
 }
 
-static void conn_done(Conn *conn) {
-	conns_del(g_data.fd2conn, conn->fd);
+static void conn_done(Loop *loop, Conn *conn) {
+	// a pending Forward is still owned by some other loop, it is freed when
+	// it comes back and does not find its connection.
+	conns_del(loop->fd2conn, conn->fd);
+	if (loop->ring) {
+		// the receive (and maybe a send) in flight hold on to the socket,
+		// this makes them complete so that they can be cleaned up
+		(void) shutdown(conn->fd, SHUT_RDWR);
+	}
 	(void) close(conn->fd);
-	dlist_detach(&conn->idle_list);
+	wheel_cancel(&loop->timers, &conn->idle);
+	dlist_detach(&conn->flush_list);
+	dlist_detach(&conn->ready_list);
+	// a receive that was paused, nothing is in flight for it
+	free(conn->recv_op);
+	if (conn->rbuf) {
+		chunk_unref(conn->rbuf);
+	}
+	chain_clear(&conn->wbuf);
+	str_free(conn->out);
 	free(conn);
 }
 
-static void state_req(Cache* cache, Conn *conn);
-static void state_res(Conn *conn);
+static void state_req(Loop *loop, Conn *conn);
+static void state_res(Loop *loop, Conn *conn);
+static void uring_send(Loop *loop, Conn *conn);
+static void uring_recv_pace(Loop *loop, Conn *conn, void *op);
 
 static int32_t do_request(Cache* cache, const uint8_t *req, uint32_t reqlen, String *out) {
-	int return_value = 0;
-
 	if (reqlen < 4) {
 		return -1;
 	}
@@ -114,102 +272,600 @@ static int32_t do_request(Cache* cache, const uint8_t *req, uint32_t reqlen, Str
 		return -1;
 	}
 
-	char **cmd = malloc(n * sizeof(char*));
-	int cmd_size = 0;
+	// the arguments are views straight into rbuf, no copies are made
+	StrView cmd[K_MAX_ARGS];
+	size_t cmd_size = 0;
 
 	size_t pos = 4;
 	while (n--) {
 		if (pos + 4 > reqlen) {
-			return_value = -1;
-			goto CLEANUP;
+			return -1;
 		}
 		uint32_t sz = 0;
 		memcpy(&sz, &req[pos], 4);
 		if (pos + 4 + sz > reqlen) {
-			return_value = -1;  // trailing garbage
-			goto CLEANUP;
+			return -1;  // trailing garbage
 		}
-		cmd[cmd_size] = (char*) (calloc(sz + 1, sizeof(char)));
-		memcpy(cmd[cmd_size], &req[pos + 4], sz);
+		cmd[cmd_size].data = (const char*) &req[pos + 4];
+		cmd[cmd_size].len = sz;
 		cmd_size++;
 		pos += 4 + sz;
 	}
 
 	if (pos != reqlen) {
-		return_value = -1;  // trailing garbage
-		goto CLEANUP;
-
+		return -1;  // trailing garbage
 	}
 	cache_execute(cache, cmd, cmd_size, out);
-CLEANUP: for (int i = 0; i < cmd_size; i++) {
-		if (cmd[i]) {
-			free(cmd[i]);
+	return 0;
+}
+
+// the shard of the keys of a multi key request, ROUTE_SPLIT if there are
+// several. The n args start at pos, every step-th is a key.
+static uint32_t route_keys(Loop *loop, const uint8_t *req, uint32_t reqlen, size_t pos,
+		uint32_t n, size_t step, const uint64_t *hcode) {
+	uint32_t route = loop->id;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t sz = 0;
+		if (pos + 4 > reqlen) {
+			return loop->id;
+		}
+		memcpy(&sz, &req[pos], 4);
+		if (pos + 4 + sz > reqlen) {
+			return loop->id;
+		}
+		if (i % step == 0) {
+			uint64_t h = i == 0 && hcode ? *hcode : str_hash(&req[pos + 4], sz);
+			uint32_t shard = cache_shard_of(h, g_data.nloops);
+			if (i > 0 && shard != route) {
+				return ROUTE_SPLIT;
+			}
+			route = shard;
+		}
+		pos += 4 + sz;
+	}
+	return route;
+}
+
+// figure out which loop owns the request, by the key in its first argument.
+// Malformed requests stay where they are and fail in do_request. hcode is
+// the hash of that key, when the prefetch already has it.
+static uint32_t request_route(Loop *loop, const uint8_t *req, uint32_t reqlen,
+		const uint64_t *hcode) {
+	if (g_data.nloops == 1 || reqlen < 8) {
+		return loop->id;
+	}
+	uint32_t n = 0;
+	memcpy(&n, &req[0], 4);
+	uint32_t sz = 0;
+	memcpy(&sz, &req[4], 4);
+	if (n < 1 || (size_t) 8 + sz > reqlen) {
+		return loop->id;
+	}
+	const Command *c = cache_command((const char*) &req[8], sz);
+	if (!c) {
+		return loop->id;
+	}
+	if (c->flags & CMD_ALL) {
+		return ROUTE_ALL;
+	}
+	if (c->flags & CMD_SPLIT) {
+		return ROUTE_SPLIT;
+	}
+	if (n < 2) {
+		return loop->id;
+	}
+	size_t pos = 8 + sz;
+	if (c->flags & CMD_MULTI_KEY) {
+		return route_keys(loop, req, reqlen, pos, n - 1, c->key_step, hcode);
+	}
+	if (pos + 4 > reqlen) {
+		return loop->id;
+	}
+	memcpy(&sz, &req[pos], 4);
+	if (pos + 4 + sz > reqlen) {
+		return loop->id;
+	}
+	if (c->flags & CMD_CURSOR) {
+		// the cursor says which shard it is in
+		char buf[32];
+		if (sz == 0 || sz >= sizeof(buf)) {
+			return loop->id;
 		}
+		memcpy(buf, &req[pos + 4], sz);
+		buf[sz] = '\0';
+		uint32_t shard = (uint32_t) (strtoull(buf, NULL, 10) & SCAN_SHARD_MASK);
+		return shard < g_data.nloops ? shard : loop->id;
+	}
+	return cache_shard_of(hcode ? *hcode : str_hash(&req[pos + 4], sz), g_data.nloops);
+}
+
+// the command a request is for, NULL if there is none
+static const Command* request_command(const uint8_t *req, uint32_t reqlen) {
+	if (reqlen < 8) {
+		return NULL;
+	}
+	uint32_t n = 0;
+	uint32_t sz = 0;
+	memcpy(&n, &req[0], 4);
+	memcpy(&sz, &req[4], 4);
+	if (n < 1 || (size_t) 8 + sz > reqlen) {
+		return NULL;
+	}
+	return cache_command((const char*) &req[8], sz);
+}
+
+// cluster mode: the error a request gets when it has to go to another node
+// instead, with the message in msg, 0 when it can run here. All the keys of
+// a request have to be in one slot. Only the loop that owns the keys can
+// tell the ones a migrating slot still has from the ones that are gone,
+// owner says whether this is it.
+static int32_t cluster_redirect(Loop *loop, const uint8_t *req, uint32_t reqlen, bool owner,
+		char *msg, size_t size) {
+	const Command *c = request_command(req, reqlen);
+	if (!c || (c->flags & (CMD_ALL | CMD_SPLIT | CMD_CURSOR | CMD_ADMIN))) {
+		return 0;
+	}
+	uint32_t n = 0;
+	uint32_t sz = 0;
+	memcpy(&n, &req[0], 4);
+	memcpy(&sz, &req[4], 4);
+	size_t pos = 8 + sz;
+	bool multi = c->flags & CMD_MULTI_KEY;
+	uint32_t nargs = multi ? n - 1 : (n > 1);
+	uint32_t slot = 0;
+	uint32_t nkeys = 0;
+	const uint8_t *key = NULL;
+	uint32_t key_len = 0;
+	for (uint32_t i = 0; i < nargs; i++) {
+		// malformed ones fail in do_request
+		if (pos + 4 > reqlen) {
+			return 0;
+		}
+		memcpy(&sz, &req[pos], 4);
+		if (pos + 4 + sz > reqlen) {
+			return 0;
+		}
+		if (!multi || i % c->key_step == 0) {
+			uint32_t s = key_slot(&req[pos + 4], sz);
+			if (nkeys > 0 && s != slot) {
+				snprintf(msg, size, "keys in different slots");
+				return ERR_ARG;
+			}
+			slot = s;
+			key = &req[pos + 4];
+			key_len = sz;
+			nkeys++;
+		}
+		pos += 4 + sz;
+	}
+	if (nkeys == 0) {
+		return 0;
+	}
+	uint32_t node = 0;
+	int32_t code = ERR_MOVED;
+	switch (cluster_slot_state(slot, &node)) {
+	case SLOT_HERE:
+		return 0;
+	case SLOT_DOWN:
+		snprintf(msg, size, "slot %u isn't served", slot);
+		return ERR_TRYAGAIN;
+	case SLOT_MIGRATING:
+		if (nkeys > 1) {
+			// some of them may be gone, and some not
+			snprintf(msg, size, "slot %u is being migrated", slot);
+			return ERR_TRYAGAIN;
+		}
+		if (!owner || cache_has(loop->cache, (const char*) key, key_len)) {
+			return 0;
+		}
+		code = ERR_ASK;
+		break;
+	}
+	int len = snprintf(msg, size, "%u ", slot);
+	cluster_node_name(node, &msg[len], size - (size_t) len);
+	return code;
+}
+
+static void loop_post(Loop *to, Forward *fwd) {
+	if (mailbox_post(&to->mailbox, &fwd->mail)) {
+		uint64_t one = 1;
+		ssize_t rv = write(to->wake_fd, &one, sizeof(one));
+		(void) rv;  // the counter can't overflow, we are the only writer
+	}
+}
+
+// A connection runs this many requests per loop iteration at most, the
+// rest of a deep pipeline waits for the next one. Once this much of its
+// replies is queued it runs and reads nothing more until they are out, a
+// client that doesn't read its replies only holds on to that much.
+const uint32_t k_conn_budget = 64;
+const size_t k_wbuf_flush_size = 256 * 1024;
+// io_uring engine: the most of a connection's requests received ahead of
+// running them, see uring_recv_pace
+const size_t k_max_rbuf_backlog = 1 << 20;
+// the biggest reply buffer kept around for the next connection
+const size_t k_max_spare_out = 64 * 1024;
+
+static String* loop_str_get(Loop *loop) {
+	String *out = loop->spare_out;
+	if (out) {
+		loop->spare_out = NULL;
+		return out;
 	}
-	free(cmd);
-	
-	return return_value;
+	return str_init(NULL);
+}
+
+static void loop_str_put(Loop *loop, String *out) {
+	if (!loop->spare_out && out->capacity <= k_max_spare_out) {
+		str_clear(out);
+		loop->spare_out = out;
+	} else {
+		str_free(out);
+	}
+}
+
+// bytes waiting to be sent
+static size_t conn_pending_out(Conn *conn) {
+	return conn->wbuf.size + (conn->out ? (size_t) str_size(conn->out) : 0);
+}
+
+// with -a always a reply only goes out once the write it answers is on
+// disk. Everything queued behind it waits too, to keep the order.
+static bool conn_durable(Conn *conn) {
+	return !g_data.aof || aof_durable(g_data.aof, conn->aof_need);
 }
 
-static int32_t try_one_request(Cache* cache, Conn *conn, uint32_t *start_index) {
+// runs the request, and notes the append only file offset of it if it
+// was a write. key is its first key with the hash in hcode, when the
+// prefetch has them, or NULL.
+static int32_t loop_execute(Loop *loop, const uint8_t *req, uint32_t len, String *out,
+		uint64_t *aof_off, const StrView *key, uint64_t hcode) {
+	uint64_t last = loop->cache->aof_last;
+	if (key) {
+		cache_hint(loop->cache, key, hcode);
+	}
+	int32_t err = do_request(loop->cache, req, len, out);
+	if (key) {
+		cache_hint(loop->cache, NULL, 0);
+	}
+	if (loop->cache->aof_last != last) {
+		*aof_off = loop->cache->aof_last;
+	}
+	return err;
+}
+
+// n bytes of the wbuf chain and then of `out` (just taken off the
+// connection) were sent. Whatever is left of `out` joins the chain.
+static void conn_sent(Loop *loop, Conn *conn, String *out, size_t n) {
+	size_t head = n < conn->wbuf.size ? n : conn->wbuf.size;
+	chain_consume(&conn->wbuf, head);
+	if (!out) {
+		return;
+	}
+	n -= head;
+	if (n < (size_t) str_size(out)) {
+		chain_append(&conn->wbuf, &out->data[n], str_size(out) - n);
+	}
+	loop_str_put(loop, out);
+}
+
+// the replies are sent at the end of the loop iteration, so that a whole
+// pipeline of them goes out together
+static void conn_queue_flush(Loop *loop, Conn *conn) {
+	if (dlist_empty(&conn->flush_list)) {
+		dlist_insert_before(&loop->flush_list, &conn->flush_list);
+	}
+}
+
+// replies are serialized straight into conn->out, behind their length
+// which reply_end fills in.
+static size_t reply_begin(Loop *loop, Conn *conn) {
+	if (!conn->out) {
+		conn->out = loop_str_get(loop);
+	}
+	size_t pos = str_size(conn->out);
+	str_append_uint32(conn->out, 0);
+	return pos;
+}
+
+static void reply_end(Loop *loop, Conn *conn, size_t pos) {
+	String *out = conn->out;
+	size_t len = str_size(out) - pos - 4;
+	if (len > K_MAX_MSG) {
+		str_truncate(out, pos + 4);
+		out_err(out, ERR_2BIG, "response is too big");
+		len = str_size(out) - pos - 4;
+	}
+	uint32_t wlen = (uint32_t) len;
+	memcpy(&out->data[pos], &wlen, 4);
+	conn_queue_flush(loop, conn);
+}
+
+// a reply that was put together somewhere else
+static void conn_reply(Loop *loop, Conn *conn, String *out) {
+	size_t pos = reply_begin(loop, conn);
+	str_appendCs_size(conn->out, out->data, str_size(out));
+	reply_end(loop, conn, pos);
+}
+
+static void forward_request(Loop *loop, Conn *conn, const uint8_t *req,
+		uint32_t len, uint32_t route) {
+	Forward *fwd = malloc(sizeof(Forward) + len);
+	if (!fwd) {
+		die("Out of memory");
+	}
+	fwd->kind = FWD_REQ;
+	fwd->all = route == ROUTE_ALL || route == ROUTE_SPLIT;
+	fwd->split = route == ROUTE_SPLIT;
+	fwd->hop = 0;
+	fwd->err = 0;
+	fwd->origin = loop;
+	fwd->fd = conn->fd;
+	fwd->out = NULL;
+	fwd->aof_off = 0;
+	fwd->len = len;
+	memcpy(fwd->req, req, len);
+	conn->pending = fwd;
+	loop_post(&g_data.loops[fwd->all ? 0 : route], fwd);
+}
+
+// The requests of rbuf whose lookups are being prefetched, n of them at the
+// offsets at, with their first keys and the hashes of those. next is the
+// first one that hasn't run yet, scanned is the offset the next window
+// starts from.
+typedef struct {
+	size_t scanned;
+	size_t n;
+	size_t next;
+	size_t at[CACHE_PREFETCH_MAX];
+	StrView keys[CACHE_PREFETCH_MAX];
+	uint64_t hcodes[CACHE_PREFETCH_MAX];
+} Prefetch;
+
+static int32_t try_one_request(Loop *loop, Conn *conn, Prefetch *pf) {
+	if (conn->pending) {
+		// waiting for another loop to answer the previous request
+		return false;
+	}
+	Chunk *rbuf = conn->rbuf;
 	// try to parse a request from the buffer
-	if (conn->rbuf_size < *start_index + 4) {
+	if (!rbuf || rbuf->end - rbuf->start < 4) {
 		// not enough data in the buffer. Will retry in the next iteration
 		return false;
 	}
 	uint32_t len = 0;
-	memcpy(&len, &conn->rbuf[*start_index], 4);
+	memcpy(&len, &rbuf->data[rbuf->start], 4);
 	if (len > K_MAX_MSG) {
 		msg("too long");
 		conn->state = STATE_END;
 		return false;
 	}
-	if (4 + len + *start_index > conn->rbuf_size) {
+	if (4 + (size_t) len > rbuf->end - rbuf->start) {
 		// not enough data in the buffer. Will retry in the next iteration
 		return false;
 	}
 
-	String *out = str_init(NULL);
-	int32_t err = do_request(cache, &conn->rbuf[4], len, out);
+	const uint8_t *req = &rbuf->data[rbuf->start + 4];
+	// the request at the front of the window is this one, unless it has no key
+	const StrView *key = NULL;
+	uint64_t hcode = 0;
+	if (pf->next < pf->n && pf->at[pf->next] == rbuf->start) {
+		key = &pf->keys[pf->next];
+		hcode = pf->hcodes[pf->next++];
+	}
+	uint32_t route = request_route(loop, req, len, key ? &hcode : NULL);
+	int32_t refused = 0;
+	char why[64];
+	if (repl_is_replica()) {
+		const Command *c = request_command(req, len);
+		if (c && (c->flags & CMD_WRITE)) {
+			// the writes come from the primary only
+			refused = ERR_READONLY;
+			snprintf(why, sizeof(why), "a replica takes no writes");
+		}
+	}
+	if (!refused && cluster_enabled()) {
+		refused = cluster_redirect(loop, req, len, route == loop->id, why, sizeof(why));
+	}
+	if (refused) {
+		size_t pos = reply_begin(loop, conn);
+		out_err(conn->out, refused, why);
+		rbuf->start += 4 + len;
+		reply_end(loop, conn, pos);
+		return (conn->state == STATE_REQ);
+	}
+	if (route != loop->id) {
+		forward_request(loop, conn, req, len, route);
+		rbuf->start += 4 + len;
+		return false;
+	}
+
+	size_t pos = reply_begin(loop, conn);
+	int32_t err = loop_execute(loop, req, len, conn->out, &conn->aof_need, key, hcode);
 	if (err) {
 		msg("bad req");
 		conn->state = STATE_END;
-		str_free(out);
+		str_truncate(conn->out, pos);
 		return false;
 	}
-	uint32_t wlen = str_size(out);
+	rbuf->start += 4 + len;
+	reply_end(loop, conn, pos);
+	return (conn->state == STATE_REQ);
+}
 
-	if ((conn->wbuf_size + wlen) > K_MAX_MSG) {
-		// cannot append to the write buffer the current message (too long), need to write!
-		conn->state = STATE_RES;
-		state_res(conn);
+// the first key of a request, false for the commands that have none
+static bool request_key(const uint8_t *req, uint32_t reqlen, StrView *key) {
+	const Command *c = request_command(req, reqlen);
+	if (!c || (c->flags & (CMD_ALL | CMD_SPLIT | CMD_CURSOR | CMD_ADMIN))) {
+		return false;
+	}
+	uint32_t n = 0;
+	uint32_t sz = 0;
+	memcpy(&n, &req[0], 4);
+	memcpy(&sz, &req[4], 4);
+	size_t pos = 8 + sz;
+	if (n < 2 || pos + 4 > reqlen) {
+		return false;
+	}
+	memcpy(&sz, &req[pos], 4);
+	if (pos + 4 + sz > reqlen) {
+		return false;
 	}
+	key->data = (const char*) &req[pos + 4];
+	key->len = sz;
+	return true;
+}
 
-	// generating echoing response
-	memcpy(&conn->wbuf[conn->wbuf_size], &wlen, 4);
-	memcpy(&conn->wbuf[conn->wbuf_size + 4], str_data(out), wlen);
-	conn->wbuf_size += 4 + wlen;
-	*start_index += 4 + len;
+// A pipeline of requests for keys all over a big db would wait on the
+// bucket and then the entry of one key after the other. The next complete
+// ones in rbuf with a key, up to CACHE_PREFETCH_MAX, get their lookups
+// prefetched together, then they run one by one as always. The hashes of
+// the keys go along, they aren't worked out again to route and run them.
+static void prefetch_requests(Loop *loop, Conn *conn, Prefetch *pf) {
+	Chunk *rbuf = conn->rbuf;
+	size_t pos = pf->scanned > rbuf->start ? pf->scanned : rbuf->start;
+	pf->n = 0;
+	pf->next = 0;
+	while (pf->n < CACHE_PREFETCH_MAX && pos + 4 <= rbuf->end) {
+		uint32_t len = 0;
+		memcpy(&len, &rbuf->data[pos], 4);
+		if (len > K_MAX_MSG || pos + 4 + len > rbuf->end) {
+			break;
+		}
+		if (request_key(&rbuf->data[pos + 4], len, &pf->keys[pf->n])) {
+			pf->at[pf->n++] = pos;
+		}
+		pos += 4 + len;
+	}
+	pf->scanned = pos;
+	cache_prefetch(loop->cache, pf->keys, pf->hcodes, pf->n);
+}
 
-	if (*start_index >= conn->rbuf_size) {
-		// we read it all, try to send!
-		conn->state = STATE_RES;
-		state_res(conn);
+// carries on in the next loop iteration, after the ones before it
+static void conn_ready(Loop *loop, Conn *conn) {
+	if (dlist_empty(&conn->ready_list)) {
+		dlist_insert_before(&loop->ready_list, &conn->ready_list);
 	}
-	str_free(out);
-	return (conn->state == STATE_REQ);
 }
 
-static int32_t try_fill_buffer(Cache* cache, Conn *conn) {
+// Runs the requests in rbuf one by one, as many as the connection's turn
+// of this loop iteration allows (k_conn_budget). With some left it's put
+// on the ready list, and whatever else is in the socket stays there too.
+// With k_wbuf_flush_size of replies queued it goes to STATE_RES, and
+// carries on once they are out.
+static void process_requests(Loop *loop, Conn *conn) {
+	if (conn->turn != loop->iteration) {
+		conn->turn = loop->iteration;
+		conn->budget = k_conn_budget;
+	}
+	// only good for this call, rbuf may move in between
+	Prefetch pf;
+	pf.scanned = 0;
+	pf.n = 0;
+	pf.next = 0;
+	// Why is there a loop? Please read the explanation of "pipelining".
+	while (conn->budget > 0 && conn_pending_out(conn) < k_wbuf_flush_size) {
+		if (pf.next == pf.n && conn->rbuf && !conn->pending) {
+			// the window is used up, on to the next one
+			prefetch_requests(loop, conn, &pf);
+		}
+		if (!try_one_request(loop, conn, &pf)) {
+			break;
+		}
+		conn->budget--;
+	}
+	if (conn->state == STATE_REQ && !conn->pending) {
+		if (conn_pending_out(conn) >= k_wbuf_flush_size) {
+			conn->state = STATE_RES;
+		} else if (conn->budget == 0) {
+			conn_ready(loop, conn);
+		}
+	}
+
+	if (conn->rbuf && conn->rbuf->start == conn->rbuf->end) {
+		// nothing left over, give the buffer back while we wait
+		chunk_unref(conn->rbuf);
+		conn->rbuf = NULL;
+	}
+	if (loop->ring) {
+		uring_recv_pace(loop, conn, NULL);
+	}
+}
+
+// how much more has to be read to complete the request at the front of
+// rbuf, at least 1 byte
+static size_t rbuf_missing(Conn *conn) {
+	Chunk *rbuf = conn->rbuf;
+	size_t remain = rbuf ? rbuf->end - rbuf->start : 0;
+	if (remain < 4) {
+		return 1;
+	}
+	uint32_t len = 0;
+	memcpy(&len, &rbuf->data[rbuf->start], 4);
+	return 4 + (size_t) len > remain ? 4 + (size_t) len - remain : 1;
+}
+
+// make room for at least `need` more bytes at the end of rbuf: move the
+// leftovers of a partial request to the front, or switch to a bigger buffer
+// if that is not enough.
+static void rbuf_room(Conn *conn, size_t need) {
+	Chunk *rbuf = conn->rbuf;
+	if (!rbuf) {
+		conn->rbuf = chunk_new(need);
+		return;
+	}
+	if (rbuf->cap - rbuf->end >= need) {
+		return;
+	}
+	size_t remain = rbuf->end - rbuf->start;
+	if (remain + need <= rbuf->cap) {
+		memmove(rbuf->data, &rbuf->data[rbuf->start], remain);
+	} else {
+		Chunk *bigger = chunk_new(remain + need);
+		memcpy(bigger->data, &rbuf->data[rbuf->start], remain);
+		chunk_unref(rbuf);
+		conn->rbuf = rbuf = bigger;
+	}
+	rbuf->start = 0;
+	rbuf->end = (uint32_t) remain;
+}
+
+// make room at the end of rbuf for the next read, sized for the request
+// being read if it doesn't fit in this buffer.
+static void rbuf_reserve(Conn *conn) {
+	rbuf_room(conn, rbuf_missing(conn));
+}
+
+// the io_uring engine receives into its own buffers, which are copied here
+static void rbuf_append(Conn *conn, const uint8_t *data, size_t len) {
+	size_t need = rbuf_missing(conn);
+	rbuf_room(conn, need > len ? need : len);
+	Chunk *rbuf = conn->rbuf;
+	memcpy(&rbuf->data[rbuf->end], data, len);
+	rbuf->end += (uint32_t) len;
+}
+
+static int32_t try_fill_buffer(Loop *loop, Conn *conn) {
+	if (conn->pending || !dlist_empty(&conn->ready_list)) {
+		// no reading until the handed off request has been answered, or
+		// the connection's next turn
+		return false;
+	}
 	// try to fill the buffer
-	assert(conn->rbuf_size < sizeof(conn->rbuf));
+	rbuf_reserve(conn);
+	Chunk *rbuf = conn->rbuf;
+	assert(rbuf->end < rbuf->cap);
 	ssize_t rv = 0;
 	do {
-		size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
-		rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
+		size_t cap = rbuf->cap - rbuf->end;
+		rv = read(conn->fd, &rbuf->data[rbuf->end], cap);
 	} while (rv < 0 && errno == EINTR);
 	if (rv < 0 && errno == EAGAIN) {
 		// got EAGAIN, stop.
+		if (rbuf->start == rbuf->end) {
+			chunk_unref(rbuf);
+			conn->rbuf = NULL;
+		}
 		return false;
 	}
 	if (rv < 0) {
@@ -218,7 +874,7 @@ static int32_t try_fill_buffer(Cache* cache, Conn *conn) {
 		return false;
 	}
 	if (rv == 0) {
-		if (conn->rbuf_size > 0) {
+		if (rbuf->end > rbuf->start) {
 			msg("unexpected EOF");
 		} else {
 			//msg("EOF");
@@ -227,36 +883,71 @@ static int32_t try_fill_buffer(Cache* cache, Conn *conn) {
 		return false;
 	}
 
-	uint32_t start_index = conn->rbuf_size;
-	conn->rbuf_size += (size_t) rv;
-	assert(conn->rbuf_size <= sizeof(conn->rbuf));
+	rbuf->end += (uint32_t) rv;
+	assert(rbuf->end <= rbuf->cap);
 
-	// Try to process requests one by one.
-	// Why is there a loop? Please read the explanation of "pipelining".
-	while (try_one_request(cache, conn, &start_index)) {
+	process_requests(loop, conn);
+	return (conn->state == STATE_REQ);
+}
+
+static void state_req(Loop *loop, Conn *conn) {
+	if (loop->ring) {
+		// the receive is always armed, data shows up on its own
+		return;
+	}
+	while (try_fill_buffer(loop, conn)) {
 	}
+}
+
+// the most chunks handed to one writev()
+#define MAX_IOV 64
 
-	size_t remain = conn->rbuf_size - start_index;
-	if (remain) {
-		memmove(conn->rbuf, &conn->rbuf[start_index], remain);
+// the iovecs for everything queued: the chain, then conn->out if all of
+// the chain fits. Sets *with_out when conn->out is in there.
+static int conn_iov(Conn *conn, struct iovec *iov, bool *with_out) {
+	int n = chain_iov(&conn->wbuf, iov, MAX_IOV - 1);
+	size_t bytes = 0;
+	for (int i = 0; i < n; i++) {
+		bytes += iov[i].iov_len;
 	}
-	conn->rbuf_size = remain;
-	return (conn->state == STATE_REQ);
+	*with_out = false;
+	if (bytes == conn->wbuf.size && conn->out && str_size(conn->out) > 0) {
+		iov[n].iov_base = conn->out->data;
+		iov[n].iov_len = str_size(conn->out);
+		n++;
+		*with_out = true;
+	}
+	return n;
 }
 
-static void state_req(Cache* cache, Conn *conn) {
-	while (try_fill_buffer(cache, conn)) {
+// everything was sent, let go of the buffers
+static void conn_sent_all(Loop *loop, Conn *conn) {
+	if (conn->out) {
+		loop_str_put(loop, conn->out);
+		conn->out = NULL;
 	}
+	conn->state = STATE_REQ;
 }
 
-static int32_t try_flush_buffer(Conn *conn) {
+static int32_t try_flush_buffer(Loop *loop, Conn *conn) {
+	if (conn->write_blocked) {
+		// no point in trying before EPOLLOUT says so
+		conn->state = STATE_RES;
+		return false;
+	}
+	// only through state_res, the replies wait for their writes (aof.h)
+	assert(conn_durable(conn));
+	struct iovec iov[MAX_IOV];
+	bool with_out = false;
+	int iovcnt = conn_iov(conn, iov, &with_out);
 	ssize_t rv = 0;
 	do {
-		size_t remain = conn->wbuf_size - conn->wbuf_sent;
-		rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remain);
+		rv = writev(conn->fd, iov, iovcnt);
 	} while (rv < 0 && errno == EINTR);
 	if (rv < 0 && errno == EAGAIN) {
 		// got EAGAIN, stop.
+		conn->write_blocked = true;
+		conn->state = STATE_RES;
 		return false;
 	}
 	if (rv < 0) {
@@ -264,105 +955,448 @@ static int32_t try_flush_buffer(Conn *conn) {
 		conn->state = STATE_END;
 		return false;
 	}
-	conn->wbuf_sent += (size_t) rv;
-	assert(conn->wbuf_sent <= conn->wbuf_size);
-	if (conn->wbuf_sent == conn->wbuf_size) {
+	String *out = NULL;
+	if (with_out) {
+		out = conn->out;
+		conn->out = NULL;
+	}
+	conn_sent(loop, conn, out, (size_t) rv);
+	if (conn_pending_out(conn) == 0) {
 		// response was fully sent, change state back
-		conn->state = STATE_REQ;
-		conn->wbuf_sent = 0;
-		conn->wbuf_size = 0;
+		conn_sent_all(loop, conn);
 		return false;
 	}
 	// still got some data in wbuf, could try to write again
 	return true;
 }
 
-static void state_res(Conn *conn) {
-	while (try_flush_buffer(conn)) {
+static void state_res(Loop *loop, Conn *conn) {
+	if (!conn_durable(conn)) {
+		// the sync wakes the loop up, and flush_replies tries again
+		conn_queue_flush(loop, conn);
+		return;
+	}
+	if (loop->ring) {
+		uring_send(loop, conn);
+		return;
+	}
+	while (try_flush_buffer(loop, conn)) {
 	}
 }
 
-const uint64_t k_idle_timeout_ms = 5 * 1000;
+// end of the loop iteration, send out the replies queued during it
+static void flush_replies(Loop *loop) {
+	if (g_data.aof && loop->cache->aof_last > loop->aof_kicked) {
+		// one kick per iteration, whatever was written during it goes to
+		// disk together (with the writes of the other loops, if they are quick)
+		aof_kick(g_data.aof);
+		loop->aof_kicked = loop->cache->aof_last;
+	}
+	// connections still waiting for the disk go back on the list
+	DList todo;
+	dlist_init(&todo);
+	if (!dlist_empty(&loop->flush_list)) {
+		dlist_insert_before(&loop->flush_list, &todo);
+		dlist_detach(&loop->flush_list);
+		dlist_init(&loop->flush_list);
+	}
+	while (!dlist_empty(&todo)) {
+		Conn *conn = container_of(todo.next, Conn, flush_list);
+		dlist_detach(&conn->flush_list);
+		dlist_init(&conn->flush_list);
+		bool stopped = conn->state == STATE_RES;
+		state_res(loop, conn);
+		if (conn->state == STATE_END) {
+			conn_done(loop, conn);
+		} else if (stopped && conn->state == STATE_REQ) {
+			// the replies it stopped for are out
+			conn_ready(loop, conn);
+		}
+	}
+}
 
-static void process_timers(Cache* cache) {
-	// the extra 1000us is for the ms resolution of poll()
-	uint64_t now_us = get_monotonic_usec() + 1000;
+// start of the loop iteration, the connections that ran out of their turn
+// in the last one get the next, in the order they ran out
+static void process_ready(Loop *loop) {
+	DList todo;
+	dlist_init(&todo);
+	if (!dlist_empty(&loop->ready_list)) {
+		dlist_insert_before(&loop->ready_list, &todo);
+		dlist_detach(&loop->ready_list);
+		dlist_init(&loop->ready_list);
+	}
+	while (!dlist_empty(&todo)) {
+		Conn *conn = container_of(todo.next, Conn, ready_list);
+		dlist_detach(&conn->ready_list);
+		dlist_init(&conn->ready_list);
+		if (conn->state != STATE_REQ) {
+			// stopped for its replies since, it carries on once they're out
+			continue;
+		}
+		conn_touch(loop, conn);
+		process_requests(loop, conn);
+		if (conn->state == STATE_REQ) {
+			state_req(loop, conn);
+		}
+		if (conn->state == STATE_END) {
+			conn_done(loop, conn);
+		}
+	}
+}
 
+// the reply to a handed off request made it back to the loop owning the
+// connection, deliver it and carry on with whatever is left in rbuf.
+static void forward_done(Loop *loop, Forward *fwd) {
+	Conn *conn = conns_get(loop->fd2conn, fwd->fd);
+	if (!conn || conn->pending != fwd) {
+		// the connection is gone
+		goto CLEANUP;
+	}
+	conn->pending = NULL;
+	if (fwd->aof_off) {
+		conn->aof_need = fwd->aof_off;
+	}
+	if (fwd->err) {
+		msg("bad req");
+		conn->state = STATE_END;
+	} else {
+		conn_reply(loop, conn, fwd->out);
+		process_requests(loop, conn);
+		// edge triggered, so there may be unread data in the socket
+		if (conn->state == STATE_REQ && !conn->pending) {
+			state_req(loop, conn);
+		}
+	}
+	if (conn->state == STATE_END) {
+		conn_done(loop, conn);
+	}
+CLEANUP:
+	str_free(fwd->out);
+	free(fwd);
+}
 
-	while (!dlist_empty(&g_data.idle_list)) {
-		Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
-		uint64_t next_us = next->idle_start + k_idle_timeout_ms * 1000;
-		if (next_us >= now_us + 1000) {
-			// not ready, the extra 1000us is for the ms resolution of poll()
-			break;
+// the size of the serialized scalar at data, 0 if it isn't one that fits
+static size_t ser_scalar_size(const char *data, size_t len) {
+	uint32_t sz = 0;
+	switch (len > 0 ? data[0] : -1) {
+	case SER_NIL:
+		return 1;
+	case SER_INT:
+	case SER_DBL:
+		return len >= 9 ? 9 : 0;
+	case SER_STR:
+		if (len < 5) {
+			return 0;
 		}
+		memcpy(&sz, &data[1], 4);
+		return len - 5 >= sz ? 5 + (size_t) sz : 0;
+	case SER_ERR:
+		if (len < 9) {
+			return 0;
+		}
+		memcpy(&sz, &data[5], 4);
+		return len - 9 >= sz ? 9 + (size_t) sz : 0;
+	}
+	return 0;
+}
 
-		printf("removing idle connection: %d\n", next->fd);
-		conn_done(next);
+// ROUTE_SPLIT arrays have an element for every key, nil from the shards
+// that don't own it. Lays the part over fwd->out, taking what isn't nil,
+// and adding up the ints (the counts of CMD_SPLIT commands).
+static void overlay_arrays(Forward *fwd, String *part) {
+	String *merged = str_init(NULL);
+	const char *a = fwd->out->data;
+	const char *b = part->data;
+	size_t alen = str_size(fwd->out);
+	size_t blen = str_size(part);
+	uint32_t n = 0;
+	memcpy(&n, &a[1], 4);
+	str_appendCs_size(merged, a, 5);
+	size_t apos = 5;
+	size_t bpos = 5;
+	for (uint32_t i = 0; i < n; i++) {
+		size_t asz = ser_scalar_size(&a[apos], alen - apos);
+		size_t bsz = ser_scalar_size(&b[bpos], blen - bpos);
+		if (asz == 0 || bsz == 0) {
+			msg("bad split reply");
+			break;
+		}
+		if (a[apos] == SER_INT && b[bpos] == SER_INT) {
+			int64_t x = 0;
+			int64_t y = 0;
+			memcpy(&x, &a[apos + 1], 8);
+			memcpy(&y, &b[bpos + 1], 8);
+			out_int(merged, x + y);
+		} else if (b[bpos] != SER_NIL) {
+			str_appendCs_size(merged, &b[bpos], (uint32_t) bsz);
+		} else {
+			str_appendCs_size(merged, &a[apos], (uint32_t) asz);
+		}
+		apos += asz;
+		bpos += bsz;
 	}
+	str_free(fwd->out);
+	fwd->out = merged;
+}
 
-	cache_evict(cache, now_us);
+// puts the reply of one more shard to a ROUTE_ALL or ROUTE_SPLIT request
+// together with the ones before it
+static void forward_merge(Forward *fwd, String *part) {
+	char got = str_char_at(part, 0);
+	char have = str_char_at(fwd->out, 0);
+	if (fwd->hop == 0) {
+		str_appendCs_size(fwd->out, part->data, str_size(part));
+	} else if (fwd->split && got == SER_ARR && have == SER_ARR) {
+		overlay_arrays(fwd, part);
+	} else if (fwd->split && got == SER_INT && have == SER_INT) {
+		// counts add up
+		int64_t x = 0;
+		int64_t total = 0;
+		memcpy(&x, &part->data[1], 8);
+		memcpy(&total, &fwd->out->data[1], 8);
+		total += x;
+		memcpy(&fwd->out->data[1], &total, 8);
+	} else if (got != SER_ARR || have != SER_ARR) {
+		// not a list of things, the first error is the answer
+		if (got == SER_ERR && have != SER_ERR) {
+			str_clear(fwd->out);
+			str_appendCs_size(fwd->out, part->data, str_size(part));
+		}
+	} else {
+		// gather the answers of every shard into one array: bump the
+		// element count and append our elements
+		uint32_t n = 0;
+		uint32_t total = 0;
+		memcpy(&n, &part->data[1], 4);
+		memcpy(&total, &fwd->out->data[1], 4);
+		total += n;
+		memcpy(&fwd->out->data[1], &total, 4);
+		str_appendCs_size(fwd->out, &part->data[5], str_size(part) - 5);
+	}
 }
 
-static void connection_io(Cache* cache, Conn *conn) {
-	// waked up by poll, update the idle timer
-	// by moving conn to the end of the list.
-	conn->idle_start = get_monotonic_usec();
-	dlist_detach(&conn->idle_list);
-	dlist_insert_before(&g_data.idle_list, &conn->idle_list);
+// a request for keys owned by this loop
+static void forward_execute(Loop *loop, Forward *fwd) {
+	if (!fwd->out) {
+		fwd->out = str_init(NULL);
+	}
+	char why[64];
+	int32_t refused = 0;
+	if (!fwd->all && cluster_enabled()) {
+		// a key of a slot that is being migrated may have gone in the meantime
+		refused = cluster_redirect(loop, fwd->req, fwd->len, true, why, sizeof(why));
+	}
+	if (refused) {
+		out_err(fwd->out, refused, why);
+		fwd->err = 0;
+	} else if (!fwd->all) {
+		fwd->err = loop_execute(loop, fwd->req, fwd->len, fwd->out, &fwd->aof_off, NULL, 0);
+	} else {
+		String *part = str_init(NULL);
+		fwd->err = loop_execute(loop, fwd->req, fwd->len, part, &fwd->aof_off, NULL, 0);
+		if (!fwd->err) {
+			forward_merge(fwd, part);
+		}
+		str_free(part);
+		if (!fwd->err && ++fwd->hop < g_data.nloops) {
+			loop_post(&g_data.loops[fwd->hop], fwd);
+			return;
+		}
+	}
+	fwd->kind = FWD_RES;
+	if (fwd->origin == loop) {
+		forward_done(loop, fwd);
+	} else {
+		loop_post(fwd->origin, fwd);
+	}
+}
 
-	if (conn->state == STATE_REQ) {
-		state_req(cache, conn);
-	} else if (conn->state == STATE_RES) {
-		state_res(conn);
+// a write from the primary, or the resync that comes before them
+static void repl_execute(Loop *loop, Forward *fwd) {
+	if (fwd->kind == FWD_LOAD) {
+		cache_reload(loop->cache, (const char*) fwd->req);
 	} else {
-		assert(0);  // not expected
+		String *out = loop_str_get(loop);
+		uint64_t aof_off = 0;
+		if (loop_execute(loop, fwd->req, fwd->len, out, &aof_off, NULL, 0)) {
+			msg("bad write from the primary");
+		}
+		loop_str_put(loop, out);
+	}
+	free(fwd);
+	atomic_fetch_sub(&g_data.repl_inflight, 1);
+}
+
+static void process_mailbox(Loop *loop) {
+	uint64_t cnt = 0;
+	ssize_t rv = read(loop->wake_fd, &cnt, sizeof(cnt));
+	(void) rv;
+	mailbox_rearm(&loop->mailbox);
+
+	Mail *mail = NULL;
+	while ((mail = mailbox_take(&loop->mailbox))) {
+		Forward *fwd = container_of(mail, Forward, mail);
+		if (!fwd->origin) {
+			repl_execute(loop, fwd);
+		} else if (fwd->kind == FWD_REQ) {
+			forward_execute(loop, fwd);
+		} else {
+			forward_done(loop, fwd);
+		}
 	}
 }
 
-static uint32_t next_timer_ms(Cache* cache) {
-	uint64_t now_us = get_monotonic_usec();
-	uint64_t next_us = (uint64_t) -1;
-	// idle timers
-	if (!dlist_empty(&g_data.idle_list)) {
-		Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
-		next_us = next->idle_start + k_idle_timeout_ms * 1000;
+// how long the timers may take per loop iteration, so that lots of keys
+// expiring at once don't stall the server. The rest go off in the next one.
+// While they fall behind the budget grows by the share that was left over,
+// up to the max, and it halves again once they keep up. A mass expiry is
+// over in a few iterations, and a few keys don't take a big slice.
+const uint64_t k_min_timer_usec = 1000;
+const uint64_t k_max_timer_usec = 25000;
+// the clock is read every so many timers
+const size_t k_timer_batch = 64;
+
+// how many keys are evicted per loop iteration at most past maxmemory.
+// While there are more to go, the loop doesn't wait for events.
+const size_t k_max_evictions = 1000;
+
+static void process_timers(Loop *loop) {
+	uint64_t now_ms = get_monotonic_usec() / 1000;
+	DList expired;
+	dlist_init(&expired);
+	wheel_advance(&loop->timers, now_ms, &expired);
+
+	uint64_t start = get_monotonic_usec();
+	size_t nworks = 0;
+	size_t left = 0;
+	while (!dlist_empty(&expired)) {
+		Timer *timer = container_of(expired.next, Timer, link);
+		dlist_detach(&timer->link);
+		dlist_init(&timer->link);
+		if (left > 0 || (++nworks % k_timer_batch == 0
+				&& get_monotonic_usec() - start >= loop->timer_usec)) {
+			wheel_add(&loop->timers, timer, now_ms);
+			left++;
+			continue;
+		}
+		switch (timer->kind) {
+		case TIMER_IDLE: {
+			Conn *conn = container_of(timer, Conn, idle);
+			printf("removing idle connection: %d\n", conn->fd);
+			conn_done(loop, conn);
+			break;
+		}
+		case TIMER_TTL:
+			cache_expire(loop->cache, timer);
+			break;
+		case TIMER_SAVE:
+			cache_bgsave(loop->cache);
+			break;
+		}
 	}
+	if (left > 0) {
+		loop->timer_usec += loop->timer_usec * left / (nworks + left);
+		if (loop->timer_usec > k_max_timer_usec) {
+			loop->timer_usec = k_max_timer_usec;
+		}
+	} else if (loop->timer_usec > k_min_timer_usec) {
+		loop->timer_usec = loop->timer_usec / 2 > k_min_timer_usec ? loop->timer_usec / 2
+				: k_min_timer_usec;
+	}
+	uint64_t evict_start = get_monotonic_usec();
+	loop->evicting = cache_evict(loop->cache, k_max_evictions);
+	loop->evict_usec = get_monotonic_usec() - evict_start;
+}
 
-	uint64_t from_cache = cache_next_expiry(cache);
-	if (from_cache != (uint64_t) -1 && from_cache < next_us) {
-		next_us = from_cache;
+// The watchdog: an iteration that took longer than g_data.stall_usec, the
+// wait for events aside, gets reported with how long each part of it took.
+// Within a second only the ones longer than all before it are, INFO counts
+// all of them. A command that took long is in the slowlog too.
+static void loop_watch(Loop *loop, uint64_t start, uint64_t io_end, uint64_t timers_end) {
+	uint64_t end = get_monotonic_usec();
+	bool stalled = g_data.stall_usec && end - start >= g_data.stall_usec;
+	cache_loop_done(loop->cache, end - start, loop->fd2conn->size, stalled);
+	if (!stalled) {
+		return;
+	}
+	if (end / 1000000 != loop->stall_sec) {
+		loop->stall_sec = end / 1000000;
+		loop->stall_worst_usec = 0;
+	}
+	if (end - start <= loop->stall_worst_usec) {
+		return;
 	}
+	loop->stall_worst_usec = end - start;
+	uint64_t timers = timers_end - io_end - loop->evict_usec;
+	fprintf(stderr, "loop %u: an iteration took %.1f ms (i/o %.1f ms, timers %.1f ms,"
+			" eviction %.1f ms, replies %.1f ms)\n", loop->id, (double) (end - start) / 1000,
+			(double) (io_end - start) / 1000, (double) timers / 1000,
+			(double) loop->evict_usec / 1000, (double) (end - timers_end) / 1000);
+}
 
-	if (next_us == (uint64_t) -1) {
-		return 10000;   // no timer, the value doesn't matter
+static void connection_io(Loop *loop, Conn *conn, uint32_t events) {
+	// waked up by poll
+	conn_touch(loop, conn);
+	if (events & EPOLLOUT) {
+		conn->write_blocked = false;
+	}
+
+	if (conn->state == STATE_RES) {
+		state_res(loop, conn);
+		if (conn->state == STATE_REQ) {
+			// carry on with the requests left in rbuf when the writes blocked
+			process_requests(loop, conn);
+		}
+	}
+	if (conn->state == STATE_REQ) {
+		state_req(loop, conn);
 	}
+}
 
-	if (next_us <= now_us) {
+static uint32_t next_timer_ms(Loop *loop) {
+	uint64_t next_ms = wheel_next(&loop->timers);
+	if (next_ms == (uint64_t) -1) {
+		return 10000;   // no timer, the value doesn't matter
+	}
+	uint64_t now_ms = get_monotonic_usec() / 1000;
+	if (next_ms <= now_ms) {
 		// missed?
 		return 0;
 	}
-	return (uint32_t) ((next_us - now_us) / 1000);
+	// rounded up, waking up early only to find nothing to do is a waste
+	return (uint32_t) (next_ms - now_ms + 1);
 }
 
-int main(void) {
-	struct epoll_event event, events[MAX_EVENTS];
-	struct sockaddr_in addr = { };
-	int epfd, fd, rv, val = 1;
+// how long the loop may wait for events: until the next timer, or hardly
+// at all while a snapshot is being written. Does a slice of that first.
+static uint32_t loop_wait_ms(Loop *loop) {
+	if (loop->evicting || !dlist_empty(&loop->ready_list)) {
+		return 0;
+	}
+	uint32_t timeout_ms = next_timer_ms(loop);
+	uint32_t save_ms = cache_save_step(loop->cache);
+	return save_ms < timeout_ms ? save_ms : timeout_ms;
+}
 
-	dlist_init(&g_data.idle_list);
-	Cache* cache = cache_init();
-	fd = socket(AF_INET, SOCK_STREAM, 0);
+// every loop listens on its own socket, the kernel spreads the incoming
+// connections over them (SO_REUSEPORT).
+static int listen_socket(void) {
+	int val = 1;
+	struct sockaddr_in addr = { };
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (fd < 0) {
 		die("socket()");
 	}
 
 	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	if (g_data.nloops > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))) {
+		die("SO_REUSEPORT");
+	}
 
 	addr.sin_family = AF_INET;
-	addr.sin_port = ntohs(PORT);
+	addr.sin_port = ntohs((uint16_t) g_data.port);
 	addr.sin_addr.s_addr = ntohl(0);    // wildcard address 0.0.0.0
-	rv = bind(fd, (const struct sockaddr*) &addr, sizeof(addr));
+	int rv = bind(fd, (const struct sockaddr*) &addr, sizeof(addr));
 	if (rv) {
 		die("bind()");
 	}
@@ -372,61 +1406,690 @@ int main(void) {
 	if (rv) {
 		die("listen()");
 	}
-	printf("The server is listening on port %i.\n", PORT);
-
-	// a hash table of all client connections, keyed by fd
-	g_data.fd2conn = conns_new(10);
 
 	// set the listen fd to nonblocking mode
 	fd_set_nb(fd);
+	return fd;
+}
+
+// the io_uring engine: instead of being told what is ready and doing the
+// syscalls itself, the loop keeps a multishot accept, one multishot receive
+// per connection and the sends in flight, and submits everything queued up
+// in one io_uring_enter() per iteration together with the wait.
+
+#define URING_ENTRIES 4096
+// the receive buffers, per loop. entries has to be a power of 2
+#define URING_BUFS 256
+#define URING_BUF_SIZE CHUNK_SIZE
+#define URING_BGID 0
+
+enum {
+	OP_ACCEPT = 0, OP_RECV = 1, OP_SEND = 2, OP_WAKE = 3, OP_CANCEL = 4,
+};
+
+// what every sqe is tagged with. Completions for a connection are checked
+// against its gen, the fd alone may already belong to a new connection.
+typedef struct {
+	uint32_t kind;
+	int fd;
+	uint32_t gen;
+	// OP_SEND only. The chunks being sent are referenced until the send
+	// completes, the connection may be closed before that.
+	struct msghdr msg;
+	Chunk *chunks[MAX_IOV];
+	size_t nchunks;
+	String *out;
+	struct iovec iov[0];
+} UringOp;
+
+static UringOp* uring_op_new(uint32_t kind, int fd, uint32_t gen, int iovcnt) {
+	UringOp *op = malloc(sizeof(UringOp) + iovcnt * sizeof(struct iovec));
+	if (!op) {
+		die("Out of memory");
+	}
+	op->kind = kind;
+	op->fd = fd;
+	op->gen = gen;
+	return op;
+}
+
+static struct io_uring_sqe* loop_sqe(Loop *loop, UringOp *op) {
+	struct io_uring_sqe *sqe = uring_get_sqe(loop->ring);
+	if (!sqe) {
+		die("io_uring submission queue is full");
+	}
+	sqe->fd = op->fd;
+	sqe->user_data = (uint64_t) (uintptr_t) op;
+	return sqe;
+}
+
+static void uring_arm_accept(Loop *loop, UringOp *op) {
+	struct io_uring_sqe *sqe = loop_sqe(loop, op);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+static void uring_arm_wake(Loop *loop, UringOp *op) {
+	struct io_uring_sqe *sqe = loop_sqe(loop, op);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+static void uring_arm_recv(Loop *loop, UringOp *op) {
+	struct io_uring_sqe *sqe = loop_sqe(loop, op);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+}
+
+static void uring_send(Loop *loop, Conn *conn) {
+	if (conn->sending) {
+		// whatever got queued since goes out when that one completes
+		return;
+	}
+	if (conn_pending_out(conn) == 0) {
+		return;
+	}
+	assert(conn_durable(conn));
+	UringOp *op = uring_op_new(OP_SEND, conn->fd, conn->gen, MAX_IOV);
+	memset(&op->msg, 0, sizeof(op->msg));
+	op->msg.msg_iov = op->iov;
+	bool with_out = false;
+	op->msg.msg_iovlen = (size_t) conn_iov(conn, op->iov, &with_out);
+	op->nchunks = 0;
+	for (Chunk *chunk = conn->wbuf.head; chunk; chunk = chunk->next) {
+		if (chunk->end > chunk->start && op->nchunks < MAX_IOV - 1) {
+			chunk_ref(chunk);
+			op->chunks[op->nchunks++] = chunk;
+		}
+	}
+	// the op owns conn->out until it completes, new replies start a new one
+	op->out = NULL;
+	if (with_out) {
+		op->out = conn->out;
+		conn->out = NULL;
+	}
+	struct io_uring_sqe *sqe = loop_sqe(loop, op);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->addr = (uint64_t) (uintptr_t) &op->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	conn->sending = true;
+}
+
+// A receive stays armed and hands over whatever arrives. A connection that
+// falls behind, k_max_rbuf_backlog of complete requests waiting in rbuf,
+// has it cancelled, with the ending receive kept in conn->recv_op. Once
+// it's caught up (rbuf is run from process_requests, op is NULL then) the
+// receive is armed again. The epoll engine just doesn't read.
+static void uring_recv_pace(Loop *loop, Conn *conn, void *op) {
+	Chunk *rbuf = conn->rbuf;
+	uint32_t len = 0;
+	if (rbuf && rbuf->end - rbuf->start >= k_max_rbuf_backlog) {
+		memcpy(&len, &rbuf->data[rbuf->start], 4);
+	}
+	// never while the request at the front isn't all there yet
+	bool behind = len && 4 + (size_t) len <= rbuf->end - rbuf->start;
+	if (op && behind && !conn->recv_paused) {
+		conn->recv_paused = true;
+		UringOp *cancel = uring_op_new(OP_CANCEL, conn->fd, conn->gen, 0);
+		struct io_uring_sqe *sqe = loop_sqe(loop, cancel);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uint64_t) (uintptr_t) op;
+	} else if (!op && !behind && conn->recv_paused) {
+		conn->recv_paused = false;
+		// still in flight otherwise, and armed again when it ends
+		if (conn->recv_op) {
+			uring_arm_recv(loop, (UringOp*) conn->recv_op);
+			conn->recv_op = NULL;
+		}
+	}
+}
+
+static Conn* uring_conn(Loop *loop, UringOp *op) {
+	Conn *conn = conns_get(loop->fd2conn, op->fd);
+	return conn && conn->gen == op->gen ? conn : NULL;
+}
+
+static void uring_on_accept(Loop *loop, struct io_uring_cqe *cqe, UringOp *op) {
+	if (cqe->res >= 0) {
+		Conn *conn = conn_new(loop, cqe->res);
+		if (conn) {
+			uring_arm_recv(loop, uring_op_new(OP_RECV, conn->fd, conn->gen, 0));
+		}
+	} else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+		msg("accept() error");
+	}
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		uring_arm_accept(loop, op);
+	}
+}
+
+static void uring_on_recv(Loop *loop, struct io_uring_cqe *cqe, UringOp *op) {
+	Conn *conn = uring_conn(loop, op);
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		if (conn && cqe->res > 0) {
+			rbuf_append(conn, uring_buf(&loop->bufs, bid), (size_t) cqe->res);
+		}
+		uring_buf_recycle(&loop->bufs, bid);
+	}
+	bool more = cqe->flags & IORING_CQE_F_MORE;
+	if (conn && cqe->res > 0) {
+		conn_touch(loop, conn);
+		if (conn->state == STATE_REQ) {
+			process_requests(loop, conn);
+		}
+	} else if (conn && cqe->res == 0) {
+		if (conn->rbuf && conn->rbuf->end > conn->rbuf->start) {
+			msg("unexpected EOF");
+		}
+		conn->state = STATE_END;
+	} else if (conn && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+		// ENOBUFS only means we ran out of receive buffers, just re-arm.
+		// ECANCELED is uring_recv_pace.
+		msg("read() error");
+		conn->state = STATE_END;
+	}
+	if (conn && conn->state == STATE_END) {
+		conn_done(loop, conn);
+		conn = NULL;
+	}
+	if (conn && more) {
+		uring_recv_pace(loop, conn, op);
+	}
+	if (!more) {
+		if (conn && conn->recv_paused) {
+			conn->recv_op = op;
+		} else if (conn) {
+			uring_arm_recv(loop, op);
+		} else {
+			free(op);
+		}
+	}
+}
+
+static void uring_on_send(Loop *loop, struct io_uring_cqe *cqe, UringOp *op) {
+	Conn *conn = uring_conn(loop, op);
+	for (size_t i = 0; i < op->nchunks; i++) {
+		chunk_unref(op->chunks[i]);
+	}
+	String *out = op->out;
+	free(op);
+	if (!conn) {
+		str_free(out);
+		return;
+	}
+	conn->sending = false;
+	if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+		msg("write() error");
+		str_free(out);
+		conn_done(loop, conn);
+		return;
+	}
+	if (cqe->res > 0) {
+		// a client reading its replies isn't idle, like EPOLLOUT
+		conn_touch(loop, conn);
+	}
+	conn_sent(loop, conn, out, cqe->res > 0 ? (size_t) cqe->res : 0);
+	if (conn_pending_out(conn) > 0) {
+		// replies queued meanwhile may still wait for the disk
+		state_res(loop, conn);
+		return;
+	}
+	// everything was sent, carry on with what came in meanwhile if we
+	// stopped for it
+	bool stopped = conn->state == STATE_RES;
+	conn_sent_all(loop, conn);
+	if (stopped) {
+		process_requests(loop, conn);
+		if (conn->state == STATE_END) {
+			conn_done(loop, conn);
+		}
+	}
+}
+
+static void uring_on_wake(Loop *loop, struct io_uring_cqe *cqe, UringOp *op) {
+	process_mailbox(loop);
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		uring_arm_wake(loop, op);
+	}
+}
+
+static void loop_init_uring(Loop *loop) {
+	loop->ring = malloc(sizeof(Uring));
+	if (!loop->ring) {
+		die("Out of memory");
+	}
+	int rv = uring_init(loop->ring, URING_ENTRIES);
+	if (rv < 0) {
+		errno = -rv;
+		die("io_uring_setup");
+	}
+	rv = uring_buf_ring_init(loop->ring, &loop->bufs, URING_BGID, URING_BUFS, URING_BUF_SIZE);
+	if (rv < 0) {
+		errno = -rv;
+		die("io_uring buffer ring");
+	}
+}
 
-	epfd = epoll_create1(0);
-	if (epfd == -1) {
+static void* loop_run_uring(void *arg) {
+	Loop *loop = (Loop*) arg;
+	// the ring only takes submissions from the thread that created it
+	loop_init_uring(loop);
+	// every loop loads its own shard, in parallel
+	cache_open(loop->cache, g_data.snap_path, g_data.save_ms, g_data.aof, g_data.aof_path);
+	uring_arm_accept(loop, uring_op_new(OP_ACCEPT, loop->listen_fd, 0, 0));
+	uring_arm_wake(loop, uring_op_new(OP_WAKE, loop->wake_fd, 0, 0));
+	while (true) {
+		int rv = uring_submit_and_wait(loop->ring, loop_wait_ms(loop));
+		if (rv < 0 && rv != -EBUSY) {
+			errno = -rv;
+			die("io_uring_enter");
+		}
+		uint64_t busy = get_monotonic_usec();
+		loop->iteration++;
+		process_ready(loop);
+
+		struct io_uring_cqe *next = NULL;
+		while ((next = uring_peek_cqe(loop->ring))) {
+			// the handlers queue new sqes, let the kernel have the slot back
+			struct io_uring_cqe cqe = *next;
+			uring_cqe_seen(loop->ring);
+			UringOp *op = (UringOp*) (uintptr_t) cqe.user_data;
+			switch (op->kind) {
+			case OP_ACCEPT:
+				uring_on_accept(loop, &cqe, op);
+				break;
+			case OP_RECV:
+				uring_on_recv(loop, &cqe, op);
+				break;
+			case OP_SEND:
+				uring_on_send(loop, &cqe, op);
+				break;
+			case OP_WAKE:
+				uring_on_wake(loop, &cqe, op);
+				break;
+			case OP_CANCEL:
+				free(op);
+				break;
+			}
+		}
+		uint64_t io_end = get_monotonic_usec();
+		process_timers(loop);
+		uint64_t timers_end = get_monotonic_usec();
+		flush_replies(loop);
+		loop_watch(loop, busy, io_end, timers_end);
+	}
+	return NULL;
+}
+
+static void loop_init(Loop *loop, uint32_t id) {
+	loop->id = id;
+	wheel_init(&loop->timers, get_monotonic_usec() / 1000);
+	loop->timer_usec = k_min_timer_usec;
+	dlist_init(&loop->flush_list);
+	dlist_init(&loop->ready_list);
+	mailbox_init(&loop->mailbox);
+	loop->cache = cache_init(id, g_data.nloops, &loop->timers, &g_data.pool);
+	cache_set_maxmemory(loop->cache, g_data.max_mem / g_data.nloops, g_data.evict_policy);
+	loop->listen_fd = listen_socket();
+	// a hash table of all client connections, keyed by fd
+	loop->fd2conn = conns_new(10);
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (loop->wake_fd == -1) {
+		die("eventfd");
+	}
+	if (g_data.uring) {
+		// the ring is set up by the loop's own thread, see loop_run_uring
+		return;
+	}
+
+	loop->epfd = epoll_create1(0);
+	if (loop->epfd == -1) {
 		die("epoll_create1");
 	}
 
+	struct epoll_event event;
 	event.events = EPOLLIN | EPOLLET;
-	event.data.fd = fd;
-	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+	event.data.fd = loop->listen_fd;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listen_fd, &event) == -1) {
 		die("epoll ctl: listen_sock!");
 	}
+	event.events = EPOLLIN;
+	event.data.fd = loop->wake_fd;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &event) == -1) {
+		die("epoll ctl: wake_fd!");
+	}
+}
+
+static void* loop_run(void *arg) {
+	Loop *loop = (Loop*) arg;
+	struct epoll_event *events = calloc(MAX_EVENTS, sizeof(struct epoll_event));
+	if (!events) {
+		die("Out of memory");
+	}
+	// every loop loads its own shard, in parallel
+	cache_open(loop->cache, g_data.snap_path, g_data.save_ms, g_data.aof, g_data.aof_path);
 	while (true) {
-		int timeout_ms = (int) next_timer_ms(cache);
+		int timeout_ms = (int) loop_wait_ms(loop);
 		// poll for active fds
-		int enfd_count = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+		int enfd_count = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout_ms);
 		if (enfd_count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
 			die("epoll_wait");
 		}
+		uint64_t busy = get_monotonic_usec();
+		loop->iteration++;
+		process_ready(loop);
 
 		// process active connections
 		for (int i = 0; i < enfd_count; ++i) {
-			if (events[i].data.fd == fd) {
-				int conn_fd = accept_new_conn(fd);
-				if (conn_fd > -1) {
+			if (events[i].data.fd == loop->listen_fd) {
+				int conn_fd = 0;
+				// edge triggered, so drain the whole backlog
+				while ((conn_fd = accept_new_conn(loop)) > -1) {
 					struct epoll_event ev;
 					ev.data.fd = conn_fd;
 					ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
-					epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+					epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
 				}
-			} else if (events[i].events & EPOLLIN) {
-				Conn *conn = conns_get(g_data.fd2conn, events[i].data.fd);
-				connection_io(cache, conn);
-				if (conn->state == STATE_END) {
-					// client closed normally, or something bad happened.
-					// destroy this connection
-					conn_done(conn);
+				continue;
+			}
+			if (events[i].data.fd == loop->wake_fd) {
+				process_mailbox(loop);
+				continue;
+			}
+			if (events[i].events & (EPOLLIN | EPOLLOUT)) {
+				Conn *conn = conns_get(loop->fd2conn, events[i].data.fd);
+				if (conn) {
+					connection_io(loop, conn, events[i].events);
+					if (conn->state == STATE_END) {
+						// client closed normally, or something bad happened.
+						// destroy this connection
+						conn_done(loop, conn);
+					}
 				}
 			}
 			if (events[i].events & (EPOLLHUP | EPOLLHUP | EPOLLERR)) {
-				Conn *conn = conns_get(g_data.fd2conn, events[i].data.fd);
+				Conn *conn = conns_get(loop->fd2conn, events[i].data.fd);
 				if (conn) {
-					conn_done(conn);
+					conn_done(loop, conn);
 				}
 			}
 		}
-		process_timers(cache);
+		uint64_t io_end = get_monotonic_usec();
+		process_timers(loop);
+		uint64_t timers_end = get_monotonic_usec();
+		flush_replies(loop);
+		loop_watch(loop, busy, io_end, timers_end);
 	}
+	free(events);
+	return NULL;
+}
 
-	return 0;
+// AOF_ALWAYS: replies held back for the sync can go now, on the loops'
+// own threads
+static void aof_synced(void *arg) {
+	(void) arg;
+	for (uint32_t i = 0; i < g_data.nloops; i++) {
+		uint64_t one = 1;
+		ssize_t rv = write(g_data.loops[i].wake_fd, &one, sizeof(one));
+		(void) rv;
+	}
+}
+
+// how many writes from the primary may wait in the mailboxes, past that
+// the follower stops reading from the primary until the loops catch up
+const size_t k_max_repl_inflight = 10000;
+
+static void repl_post(uint32_t to, uint32_t kind, const void *data, uint32_t len) {
+	Forward *fwd = malloc(sizeof(Forward) + len);
+	if (!fwd) {
+		die("Out of memory");
+	}
+	memset(fwd, 0, sizeof(Forward));
+	fwd->kind = kind;
+	fwd->fd = -1;
+	fwd->len = len;
+	memcpy(fwd->req, data, len);
+	atomic_fetch_add(&g_data.repl_inflight, 1);
+	loop_post(&g_data.loops[to], fwd);
 }
 
+// the repl.h hooks, called from its threads
+static void repl_apply(void *arg, const uint8_t *req, uint32_t len) {
+	while (atomic_load(&g_data.repl_inflight) >= k_max_repl_inflight) {
+		usleep(100);
+	}
+	uint32_t route = request_route(&g_data.loops[0], req, len, NULL);
+	if (route == ROUTE_ALL || route == ROUTE_SPLIT) {
+		// a copy for every shard rather than one going around them, so that
+		// it keeps its place among the writes after it on every one
+		for (uint32_t i = 0; i < g_data.nloops; i++) {
+			repl_post(i, FWD_REQ, req, len);
+		}
+	} else {
+		repl_post(route, FWD_REQ, req, len);
+	}
+}
+
+static void repl_load(void *arg, const char *path) {
+	for (uint32_t i = 0; i < g_data.nloops; i++) {
+		repl_post(i, FWD_LOAD, path, (uint32_t) strlen(path) + 1);
+	}
+}
+
+static uint64_t repl_saved_from(void *arg) {
+	uint64_t lowest = (uint64_t) -1;
+	for (uint32_t i = 0; i < g_data.nloops; i++) {
+		uint64_t from = cache_saved_from(g_data.loops[i].cache);
+		lowest = from < lowest ? from : lowest;
+	}
+	return lowest;
+}
+
+// 512, 64k, 16m, 1g
+static bool parse_size(const char *s, size_t *size) {
+	char *end = NULL;
+	unsigned long long n = strtoull(s, &end, 10);
+	int shift = 0;
+	switch (*end) {
+	case 'g': case 'G': shift += 10; /* fall through */
+	case 'm': case 'M': shift += 10; /* fall through */
+	case 'k': case 'K': shift += 10; end++; break;
+	}
+	if (end == s || *end) {
+		return false;
+	}
+	*size = (size_t) n << shift;
+	return true;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-t threads] [-e epoll|uring] [-f snapshot] [-s save seconds]"
+			" [-a always|everysec|no] [-A aof path] [-z packed zset size] [-H packed hash size]"
+			" [-m maxmemory[k|m|g]] [-p lru|lfu]"
+			" [-w worker threads]"
+			" [-l slowlog usec] [-W stall ms]"
+			" [-P port] [-R replication port] [-r primary host:port] [-b backlog size[k|m|g]]"
+			" [-c cluster ip]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	// a client going away mid reply is handled where the write fails
+	signal(SIGPIPE, SIG_IGN);
+	uint64_t seed = 0;
+	if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+		seed = get_monotonic_usec() ^ ((uint64_t) getpid() << 32);
+	}
+	str_hash_seed(seed);
+	uint32_t nloops = 1;
+	size_t nworkers = 4;
+	g_data.snap_path = "dump.minis";
+	g_data.aof_path = "appendonly.aof";
+	g_data.stall_usec = 100000;
+	g_data.port = PORT;
+	g_data.backlog_size = 16 << 20;
+	const char *primary = NULL;
+	const char *cluster_ip = NULL;
+	bool aof_on = false;
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strcmp(argv[i], "-t") && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 1 || n > MAX_LOOPS) {
+				usage(argv[0]);
+			}
+			nloops = (uint32_t) n;
+		} else if (0 == strcmp(argv[i], "-e") && i + 1 < argc) {
+			const char *engine = argv[++i];
+			if (0 == strcmp(engine, "uring")) {
+				g_data.uring = true;
+			} else if (0 != strcmp(engine, "epoll")) {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-f") && i + 1 < argc) {
+			g_data.snap_path = argv[++i];
+		} else if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+			int secs = atoi(argv[++i]);
+			if (secs < 0) {
+				usage(argv[0]);
+			}
+			g_data.save_ms = (uint64_t) secs * 1000;
+		} else if (0 == strcmp(argv[i], "-a") && i + 1 < argc) {
+			const char *policy = argv[++i];
+			if (0 == strcmp(policy, "always")) {
+				g_data.aof_policy = AOF_ALWAYS;
+			} else if (0 == strcmp(policy, "everysec")) {
+				g_data.aof_policy = AOF_EVERYSEC;
+			} else if (0 == strcmp(policy, "no")) {
+				g_data.aof_policy = AOF_NO;
+			} else {
+				usage(argv[0]);
+			}
+			aof_on = true;
+		} else if (0 == strcmp(argv[i], "-A") && i + 1 < argc) {
+			g_data.aof_path = argv[++i];
+		} else if (0 == strcmp(argv[i], "-m") && i + 1 < argc) {
+			if (!parse_size(argv[++i], &g_data.max_mem)) {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-p") && i + 1 < argc) {
+			const char *policy = argv[++i];
+			if (0 == strcmp(policy, "lru")) {
+				g_data.evict_policy = EVICT_LRU;
+			} else if (0 == strcmp(policy, "lfu")) {
+				g_data.evict_policy = EVICT_LFU;
+			} else {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-z") && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				usage(argv[0]);
+			}
+			g_zset_max_packed = (uint32_t) n;
+		} else if (0 == strcmp(argv[i], "-H") && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 0) {
+				usage(argv[0]);
+			}
+			g_hash_max_packed = (uint32_t) n;
+		} else if (0 == strcmp(argv[i], "-w") && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 1) {
+				usage(argv[0]);
+			}
+			nworkers = (size_t) n;
+		} else if (0 == strcmp(argv[i], "-l") && i + 1 < argc) {
+			g_slowlog_usec = atoll(argv[++i]);
+		} else if (0 == strcmp(argv[i], "-W") && i + 1 < argc) {
+			int ms = atoi(argv[++i]);
+			if (ms < 0) {
+				usage(argv[0]);
+			}
+			g_data.stall_usec = (uint64_t) ms * 1000;
+		} else if (0 == strcmp(argv[i], "-P") && i + 1 < argc) {
+			g_data.port = atoi(argv[++i]);
+			if (g_data.port < 1 || g_data.port > 65535) {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-R") && i + 1 < argc) {
+			g_data.repl_port = atoi(argv[++i]);
+			if (g_data.repl_port < 1 || g_data.repl_port > 65535) {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-r") && i + 1 < argc) {
+			primary = argv[++i];
+		} else if (0 == strcmp(argv[i], "-b") && i + 1 < argc) {
+			if (!parse_size(argv[++i], &g_data.backlog_size) || g_data.backlog_size == 0) {
+				usage(argv[0]);
+			}
+		} else if (0 == strcmp(argv[i], "-c") && i + 1 < argc) {
+			cluster_ip = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (cluster_ip) {
+		// the address the other nodes and the clients know this one by
+		struct sockaddr_in addr = { 0 };
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t) g_data.port);
+		if (inet_pton(AF_INET, cluster_ip, &addr.sin_addr) != 1) {
+			usage(argv[0]);
+		}
+		cluster_init(&addr);
+	}
+
+	// every loop has to be fully set up before any of them starts,
+	// since they post to each other's mailboxes.
+	g_data.nloops = nloops;
+	thread_pool_init(&g_data.pool, nworkers);
+	g_data.loops = calloc(nloops, sizeof(Loop));
+	if (!g_data.loops) {
+		die("Out of memory");
+	}
+	for (uint32_t i = 0; i < nloops; ++i) {
+		loop_init(&g_data.loops[i], i);
+	}
+	if (aof_on) {
+		g_data.aof = aof_open(g_data.aof_path, g_data.aof_policy, &aof_synced, NULL);
+		if (!g_data.aof) {
+			die("can't open the append only file");
+		}
+	}
+	ReplHooks hooks = { &repl_apply, &repl_load, &repl_saved_from, NULL };
+	repl_init(&hooks, g_data.repl_port, g_data.snap_path, nloops, g_data.backlog_size);
+	if (primary) {
+		// host:port
+		char host[64];
+		const char *colon = strrchr(primary, ':');
+		size_t len = colon ? (size_t) (colon - primary) : 0;
+		if (!colon || len >= sizeof(host)) {
+			usage(argv[0]);
+		}
+		memcpy(host, primary, len);
+		host[len] = '\0';
+		if (!repl_follow(host, atoi(colon + 1))) {
+			usage(argv[0]);
+		}
+	}
+	printf("The server is listening on port %i with %u event loop(s) on %s%s.\n", g_data.port,
+			nloops, g_data.uring ? "io_uring" : "epoll", cluster_ip ? ", in cluster mode" : "");
+
+	void* (*run)(void*) = g_data.uring ? &loop_run_uring : &loop_run;
+	for (uint32_t i = 1; i < nloops; ++i) {
+		if (pthread_create(&g_data.loops[i].thread, NULL, run, &g_data.loops[i])) {
+			die("pthread_create");
+		}
+	}
+	// the main thread runs the first loop
+	run(&g_data.loops[0]);
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * slab.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+#include "common.h"
+
+#define SLAB_PAGE_SIZE (64 * 1024)
+// the page header, keeps the objects 16 byte aligned
+#define SLAB_PAGE_HEADER 64
+
+static const size_t k_classes[] = { 16, 32, 48, 64, 80, 96, 112, 128, 160, 192,
+		224, 256, 320, 384, 448, 512, 640, 768, 896, 1024 };
+
+#define NUM_CLASSES (sizeof(k_classes) / sizeof(k_classes[0]))
+
+// a freed object, the link lives in the object itself
+typedef struct free_obj {
+	struct free_obj *next;
+} FreeObj;
+
+struct slab;
+
+typedef struct {
+	struct slab *owner;
+	size_t size;
+	FreeObj *free_list;
+	// objects freed by other threads, taken all at once by the owner
+	FreeObj *_Atomic remote_free;
+	// the unused tail of the newest page
+	char *bump;
+	char *bump_end;
+	// the stats are only written by the owner, so plain loads and stores
+	// (relaxed atomics, to let other threads read them) are enough
+	atomic_size_t objects;
+	atomic_size_t requested;
+	atomic_size_t pages;
+	// remote frees add up here instead, they can race with each other
+	atomic_size_t remote_objects;
+	atomic_size_t remote_requested;
+} SlabClass;
+
+// every page starts with this, found from an object by masking its address
+typedef struct {
+	SlabClass *cls;
+} SlabPage;
+
+// the slabs of one thread, never freed as remote frees may still come in
+typedef struct slab {
+	SlabClass classes[NUM_CLASSES];
+	struct slab *next;
+} Slab;
+
+static __thread Slab *t_slab = NULL;
+
+static struct {
+	pthread_mutex_t mu;
+	// every thread's slabs, for the stats
+	Slab *all;
+	atomic_size_t large_objects;
+	atomic_size_t large_bytes;
+} g_slabs = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+static void counter_add(atomic_size_t *counter, size_t delta) {
+	atomic_store_explicit(counter,
+			atomic_load_explicit(counter, memory_order_relaxed) + delta,
+			memory_order_relaxed);
+}
+
+static void counter_sub(atomic_size_t *counter, size_t delta) {
+	atomic_store_explicit(counter,
+			atomic_load_explicit(counter, memory_order_relaxed) - delta,
+			memory_order_relaxed);
+}
+
+static size_t class_index(size_t size) {
+	if (size <= 128) {
+		return size ? (size - 1) / 16 : 0;
+	}
+	size_t i = 8;
+	while (k_classes[i] < size) {
+		i++;
+	}
+	return i;
+}
+
+size_t slab_size_class(size_t size) {
+	return size > SLAB_MAX_SIZE ? size : k_classes[class_index(size)];
+}
+
+static Slab* slab_get(void) {
+	if (t_slab) {
+		return t_slab;
+	}
+	Slab *slab = calloc(1, sizeof(Slab));
+	if (!slab) {
+		die("Out of memory");
+	}
+	for (size_t i = 0; i < NUM_CLASSES; i++) {
+		slab->classes[i].owner = slab;
+		slab->classes[i].size = k_classes[i];
+	}
+	pthread_mutex_lock(&g_slabs.mu);
+	slab->next = g_slabs.all;
+	g_slabs.all = slab;
+	pthread_mutex_unlock(&g_slabs.mu);
+	t_slab = slab;
+	return slab;
+}
+
+static void class_new_page(SlabClass *cls) {
+	SlabPage *page = aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+	if (!page) {
+		die("Out of memory");
+	}
+	page->cls = cls;
+	cls->bump = (char*) page + SLAB_PAGE_HEADER;
+	cls->bump_end = (char*) page + SLAB_PAGE_SIZE;
+	counter_add(&cls->pages, 1);
+}
+
+void* slab_alloc(size_t size) {
+	if (size > SLAB_MAX_SIZE) {
+		void *ptr = malloc(size);
+		if (!ptr) {
+			die("Out of memory");
+		}
+		atomic_fetch_add_explicit(&g_slabs.large_objects, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&g_slabs.large_bytes, size, memory_order_relaxed);
+		return ptr;
+	}
+
+	SlabClass *cls = &slab_get()->classes[class_index(size)];
+	if (!cls->free_list && atomic_load_explicit(&cls->remote_free, memory_order_relaxed)) {
+		cls->free_list = atomic_exchange(&cls->remote_free, NULL);
+	}
+
+	void *ptr = NULL;
+	if (cls->free_list) {
+		ptr = cls->free_list;
+		cls->free_list = cls->free_list->next;
+	} else {
+		if (cls->bump + cls->size > cls->bump_end) {
+			class_new_page(cls);
+		}
+		ptr = cls->bump;
+		cls->bump += cls->size;
+	}
+	counter_add(&cls->objects, 1);
+	counter_add(&cls->requested, size);
+	return ptr;
+}
+
+void slab_free(void *ptr, size_t size) {
+	if (!ptr) {
+		return;
+	}
+	if (size > SLAB_MAX_SIZE) {
+		atomic_fetch_sub_explicit(&g_slabs.large_objects, 1, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&g_slabs.large_bytes, size, memory_order_relaxed);
+		free(ptr);
+		return;
+	}
+
+	SlabPage *page = (SlabPage*) ((uintptr_t) ptr & ~((uintptr_t) SLAB_PAGE_SIZE - 1));
+	SlabClass *cls = page->cls;
+	assert(cls->size == k_classes[class_index(size)]);
+	FreeObj *obj = (FreeObj*) ptr;
+	if (cls->owner == t_slab) {
+		obj->next = cls->free_list;
+		cls->free_list = obj;
+		counter_sub(&cls->objects, 1);
+		counter_sub(&cls->requested, size);
+		return;
+	}
+
+	// somebody else's object, push it onto their remote list. The owner
+	// takes the whole list at once, so there is no ABA to worry about.
+	obj->next = atomic_load(&cls->remote_free);
+	while (!atomic_compare_exchange_weak(&cls->remote_free, &obj->next, obj)) {
+	}
+	atomic_fetch_add_explicit(&cls->remote_objects, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&cls->remote_requested, size, memory_order_relaxed);
+}
+
+void slab_stats(SlabStats *stats) {
+	memset(stats, 0, sizeof(SlabStats));
+	pthread_mutex_lock(&g_slabs.mu);
+	for (Slab *slab = g_slabs.all; slab; slab = slab->next) {
+		for (size_t i = 0; i < NUM_CLASSES; i++) {
+			SlabClass *cls = &slab->classes[i];
+			size_t remote = atomic_load_explicit(&cls->remote_objects, memory_order_relaxed);
+			size_t remote_req = atomic_load_explicit(&cls->remote_requested, memory_order_relaxed);
+			size_t objects = atomic_load_explicit(&cls->objects, memory_order_relaxed);
+			size_t requested = atomic_load_explicit(&cls->requested, memory_order_relaxed);
+			size_t pages = atomic_load_explicit(&cls->pages, memory_order_relaxed);
+			objects = objects > remote ? objects - remote : 0;
+			stats->objects += objects;
+			stats->used_bytes += objects * cls->size;
+			stats->requested_bytes += requested > remote_req ? requested - remote_req : 0;
+			stats->pages += pages;
+			stats->reserved_bytes += pages * SLAB_PAGE_SIZE;
+		}
+	}
+	pthread_mutex_unlock(&g_slabs.mu);
+	stats->large_objects = atomic_load_explicit(&g_slabs.large_objects, memory_order_relaxed);
+	stats->large_bytes = atomic_load_explicit(&g_slabs.large_bytes, memory_order_relaxed);
+	stats->objects += stats->large_objects;
+	stats->used_bytes += stats->large_bytes;
+	stats->requested_bytes += stats->large_bytes;
+	stats->reserved_bytes += stats->large_bytes;
+}
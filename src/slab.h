@@ -0,0 +1,45 @@
+/*
+ * slab.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size class allocator for the small, fixed-after-creation objects the cache
+// is made of (Entry, ZNode, ZSet and short values). Objects are carved out
+// of 64k pages with no per-object header. Every thread allocates from its
+// own slabs, a free from another thread (e.g. a thread pool worker) is
+// handed back to the owning thread lock-free.
+// Requests larger than the biggest size class go straight to malloc.
+
+#define SLAB_MAX_SIZE 1024
+
+typedef struct {
+	// bytes asked for by callers
+	size_t requested_bytes;
+	// bytes handed out, i.e. rounded up to the size class
+	size_t used_bytes;
+	// bytes taken from the system, pages plus large allocations
+	size_t reserved_bytes;
+	size_t objects;
+	size_t pages;
+	size_t large_objects;
+	size_t large_bytes;
+} SlabStats;
+
+extern void* slab_alloc(size_t size);
+// size must be the one given to slab_alloc
+extern void slab_free(void *ptr, size_t size);
+// the size actually reserved for a request of this size, callers can use the
+// slack (e.g. to keep a value inline that grows a bit)
+extern size_t slab_size_class(size_t size);
+// totals over all threads, approximate while others are allocating
+extern void slab_stats(SlabStats *stats);
+
+#endif /* SLAB_H_ */
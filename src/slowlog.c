@@ -0,0 +1,127 @@
+/*
+ * slowlog.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "slowlog.h"
+#include "common.h"
+#include "out.h"
+
+int64_t g_slowlog_usec = 10000;
+
+typedef struct {
+	uint64_t id;
+	uint64_t time_ms;
+	uint64_t usec;
+	uint32_t shard;
+	uint32_t nargs;
+	// the args one after the other, cut short where they were too long
+	char *buf;
+	uint32_t lens[SLOWLOG_MAX_ARGS];
+} SlowEntry;
+
+static pthread_mutex_t g_mu = PTHREAD_MUTEX_INITIALIZER;
+// a ring, next_id % SLOWLOG_LEN is where the next one goes
+static SlowEntry g_ring[SLOWLOG_LEN];
+static uint64_t g_next_id;
+static size_t g_len;
+
+static uint64_t wall_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+// appends one arg of the summary, and returns its length
+static uint32_t put_arg(char *to, const char *data, size_t len) {
+	if (len <= SLOWLOG_MAX_ARG_LEN) {
+		memcpy(to, data, len);
+		return (uint32_t) len;
+	}
+	memcpy(to, data, SLOWLOG_MAX_ARG_LEN);
+	return SLOWLOG_MAX_ARG_LEN + (uint32_t) sprintf(to + SLOWLOG_MAX_ARG_LEN,
+			"... (%zu more bytes)", len - SLOWLOG_MAX_ARG_LEN);
+}
+
+void slowlog_push(const StrView *args, size_t n, uint64_t usec, uint32_t shard) {
+	// put together outside of the lock, the note on the cut off args included
+	const size_t k_note = 48;
+	SlowEntry ent;
+	memset(&ent, 0, sizeof(ent));
+	ent.time_ms = wall_ms();
+	ent.usec = usec;
+	ent.shard = shard;
+	ent.nargs = (uint32_t) (n > SLOWLOG_MAX_ARGS ? SLOWLOG_MAX_ARGS : n);
+	ent.buf = malloc(ent.nargs * (SLOWLOG_MAX_ARG_LEN + k_note));
+	if (!ent.buf) {
+		die("Out of memory");
+	}
+	char *pos = ent.buf;
+	for (uint32_t i = 0; i < ent.nargs; i++) {
+		if (i == SLOWLOG_MAX_ARGS - 1 && n > SLOWLOG_MAX_ARGS) {
+			ent.lens[i] = (uint32_t) sprintf(pos, "... (%zu more arguments)", n - i);
+		} else {
+			ent.lens[i] = put_arg(pos, args[i].data, args[i].len);
+		}
+		pos += ent.lens[i];
+	}
+
+	pthread_mutex_lock(&g_mu);
+	ent.id = g_next_id++;
+	SlowEntry *slot = &g_ring[ent.id % SLOWLOG_LEN];
+	char *old = slot->buf;
+	*slot = ent;
+	if (g_len < SLOWLOG_LEN) {
+		g_len++;
+	}
+	pthread_mutex_unlock(&g_mu);
+	free(old);
+}
+
+void slowlog_out(String *out, size_t n) {
+	pthread_mutex_lock(&g_mu);
+	if (n > g_len) {
+		n = g_len;
+	}
+	out_arr(out, (uint32_t) n);
+	for (size_t i = 0; i < n; i++) {
+		SlowEntry *ent = &g_ring[(g_next_id - 1 - i) % SLOWLOG_LEN];
+		out_arr(out, 5);
+		out_int(out, (int64_t) ent->id);
+		out_int(out, (int64_t) ent->time_ms);
+		out_int(out, (int64_t) ent->usec);
+		out_int(out, (int64_t) ent->shard);
+		out_arr(out, ent->nargs);
+		const char *pos = ent->buf;
+		for (uint32_t k = 0; k < ent->nargs; k++) {
+			out_str_size(out, pos, ent->lens[k]);
+			pos += ent->lens[k];
+		}
+	}
+	pthread_mutex_unlock(&g_mu);
+}
+
+size_t slowlog_len(void) {
+	pthread_mutex_lock(&g_mu);
+	size_t n = g_len;
+	pthread_mutex_unlock(&g_mu);
+	return n;
+}
+
+void slowlog_reset(void) {
+	pthread_mutex_lock(&g_mu);
+	for (size_t i = 0; i < SLOWLOG_LEN; i++) {
+		free(g_ring[i].buf);
+		g_ring[i].buf = NULL;
+	}
+	// the ids carry on
+	g_len = 0;
+	pthread_mutex_unlock(&g_mu);
+}
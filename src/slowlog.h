@@ -0,0 +1,33 @@
+/*
+ * slowlog.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef SLOWLOG_H_
+#define SLOWLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "strings.h"
+
+// The commands that took longer than g_slowlog_usec, the last
+// SLOWLOG_LEN of them for the whole server. Only the slow ones take the
+// lock, the others don't get past the comparison.
+#define SLOWLOG_LEN 128
+// the most args kept of a command, and the most bytes of each
+#define SLOWLOG_MAX_ARGS 32
+#define SLOWLOG_MAX_ARG_LEN 128
+
+// 0 logs every command, negative none. Set at startup.
+extern int64_t g_slowlog_usec;
+
+extern void slowlog_push(const StrView *args, size_t n, uint64_t usec, uint32_t shard);
+// the newest n entries, newest first: id, unix time in ms, usec, shard and
+// the args
+extern void slowlog_out(String *out, size_t n);
+extern size_t slowlog_len(void);
+extern void slowlog_reset(void);
+
+#endif /* SLOWLOG_H_ */
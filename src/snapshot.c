@@ -0,0 +1,327 @@
+/*
+ * snapshot.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "common.h"
+
+#define SNAP_MAGIC "MINISNAP"
+#define SNAP_END_MAGIC "MINISEND"
+// 2 added SNAP_HASH, a version 1 file reads the same
+#define SNAP_VERSION 2
+#define SNAP_HEADER_SIZE (8 + 4 + 4 + 4)
+#define SNAP_TRAILER_SIZE (1 + 8 + 8)
+
+struct snap_writer {
+	int fd;
+	char *path;
+	char *tmp_path;
+	TheadPool *tp;
+	// filled by the loop
+	String *buf;
+	uint64_t nrecords;
+	// the trailer was handed to the pool
+	bool finishing;
+	// a buffer is with the pool
+	atomic_bool busy;
+	atomic_int state;
+};
+
+typedef struct {
+	SnapWriter *w;
+	String *buf;
+	bool last;
+} SnapJob;
+
+SnapWriter* snap_writer_new(const char *path, uint32_t shard, uint32_t nshards,
+		TheadPool *tp) {
+	SnapWriter *w = calloc(1, sizeof(SnapWriter));
+	if (!w) {
+		die("Out of memory");
+	}
+	w->path = strdup(path);
+	w->tmp_path = malloc(strlen(path) + 5);
+	if (!w->path || !w->tmp_path) {
+		die("Out of memory");
+	}
+	sprintf(w->tmp_path, "%s.tmp", path);
+	w->fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (w->fd < 0) {
+		free(w->path);
+		free(w->tmp_path);
+		free(w);
+		return NULL;
+	}
+	w->tp = tp;
+	w->buf = str_init(NULL);
+	atomic_init(&w->busy, false);
+	atomic_init(&w->state, SNAP_RUNNING);
+
+	str_appendCs_size(w->buf, SNAP_MAGIC, 8);
+	str_append_uint32(w->buf, SNAP_VERSION);
+	str_append_uint32(w->buf, shard);
+	str_append_uint32(w->buf, nshards);
+	return w;
+}
+
+static void put_record(SnapWriter *w, uint8_t type, const char *key, size_t key_len,
+		int64_t expire_at) {
+	str_appendC(w->buf, (char) type);
+	str_append_int64_t(w->buf, expire_at);
+	str_append_uint32(w->buf, (uint32_t) key_len);
+	str_appendCs_size(w->buf, key, (uint32_t) key_len);
+	w->nrecords++;
+}
+
+void snap_put_str(SnapWriter *w, const char *key, size_t key_len,
+		const char *val, size_t val_len, int64_t expire_at) {
+	put_record(w, SNAP_STR, key, key_len, expire_at);
+	str_append_uint32(w->buf, (uint32_t) val_len);
+	str_appendCs_size(w->buf, val, (uint32_t) val_len);
+}
+
+void snap_put_zset(SnapWriter *w, const char *key, size_t key_len, uint32_t n,
+		int64_t expire_at) {
+	put_record(w, SNAP_ZSET, key, key_len, expire_at);
+	str_append_uint32(w->buf, n);
+}
+
+void snap_put_znode(SnapWriter *w, double score, const char *name, size_t len) {
+	str_append_double(w->buf, score);
+	str_append_uint32(w->buf, (uint32_t) len);
+	str_appendCs_size(w->buf, name, (uint32_t) len);
+}
+
+void snap_put_hash(SnapWriter *w, const char *key, size_t key_len, uint32_t n,
+		int64_t expire_at) {
+	put_record(w, SNAP_HASH, key, key_len, expire_at);
+	str_append_uint32(w->buf, n);
+}
+
+void snap_put_hfield(SnapWriter *w, const char *field, size_t flen,
+		const char *val, size_t vlen) {
+	str_append_uint32(w->buf, (uint32_t) flen);
+	str_appendCs_size(w->buf, field, (uint32_t) flen);
+	str_append_uint32(w->buf, (uint32_t) vlen);
+	str_appendCs_size(w->buf, val, (uint32_t) vlen);
+}
+
+size_t snap_buffered(SnapWriter *w) {
+	return (size_t) str_size(w->buf);
+}
+
+static bool write_all(int fd, const char *buf, size_t n) {
+	while (n > 0) {
+		ssize_t rv = write(fd, buf, n);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rv <= 0) {
+			return false;
+		}
+		n -= (size_t) rv;
+		buf += rv;
+	}
+	return true;
+}
+
+// runs on the thread pool
+static void snap_write_job(void *arg) {
+	SnapJob *job = (SnapJob*) arg;
+	SnapWriter *w = job->w;
+	bool ok = atomic_load(&w->state) == SNAP_RUNNING
+			&& write_all(w->fd, job->buf->data, (size_t) str_size(job->buf));
+	if (ok && job->last) {
+		ok = fsync(w->fd) == 0;
+		ok = close(w->fd) == 0 && ok;
+		w->fd = -1;
+		ok = ok && rename(w->tmp_path, w->path) == 0;
+	}
+	if (!ok) {
+		atomic_store(&w->state, SNAP_FAILED);
+	} else if (job->last) {
+		atomic_store(&w->state, SNAP_DONE);
+	}
+	str_free(job->buf);
+	free(job);
+	atomic_store(&w->busy, false);
+}
+
+bool snap_flush(SnapWriter *w, bool last) {
+	if (w->finishing) {
+		// nothing goes after the trailer
+		return true;
+	}
+	if (atomic_load(&w->busy)) {
+		return false;
+	}
+	if (last) {
+		str_appendC(w->buf, (char) SNAP_END);
+		str_append_int64_t(w->buf, (int64_t) w->nrecords);
+		str_appendCs_size(w->buf, SNAP_END_MAGIC, 8);
+		w->finishing = true;
+	}
+	SnapJob *job = malloc(sizeof(SnapJob));
+	if (!job) {
+		die("Out of memory");
+	}
+	job->w = w;
+	job->buf = w->buf;
+	job->last = last;
+	w->buf = str_init(NULL);
+	atomic_store(&w->busy, true);
+	thread_pool_queue(w->tp, &snap_write_job, job);
+	return true;
+}
+
+int snap_state(SnapWriter *w) {
+	if (atomic_load(&w->busy)) {
+		return SNAP_RUNNING;
+	}
+	return atomic_load(&w->state);
+}
+
+void snap_writer_free(SnapWriter *w) {
+	if (w->fd >= 0) {
+		close(w->fd);
+	}
+	if (atomic_load(&w->state) != SNAP_DONE) {
+		unlink(w->tmp_path);
+	}
+	str_free(w->buf);
+	free(w->path);
+	free(w->tmp_path);
+	free(w);
+}
+
+int snap_open(SnapReader *r, const char *path) {
+	memset(r, 0, sizeof(SnapReader));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int err = errno;
+		close(fd);
+		return -err;
+	}
+	size_t size = (size_t) st.st_size;
+	if (size < SNAP_HEADER_SIZE + SNAP_TRAILER_SIZE) {
+		close(fd);
+		return -EINVAL;
+	}
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return -errno;
+	}
+	// read once front to back
+	madvise(data, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	r->data = (const uint8_t*) data;
+	r->size = size;
+
+	const uint8_t *trailer = &r->data[size - SNAP_TRAILER_SIZE];
+	uint32_t version = 0;
+	memcpy(&version, &r->data[8], 4);
+	if (memcmp(r->data, SNAP_MAGIC, 8) || version < 1 || version > SNAP_VERSION
+			|| trailer[0] != SNAP_END || memcmp(&trailer[9], SNAP_END_MAGIC, 8)) {
+		munmap(data, size);
+		r->data = NULL;
+		return -EINVAL;
+	}
+	memcpy(&r->shard, &r->data[12], 4);
+	memcpy(&r->nshards, &r->data[16], 4);
+	memcpy(&r->nrecords, &trailer[1], 8);
+	r->pos = SNAP_HEADER_SIZE;
+	// the records end where the trailer starts
+	r->size = size - SNAP_TRAILER_SIZE;
+	return 0;
+}
+
+static bool get_bytes(SnapReader *r, void *out, size_t n) {
+	if (r->size - r->pos < n) {
+		r->bad = true;
+		return false;
+	}
+	memcpy(out, &r->data[r->pos], n);
+	r->pos += n;
+	return true;
+}
+
+static bool get_view(SnapReader *r, StrView *view) {
+	uint32_t len = 0;
+	if (!get_bytes(r, &len, 4) || r->size - r->pos < len) {
+		r->bad = true;
+		return false;
+	}
+	view->data = (const char*) &r->data[r->pos];
+	view->len = len;
+	r->pos += len;
+	return true;
+}
+
+bool snap_next_znode(SnapReader *r, double *score, StrView *name) {
+	if (r->members_left == 0 || r->members_type != SNAP_ZSET || r->bad) {
+		return false;
+	}
+	r->members_left--;
+	return get_bytes(r, score, 8) && get_view(r, name);
+}
+
+bool snap_next_hfield(SnapReader *r, StrView *field, StrView *val) {
+	if (r->members_left == 0 || r->members_type != SNAP_HASH || r->bad) {
+		return false;
+	}
+	r->members_left--;
+	return get_view(r, field) && get_view(r, val);
+}
+
+bool snap_next(SnapReader *r, SnapRecord *rec) {
+	double score = 0;
+	StrView name;
+	StrView val;
+	while (snap_next_znode(r, &score, &name) || snap_next_hfield(r, &name, &val)) {
+	}
+	if (r->bad || r->pos == r->size) {
+		return false;
+	}
+	memset(rec, 0, sizeof(SnapRecord));
+	if (!get_bytes(r, &rec->type, 1) || !get_bytes(r, &rec->expire_at, 8)
+			|| !get_view(r, &rec->key)) {
+		return false;
+	}
+	switch (rec->type) {
+	case SNAP_STR:
+		return get_view(r, &rec->val);
+	case SNAP_ZSET:
+	case SNAP_HASH:
+		if (!get_bytes(r, &rec->nmembers, 4)) {
+			return false;
+		}
+		r->members_left = rec->nmembers;
+		r->members_type = rec->type;
+		return true;
+	default:
+		r->bad = true;
+		return false;
+	}
+}
+
+void snap_close(SnapReader *r) {
+	if (r->data) {
+		munmap((void*) r->data, r->size + SNAP_TRAILER_SIZE);
+	}
+	r->data = NULL;
+}
@@ -0,0 +1,96 @@
+/*
+ * snapshot.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "strings.h"
+#include "thread_pool.h"
+
+// The snapshot file of one shard, everything little endian:
+//   header   "MINISNAP", u32 version, u32 shard, u32 nshards
+//   records  u8 type, i64 expiry (unix time in ms, 0 for none), u32 key len, key
+//            SNAP_STR   u32 len, value
+//            SNAP_ZSET  u32 n, then n times f64 score, u32 len, name
+//            SNAP_HASH  u32 n, then n times u32 len, field, u32 len, value
+//   trailer  u8 SNAP_END, u64 number of records, "MINISEND"
+// Files are written under a temporary name and renamed once complete, a
+// file without the trailer is never loaded.
+enum {
+	SNAP_STR = 0, SNAP_ZSET = 1, SNAP_HASH = 2, SNAP_END = 0xff,
+};
+
+enum {
+	SNAP_RUNNING = 0, SNAP_DONE = 1, SNAP_FAILED = 2,
+};
+
+// Writing: the loop fills a buffer, the thread pool writes it out. Only one
+// buffer is with the pool at a time, so they land in order.
+typedef struct snap_writer SnapWriter;
+
+// NULL when the file can't be created
+extern SnapWriter* snap_writer_new(const char *path, uint32_t shard, uint32_t nshards,
+		TheadPool *tp);
+extern void snap_put_str(SnapWriter *w, const char *key, size_t key_len,
+		const char *val, size_t val_len, int64_t expire_at);
+// followed by n calls to snap_put_znode
+extern void snap_put_zset(SnapWriter *w, const char *key, size_t key_len, uint32_t n,
+		int64_t expire_at);
+extern void snap_put_znode(SnapWriter *w, double score, const char *name, size_t len);
+// followed by n calls to snap_put_hfield
+extern void snap_put_hash(SnapWriter *w, const char *key, size_t key_len, uint32_t n,
+		int64_t expire_at);
+extern void snap_put_hfield(SnapWriter *w, const char *field, size_t flen,
+		const char *val, size_t vlen);
+// bytes put but not yet handed to the pool
+extern size_t snap_buffered(SnapWriter *w);
+// hands the buffer to the pool, false when the last one is still being
+// written. last adds the trailer, and the file is synced and renamed.
+extern bool snap_flush(SnapWriter *w, bool last);
+// SNAP_DONE or SNAP_FAILED once the last buffer went through
+extern int snap_state(SnapWriter *w);
+// the writer must not be busy, an unfinished file is removed
+extern void snap_writer_free(SnapWriter *w);
+
+// Reading: straight out of a read only mapping of the file
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+	uint32_t shard;
+	uint32_t nshards;
+	uint64_t nrecords;
+	// members of the current zset or hash record not read yet, and its type
+	uint32_t members_left;
+	uint8_t members_type;
+	// the records ran past the end, or had an unknown type
+	bool bad;
+} SnapReader;
+
+typedef struct {
+	uint8_t type;
+	int64_t expire_at;
+	StrView key;
+	// SNAP_STR only
+	StrView val;
+	// SNAP_ZSET and SNAP_HASH
+	uint32_t nmembers;
+} SnapRecord;
+
+// -errno on failure, -EINVAL when the file is not a complete snapshot
+extern int snap_open(SnapReader *r, const char *path);
+// false at the end. Members of the previous record that weren't read are
+// skipped. The views point into the mapping.
+extern bool snap_next(SnapReader *r, SnapRecord *rec);
+extern bool snap_next_znode(SnapReader *r, double *score, StrView *name);
+extern bool snap_next_hfield(SnapReader *r, StrView *field, StrView *val);
+extern void snap_close(SnapReader *r);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,106 @@
+/*
+ * snapshot_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "snapshot.h"
+#include "common.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *k_path = "snapshot_test.minis";
+
+static void wait_done(SnapWriter *w) {
+	while (snap_state(w) == SNAP_RUNNING) {
+		usleep(1000);
+	}
+	assert(snap_state(w) == SNAP_DONE);
+}
+
+static bool view_is(StrView *view, const char *s) {
+	return view->len == strlen(s) && 0 == memcmp(view->data, s, view->len);
+}
+
+int main(void) {
+	TheadPool tp;
+	memset(&tp, 0, sizeof(tp));
+	thread_pool_init(&tp, 1);
+	const size_t n = 10000;
+
+	SnapWriter *w = snap_writer_new(k_path, 3, 4, &tp);
+	assert(w);
+	// an unfinished file doesn't count
+	assert(access(k_path, F_OK) != 0);
+	char key[32];
+	for (size_t i = 0; i < n; i++) {
+		int len = sprintf(key, "key:%zu", i);
+		snap_put_str(w, key, (size_t) len, key, (size_t) len, (int64_t) i);
+		if (i % 1000 == 0) {
+			// hand it over in pieces, like the server does
+			while (!snap_flush(w, false)) {
+				usleep(100);
+			}
+		}
+	}
+	snap_put_zset(w, "z", 1, 2, 0);
+	snap_put_znode(w, 1.5, "a", 1);
+	snap_put_znode(w, -2, "bb", 2);
+	snap_put_zset(w, "empty", 5, 0, 0);
+	snap_put_hash(w, "h", 1, 2, 7);
+	snap_put_hfield(w, "f1", 2, "v1", 2);
+	snap_put_hfield(w, "f2", 2, "", 0);
+	snap_put_hash(w, "h2", 2, 1, 0);
+	snap_put_hfield(w, "f", 1, "v", 1);
+	snap_put_str(w, "last", 4, "", 0, 0);
+	while (!snap_flush(w, true)) {
+		usleep(100);
+	}
+	wait_done(w);
+	snap_writer_free(w);
+
+	SnapReader r;
+	assert(snap_open(&r, k_path) == 0);
+	assert(r.shard == 3 && r.nshards == 4 && r.nrecords == n + 5);
+	SnapRecord rec;
+	for (size_t i = 0; i < n; i++) {
+		assert(snap_next(&r, &rec));
+		sprintf(key, "key:%zu", i);
+		assert(rec.type == SNAP_STR && rec.expire_at == (int64_t) i);
+		assert(view_is(&rec.key, key) && view_is(&rec.val, key));
+	}
+	assert(snap_next(&r, &rec) && rec.type == SNAP_ZSET && rec.nmembers == 2);
+	double score = 0;
+	StrView name;
+	assert(snap_next_znode(&r, &score, &name) && score == 1.5 && view_is(&name, "a"));
+	// the rest of the members are skipped
+	assert(snap_next(&r, &rec) && rec.type == SNAP_ZSET && view_is(&rec.key, "empty"));
+	assert(!snap_next_znode(&r, &score, &name));
+	assert(snap_next(&r, &rec) && rec.type == SNAP_HASH && rec.nmembers == 2);
+	assert(rec.expire_at == 7 && view_is(&rec.key, "h"));
+	StrView field;
+	StrView val;
+	// a hash has no zset members
+	assert(!snap_next_znode(&r, &score, &name));
+	assert(snap_next_hfield(&r, &field, &val) && view_is(&field, "f1") && view_is(&val, "v1"));
+	assert(snap_next_hfield(&r, &field, &val) && view_is(&field, "f2") && val.len == 0);
+	assert(!snap_next_hfield(&r, &field, &val));
+	// skipped without reading any
+	assert(snap_next(&r, &rec) && rec.type == SNAP_HASH && view_is(&rec.key, "h2"));
+	assert(snap_next(&r, &rec) && view_is(&rec.key, "last") && rec.val.len == 0);
+	assert(!snap_next(&r, &rec) && !r.bad);
+	snap_close(&r);
+
+	// a cut off file is refused
+	assert(truncate(k_path, 100) == 0);
+	assert(snap_open(&r, k_path) == -EINVAL);
+	unlink(k_path);
+
+	printf("Success!\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * stats.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "stats.h"
+
+#define HIST_SUB (1u << HIST_SUB_BITS)
+
+static size_t hist_bucket(uint64_t v) {
+	if (v < HIST_SUB) {
+		return (size_t) v;
+	}
+	// the power of two, then the next HIST_SUB_BITS bits below the top one
+	int e = 63 - __builtin_clzll(v);
+	if (e >= HIST_MAX_BITS) {
+		return HIST_BUCKETS - 1;
+	}
+	return ((size_t) (e - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+			| (size_t) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// the largest value that goes to bucket i
+static uint64_t hist_top(size_t i) {
+	if (i < HIST_SUB) {
+		return i;
+	}
+	int e = (int) (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	uint64_t m = HIST_SUB | (i & (HIST_SUB - 1));
+	return ((m + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(Histogram *h, uint64_t v) {
+	counter_add(&h->counts[hist_bucket(v)], 1);
+	if (v > counter_get(&h->max)) {
+		counter_set(&h->max, v);
+	}
+}
+
+uint64_t hist_quantile(Histogram *const *h, size_t n, double q) {
+	uint64_t total = 0;
+	for (size_t k = 0; k < n; k++) {
+		for (size_t i = 0; i < HIST_BUCKETS; i++) {
+			total += counter_get(&h[k]->counts[i]);
+		}
+	}
+	if (total == 0) {
+		return 0;
+	}
+	// the rank of the value asked for, from 1
+	uint64_t rank = (uint64_t) (q * (double) total);
+	rank = rank < 1 ? 1 : rank > total ? total : rank;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HIST_BUCKETS; i++) {
+		for (size_t k = 0; k < n; k++) {
+			seen += counter_get(&h[k]->counts[i]);
+		}
+		if (seen >= rank) {
+			uint64_t top = hist_top(i);
+			uint64_t max = hist_max(h, n);
+			return top < max ? top : max;
+		}
+	}
+	return hist_max(h, n);
+}
+
+uint64_t hist_max(Histogram *const *h, size_t n) {
+	uint64_t max = 0;
+	for (size_t k = 0; k < n; k++) {
+		uint64_t v = counter_get(&h[k]->max);
+		max = v > max ? v : max;
+	}
+	return max;
+}
+
+void rate_add(Rate *r, uint64_t now_ms, uint64_t n) {
+	uint64_t sec = now_ms / 1000;
+	uint64_t last = counter_get(&r->sec);
+	if (sec != last) {
+		counter_set(&r->prev, sec == last + 1 ? counter_get(&r->cur) : 0);
+		counter_set(&r->cur, 0);
+		counter_set(&r->sec, sec);
+	}
+	counter_add(&r->cur, n);
+}
+
+uint64_t rate_get(const Rate *r, uint64_t now_ms) {
+	uint64_t sec = now_ms / 1000;
+	uint64_t last = counter_get(&r->sec);
+	if (sec == last) {
+		return counter_get(&r->prev);
+	}
+	// nothing came since the second that just ended, or for longer
+	return sec == last + 1 ? counter_get(&r->cur) : 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * stats.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Numbers that one thread keeps and any thread may read. Only the owner
+// writes, so an update is a plain load and store (relaxed atomics, no
+// lock prefix), and a reader sees every one whole.
+typedef struct {
+	atomic_uint_fast64_t v;
+} Counter;
+
+static inline uint64_t counter_get(const Counter *c) {
+	return atomic_load_explicit(&c->v, memory_order_relaxed);
+}
+
+static inline void counter_set(Counter *c, uint64_t v) {
+	atomic_store_explicit(&c->v, v, memory_order_relaxed);
+}
+
+static inline void counter_add(Counter *c, uint64_t n) {
+	counter_set(c, counter_get(c) + n);
+}
+
+// A log-linear histogram: 2^HIST_SUB_BITS buckets for every power of two,
+// so a bucket is at most 25% wide, up to 2^HIST_MAX_BITS. Values past that
+// go to the last bucket.
+#define HIST_SUB_BITS 2
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+	Counter counts[HIST_BUCKETS];
+	Counter max;
+} Histogram;
+
+extern void hist_record(Histogram *h, uint64_t v);
+// the q quantile (0 to 1) of n histograms taken together, the top of the
+// bucket it falls in. 0 if they are empty.
+extern uint64_t hist_quantile(Histogram *const *h, size_t n, double q);
+extern uint64_t hist_max(Histogram *const *h, size_t n);
+
+// Events per second, over the last whole second that went by
+typedef struct {
+	Counter sec;
+	Counter cur;
+	Counter prev;
+} Rate;
+
+extern void rate_add(Rate *r, uint64_t now_ms, uint64_t n);
+extern uint64_t rate_get(const Rate *r, uint64_t now_ms);
+
+#endif /* STATS_H_ */
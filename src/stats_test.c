@@ -0,0 +1,65 @@
+/*
+ * stats_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "stats.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// within the width of a bucket of the right answer
+static void near(uint64_t got, uint64_t want) {
+	assert(got >= want && got <= want + want / 4 + 1);
+}
+
+int main(void) {
+	static Histogram a;
+	static Histogram b;
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	Histogram *one[1] = { &a };
+	Histogram *both[2] = { &a, &b };
+	assert(hist_quantile(one, 1, 0.5) == 0);
+
+	// the small values have a bucket each
+	for (uint64_t v = 0; v < 8; v++) {
+		hist_record(&a, v);
+	}
+	for (uint64_t v = 0; v < 8; v++) {
+		assert(hist_quantile(one, 1, (double) (v + 1) / 8) == v);
+	}
+
+	memset(&a, 0, sizeof(a));
+	for (uint64_t v = 1; v <= 100000; v++) {
+		hist_record(v % 2 ? &a : &b, v);
+	}
+	near(hist_quantile(both, 2, 0.5), 50000);
+	near(hist_quantile(both, 2, 0.99), 99000);
+	near(hist_quantile(one, 1, 0.5), 50000);
+	assert(hist_quantile(both, 2, 1) == 100000);
+	assert(hist_max(both, 2) == 100000);
+
+	// way past the last bucket
+	hist_record(&a, (uint64_t) 1 << 50);
+	assert(hist_max(one, 1) == (uint64_t) 1 << 50);
+	assert(hist_quantile(one, 1, 1) >= (uint64_t) 1 << 39);
+
+	Rate r;
+	memset(&r, 0, sizeof(r));
+	rate_add(&r, 5000, 3);
+	rate_add(&r, 5999, 4);
+	assert(rate_get(&r, 5500) == 0);
+	assert(rate_get(&r, 6200) == 7);
+	rate_add(&r, 6300, 1);
+	assert(rate_get(&r, 6400) == 7);
+	assert(rate_get(&r, 7000) == 1);
+	assert(rate_get(&r, 9000) == 0);
+	rate_add(&r, 9000, 2);
+	assert(rate_get(&r, 9001) == 0);
+
+	printf("Success!\n");
+	return 0;
+}
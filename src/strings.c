@@ -49,6 +49,13 @@ void str_clear(String *this) {
 	this->data[0] = '\0';
 }
 
+void str_truncate(String *this, size_t size) {
+	if (size < this->i) {
+		this->i = size;
+		this->data[size] = '\0';
+	}
+}
+
 String* str_init(const char *chars) {
 	String *this = malloc(sizeof(String));
 	this->i = 0;
@@ -102,7 +109,7 @@ void str_append_double(String *this, double dbl) {
 	if (!this) {
 		return;
 	}
-	ensureAdditionalCapacity(this, 4);
+	ensureAdditionalCapacity(this, 8);
 	memcpy(&this->data[this->i], &dbl, 8);
 	this->i += 8;
 }
@@ -17,8 +17,17 @@ typedef struct {
 	size_t i;
 } String;
 
+// a non-owning (pointer, length) view into somebody else's bytes,
+// e.g. a request argument sitting in Conn.rbuf. Not NUL terminated.
+typedef struct {
+	const char *data;
+	size_t len;
+} StrView;
+
 extern String* str_init(const char *chars);
 extern void str_clear(String *this);
+// drops everything past the first size bytes
+extern void str_truncate(String *this, size_t size);
 extern void str_appendS(String *this, String *that);
 extern void str_appendCs(String *this, const char *that);
 extern void str_appendC(String *this, char that);
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+# Runs the server on an append only file with both engines, pipelines
+# writes at it while reading the replies slowly, so that replies queue up
+# behind sends that are still going, then kills it and starts it
+# again on the file. With -a always a reply only goes out once its write
+# is in the file (the server asserts it's synced too), and every write that
+# got one is there after the restart.
+
+import os
+import signal
+import socket
+import struct
+import subprocess
+import tempfile
+import threading
+import time
+
+PORT = 1240
+NKEYS = 100
+BATCHES = 100
+BATCH = 1000
+
+
+def req(*args):
+    body = struct.pack('<I', len(args)) + b''.join(struct.pack('<I', len(a)) + a for a in args)
+    return struct.pack('<I', len(body)) + body
+
+
+def port_free():
+    # the rings of a killed io_uring server are torn down in the background,
+    # its listening socket can be around for a moment
+    probe = socket.socket()
+    probe.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    try:
+        probe.bind(('0.0.0.0', PORT))
+        return True
+    except OSError:
+        return False
+    finally:
+        probe.close()
+
+
+def start(engine, policy, path):
+    for _ in range(50):
+        if port_free():
+            break
+        time.sleep(0.1)
+    server = subprocess.Popen(['./server', '-e', engine, '-a', policy, '-A', path, '-s', '0',
+                               '-P', str(PORT), '-f', path + '.snap'],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.STDOUT)
+    for _ in range(50):
+        try:
+            return server, socket.create_connection(('127.0.0.1', PORT))
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+    raise Exception('the server did not come up')
+
+
+def run(engine, policy):
+    path = os.path.join(tempfile.mkdtemp(), 'test.aof')
+    server, _ = start(engine, policy, path)
+    # a slow reader with a small window: the sends block, and the writes
+    # that run meanwhile queue their replies behind them
+    conn = socket.socket()
+    conn.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    conn.connect(('127.0.0.1', PORT))
+    keys = [b'k%d' % i for i in range(NKEYS)]
+    total = BATCHES * BATCH
+    # the file is the requests of the writes, one after the other
+    ends = []
+    size = 0
+    for i in range(total):
+        size += len(req(b'incr', keys[i % NKEYS]))
+        ends.append(size)
+
+    def send():
+        for b in range(BATCHES):
+            conn.sendall(b''.join(req(b'incr', keys[i % NKEYS])
+                                  for i in range(b * BATCH, (b + 1) * BATCH)))
+            time.sleep(0.001)
+    sender = threading.Thread(target=send)
+    sender.start()
+    buf = b''
+    got = 0
+    while got < total:
+        data = conn.recv(4096)
+        assert data, f'{engine} {policy}: the server hung up'
+        buf += data
+        while len(buf) >= 4 and len(buf) >= 4 + struct.unpack('<I', buf[:4])[0]:
+            n = struct.unpack('<I', buf[:4])[0]
+            assert buf[4] == 3, buf[:4 + n]  # an int
+            buf = buf[4 + n:]
+            got += 1
+        if policy == 'always' and got:
+            assert os.path.getsize(path) >= ends[got - 1], f'{engine}: a reply before its write'
+        time.sleep(0.001)
+    sender.join()
+    server.send_signal(signal.SIGKILL)
+    server.wait()
+
+    server, conn = start(engine, policy, path)
+    conn.sendall(b''.join(req(b'get', k) for k in keys))
+    expect = b''.join(struct.pack('<IBI', 5 + len(str(total // NKEYS)), 2,
+                                  len(str(total // NKEYS))) + str(total // NKEYS).encode()
+                      for _ in keys)
+    buf = b''
+    while len(buf) < len(expect):
+        data = conn.recv(1 << 16)
+        assert data, 'the server hung up'
+        buf += data
+    assert buf == expect, f'{engine} {policy}: writes missing after a restart'
+    server.kill()
+    server.wait()
+
+
+for engine in ('epoll', 'uring'):
+    for policy in ('always', 'everysec'):
+        run(engine, policy)
+print('AOF OK')
@@ -39,6 +39,156 @@ $ ./client zquery zset 1 "" 0 10
 (str) n2
 (dbl) 2
 (arr) end
+$ ./client set k1 v1
+(nil)
+$ ./client get k1
+(str) v1
+$ ./client del k1
+(int) 1
+$ ./client get k1
+(nil)
+$ ./client set k2 v2
+(nil)
+$ ./client scan 0 match "k*" count 100
+(arr) len=2
+(int) 0
+(arr) len=1
+(str) k2
+(arr) end
+(arr) end
+$ ./client pttl k2
+(int) -1
+$ ./client pttl nokey
+(int) -2
+$ ./client pexpire k2 100000
+(int) 1
+$ ./client pexpire k2 -1
+(int) 1
+$ ./client pttl k2
+(int) -1
+$ ./client pexpireat k2 1
+(int) 1
+$ ./client get k2
+(nil)
+$ ./client pexpireat nokey 1
+(int) 0
+$ ./client mset m1 v1 m2 v2 m3 v3
+(nil)
+$ ./client mget m1 nokey m3 zset
+(arr) len=4
+(str) v1
+(nil)
+(str) v3
+(nil)
+(arr) end
+$ ./client del m1 m2 nokey
+(int) 2
+$ ./client mget m1 m2 m3
+(arr) len=3
+(nil)
+(nil)
+(str) v3
+(arr) end
+$ ./client mset m1 v1 m2
+(err) 1 Unknown cmd
+$ ./client replicaof localhost 1234
+(err) 4 expect an IPv4 address and a port
+$ ./client replicaof 127.0.0.1 0
+(err) 4 expect an IPv4 address and a port
+$ ./client cluster keyslot {user1}a
+(int) 173
+$ ./client cluster keyslot user1
+(int) 173
+$ ./client cluster slots
+(err) 4 cluster mode is off
+$ ./client GET m3
+(str) v3
+$ ./client incr cnt
+(int) 1
+$ ./client incrby cnt 41
+(int) 42
+$ ./client decrby cnt 50
+(int) -8
+$ ./client decr cnt
+(int) -9
+$ ./client get cnt
+(str) -9
+$ ./client set cnt 9223372036854775807
+(nil)
+$ ./client incr cnt
+(err) 4 increment or decrement would overflow
+$ ./client set cnt 010
+(nil)
+$ ./client incr cnt
+(err) 4 value is not an integer
+$ ./client get cnt
+(str) 010
+$ ./client incr zset
+(err) 3 expect string
+$ ./client get
+(err) 1 Unknown cmd
+$ ./client zadd zr 1 a
+(int) 1
+$ ./client zadd zr 2 b
+(int) 1
+$ ./client zadd zr 3 c
+(int) 1
+$ ./client zrank zr c
+(int) 2
+$ ./client zrevrank zr c
+(int) 0
+$ ./client zrank zr nope
+(nil)
+$ ./client zcount zr (1 +inf
+(int) 2
+$ ./client zrange zr -2 -1 withscores
+(arr) len=4
+(str) b
+(dbl) 2
+(str) c
+(dbl) 3
+(arr) end
+$ ./client zrangebyscore zr -inf (3 limit 1 5
+(arr) len=1
+(str) b
+(arr) end
+$ ./client zrange nokey 0 -1
+(arr) len=0
+(arr) end
+$ ./client hset h f1 v1 f2 v2
+(int) 2
+$ ./client hset h f1 v11 f3 v3
+(int) 1
+$ ./client hget h f1
+(str) v11
+$ ./client hget h nope
+(nil)
+$ ./client hget nokey f1
+(nil)
+$ ./client hdel h f2 nope
+(int) 1
+$ ./client hgetall h
+(arr) len=4
+(str) f1
+(str) v11
+(str) f3
+(str) v3
+(arr) end
+$ ./client hset h f1
+(err) 1 Unknown cmd
+$ ./client hget zr a
+(err) 3 expect hash
+$ ./client get h
+(err) 3 expect string
+$ ./client hdel h f1 f3
+(int) 2
+$ ./client hgetall h
+(arr) len=0
+(arr) end
+$ ./client set h v
+(nil)
+$ ./client hset h f v
+(err) 3 expect hash
 '''
 
 
@@ -5,54 +5,153 @@
  *      Author: loshmi
  */
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include "thread_pool.h"
+#include "common.h"
 
+#define TP_MASK (TP_QUEUE_SIZE - 1)
 
-static void *worker(void *arg) {
-    TheadPool *tp = (TheadPool *)arg;
-    while (1) {
-        pthread_mutex_lock(&tp->mu);
-        // wait for the condition: a non-empty queue
-        while (dq_empty(&tp->queue)) {
-            pthread_cond_wait(&tp->not_empty, &tp->mu);
+// The rings are bounded MPMC queues with a sequence number per slot. A
+// slot at position pos is free to push into while seq == pos, and holds a
+// job to pop while seq == pos + 1. Popping hands it to the next lap by
+// setting seq to pos + TP_QUEUE_SIZE. Claiming a position is a CAS on
+// tail or head, so pushers and poppers only ever wait on each other for
+// the copy of one Work.
+static void queue_init(TPQueue *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    for (size_t i = 0; i < TP_QUEUE_SIZE; i++) {
+        atomic_init(&q->slots[i].seq, i);
+    }
+}
+
+static bool queue_push(TPQueue *q, Work work) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    TPSlot *slot = NULL;
+    while (true) {
+        slot = &q->slots[pos & TP_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // a lap behind, the ring is full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
         }
+    }
+    slot->work = work;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
 
-        // got the job
-        Work* w = (Work*)dq_peek_front(&tp->queue);
-        dq_pop_front(&tp->queue);
-        pthread_mutex_unlock(&tp->mu);
+static bool queue_pop(TPQueue *q, Work *work) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    TPSlot *slot = NULL;
+    while (true) {
+        slot = &q->slots[pos & TP_MASK];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // empty, or the push into it isn't done yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    *work = slot->work;
+    atomic_store_explicit(&slot->seq, pos + TP_QUEUE_SIZE, memory_order_release);
+    return true;
+}
 
-        // do the work
-        w->f(w->arg);
+// every claim on pending is backed by a pushed job, but another worker
+// may have taken that one and left its own behind, so this goes around
+// until it finds one
+static Work take(TPWorker *me) {
+    TheadPool *tp = me->tp;
+    Work work;
+    while (true) {
+        for (size_t i = 0; i < tp->num_threads; i++) {
+            TPWorker *from = &tp->workers[(me->id + i) % tp->num_threads];
+            if (queue_pop(&from->queue, &work)) {
+                return work;
+            }
+        }
+        sched_yield();
+    }
+}
+
+static void *worker(void *arg) {
+    TPWorker *me = (TPWorker *)arg;
+    while (1) {
+        if (sem_wait(&me->tp->pending) != 0) {
+            assert(errno == EINTR);
+            continue;
+        }
+        Work work = take(me);
+        work.f(work.arg);
     }
     return NULL;
 }
 
 void thread_pool_init(TheadPool *tp, size_t num_threads) {
     assert(num_threads > 0);
-
-    int rv = pthread_mutex_init(&tp->mu, NULL);
-    assert(rv == 0);
-    rv = pthread_cond_init(&tp->not_empty, NULL);
+    tp->num_threads = num_threads;
+    atomic_init(&tp->next, 0);
+    int rv = sem_init(&tp->pending, 0, 0);
     assert(rv == 0);
 
-    tp->threads = calloc(num_threads, sizeof(pthread_t));
+    tp->workers = aligned_alloc(_Alignof(TPWorker), num_threads * sizeof(TPWorker));
+    if (!tp->workers) {
+        die("Out of memory");
+    }
     for (size_t i = 0; i < num_threads; ++i) {
-        rv = pthread_create(&tp->threads[i], NULL, &worker, tp);
-        pthread_detach(tp->threads[i]);
+        tp->workers[i].tp = tp;
+        tp->workers[i].id = i;
+        queue_init(&tp->workers[i].queue);
+    }
+    // all of the rings have to be there before a worker goes stealing
+    for (size_t i = 0; i < num_threads; ++i) {
+        rv = pthread_create(&tp->workers[i].thread, NULL, &worker, &tp->workers[i]);
         assert(rv == 0);
+        pthread_detach(tp->workers[i].thread);
     }
 }
 
 void thread_pool_queue(TheadPool *tp, void (*f)(void *), void *arg) {
-    Work w;
-    w.f = f;
-    w.arg = arg;
-
-    pthread_mutex_lock(&tp->mu);
-    dq_push_back(&tp->queue, &w);
-    pthread_cond_signal(&tp->not_empty);
-    pthread_mutex_unlock(&tp->mu);
+    Work work = { f, arg };
+    size_t start = atomic_fetch_add_explicit(&tp->next, 1, memory_order_relaxed);
+    for (size_t i = 0; i < tp->num_threads; i++) {
+        if (queue_push(&tp->workers[(start + i) % tp->num_threads].queue, work)) {
+            sem_post(&tp->pending);
+            return;
+        }
+    }
+    // the workers are this far behind, waiting for them wouldn't be faster
+    f(arg);
 }
 
+size_t thread_pool_pending(TheadPool *tp) {
+    size_t n = 0;
+    for (size_t i = 0; i < tp->num_threads; i++) {
+        TPQueue *q = &tp->workers[i].queue;
+        size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        n += tail > head ? tail - head : 0;
+    }
+    return n;
+}
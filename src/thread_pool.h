@@ -10,23 +10,58 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdatomic.h>
 #include <pthread.h>
-#include "deque.h"
+#include <semaphore.h>
 
+// Every worker has a bounded ring of its own, any thread can push to any
+// of them and pop from any of them without a lock. Jobs are spread over
+// the rings round robin, a worker takes from its own first and steals
+// from the others when it runs dry. The jobs live in the ring slots, so
+// queueing one allocates nothing.
+#define TP_QUEUE_SIZE 1024
 
 typedef struct work {
     void (*f)(void *);
     void *arg;
 } Work;
 
-typedef  struct thead_pool {
-    pthread_t* threads;
-    t_deque queue;
-    pthread_mutex_t mu;
-    pthread_cond_t not_empty;
+typedef struct {
+    // which lap of the ring the slot is on, see thread_pool.c
+    atomic_size_t seq;
+    Work work;
+} TPSlot;
+
+typedef struct {
+    // apart, so the pushers and the poppers don't share a cache line
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    TPSlot slots[TP_QUEUE_SIZE];
+} TPQueue;
+
+struct thead_pool;
+
+typedef struct {
+    struct thead_pool *tp;
+    size_t id;
+    pthread_t thread;
+    TPQueue queue;
+} TPWorker;
+
+typedef struct thead_pool {
+    size_t num_threads;
+    TPWorker *workers;
+    // the ring the next push starts at
+    atomic_size_t next;
+    // the jobs that no worker has claimed yet, the idle ones sleep on it
+    sem_t pending;
 } TheadPool;
 
 extern void thread_pool_init(TheadPool *tp, size_t num_threads);
+// can be called from any thread. When every ring is full the work is done
+// right here instead.
 extern void thread_pool_queue(TheadPool *tp, void (*f)(void *), void *arg);
+// the jobs waiting in the rings, about
+extern size_t thread_pool_pending(TheadPool *tp);
 
 #endif /* THREAD_POOL_H_ */
@@ -0,0 +1,86 @@
+/*
+ * thread_pool_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "thread_pool.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define K_PRODUCERS 4
+#define K_JOBS 200000
+
+static atomic_uint_fast64_t g_done;
+static atomic_uint_fast64_t g_sum;
+static atomic_bool g_blocked;
+static atomic_size_t g_stuck;
+
+static void add_job(void *arg) {
+	atomic_fetch_add(&g_sum, (uint64_t) (uintptr_t) arg);
+	atomic_fetch_add(&g_done, 1);
+}
+
+static void block_job(void *arg) {
+	atomic_fetch_add(&g_stuck, 1);
+	while (atomic_load(&g_blocked)) {
+		usleep(100);
+	}
+	atomic_fetch_add(&g_done, 1);
+}
+
+static void* produce(void *arg) {
+	TheadPool *tp = (TheadPool*) arg;
+	for (uintptr_t i = 1; i <= K_JOBS; i++) {
+		thread_pool_queue(tp, &add_job, (void*) i);
+	}
+	return NULL;
+}
+
+static void wait_done(uint64_t n) {
+	while (atomic_load(&g_done) < n) {
+		usleep(100);
+	}
+	assert(atomic_load(&g_done) == n);
+}
+
+int main(void) {
+	TheadPool tp;
+	thread_pool_init(&tp, 3);
+
+	// every job runs exactly once, from pushers racing each other
+	pthread_t producers[K_PRODUCERS];
+	for (size_t i = 0; i < K_PRODUCERS; i++) {
+		assert(0 == pthread_create(&producers[i], NULL, &produce, &tp));
+	}
+	for (size_t i = 0; i < K_PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+	wait_done((uint64_t) K_PRODUCERS * K_JOBS);
+	assert(atomic_load(&g_sum) == (uint64_t) K_PRODUCERS * K_JOBS * (K_JOBS + 1) / 2);
+
+	// with the workers stuck, the rings fill up and the rest runs right here
+	atomic_store(&g_done, 0);
+	atomic_store(&g_blocked, true);
+	for (size_t i = 0; i < tp.num_threads; i++) {
+		thread_pool_queue(&tp, &block_job, NULL);
+	}
+	while (atomic_load(&g_stuck) < tp.num_threads) {
+		usleep(100);
+	}
+	const uint64_t n = (uint64_t) tp.num_threads * TP_QUEUE_SIZE + 10;
+	for (uint64_t i = 0; i < n; i++) {
+		thread_pool_queue(&tp, &add_job, NULL);
+	}
+	// the ones that didn't fit
+	assert(atomic_load(&g_done) == 10);
+	atomic_store(&g_blocked, false);
+	wait_done(n + tp.num_threads);
+
+	printf("Success!\n");
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * timer.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <assert.h>
+#include "timer.h"
+#include "common.h"
+
+// the slot of a timer that is not in the wheel
+#define SLOT_NONE ((uint16_t) -1)
+
+void wheel_init(TimerWheel *wheel, uint64_t now_ms) {
+	for (size_t l = 0; l < WHEEL_LEVELS; l++) {
+		for (size_t i = 0; i < WHEEL_SLOTS; i++) {
+			dlist_init(&wheel->slots[l][i]);
+		}
+		wheel->used[l] = 0;
+	}
+	wheel->cur = now_ms;
+	wheel->size = 0;
+}
+
+void timer_init(Timer *timer, uint16_t kind) {
+	dlist_init(&timer->link);
+	timer->expire_ms = 0;
+	timer->slot = SLOT_NONE;
+	timer->kind = kind;
+}
+
+bool timer_armed(Timer *timer) {
+	return timer->slot != SLOT_NONE;
+}
+
+static uint64_t level_start_mask(size_t level) {
+	return ((uint64_t) 1 << (WHEEL_BITS * level)) - 1;
+}
+
+// where a timer goes: the level is the highest group of 6 bits in which
+// its expiry differs from cur, so every timer in level l shares the
+// bits above that level with cur, and sits in a slot past cur's.
+static void wheel_place(TimerWheel *wheel, Timer *timer) {
+	uint64_t at = timer->expire_ms > wheel->cur ? timer->expire_ms : wheel->cur;
+	uint64_t diff = at ^ wheel->cur;
+	size_t level = diff ? (size_t) (63 - __builtin_clzll(diff)) / WHEEL_BITS : 0;
+	size_t idx = (size_t) (at >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+	dlist_insert_before(&wheel->slots[level][idx], &timer->link);
+	wheel->used[level] |= (uint64_t) 1 << idx;
+	timer->slot = (uint16_t) (level * WHEEL_SLOTS + idx);
+}
+
+static void wheel_unlink(TimerWheel *wheel, Timer *timer) {
+	size_t level = timer->slot / WHEEL_SLOTS;
+	size_t idx = timer->slot % WHEEL_SLOTS;
+	dlist_detach(&timer->link);
+	dlist_init(&timer->link);
+	if (dlist_empty(&wheel->slots[level][idx])) {
+		wheel->used[level] &= ~((uint64_t) 1 << idx);
+	}
+	timer->slot = SLOT_NONE;
+}
+
+void wheel_add(TimerWheel *wheel, Timer *timer, uint64_t expire_ms) {
+	if (timer_armed(timer)) {
+		wheel_unlink(wheel, timer);
+	} else {
+		wheel->size++;
+	}
+	timer->expire_ms = expire_ms;
+	wheel_place(wheel, timer);
+}
+
+void wheel_cancel(TimerWheel *wheel, Timer *timer) {
+	if (!timer_armed(timer)) {
+		return;
+	}
+	wheel_unlink(wheel, timer);
+	wheel->size--;
+}
+
+void wheel_cancel_kind(TimerWheel *wheel, uint16_t kind) {
+	for (size_t l = 0; l < WHEEL_LEVELS; l++) {
+		uint64_t bits = wheel->used[l];
+		while (bits) {
+			DList *slot = &wheel->slots[l][__builtin_ctzll(bits)];
+			bits &= bits - 1;
+			DList *node = slot->next;
+			while (node != slot) {
+				Timer *timer = container_of(node, Timer, link);
+				node = node->next;
+				if (timer->kind == kind) {
+					wheel_cancel(wheel, timer);
+				}
+			}
+		}
+	}
+}
+
+uint64_t wheel_next(TimerWheel *wheel) {
+	if (wheel->size == 0) {
+		return (uint64_t) -1;
+	}
+	// the lower levels always come first, they are about the current slot
+	// of the level above
+	for (size_t l = 0; l < WHEEL_LEVELS; l++) {
+		size_t shift = WHEEL_BITS * l;
+		size_t pos = (size_t) (wheel->cur >> shift) & (WHEEL_SLOTS - 1);
+		uint64_t bits = wheel->used[l] & (~(uint64_t) 0 << pos);
+		if (!bits) {
+			continue;
+		}
+		uint64_t idx = (uint64_t) __builtin_ctzll(bits);
+		uint64_t above = shift + WHEEL_BITS < 64 ? ~level_start_mask(l + 1) : 0;
+		return (wheel->cur & above) | (idx << shift);
+	}
+	assert(!"the wheel lost a timer");
+	return (uint64_t) -1;
+}
+
+// the timers of slots[level][idx] go to the lower levels
+static void wheel_cascade(TimerWheel *wheel, size_t level, size_t idx) {
+	DList *slot = &wheel->slots[level][idx];
+	wheel->used[level] &= ~((uint64_t) 1 << idx);
+	while (!dlist_empty(slot)) {
+		Timer *timer = container_of(slot->next, Timer, link);
+		dlist_detach(&timer->link);
+		wheel_place(wheel, timer);
+		assert(timer->slot / WHEEL_SLOTS < level);
+	}
+}
+
+void wheel_advance(TimerWheel *wheel, uint64_t now_ms, DList *expired) {
+	while (wheel->size > 0) {
+		uint64_t next = wheel_next(wheel);
+		if (next > now_ms) {
+			break;
+		}
+		// nothing is due in between, so skip right to it
+		wheel->cur = next;
+		for (size_t l = WHEEL_LEVELS - 1; l > 0; l--) {
+			if ((next & level_start_mask(l)) == 0) {
+				size_t idx = (size_t) (next >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1);
+				wheel_cascade(wheel, l, idx);
+			}
+		}
+		size_t idx = (size_t) next & (WHEEL_SLOTS - 1);
+		DList *slot = &wheel->slots[0][idx];
+		while (!dlist_empty(slot)) {
+			Timer *timer = container_of(slot->next, Timer, link);
+			dlist_detach(&timer->link);
+			timer->slot = SLOT_NONE;
+			wheel->size--;
+			dlist_insert_before(expired, &timer->link);
+		}
+		wheel->used[0] &= ~((uint64_t) 1 << idx);
+	}
+	if (wheel->cur < now_ms) {
+		wheel->cur = now_ms;
+	}
+}
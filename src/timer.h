@@ -0,0 +1,65 @@
+/*
+ * timer.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+
+// what a timer is for, to tell them apart when they go off
+enum {
+	TIMER_IDLE = 0, TIMER_TTL = 1, TIMER_SAVE = 2,
+};
+
+// timer node, should be embedded into the payload
+typedef struct {
+	DList link;
+	// in ms, on the get_monotonic_usec() clock
+	uint64_t expire_ms;
+	// the slot it sits in, level * WHEEL_SLOTS + index
+	uint16_t slot;
+	uint16_t kind;
+} Timer;
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+// enough levels to cover every 64 bit expiry
+#define WHEEL_LEVELS 11
+
+// a hierarchical timing wheel with 1ms ticks. Level l has 64 slots of
+// 64^l ms each, a timer sits in the lowest level whose span covers it.
+// Adding, moving and cancelling timers is O(1), the timers of a higher
+// level slot are spread over the lower levels when time gets to it.
+typedef struct {
+	DList slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	// bit i of level l is set when slots[l][i] is not empty
+	uint64_t used[WHEEL_LEVELS];
+	// the tick last advanced to. Timers that are already due when added
+	// go into its slot, and go off on the next advance.
+	uint64_t cur;
+	size_t size;
+} TimerWheel;
+
+extern void wheel_init(TimerWheel *wheel, uint64_t now_ms);
+extern void timer_init(Timer *timer, uint16_t kind);
+extern bool timer_armed(Timer *timer);
+// arms the timer, or moves it if it already is
+extern void wheel_add(TimerWheel *wheel, Timer *timer, uint64_t expire_ms);
+extern void wheel_cancel(TimerWheel *wheel, Timer *timer);
+// cancels every timer of the kind, in one pass over the wheel
+extern void wheel_cancel_kind(TimerWheel *wheel, uint16_t kind);
+// nothing goes off before this, (uint64_t) -1 when there are no timers.
+// It may be earlier than the first expiry, when timers have to be moved
+// down a level.
+extern uint64_t wheel_next(TimerWheel *wheel);
+// moves the timers due by now_ms onto the expired list, disarmed
+extern void wheel_advance(TimerWheel *wheel, uint64_t now_ms, DList *expired);
+
+#endif /* TIMER_H_ */
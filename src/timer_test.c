@@ -0,0 +1,133 @@
+/*
+ * timer_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "timer.h"
+#include "common.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+	Timer timer;
+	uint64_t fired_at;
+} Item;
+
+static uint64_t rnd(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// the last time advanced to, nothing that fires now was due by then
+static uint64_t g_prev = 0;
+
+static size_t fire(TimerWheel *wheel, uint64_t now) {
+	DList expired;
+	dlist_init(&expired);
+	wheel_advance(wheel, now, &expired);
+	size_t n = 0;
+	while (!dlist_empty(&expired)) {
+		Item *item = container_of(expired.next, Item, timer.link);
+		dlist_detach(&item->timer.link);
+		dlist_init(&item->timer.link);
+		assert(!timer_armed(&item->timer));
+		assert(item->timer.expire_ms <= now);
+		assert(item->timer.expire_ms > g_prev);
+		assert(item->fired_at == 0);
+		item->fired_at = now;
+		n++;
+	}
+	g_prev = now;
+	return n;
+}
+
+int main(void) {
+	const size_t n = 100000;
+	uint64_t seed = 42;
+	uint64_t now = 1000;
+	TimerWheel wheel;
+	wheel_init(&wheel, now);
+	g_prev = now - 1;
+	assert(wheel_next(&wheel) == (uint64_t) -1);
+
+	Item *items = calloc(n, sizeof(Item));
+	for (size_t i = 0; i < n; i++) {
+		timer_init(&items[i].timer, TIMER_TTL);
+		// spread over every level, from 1ms to about 70 days
+		uint64_t delay = rnd(&seed) % ((uint64_t) 1 << (rnd(&seed) % 33));
+		wheel_add(&wheel, &items[i].timer, now + delay);
+	}
+	// move some, cancel some
+	for (size_t i = 0; i < n; i += 3) {
+		wheel_add(&wheel, &items[i].timer, now + rnd(&seed) % 100000);
+	}
+	size_t cancelled = 0;
+	for (size_t i = 1; i < n; i += 7) {
+		wheel_cancel(&wheel, &items[i].timer);
+		assert(!timer_armed(&items[i].timer));
+		cancelled++;
+	}
+	assert(wheel.size == n - cancelled);
+
+	// advance in uneven steps, everything has to fire exactly when due
+	size_t fired = 0;
+	while (wheel.size > 0) {
+		uint64_t next = wheel_next(&wheel);
+		assert(next >= now);
+		uint64_t step = rnd(&seed) % 3 == 0 ? next - now : rnd(&seed) % 5000;
+		now += step;
+		fired += fire(&wheel, now);
+	}
+	assert(fired == n - cancelled);
+	for (size_t i = 0; i < n; i++) {
+		if (i % 7 == 1) {
+			assert(items[i].fired_at == 0);
+			continue;
+		}
+		assert(items[i].fired_at >= items[i].timer.expire_ms);
+	}
+
+	// a timer in the past goes off right away, and nothing goes off early
+	Item late = { };
+	timer_init(&late.timer, TIMER_IDLE);
+	wheel_add(&wheel, &late.timer, now - 10);
+	g_prev = 0;
+	assert(wheel_next(&wheel) <= now);
+	assert(fire(&wheel, now) == 1);
+	Item soon = { };
+	timer_init(&soon.timer, TIMER_IDLE);
+	wheel_add(&wheel, &soon.timer, now + 5000);
+	assert(fire(&wheel, now + 4999) == 0);
+	assert(fire(&wheel, now + 5000) == 1);
+
+	// only the kind asked for goes, from every level
+	now += 5000;
+	g_prev = now - 1;
+	for (size_t i = 0; i < n; i++) {
+		timer_init(&items[i].timer, i % 2 ? TIMER_TTL : TIMER_IDLE);
+		items[i].fired_at = 0;
+		wheel_add(&wheel, &items[i].timer, now + 1 + rnd(&seed) % ((uint64_t) 1 << (rnd(&seed) % 33)));
+	}
+	wheel_cancel_kind(&wheel, TIMER_TTL);
+	assert(wheel.size == n / 2);
+	for (size_t i = 1; i < n; i += 2) {
+		assert(!timer_armed(&items[i].timer));
+	}
+	fired = 0;
+	while (wheel.size > 0) {
+		now = wheel_next(&wheel);
+		fired += fire(&wheel, now);
+	}
+	assert(fired == n / 2);
+	for (size_t i = 0; i < n; i++) {
+		assert((items[i].fired_at != 0) == (i % 2 == 0));
+	}
+
+	free(items);
+	printf("Success!\n");
+}
@@ -0,0 +1,203 @@
+/*
+ * uring.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags, void *arg, size_t argsz) {
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(Uring *ring, unsigned entries) {
+	memset(ring, 0, sizeof(Uring));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	// we only ever touch the ring from the loop's own thread
+	p.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+	int fd = sys_setup(entries, &p);
+	if (fd < 0 && errno == EINVAL) {
+		// older kernel
+		memset(&p, 0, sizeof(p));
+		fd = sys_setup(entries, &p);
+	}
+	if (fd < 0) {
+		return -errno;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+		close(fd);
+		return -ENOSYS;
+	}
+	ring->fd = fd;
+
+	// the sq and cq rings share one mapping
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	size_t size = sq_size > cq_size ? sq_size : cq_size;
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+		close(fd);
+		return -errno;
+	}
+	ring->sq_ring = ring->cq_ring = ptr;
+	ring->sq_ring_size = ring->cq_ring_size = size;
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		int err = errno;
+		munmap(ptr, size);
+		close(fd);
+		return -err;
+	}
+
+	char *sq = (char*) ptr;
+	ring->sq_head = (unsigned*) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	// sqes are always used in order, so the index array is the identity
+	unsigned *array = (unsigned*) (sq + p.sq_off.array);
+	for (unsigned i = 0; i < p.sq_entries; i++) {
+		array[i] = i;
+	}
+
+	char *cq = (char*) ptr;
+	ring->cq_head = (unsigned*) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+	return 0;
+}
+
+void uring_free(Uring *ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+static int uring_submit(Uring *ring, unsigned min_complete, unsigned flags,
+		void *arg, size_t argsz) {
+	unsigned tail = *ring->sq_tail + ring->to_submit;
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	unsigned n = ring->to_submit;
+	ring->to_submit = 0;
+	int rv = 0;
+	do {
+		rv = sys_enter(ring->fd, n, min_complete, flags, arg, argsz);
+	} while (rv < 0 && errno == EINTR && min_complete == 0);
+	return rv < 0 ? -errno : rv;
+}
+
+struct io_uring_sqe* uring_get_sqe(Uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned next = *ring->sq_tail + ring->to_submit;
+	if (next - head >= ring->sq_entries) {
+		// full, make room
+		uring_submit(ring, 0, 0, NULL, 0);
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		next = *ring->sq_tail + ring->to_submit;
+		if (next - head >= ring->sq_entries) {
+			return NULL;
+		}
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[next & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->to_submit++;
+	return sqe;
+}
+
+int uring_submit_and_wait(Uring *ring, uint32_t timeout_ms) {
+	struct __kernel_timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t) (uintptr_t) &ts;
+	int rv = uring_submit(ring, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(arg));
+	if (rv == -ETIME || rv == -EINTR) {
+		return 0;
+	}
+	return rv;
+}
+
+struct io_uring_cqe* uring_peek_cqe(Uring *ring) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buf_ring_init(Uring *ring, UringBufRing *br, uint16_t bgid,
+		unsigned entries, size_t buf_size) {
+	br->entries = entries;
+	br->buf_size = buf_size;
+	br->bgid = bgid;
+	br->ring_size = entries * sizeof(struct io_uring_buf);
+	br->br = mmap(NULL, br->ring_size, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br->br == MAP_FAILED) {
+		return -errno;
+	}
+	br->bufs = malloc(entries * buf_size);
+	if (!br->bufs) {
+		munmap(br->br, br->ring_size);
+		return -ENOMEM;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) br->br;
+	reg.ring_entries = entries;
+	reg.bgid = bgid;
+	if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		int err = errno;
+		free(br->bufs);
+		munmap(br->br, br->ring_size);
+		return -err;
+	}
+
+	br->br->tail = 0;
+	for (unsigned i = 0; i < entries; i++) {
+		uring_buf_recycle(br, (uint16_t) i);
+	}
+	return 0;
+}
+
+uint8_t* uring_buf(UringBufRing *br, uint16_t bid) {
+	return &br->bufs[(size_t) bid * br->buf_size];
+}
+
+void uring_buf_recycle(UringBufRing *br, uint16_t bid) {
+	uint16_t tail = br->br->tail;
+	struct io_uring_buf *buf = &br->br->bufs[tail & (br->entries - 1)];
+	buf->addr = (uint64_t) (uintptr_t) uring_buf(br, bid);
+	buf->len = (uint32_t) br->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&br->br->tail, (uint16_t) (tail + 1), __ATOMIC_RELEASE);
+}
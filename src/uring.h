@@ -0,0 +1,70 @@
+/*
+ * uring.h
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// Just enough of io_uring, on top of the raw syscalls, for the server's
+// io_uring engine: one ring per event loop, and rings of provided buffers
+// for the receives.
+
+typedef struct {
+	int fd;
+	// submission queue, shared with the kernel
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	// sqes handed out but not yet submitted
+	unsigned to_submit;
+	// completion queue, shared with the kernel
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	// the mappings, for uring_free
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} Uring;
+
+// a ring of equally sized buffers the kernel picks from for receives
+typedef struct {
+	struct io_uring_buf_ring *br;
+	uint8_t *bufs;
+	size_t ring_size;
+	unsigned entries;
+	size_t buf_size;
+	uint16_t bgid;
+} UringBufRing;
+
+// returns -errno on failure, e.g. when io_uring is not available
+extern int uring_init(Uring *ring, unsigned entries);
+extern void uring_free(Uring *ring);
+// a zeroed sqe, submits what is queued first if the queue is full
+extern struct io_uring_sqe* uring_get_sqe(Uring *ring);
+// submits everything queued in one go, and waits for at least one
+// completion or the timeout
+extern int uring_submit_and_wait(Uring *ring, uint32_t timeout_ms);
+// NULL when there are no completions
+extern struct io_uring_cqe* uring_peek_cqe(Uring *ring);
+extern void uring_cqe_seen(Uring *ring);
+
+extern int uring_buf_ring_init(Uring *ring, UringBufRing *br, uint16_t bgid,
+		unsigned entries, size_t buf_size);
+extern uint8_t* uring_buf(UringBufRing *br, uint16_t bid);
+// hands a buffer back to the kernel once its data has been consumed
+extern void uring_buf_recycle(UringBufRing *br, uint16_t bid);
+
+#endif /* URING_H_ */
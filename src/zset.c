@@ -11,13 +11,17 @@
 #include <stdbool.h>
 #include "zset.h"
 #include "common.h"
+#include "slab.h"
+
+uint32_t g_zset_max_packed = 128;
+
+// a packed entry: f64 score, u8 len, then the name
+#define PK_HEADER 9
 
 static ZNode* znode_new(const char *name, size_t len, double score) {
-	ZNode *node = (ZNode*) malloc(sizeof(ZNode) + len);
-	assert(node);   // not a good idea in real projects
+	ZNode *node = (ZNode*) slab_alloc(sizeof(ZNode) + len);
 	memset(node, 0, sizeof(ZNode) + len);
 	avl_init(&node->tree);
-	node->hmap.next = NULL;
 	node->hmap.hcode = str_hash((uint8_t*) name, len);
 	node->score = score;
 	node->len = len;
@@ -25,21 +29,30 @@ static ZNode* znode_new(const char *name, size_t len, double score) {
 	return node;
 }
 
+static void znode_del(ZNode *node) {
+	slab_free(node, sizeof(ZNode) + node->len);
+}
+
 static uint32_t min(size_t lhs, size_t rhs) {
 	return lhs < rhs ? lhs : rhs;
 }
 
 // compare by the (score, name) tuple
-static bool zless1(AVLNode *lhs, double score, const char *name, size_t len) {
-	ZNode *zl = container_of(lhs, ZNode, tree);
-	if (zl->score != score) {
-		return zl->score < score;
+static bool tuple_less(double ls, const char *lname, size_t llen, double rs,
+		const char *rname, size_t rlen) {
+	if (ls != rs) {
+		return ls < rs;
 	}
-	int rv = memcmp(zl->name, name, min(zl->len, len));
+	int rv = memcmp(lname, rname, min(llen, rlen));
 	if (rv != 0) {
 		return rv < 0;
 	}
-	return zl->len < len;
+	return llen < rlen;
+}
+
+static bool zless1(AVLNode *lhs, double score, const char *name, size_t len) {
+	ZNode *zl = container_of(lhs, ZNode, tree);
+	return tuple_less(zl->score, zl->name, zl->len, score, name, len);
 }
 
 static bool zless(AVLNode *lhs, AVLNode *rhs) {
@@ -47,6 +60,50 @@ static bool zless(AVLNode *lhs, AVLNode *rhs) {
 	return zless1(lhs, zr->score, zr->name, zr->len);
 }
 
+static double pk_score(const uint8_t *p) {
+	double score = 0;
+	memcpy(&score, p, 8);
+	return score;
+}
+
+static uint32_t pk_size(const uint8_t *p) {
+	return PK_HEADER + p[8];
+}
+
+// the offset of the member and its rank, false if it isn't there
+static bool pk_find(ZSet *zset, const char *name, size_t len, uint32_t *off, int64_t *idx) {
+	uint32_t pos = 0;
+	for (uint32_t i = 0; i < zset->pack.n; i++) {
+		const uint8_t *p = &zset->pack.data[pos];
+		if (p[8] == len && 0 == memcmp(&p[PK_HEADER], name, len)) {
+			*off = pos;
+			*idx = i;
+			return true;
+		}
+		pos += pk_size(p);
+	}
+	return false;
+}
+
+static void pk_delete(ZSet *zset, uint32_t off) {
+	pack_delete(&zset->pack, off, pk_size(&zset->pack.data[off]));
+}
+
+static void pk_insert(ZSet *zset, const char *name, size_t len, double score) {
+	uint32_t pos = 0;
+	while (pos < zset->pack.used) {
+		const uint8_t *p = &zset->pack.data[pos];
+		if (!tuple_less(pk_score(p), (const char*) &p[PK_HEADER], p[8], score, name, len)) {
+			break;
+		}
+		pos += pk_size(p);
+	}
+	uint8_t *p = pack_insert(&zset->pack, pos, PK_HEADER + (uint32_t) len);
+	memcpy(p, &score, 8);
+	p[8] = (uint8_t) len;
+	memcpy(&p[PK_HEADER], name, len);
+}
+
 // insert into the AVL tree
 static void tree_add(ZSet *zset, ZNode *node) {
 	if (!zset->tree) {
@@ -67,6 +124,29 @@ static void tree_add(ZSet *zset, ZNode *node) {
 	}
 }
 
+static void tree_insert(ZSet *zset, const char *name, size_t len, double score) {
+	ZNode *node = znode_new(name, len, score);
+	hm_insert(&zset->hmap, &node->hmap);
+	tree_add(zset, node);
+	zset->tree_mem += slab_size_class(sizeof(ZNode) + len);
+}
+
+// moves the members of a packed set into the tree, for good
+static void zset_convert(ZSet *zset, size_t reserve) {
+	Pack pack = zset->pack;
+	zset->encoding = ZSET_TREE;
+	// the pack fields share the memory, hm_init doesn't clear the tables
+	zset->tree = NULL;
+	memset(&zset->hmap, 0, sizeof(HMap));
+	zset->tree_mem = 0;
+	hm_reserve(&zset->hmap, reserve);
+	for (uint32_t pos = 0; pos < pack.used; pos += pk_size(&pack.data[pos])) {
+		const uint8_t *p = &pack.data[pos];
+		tree_insert(zset, (const char*) &p[PK_HEADER], p[8], pk_score(p));
+	}
+	pack_dispose(&pack);
+}
+
 // update the score of an existing node (AVL tree reinsertion)
 static void zset_update(ZSet *zset, ZNode *node, double score) {
 	if (node->score == score) {
@@ -78,20 +158,6 @@ static void zset_update(ZSet *zset, ZNode *node, double score) {
 	tree_add(zset, node);
 }
 
-// add a new (score, name) tuple, or update the score of the existing tuple
-int zset_add(ZSet *zset, const char *name, size_t len, double score) {
-	ZNode *node = zset_lookup(zset, name, len);
-	if (node) {
-		zset_update(zset, node, score);
-		return false;
-	} else {
-		node = znode_new(name, len, score);
-		hm_insert(&zset->hmap, &node->hmap);
-		tree_add(zset, node);
-		return true;
-	}
-}
-
 // a helper structure for the hashtable lookup
 typedef struct {
 	HNode node;
@@ -112,7 +178,7 @@ static int hcmp(HNode *node, HNode *key) {
 }
 
 // lookup by name
-ZNode* zset_lookup(ZSet *zset, const char *name, size_t len) {
+static ZNode* zset_lookup(ZSet *zset, const char *name, size_t len) {
 	if (!zset->tree) {
 		return NULL;
 	}
@@ -130,7 +196,7 @@ ZNode* zset_lookup(ZSet *zset, const char *name, size_t len) {
 }
 
 // deletion by name
-ZNode* zset_pop(ZSet *zset, const char *name, size_t len) {
+static ZNode* zset_pop(ZSet *zset, const char *name, size_t len) {
 	if (!zset->tree) {
 		return NULL;
 	}
@@ -149,29 +215,249 @@ ZNode* zset_pop(ZSet *zset, const char *name, size_t len) {
 	return node;
 }
 
-// find the (score, name) tuple that is greater or equal to the argument.
-ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len) {
-    AVLNode *found = NULL;
-    AVLNode *cur = zset->tree;
-    while (cur) {
-        if (zless1(cur, score, name, len)) {
-            cur = cur->right;
-        } else {
-            found = cur;    // candidate
-            cur = cur->left;
-        }
-    }
-    return found ? container_of(found, ZNode, tree) : NULL;
+int zset_add(ZSet *zset, const char *name, size_t len, double score) {
+	if (zset->encoding == ZSET_PACKED) {
+		uint32_t off = 0;
+		int64_t idx = 0;
+		if (pk_find(zset, name, len, &off, &idx)) {
+			if (pk_score(&zset->pack.data[off]) != score) {
+				pk_delete(zset, off);
+				pk_insert(zset, name, len, score);
+			}
+			return false;
+		}
+		if (zset->pack.n < g_zset_max_packed && len <= ZSET_MAX_PACKED_NAME) {
+			pk_insert(zset, name, len, score);
+			return true;
+		}
+		zset_convert(zset, (size_t) zset->pack.n + 1);
+	}
+	ZNode *node = zset_lookup(zset, name, len);
+	if (node) {
+		zset_update(zset, node, score);
+		return false;
+	}
+	tree_insert(zset, name, len, score);
+	return true;
+}
+
+bool zset_score(ZSet *zset, const char *name, size_t len, double *score) {
+	if (zset->encoding == ZSET_PACKED) {
+		uint32_t off = 0;
+		int64_t idx = 0;
+		if (!pk_find(zset, name, len, &off, &idx)) {
+			return false;
+		}
+		*score = pk_score(&zset->pack.data[off]);
+		return true;
+	}
+	ZNode *node = zset_lookup(zset, name, len);
+	if (!node) {
+		return false;
+	}
+	*score = node->score;
+	return true;
+}
+
+bool zset_rem(ZSet *zset, const char *name, size_t len) {
+	if (zset->encoding == ZSET_PACKED) {
+		uint32_t off = 0;
+		int64_t idx = 0;
+		if (!pk_find(zset, name, len, &off, &idx)) {
+			return false;
+		}
+		pk_delete(zset, off);
+		return true;
+	}
+	ZNode *node = zset_pop(zset, name, len);
+	if (!node) {
+		return false;
+	}
+	zset->tree_mem -= slab_size_class(sizeof(ZNode) + node->len);
+	znode_del(node);
+	return true;
+}
+
+int64_t zset_rank(ZSet *zset, const char *name, size_t len) {
+	if (zset->encoding == ZSET_PACKED) {
+		uint32_t off = 0;
+		int64_t idx = -1;
+		return pk_find(zset, name, len, &off, &idx) ? idx : -1;
+	}
+	ZNode *node = zset_lookup(zset, name, len);
+	return node ? avl_rank(&node->tree) : -1;
+}
+
+int64_t zset_size(ZSet *zset) {
+	if (zset->encoding == ZSET_PACKED) {
+		return zset->pack.n;
+	}
+	return (int64_t) hm_size(&zset->hmap);
+}
+
+static bool iter_set(ZIter *it) {
+	it->valid = it->zset->encoding == ZSET_PACKED ? it->off < it->zset->pack.used
+			: it->node != NULL;
+	if (!it->valid) {
+		return false;
+	}
+	if (it->zset->encoding == ZSET_PACKED) {
+		const uint8_t *p = &it->zset->pack.data[it->off];
+		it->score = pk_score(p);
+		it->name = (const char*) &p[PK_HEADER];
+		it->len = p[8];
+	} else {
+		it->score = it->node->score;
+		it->name = it->node->name;
+		it->len = it->node->len;
+	}
+	return true;
+}
+
+static bool iter_tree(ZSet *zset, AVLNode *found, ZIter *it) {
+	memset(it, 0, sizeof(ZIter));
+	it->zset = zset;
+	it->node = found ? container_of(found, ZNode, tree) : NULL;
+	return iter_set(it);
+}
+
+// the first packed entry for which before is false
+static bool iter_pack(ZSet *zset, double score, const char *name, size_t len,
+		bool exclusive, ZIter *it) {
+	memset(it, 0, sizeof(ZIter));
+	it->zset = zset;
+	while (it->off < zset->pack.used) {
+		const uint8_t *p = &zset->pack.data[it->off];
+		double s = pk_score(p);
+		bool before = name ? tuple_less(s, (const char*) &p[PK_HEADER], p[8], score, name, len)
+				: exclusive ? s <= score : s < score;
+		if (!before) {
+			break;
+		}
+		it->off += pk_size(p);
+		it->idx++;
+	}
+	return iter_set(it);
+}
+
+bool zset_seek(ZSet *zset, double score, const char *name, size_t len, ZIter *it) {
+	if (zset->encoding == ZSET_PACKED) {
+		return iter_pack(zset, score, name, len, false, it);
+	}
+	AVLNode *found = NULL;
+	AVLNode *cur = zset->tree;
+	while (cur) {
+		if (zless1(cur, score, name, len)) {
+			cur = cur->right;
+		} else {
+			found = cur;    // candidate
+			cur = cur->left;
+		}
+	}
+	return iter_tree(zset, found, it);
+}
+
+bool zset_seek_score(ZSet *zset, double score, bool exclusive, ZIter *it) {
+	if (zset->encoding == ZSET_PACKED) {
+		return iter_pack(zset, score, NULL, 0, exclusive, it);
+	}
+	AVLNode *found = NULL;
+	AVLNode *cur = zset->tree;
+	while (cur) {
+		double s = container_of(cur, ZNode, tree)->score;
+		if (exclusive ? s <= score : s < score) {
+			cur = cur->right;
+		} else {
+			found = cur;
+			cur = cur->left;
+		}
+	}
+	return iter_tree(zset, found, it);
+}
+
+bool zset_seek_rank(ZSet *zset, int64_t rank, ZIter *it) {
+	if (zset->encoding == ZSET_TREE) {
+		return iter_tree(zset, avl_at(zset->tree, rank), it);
+	}
+	memset(it, 0, sizeof(ZIter));
+	it->zset = zset;
+	if (rank < 0 || rank >= zset->pack.n) {
+		it->off = zset->pack.used;
+		return iter_set(it);
+	}
+	for (; it->idx < rank; it->idx++) {
+		it->off += pk_size(&zset->pack.data[it->off]);
+	}
+	return iter_set(it);
 }
 
-// offset into the succeeding or preceding node.
-ZNode *znode_offset(ZNode *node, int64_t offset) {
-    AVLNode *tnode = node ? avl_offset(&node->tree, offset) : NULL;
-    return tnode ? container_of(tnode, ZNode, tree) : NULL;
+bool zset_next(ZIter *it) {
+	if (!it->valid) {
+		return false;
+	}
+	if (it->zset->encoding == ZSET_PACKED) {
+		it->off += pk_size(&it->zset->pack.data[it->off]);
+		it->idx++;
+	} else {
+		AVLNode *next = avl_next(&it->node->tree);
+		it->node = next ? container_of(next, ZNode, tree) : NULL;
+	}
+	return iter_set(it);
 }
 
-void znode_del(ZNode *node) {
-	free(node);
+bool zset_offset(ZIter *it, int64_t offset) {
+	if (!it->valid) {
+		return false;
+	}
+	if (it->zset->encoding == ZSET_PACKED) {
+		return zset_seek_rank(it->zset, it->idx + offset, it);
+	}
+	AVLNode *tnode = avl_offset(&it->node->tree, offset);
+	it->node = tnode ? container_of(tnode, ZNode, tree) : NULL;
+	return iter_set(it);
+}
+
+int64_t zset_iter_rank(ZIter *it) {
+	if (!it->valid) {
+		return zset_size(it->zset);
+	}
+	return it->zset->encoding == ZSET_PACKED ? it->idx : avl_rank(&it->node->tree);
+}
+
+typedef struct {
+	void (*f)(double, const char*, size_t, void*);
+	void *arg;
+} ScanCtx;
+
+static void cb_scan(HNode *node, void *arg) {
+	ScanCtx *ctx = (ScanCtx*) arg;
+	ZNode *znode = container_of(node, ZNode, hmap);
+	ctx->f(znode->score, znode->name, znode->len, ctx->arg);
+}
+
+void zset_scan(ZSet *zset, void (*f)(double, const char*, size_t, void*), void *arg) {
+	if (zset->encoding == ZSET_PACKED) {
+		for (uint32_t pos = 0; pos < zset->pack.used; pos += pk_size(&zset->pack.data[pos])) {
+			const uint8_t *p = &zset->pack.data[pos];
+			f(pk_score(p), (const char*) &p[PK_HEADER], p[8], arg);
+		}
+		return;
+	}
+	ScanCtx ctx = { f, arg };
+	hm_scan(&zset->hmap, &cb_scan, &ctx);
+}
+
+void zset_reserve(ZSet *zset, size_t n) {
+	if (zset->encoding == ZSET_PACKED && n > g_zset_max_packed) {
+		zset_convert(zset, n);
+	}
+}
+
+size_t zset_mem(ZSet *zset) {
+	if (zset->encoding == ZSET_PACKED) {
+		return zset->pack.cap;
+	}
+	return zset->tree_mem + hm_mem(&zset->hmap);
 }
 
 static void tree_dispose(AVLNode *node) {
@@ -183,8 +469,11 @@ static void tree_dispose(AVLNode *node) {
 	znode_del(container_of(node, ZNode, tree));
 }
 
-// destroy the zset
 void zset_dispose(ZSet *zset) {
+	if (zset->encoding == ZSET_PACKED) {
+		pack_dispose(&zset->pack);
+		return;
+	}
 	tree_dispose(zset->tree);
 	hm_destroy(&zset->hmap);
 }
@@ -8,12 +8,37 @@
 #ifndef ZSET_H_
 #define ZSET_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "avl.h"
 #include "hashtable.h"
+#include "pack.h"
+
+// Small sets are packed: one buffer of (f64 score, u8 len, name) entries in
+// (score, name) order, searched front to back. A set that grows past
+// g_zset_max_packed members, or gets a name longer than ZSET_MAX_PACKED_NAME,
+// moves to an AVL tree for the order plus a hashtable for the names, and
+// stays there. A zeroed ZSet is an empty packed one.
+enum {
+	ZSET_PACKED = 0, ZSET_TREE = 1,
+};
+
+#define ZSET_MAX_PACKED_NAME 64
+
+// 0 packs nothing. Set at startup, before there are any sets.
+extern uint32_t g_zset_max_packed;
 
 typedef struct {
-	AVLNode *tree;
-	HMap hmap;
+	uint32_t encoding;
+	union {
+		Pack pack;
+		struct {
+			AVLNode *tree;
+			HMap hmap;
+			// bytes of the nodes
+			size_t tree_mem;
+		};
+	};
 } ZSet;
 
 typedef struct {
@@ -24,12 +49,48 @@ typedef struct {
 	char name[0];
 } ZNode;
 
+// A position in a set, in (score, name) order. The member is in score, name
+// and len while valid. Changing the set invalidates it.
+typedef struct {
+	ZSet *zset;
+	bool valid;
+	double score;
+	const char *name;
+	size_t len;
+	// ZSET_TREE
+	ZNode *node;
+	// ZSET_PACKED, the offset of the entry and its rank
+	uint32_t off;
+	int64_t idx;
+} ZIter;
+
+// add a new (score, name) tuple, or update the score of the existing one.
+// true if it was added.
 extern int zset_add(ZSet *zset, const char *name, size_t len, double score);
-extern ZNode* zset_lookup(ZSet *zset, const char *name, size_t len);
-extern ZNode* zset_pop(ZSet *zset, const char *name, size_t len);
-ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len);
-extern ZNode *znode_offset(ZNode *node, int64_t offset);
+// lookup by name, false if it isn't there
+extern bool zset_score(ZSet *zset, const char *name, size_t len, double *score);
+extern bool zset_rem(ZSet *zset, const char *name, size_t len);
+// ranks from 0, in (score, name) order. -1 if it isn't there.
+extern int64_t zset_rank(ZSet *zset, const char *name, size_t len);
+// the number of members
+extern int64_t zset_size(ZSet *zset);
+// the first tuple greater or equal to (score, name)
+extern bool zset_seek(ZSet *zset, double score, const char *name, size_t len, ZIter *it);
+// the first member with a score >= score, or > score if exclusive
+extern bool zset_seek_score(ZSet *zset, double score, bool exclusive, ZIter *it);
+extern bool zset_seek_rank(ZSet *zset, int64_t rank, ZIter *it);
+extern bool zset_next(ZIter *it);
+// moves it by offset members, either way
+extern bool zset_offset(ZIter *it, int64_t offset);
+// the size of the set past the end
+extern int64_t zset_iter_rank(ZIter *it);
+// every member, in no particular order
+extern void zset_scan(ZSet *zset, void (*f)(double, const char*, size_t, void*), void *arg);
+// for an empty set that will get n members
+extern void zset_reserve(ZSet *zset, size_t n);
+// the bytes the set holds on to besides the ZSet itself
+extern size_t zset_mem(ZSet *zset);
+// destroy the zset
 extern void zset_dispose(ZSet *zset);
-extern void znode_del(ZNode *node);
 
 #endif /* ZSET_H_ */
@@ -0,0 +1,137 @@
+/*
+ * zset_test.c
+ *
+ *  Created on: Oct 14, 2026
+ *      Author: loshmi
+ */
+
+#include "zset.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define K_NAMES 64
+
+// the reference: whether every name is in the set, and its score
+static double g_scores[K_NAMES];
+static bool g_in[K_NAMES];
+static bool g_long_names;
+
+static int name_of(int i, char *buf) {
+	// every 7th name is too long to be packed
+	if (g_long_names && i % 7 == 6) {
+		memset(buf, 'x', ZSET_MAX_PACKED_NAME);
+		return ZSET_MAX_PACKED_NAME + sprintf(buf + ZSET_MAX_PACKED_NAME, "%d", i);
+	}
+	return sprintf(buf, "n%d", i);
+}
+
+// the members in (score, name) order, from the reference
+static int sorted(int *order) {
+	char a[128];
+	char b[128];
+	int n = 0;
+	for (int i = 0; i < K_NAMES; i++) {
+		if (g_in[i]) {
+			order[n++] = i;
+		}
+	}
+	for (int i = 1; i < n; i++) {
+		for (int j = i; j > 0; j--) {
+			int l = order[j - 1];
+			int r = order[j];
+			int ll = name_of(l, a);
+			int rl = name_of(r, b);
+			int cmp = memcmp(a, b, (size_t) (ll < rl ? ll : rl));
+			bool less = g_scores[r] != g_scores[l] ? g_scores[r] < g_scores[l]
+					: cmp != 0 ? cmp > 0 : rl < ll;
+			if (!less) {
+				break;
+			}
+			order[j - 1] = r;
+			order[j] = l;
+		}
+	}
+	return n;
+}
+
+static void verify(ZSet *zset, bool long_names) {
+	int order[K_NAMES];
+	char buf[128];
+	int n = sorted(order);
+	assert(zset_size(zset) == n);
+	ZIter it;
+	zset_seek_rank(zset, 0, &it);
+	for (int r = 0; r < n; r++) {
+		int len = name_of(order[r], buf);
+		assert(it.valid && it.score == g_scores[order[r]]);
+		assert(it.len == (size_t) len && 0 == memcmp(it.name, buf, it.len));
+		assert(zset_iter_rank(&it) == r);
+		assert(zset_rank(zset, buf, (size_t) len) == r);
+		zset_next(&it);
+	}
+	assert(!it.valid);
+	for (int r = 0; r < n; r++) {
+		int len = name_of(order[r], buf);
+		ZIter at;
+		assert(zset_seek(zset, g_scores[order[r]], buf, (size_t) len, &at));
+		assert(zset_iter_rank(&at) == r);
+		zset_offset(&at, -r);
+		assert(at.valid && zset_iter_rank(&at) == 0);
+		assert(zset_seek_score(zset, g_scores[order[r]], false, &at));
+		assert(at.score == g_scores[order[r]]);
+	}
+	// past the end
+	ZIter end;
+	assert(!zset_seek_score(zset, 1e9, false, &end) && zset_iter_rank(&end) == n);
+	if (n <= (int) g_zset_max_packed && !long_names) {
+		// small sets that never grew stay packed
+		assert(zset->encoding == ZSET_PACKED);
+	}
+}
+
+static void run(uint32_t max_packed, bool long_names, unsigned seed) {
+	g_zset_max_packed = max_packed;
+	g_long_names = long_names;
+	memset(g_in, 0, sizeof(g_in));
+	srand(seed);
+	ZSet zset;
+	memset(&zset, 0, sizeof(zset));
+	bool grew = false;
+	char buf[128];
+	for (int step = 0; step < 20000; step++) {
+		int i = rand() % K_NAMES;
+		int len = name_of(i, buf);
+		// a few scores only, so ties go by name
+		double score = (double) (rand() % 8);
+		if (rand() % 3) {
+			assert(zset_add(&zset, buf, (size_t) len, score) == !g_in[i]);
+			g_in[i] = true;
+			g_scores[i] = score;
+			grew = grew || (long_names && i % 7 == 6);
+		} else {
+			assert(zset_rem(&zset, buf, (size_t) len) == g_in[i]);
+			g_in[i] = false;
+		}
+		double got = 0;
+		assert(zset_score(&zset, buf, (size_t) len, &got) == g_in[i]);
+		assert(!g_in[i] || got == g_scores[i]);
+		if (step % 100 == 0) {
+			int n = sorted((int[K_NAMES]) { 0 });
+			grew = grew || n > (int) max_packed;
+			verify(&zset, grew);
+		}
+	}
+	verify(&zset, grew);
+	zset_dispose(&zset);
+}
+
+int main(void) {
+	// everything in the tree, always packed, and crossing over
+	run(0, false, 1);
+	run(K_NAMES, false, 2);
+	run(16, true, 3);
+	printf("Success!\n");
+	return 0;
+}